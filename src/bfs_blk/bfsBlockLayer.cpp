@@ -10,12 +10,15 @@
 
 /* Include files  */
 #include <algorithm>
+#include <set>
 
 /* Project include files */
 #include <bfsBlockError.h>
 #include <bfsBlockLayer.h>
 #include <bfsConfigLayer.h>
 #include <bfsDeviceLayer.h>
+#include <bfsLatencyDevice.h>
+#include <bfsRemoteDevice.h>
 #include <bfsVertBlockCluster.h>
 #include <bfs_log.h>
 #include <bfs_util.h>
@@ -27,6 +30,17 @@
 bool bfsBlockLayer::bfsBlockLayerInitialized = false;
 bfs_vert_cluster_alloc_t bfsBlockLayer::bfsBlockAllocAlgorithm =
 	BFSBLK_MAX_ALLOC;
+bfs_vbid_t bfsBlockLayer::bfsBlockStripeUnit = 0;
+uint32_t bfsBlockLayer::bfsBlockReplicas = 0;
+uint32_t bfsBlockLayer::bfsBlockECData = 0;
+uint32_t bfsBlockLayer::bfsBlockECParity = 0;
+bool bfsBlockLayer::bfsBlockWriteBack = false;
+bool bfsBlockLayer::bfsBlockWriteBackConfigured = false;
+uint32_t bfsBlockLayer::bfsBlockDirtyHigh = 0;
+uint32_t bfsBlockLayer::bfsBlockDirtyLow = 0;
+uint64_t bfsBlockLayer::bfsBlockFlushInterval = 0;
+uint32_t bfsBlockLayer::bfsBlockRAMin = 0;
+uint32_t bfsBlockLayer::bfsBlockRAMax = 0;
 unsigned long bfsBlockLayer::bfsBlockLogLevel = (unsigned long)0;
 unsigned long bfsBlockLayer::bfsVerboseBlockLogLevel = (unsigned long)0;
 
@@ -40,7 +54,7 @@ const char *bfsBlockLayer::bfs_cluster_state_strings[BFSBLK_MAXSTATE] = {
 	"BFSBLK_UNINITIALIZED", "BFSBLK_READY", "BFSBLK_ERRORED"};
 
 const char *bfsBlockLayer::bfs_vert_cluster_alloc_strings[BFSBLK_MAX_ALLOC] = {
-	"linear", "interleave"};
+	"linear", "interleave", "erasure"};
 
 //
 // Class Functions
@@ -184,6 +198,135 @@ int bfsBlockLayer::bfsBlockLayerInit(void) {
 		}
 		i++;
 	}
+
+	// Get the stripe unit (for interleaved allocation)
+	if (bfsBlockStripeUnit == 0) {
+		subcfg = NULL;
+		int64_t _stripe_unit = 0;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_STRIPE_UNIT,
+				  strlen(BFS_BLKLYR_STRIPE_UNIT) + 1)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL, "Failed ocall_getSubItemByName");
+			return (-1);
+		}
+		if (((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_stripe_unit, (int64_t)subcfg)) != SGX_SUCCESS) ||
+			(_stripe_unit <= 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong stripe_unit");
+			return (-1);
+		}
+		bfsBlockStripeUnit = (bfs_vbid_t)_stripe_unit;
+	}
+
+	// Get the replication factor
+	if (bfsBlockReplicas == 0) {
+		subcfg = NULL;
+		int64_t _replicas = 0;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_REPLICAS,
+				  strlen(BFS_BLKLYR_REPLICAS) + 1)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL, "Failed ocall_getSubItemByName");
+			return (-1);
+		}
+		if (((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_replicas, (int64_t)subcfg)) != SGX_SUCCESS) ||
+			(_replicas <= 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong replicas");
+			return (-1);
+		}
+		bfsBlockReplicas = (uint32_t)_replicas;
+	}
+
+	// Get the erasure code geometry (data and parity chunks per stripe)
+	if (bfsBlockECData == 0) {
+		subcfg = NULL;
+		int64_t _ec_data = 0, _ec_parity = 0;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_EC_DATA,
+				  strlen(BFS_BLKLYR_EC_DATA) + 1)) != SGX_SUCCESS) ||
+			((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_ec_data, (int64_t)subcfg)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong erasure_data");
+			return (-1);
+		}
+		subcfg = NULL;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_EC_PARITY,
+				  strlen(BFS_BLKLYR_EC_PARITY) + 1)) != SGX_SUCCESS) ||
+			((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_ec_parity, (int64_t)subcfg)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong erasure_parity");
+			return (-1);
+		}
+		if ((_ec_data <= 0) || (_ec_parity <= 0) ||
+			(_ec_data + _ec_parity > BFS_EC_MAX_CHUNKS)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad erasure code geometry %ld+%ld",
+					   _ec_data, _ec_parity);
+			return (-1);
+		}
+		bfsBlockECData = (uint32_t)_ec_data;
+		bfsBlockECParity = (uint32_t)_ec_parity;
+	}
+
+	// Get the write-back cache settings (no flusher thread in the enclave, so
+	// just check the flag is off)
+	if (!bfsBlockWriteBackConfigured) {
+		char _write_back[log_flag_max_len] = {0};
+		subcfg = NULL;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_WRITE_BACK,
+				  strlen(BFS_BLKLYR_WRITE_BACK) + 1)) != SGX_SUCCESS) ||
+			((ocall_status = ocall_bfsCfgItemValue(
+				  &ret, (int64_t)subcfg, _write_back, log_flag_max_len)) !=
+			 SGX_SUCCESS) ||
+			(ret != BFS_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL, "Failed ocall_bfsCfgItemValue");
+			return (-1);
+		}
+		if (std::string(_write_back) == "true") {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Write-back block cache unsupported in enclave");
+			return (-1);
+		}
+		bfsBlockWriteBackConfigured = true;
+	}
+
+	// Get the readahead window sizes
+	if (bfsBlockRAMin == 0) {
+		int64_t _ra_min = 0, _ra_max = 0;
+		subcfg = NULL;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_RA_MIN,
+				  strlen(BFS_BLKLYR_RA_MIN) + 1)) != SGX_SUCCESS) ||
+			((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_ra_min, (int64_t)subcfg)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong readahead_min");
+			return (-1);
+		}
+		subcfg = NULL;
+		if (((ocall_status = ocall_getSubItemByName(
+				  (int64_t *)&subcfg, (int64_t)config, BFS_BLKLYR_RA_MAX,
+				  strlen(BFS_BLKLYR_RA_MAX) + 1)) != SGX_SUCCESS) ||
+			((ocall_status = ocall_bfsCfgItemValueLong(
+				  &_ra_max, (int64_t)subcfg)) != SGX_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed ocall_bfsCfgItemValueLong readahead_max");
+			return (-1);
+		}
+		if ((_ra_min <= 0) || (_ra_max < 0) ||
+			((_ra_max > 0) && (_ra_max < _ra_min))) {
+			logMessage(LOG_ERROR_LEVEL, "Bad readahead windows %ld/%ld",
+					   _ra_min, _ra_max);
+			return (-1);
+		}
+		bfsBlockRAMin = (uint32_t)_ra_min;
+		bfsBlockRAMax = (uint32_t)_ra_max;
+	}
 #else
 	// Get the layer configuration
 	config = bfsConfigLayer::getConfigItem(BFS_BLKLYR_CONFIG);
@@ -229,17 +372,114 @@ int bfsBlockLayer::bfsBlockLayerInit(void) {
 		}
 		i++;
 	}
-#endif
-
-	// If no algorithm configured, bail out
-	if (i >= BFSBLK_MAX_ALLOC) {
+	if (bfsBlockAllocAlgorithm == BFSBLK_MAX_ALLOC) {
 		message = "Unknown block allocation algorithm in config : " +
 				  subcfg->bfsCfgItemValue();
 		throw new bfsBlockError(message);
 	}
 
+	// Get the stripe unit (for interleaved allocation)
+	if (bfsBlockStripeUnit == 0) {
+		subcfg = config->getSubItemByName(BFS_BLKLYR_STRIPE_UNIT);
+		if (subcfg->bfsCfgItemValueLong() <= 0) {
+			message = "Bad block stripe unit in config : " +
+					  subcfg->bfsCfgItemValue();
+			throw new bfsBlockError(message);
+		}
+		bfsBlockStripeUnit = (bfs_vbid_t)subcfg->bfsCfgItemValueLong();
+	}
+
+	// Get the replication factor
+	if (bfsBlockReplicas == 0) {
+		subcfg = config->getSubItemByName(BFS_BLKLYR_REPLICAS);
+		if (subcfg->bfsCfgItemValueLong() <= 0) {
+			message = "Bad block replica count in config : " +
+					  subcfg->bfsCfgItemValue();
+			throw new bfsBlockError(message);
+		}
+		bfsBlockReplicas = (uint32_t)subcfg->bfsCfgItemValueLong();
+	}
+
+	// Get the erasure code geometry (data and parity chunks per stripe)
+	if (bfsBlockECData == 0) {
+		int64_t ec_data =
+			config->getSubItemByName(BFS_BLKLYR_EC_DATA)->bfsCfgItemValueLong();
+		int64_t ec_parity = config->getSubItemByName(BFS_BLKLYR_EC_PARITY)
+							 ->bfsCfgItemValueLong();
+		if ((ec_data <= 0) || (ec_parity <= 0) ||
+			(ec_data + ec_parity > BFS_EC_MAX_CHUNKS)) {
+			message = "Bad erasure code geometry in config : " +
+					  to_string(ec_data) + "+" + to_string(ec_parity);
+			throw new bfsBlockError(message);
+		}
+		bfsBlockECData = (uint32_t)ec_data;
+		bfsBlockECParity = (uint32_t)ec_parity;
+	}
+
+	// Get the write-back cache settings (watermarks are percent of the cache)
+	if (!bfsBlockWriteBackConfigured) {
+		bfsBlockWriteBack =
+			(config->getSubItemByName(BFS_BLKLYR_WRITE_BACK)
+				 ->bfsCfgItemValue() == "true");
+		int64_t high = config->getSubItemByName(BFS_BLKLYR_DIRTY_HIGH)
+						   ->bfsCfgItemValueLong();
+		int64_t low = config->getSubItemByName(BFS_BLKLYR_DIRTY_LOW)
+						  ->bfsCfgItemValueLong();
+		int64_t interval = config->getSubItemByName(BFS_BLKLYR_FLUSH_INTERVAL)
+							   ->bfsCfgItemValueLong();
+		if ((low < 0) || (low >= high) || (high > 100) || (interval <= 0)) {
+			message = "Bad write-back settings in config : watermarks " +
+					  to_string(low) + "/" + to_string(high) + ", interval " +
+					  to_string(interval);
+			throw new bfsBlockError(message);
+		}
+		bfsBlockDirtyHigh = (uint32_t)high;
+		bfsBlockDirtyLow = (uint32_t)low;
+		bfsBlockFlushInterval = (uint64_t)interval;
+		bfsBlockWriteBackConfigured = true;
+	}
+
+	// Get the readahead window sizes (max 0 disables readahead)
+	if (bfsBlockRAMin == 0) {
+		int64_t ra_min =
+			config->getSubItemByName(BFS_BLKLYR_RA_MIN)->bfsCfgItemValueLong();
+		int64_t ra_max =
+			config->getSubItemByName(BFS_BLKLYR_RA_MAX)->bfsCfgItemValueLong();
+		if ((ra_min <= 0) || (ra_max < 0) ||
+			((ra_max > 0) && (ra_max < ra_min))) {
+			message = "Bad readahead windows in config : " +
+					  to_string(ra_min) + "/" + to_string(ra_max);
+			throw new bfsBlockError(message);
+		}
+		bfsBlockRAMin = (uint32_t)ra_min;
+		bfsBlockRAMax = (uint32_t)ra_max;
+	}
+#endif
+
+	// If no algorithm configured, bail out (the enclave, the untrusted side
+	// throws above)
+	if (bfsBlockAllocAlgorithm == BFSBLK_MAX_ALLOC) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Unknown block allocation algorithm in config");
+		return (-1);
+	}
+
+	// Erasure coded stripes already tolerate device loss, don't also replicate
+	if ((bfsBlockAllocAlgorithm == BFSBLK_ERASURE_ALLOC) &&
+		(bfsBlockReplicas != 1)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Erasure coded allocation cannot be combined with replicas");
+		return (-1);
+	}
+
 	// Log the block layer being initialized, return successfully
-	logMessage(BLOCK_LOG_LEVEL, "bfsBlockLayer initialized. ");
+	logMessage(BLOCK_LOG_LEVEL,
+			   "bfsBlockLayer initialized (allocation %s, stripe unit %lu, "
+			   "replicas %u, erasure %u+%u, write-back %s, readahead %u-%u).",
+			   bfs_vert_cluster_alloc_strings[bfsBlockAllocAlgorithm],
+			   bfsBlockStripeUnit, bfsBlockReplicas, bfsBlockECData,
+			   bfsBlockECParity, bfsBlockWriteBack ? "on" : "off",
+			   bfsBlockRAMin, bfsBlockRAMax);
 
 	bfsBlockLayerInitialized = true;
 
@@ -268,6 +508,17 @@ int bfsBlockLayer::bfsBlockLayerUtest(void) {
 	bfs_vbid_t vaddr;
 	vector<int> slots;
 	char utstr[129];
+	set<pair<bfsDevice *, bfs_block_id_t>> mapped;
+	bfsDevice *pdev;
+	bfs_block_id_t pblk;
+	set<bfsDevice *> repdevs;
+	uint32_t rep, c, k, n;
+	bfsDevice *cdev;
+	bfs_block_id_t cblk;
+	vector<char> seqdata;
+	blk_ra_stats ra_before, ra_after;
+	bfsRemoteDevice *rdev = NULL;
+	int ret;
 
 	if (bfsBlockLayerInit() != BFS_SUCCESS) {
 		logMessage(LOG_ERROR_LEVEL,
@@ -287,6 +538,65 @@ int bfsBlockLayer::bfsBlockLayerUtest(void) {
 		return BFS_FAILURE;
 	}
 
+	if (bfsErasureCode::bfsErasureCodeUtest()) {
+		logMessage(LOG_ERROR_LEVEL, "Erasure code unit test failed.");
+		return BFS_FAILURE;
+	}
+
+	// Check the virtual to physical mapping is one-to-one (and in range),
+	// with the replicas of each block on different devices
+	for (bfs_vbid_t i = 0; i < get_vbc()->getMaxVertBlocNum(); i++) {
+		repdevs.clear();
+		for (rep = 0; rep < getReplicaCount(); rep++) {
+			if ((get_vbc()->getReplicaAddr(i, rep, pdev, pblk)) ||
+				(pblk >= pdev->getNumBlocks()) ||
+				(!mapped.insert(make_pair(pdev, pblk)).second) ||
+				(!repdevs.insert(pdev).second)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Bad mapping for virtual block [%lu] replica %u", i,
+						   rep);
+				return (-1);
+			}
+		}
+	}
+
+	// For erasure coded stripes, the chunks of a row are on different devices
+	// (data where the blocks map to) and the parity doesn't overlap anything
+	k = getErasureDataChunks();
+	n = k + getErasureParityChunks();
+	for (bfs_vbid_t row = 0;
+		 (getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC) &&
+		 (row < get_vbc()->getMaxVertBlocNum() / k);
+		 row++) {
+		repdevs.clear();
+		for (c = 0; c < n; c++) {
+			if ((get_vbc()->getStripeChunkAddr(row, c, cdev, cblk)) ||
+				(cblk >= cdev->getNumBlocks()) ||
+				(!repdevs.insert(cdev).second) ||
+				((c < k) && ((get_vbc()->getPhyBlockAddr(row * k + c, pdev,
+														 pblk)) ||
+							 (pdev != cdev) || (pblk != cblk))) ||
+				((c >= k) && (!mapped.insert(make_pair(cdev, cblk)).second))) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Bad mapping for stripe [%lu] chunk %u", row, c);
+				return (-1);
+			}
+		}
+	}
+	// (quietly, the refusal is logged as an error)
+	disableLogLevels(LOG_ERROR_LEVEL);
+	ret = get_vbc()->getPhyBlockAddr(get_vbc()->getMaxVertBlocNum(), pdev,
+									 pblk);
+	enableLogLevels(LOG_ERROR_LEVEL);
+	if (ret == 0) {
+		logMessage(LOG_ERROR_LEVEL, "Mapped virtual block past the cluster");
+		return (-1);
+	}
+	mapped.clear();
+	logMessage(BLOCK_LOG_LEVEL, "Validated %s mapping of %lu blocks.",
+			   bfs_vert_cluster_alloc_strings[getAllocationAlgorithm()],
+			   get_vbc()->getMaxVertBlocNum());
+
 	// Setup a place to hold the unit test data
 	typedef struct {
 		bfs_vbid_t blk;			 // The virtual block number used
@@ -457,6 +767,215 @@ int bfsBlockLayer::bfsBlockLayerUtest(void) {
 		}
 	}
 
+	// Flush any write-back cached blocks out, make sure none are left
+	if ((flushBlocks()) || (get_vbc()->getDirtyCount() != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Failed flushing dirty blocks.");
+		return (-1);
+	}
+
+	// Check every replica of the written blocks holds the data
+	for (slot = 0; slot < BFS_DEV_UNIT_TEST_SLOTS; slot++) {
+		for (rep = 0; (utblks[slot].blk != BFS_UTEST_UNUSED) &&
+					  (rep < getReplicaCount());
+			 rep++) {
+			if ((get_vbc()->getReplicaAddr(utblks[slot].blk, rep, pdev,
+										   pblk)) ||
+				(pdev->getBlock(pblk, utblks[slot].checkBlock)) ||
+				(memcmp(utblks[slot].block, utblks[slot].checkBlock, BLK_SZ) !=
+				 0)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Replica %u of block [%lu] failed validation.", rep,
+						   utblks[slot].blk);
+				return (-1);
+			}
+		}
+	}
+	logMessage(BLOCK_LOG_LEVEL, "Validated %u replica(s) of written blocks.",
+			   getReplicaCount());
+
+	// Rewrite a (possibly cached) block around the cache, reads must see it
+	for (slot = 0; (slot < BFS_DEV_UNIT_TEST_SLOTS) &&
+				   (utblks[slot].blk == BFS_UTEST_UNUSED);
+		 slot++)
+		;
+	if (slot < BFS_DEV_UNIT_TEST_SLOTS) {
+		get_random_data(utblks[slot].block, BLK_SZ);
+		blist.clear();
+		blist[utblks[slot].blk] =
+			new VBfsBlock(utblks[slot].block, BLK_SZ, 0, 0, utblks[slot].blk);
+		if ((get_vbc()->writeBlocks(blist)) ||
+			(readBlock(*blist.begin()->second) == BFS_FAILURE) ||
+			(memcmp(utblks[slot].block, blist.begin()->second->getBuffer(),
+					BLK_SZ) != 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Read of block [%lu] missed its batched write.",
+					   utblks[slot].blk);
+			return (-1);
+		}
+		delete blist.begin()->second;
+		blist.clear();
+	}
+
+	// Synchronous writes must reach the devices, even with write-back caching
+	for (slot = 0; (slot < BFS_DEV_UNIT_TEST_SLOTS) &&
+				   (utblks[slot].blk == BFS_UTEST_UNUSED);
+		 slot++)
+		;
+	if (slot < BFS_DEV_UNIT_TEST_SLOTS) {
+		get_random_data(utblks[slot].block, BLK_SZ);
+		VBfsBlock syncblk(utblks[slot].block, BLK_SZ, 0, 0, utblks[slot].blk);
+		if ((writeBlock(syncblk, _bfs__O_SYNC) == BFS_FAILURE) ||
+			(get_vbc()->getReplicaAddr(utblks[slot].blk, 0, pdev, pblk)) ||
+			(pdev->getBlock(pblk, utblks[slot].checkBlock)) ||
+			(memcmp(utblks[slot].block, utblks[slot].checkBlock, BLK_SZ) !=
+			 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Synchronous write of block [%lu] was not written "
+					   "through.",
+					   utblks[slot].blk);
+			return (-1);
+		}
+
+		// (and the cached copy must survive being written out)
+		memset(syncblk.getBuffer(), 0x0, BLK_SZ);
+		if ((readBlock(syncblk) == BFS_FAILURE) ||
+			(memcmp(utblks[slot].block, syncblk.getBuffer(), BLK_SZ) != 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Read of block [%lu] after its synchronous write failed "
+					   "validation.",
+					   utblks[slot].blk);
+			return (-1);
+		}
+	}
+
+	// Released blocks are trimmed on the devices by the next flush (unless
+	// erasure coded), so their replicas read back as zeros
+	if ((slot < BFS_DEV_UNIT_TEST_SLOTS) &&
+		(getAllocationAlgorithm() != BFSBLK_ERASURE_ALLOC)) {
+		if ((deallocBlock(utblks[slot].blk) != BFS_SUCCESS) ||
+			(flushBlocks() != BFS_SUCCESS)) {
+			logMessage(LOG_ERROR_LEVEL, "Release/flush of block [%lu] failed.",
+					   utblks[slot].blk);
+			return (-1);
+		}
+		memset(utblks[slot].block, 0x0, BLK_SZ);
+		for (rep = 0; rep < getReplicaCount(); rep++) {
+			if ((get_vbc()->getReplicaAddr(utblks[slot].blk, rep, pdev,
+										   pblk)) ||
+				(pdev->getBlock(pblk, utblks[slot].checkBlock)) ||
+				(memcmp(utblks[slot].block, utblks[slot].checkBlock, BLK_SZ) !=
+				 0)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Replica %u of released block [%lu] not trimmed.",
+						   rep, utblks[slot].blk);
+				return (-1);
+			}
+		}
+		utblks[slot].blk = BFS_UTEST_UNUSED;
+	}
+
+	// Write a run of blocks, then read it back sequentially (read ahead)
+	ra_before = get_vbc()->getReadaheadStats();
+	seqdata.resize(BFS_BLK_UTEST_RA_BLOCKS * BLK_SZ);
+	get_random_data(&seqdata[0], (uint32_t)seqdata.size());
+	vaddr = get_random_value(
+		0, get_vbc()->getMaxVertBlocNum() - BFS_BLK_UTEST_RA_BLOCKS);
+	blist.clear();
+	for (j = 0; j < BFS_BLK_UTEST_RA_BLOCKS; j++) {
+		blist[vaddr + j] =
+			new VBfsBlock(&seqdata[j * BLK_SZ], BLK_SZ, 0, 0, vaddr + j);
+	}
+	if (get_vbc()->writeBlocks(blist)) {
+		logMessage(LOG_ERROR_LEVEL, "Failed writing sequential blocks.");
+		return (-1);
+	}
+	for (it = blist.begin(); it != blist.end(); it++) {
+		memset(it->second->getBuffer(), 0x0, BLK_SZ);
+		if ((readBlock(*it->second) == BFS_FAILURE) ||
+			(memcmp(it->second->getBuffer(),
+					&seqdata[(it->first - vaddr) * BLK_SZ], BLK_SZ) != 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Sequential read of block [%lu] failed validation.",
+					   it->first);
+			return (-1);
+		}
+		delete it->second;
+	}
+	blist.clear();
+
+	// Most of the run should have been read from prefetched blocks
+	ra_after = get_vbc()->getReadaheadStats();
+	if ((getReadaheadMax() > 0) && (bfsUtilLayer::cache_enabled()) &&
+		(ra_after.hits - ra_before.hits < BFS_BLK_UTEST_RA_BLOCKS / 2)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Readahead hit only %lu of %u sequential blocks.",
+				   ra_after.hits - ra_before.hits, BFS_BLK_UTEST_RA_BLOCKS);
+		return (-1);
+	}
+	logMessage(BLOCK_LOG_LEVEL,
+			   "Validated %u sequential reads (readahead %lu windows, %lu "
+			   "prefetched, %lu hits, %lu wasted).",
+			   BFS_BLK_UTEST_RA_BLOCKS, ra_after.windows - ra_before.windows,
+			   ra_after.prefetched - ra_before.prefetched,
+			   ra_after.hits - ra_before.hits,
+			   ra_after.waste - ra_before.waste);
+
+	// Kill the connection to the device holding a written block (as if the
+	// device died), the reads must fail over to the other replicas or
+	// rebuild the blocks from the rest of their stripes
+	for (slot = 0; (slot < BFS_DEV_UNIT_TEST_SLOTS) &&
+				   (utblks[slot].blk == BFS_UTEST_UNUSED);
+		 slot++)
+		;
+	if ((slot < BFS_DEV_UNIT_TEST_SLOTS) &&
+		((getReplicaCount() > 1) ||
+		 (getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC)) &&
+		(get_vbc()->getReplicaAddr(utblks[slot].blk, 0, pdev, pblk) == 0)) {
+		rdev = dynamic_cast<bfsRemoteDevice *>(pdev);
+	}
+	if (rdev != NULL) {
+		for (j = 0; j < rdev->getNumConnections(); j++) {
+			rdev->getConnection(j)->shutdown();
+		}
+		blist.clear();
+		for (slot = 0; slot < BFS_DEV_UNIT_TEST_SLOTS; slot++) {
+			if ((utblks[slot].blk != BFS_UTEST_UNUSED) &&
+				((utblks[slot].blk < vaddr) ||
+				 (utblks[slot].blk >= vaddr + BFS_BLK_UTEST_RA_BLOCKS))) {
+				blist[utblks[slot].blk] =
+					new VBfsBlock(NULL, BLK_SZ, 0, 0, utblks[slot].blk);
+			}
+		}
+		disableLogLevels(LOG_ERROR_LEVEL);
+		ret = get_vbc()->readBlocks(blist);
+		enableLogLevels(LOG_ERROR_LEVEL);
+		if ((ret) || (rdev->getDeviceState() != BFSDEV_ERRORED)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Reads failed (or device not errored) after device "
+					   "[%lu] disconnected.",
+					   rdev->getDeviceIdenfier());
+			return (-1);
+		}
+		for (slot = 0; slot < BFS_DEV_UNIT_TEST_SLOTS; slot++) {
+			if ((blist.find(utblks[slot].blk) != blist.end()) &&
+				(memcmp(utblks[slot].block,
+						blist[utblks[slot].blk]->getBuffer(), BLK_SZ) != 0)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Read of block [%lu] failed validation after device "
+						   "[%lu] disconnected.",
+						   utblks[slot].blk, rdev->getDeviceIdenfier());
+				return (-1);
+			}
+		}
+		for (it = blist.begin(); it != blist.end(); it++) {
+			delete it->second;
+		}
+		logMessage(BLOCK_LOG_LEVEL,
+				   "Validated %lu reads with device [%lu] disconnected.",
+				   blist.size(), rdev->getDeviceIdenfier());
+		blist.clear();
+	}
+
 	// When we have a shutdown method, we will add it here
 	// TODO: add layer shutdowm method
 
@@ -465,4 +984,560 @@ int bfsBlockLayer::bfsBlockLayerUtest(void) {
 			   "\033[93mBfs block unit test completed successfully.\033[0m\n");
 	return (0);
 }
+
+/**
+ * @brief Benchmark multi-block reads/writes against the number of devices
+ * the blocks are spread over, timing the same cluster readBlocks/writeBlocks
+ * with the per-device requests dispatched sequentially (each waited on
+ * before the next is sent) and fanned out (all sent, then joined on).  The
+ * cluster is built over in-memory stub devices whose requests take a fixed
+ * latency, so a sequential dispatch must pay the sum of the latencies of the
+ * requests and a fan-out only the largest (per round of requests, erasure
+ * coded writes read the rest of their stripes first), which is asserted.
+ *
+ * @param blocks - the number of blocks in each read/write
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsBlockLayer::bfsBlockLayerFanoutBench(int blocks) {
+
+	// Local variables
+	vector<bfsLatencyDevice *> stubs;
+	bfs_device_list_t manifest;
+	bfs_device_vec_t devs;
+	bfs_vblock_list_t vlist;
+	bfs_vblock_list_t::iterator vit;
+	map<bfs_vbid_t, string> data;
+	bfs_block_id_t pbid;
+	bfs_vbid_t vbid;
+	bfsDevice *dev;
+	char blk[BLK_SZ];
+	double wr[2], rd[2], wrq[2], rdq[2], lat = BFS_BLK_BENCH_LATENCY;
+	uint64_t reqs[3];
+	size_t nd, ndevs = BFS_BLK_BENCH_DEVICES;
+	int it, fan, wrounds;
+	bool check;
+
+	// Setup the block layer and a cluster of stub devices (enough for the
+	// configured replicas or stripes)
+	if (bfsBlockLayerInit() != BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed to initalize block layer for benchmark, aborting.");
+		return (-1);
+	}
+	ndevs = max(ndevs, (size_t)getReplicaCount());
+	if (getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC) {
+		ndevs = max(ndevs, (size_t)(getErasureDataChunks() +
+									getErasureParityChunks()));
+	}
+	for (nd = 0; nd < ndevs; nd++) {
+		stubs.push_back(new bfsLatencyDevice((bfs_device_id_t)(nd + 1),
+											 BFS_BLK_BENCH_DEV_BLOCKS,
+											 BFS_BLK_BENCH_LATENCY));
+		manifest[(bfs_device_id_t)(nd + 1)] = stubs.back();
+	}
+	if (set_vbc(bfsVertBlockCluster::bfsClusterFactory(manifest)) !=
+		BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed to initalize block layer for benchmark, aborting.");
+		return (-1);
+	}
+	devs = get_vbc()->get_devices();
+
+	// The flusher of write-back caching sends requests of its own meanwhile,
+	// so the requests can only be checked writing through
+	wrounds = (getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC) ? 2 : 1;
+	check = !writeBackEnabled();
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Fan-out benchmark, %d blocks per request, %d iterations, %lu "
+			   "devices with %.0f us latency%s",
+			   blocks, BFS_BLK_BENCH_ITERATIONS, devs.size(), lat,
+			   check ? "" : " (write-back, not checked)");
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "devices, seq write (us), fan-out write (us), seq read (us), "
+			   "fan-out read (us), write speedup, read speedup, write "
+			   "requests, read requests");
+
+	// Walk the device counts, spreading the blocks over the first nd devices
+	for (nd = 1; nd <= devs.size(); nd++) {
+
+		// Pick random virtual blocks living on the devices, note the data
+		while (vlist.size() < (size_t)blocks) {
+			vbid = get_random_value(0, get_vbc()->getMaxVertBlocNum() - 1);
+			if ((get_vbc()->getPhyBlockAddr(vbid, dev, pbid)) ||
+				(find(devs.begin(), devs.begin() + nd, dev) ==
+				 devs.begin() + nd) ||
+				(vlist.find(vbid) != vlist.end())) {
+				continue;
+			}
+			get_random_data(blk, BLK_SZ);
+			vlist[vbid] = new VBfsBlock(blk, BLK_SZ, 0, 0, vbid);
+			data[vbid] = string(blk, BLK_SZ);
+		}
+
+		// Time the requests dispatched sequentially and fanned out (taking
+		// turns, after a warm up round trip), counting the requests sent
+		if (get_vbc()->writeBlocks(vlist) || get_vbc()->readBlocks(vlist)) {
+			return (-1);
+		}
+		wr[0] = wr[1] = rd[0] = rd[1] = 0.0;
+		wrq[0] = wrq[1] = rdq[0] = rdq[1] = 0.0;
+		for (it = 0; it < BFS_BLK_BENCH_ITERATIONS; it++) {
+			for (fan = 0; fan < 2; fan++) {
+				get_vbc()->setSequentialDispatch(fan == 0);
+				reqs[0] = bfsBlockLayerStubRequests(stubs);
+				auto t0 = chrono::high_resolution_clock::now();
+				if (get_vbc()->writeBlocks(vlist)) {
+					return (-1);
+				}
+				auto t1 = chrono::high_resolution_clock::now();
+				reqs[1] = bfsBlockLayerStubRequests(stubs);
+				if (get_vbc()->readBlocks(vlist)) {
+					return (-1);
+				}
+				auto t2 = chrono::high_resolution_clock::now();
+				reqs[2] = bfsBlockLayerStubRequests(stubs);
+				wr[fan] += chrono::duration<double, micro>(t1 - t0).count();
+				rd[fan] += chrono::duration<double, micro>(t2 - t1).count();
+				wrq[fan] += (double)(reqs[1] - reqs[0]);
+				rdq[fan] += (double)(reqs[2] - reqs[1]);
+			}
+		}
+		get_vbc()->setSequentialDispatch(false);
+
+		// Make sure the data made the round trip
+		for (vit = vlist.begin(); vit != vlist.end(); vit++) {
+			if (memcmp(vit->second->getBuffer(), data[vit->first].c_str(),
+					   BLK_SZ) != 0) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Benchmark block [%lu] failed match validation.",
+						   vit->first);
+				return (-1);
+			}
+		}
+
+		// Report the average request times
+		for (fan = 0; fan < 2; fan++) {
+			wr[fan] /= BFS_BLK_BENCH_ITERATIONS;
+			rd[fan] /= BFS_BLK_BENCH_ITERATIONS;
+			wrq[fan] /= BFS_BLK_BENCH_ITERATIONS;
+			rdq[fan] /= BFS_BLK_BENCH_ITERATIONS;
+		}
+		logMessage(LOG_OUTPUT_LEVEL,
+				   "%lu, %.1f, %.1f, %.1f, %.1f, %.2f, %.2f, %.1f, %.1f", nd,
+				   wr[0], wr[1], rd[0], rd[1], wr[0] / wr[1], rd[0] / rd[1],
+				   wrq[0], rdq[0]);
+
+		// The sequential dispatch pays the sum of the latencies, the fan-out
+		// only the largest (per round), so it must save at least half of the
+		// others (leaving room for a noisy host)
+		if (check &&
+			((wr[0] < 0.9 * wrq[0] * lat) || (rd[0] < 0.9 * rdq[0] * lat) ||
+			 ((wrq[0] > wrounds) &&
+			  (wr[0] - wr[1] < 0.5 * (wrq[0] - wrounds) * lat)) ||
+			 ((rdq[0] > 1) && (rd[0] - rd[1] < 0.5 * (rdq[0] - 1) * lat)))) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Fan-out over %lu devices not the max of the latencies "
+					   "(sequential the sum)",
+					   nd);
+			return (-1);
+		}
+
+		// Release the blocks for the next round
+		for (vit = vlist.begin(); vit != vlist.end(); vit++) {
+			delete vit->second;
+		}
+		vlist.clear();
+		data.clear();
+	}
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Count the requests sent to the stub devices of a benchmark
+ *
+ * @param stubs - the stub devices
+ * @return uint64_t : the number of requests
+ */
+
+uint64_t
+bfsBlockLayer::bfsBlockLayerStubRequests(vector<bfsLatencyDevice *> &stubs) {
+	uint64_t n = 0;
+	for (size_t i = 0; i < stubs.size(); i++) {
+		n += stubs[i]->getRequests();
+	}
+	return (n);
+}
+
+/**
+ * @brief Benchmark virtual to physical block address translation over random
+ * virtual blocks, against a scan of the device list (as translation was done
+ * before the cluster kept a translation table, linear allocation only).
+ *
+ * @param lookups - the number of addresses to translate
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsBlockLayer::bfsBlockLayerTranslateBench(uint64_t lookups) {
+
+	// Local variables
+	vector<bfs_vbid_t> vbids(BFS_BLK_BENCH_VBIDS);
+	bfs_device_vec_t::iterator it;
+	bfs_vbid_t addr, saddr;
+	bfs_block_id_t pbid;
+	bfsDevice *dev = NULL;
+	uint64_t n, tsum = 0, ssum = 0;
+	double tns, sns;
+
+	// Setup the block layer and cluster, pick the addresses to translate
+	if ((bfsBlockLayerInit() != BFS_SUCCESS) ||
+		(set_vbc(bfsVertBlockCluster::bfsClusterFactory()) != BFS_SUCCESS)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed to initalize block layer for benchmark, aborting.");
+		return (-1);
+	}
+	bfs_device_vec_t &devs = get_vbc()->get_devices();
+	for (n = 0; n < BFS_BLK_BENCH_VBIDS; n++) {
+		vbids[n] = get_random_value(0, get_vbc()->getMaxVertBlocNum() - 1);
+	}
+
+	// Time the table translation
+	auto t0 = chrono::high_resolution_clock::now();
+	for (n = 0; n < lookups; n++) {
+		if (get_vbc()->getPhyBlockAddr(vbids[n & (BFS_BLK_BENCH_VBIDS - 1)],
+									   dev, pbid)) {
+			return (-1);
+		}
+		tsum += pbid + dev->getDeviceIdenfier();
+	}
+	auto t1 = chrono::high_resolution_clock::now();
+
+	// Time the device list scan
+	for (n = 0; n < lookups; n++) {
+		addr = vbids[n & (BFS_BLK_BENCH_VBIDS - 1)];
+		for (saddr = 0, it = devs.begin(); it != devs.end(); it++) {
+			if (saddr + (*it)->getNumBlocks() > addr) {
+				dev = (*it);
+				pbid = addr - saddr;
+				break;
+			}
+			saddr += (*it)->getNumBlocks();
+		}
+		ssum += pbid + dev->getDeviceIdenfier();
+	}
+	auto t2 = chrono::high_resolution_clock::now();
+
+	// Report the per lookup times (sums agree for linear allocation)
+	tns = chrono::duration<double, nano>(t1 - t0).count() / (double)lookups;
+	sns = chrono::duration<double, nano>(t2 - t1).count() / (double)lookups;
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Translated %lu addresses over %lu devices (%s allocation)",
+			   lookups, devs.size(),
+			   bfs_vert_cluster_alloc_strings[getAllocationAlgorithm()]);
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "table %.2f ns/lookup, scan %.2f ns/lookup, speedup %.2f "
+			   "[sums %lu/%lu]",
+			   tns, sns, sns / tns, tsum, ssum);
+
+	// Return successfully
+	return (0);
+}
+/**
+ * @brief Benchmark the erasure code, the encode and (degraded, m data chunks
+ * lost) decode throughput of a few stripe geometries with the scalar and
+ * SIMD kernels, against plain striping (just moving the data into chunks).
+ *
+ * @param mbytes - the amount of data (MB) to push through each code
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsBlockLayer::bfsBlockLayerErasureBench(uint64_t mbytes) {
+
+	// Local variables
+	const uint32_t codes[BFS_BLK_BENCH_EC_CODES][2] = {{4, 2}, {6, 3}, {10, 4}};
+	double secs[5], bytes;
+	uint64_t stripes, st;
+	uint32_t i, c, k, m, pass;
+	bool present[BFS_EC_MAX_CHUNKS];
+
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Erasure benchmark, %lu MB per code, SIMD kernel %s", mbytes,
+			   bfsErasureCode::simdAvailable() ? "available" : "unavailable");
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "code, stripe (GB/s), encode scalar (GB/s), encode simd (GB/s), "
+			   "decode scalar (GB/s), decode simd (GB/s)");
+
+	for (i = 0; i < BFS_BLK_BENCH_EC_CODES; i++) {
+
+		// Setup the code and a stripe of random data
+		k = codes[i][0];
+		m = codes[i][1];
+		bfsErasureCode ec(k, m);
+		vector<char> src(k * BLK_SZ), chunks((k + m) * BLK_SZ);
+		vector<char *> ptrs(k + m);
+		for (c = 0; c < k + m; c++) {
+			ptrs[c] = &chunks[c * BLK_SZ];
+		}
+		get_random_data(&src[0], k * BLK_SZ);
+		stripes = max((uint64_t)1, (mbytes << 20) / (k * BLK_SZ));
+
+		// Time plain striping (copying the data into the chunks)
+		auto t0 = chrono::high_resolution_clock::now();
+		for (st = 0; st < stripes; st++) {
+			for (c = 0; c < k; c++) {
+				memcpy(ptrs[c], &src[c * BLK_SZ], BLK_SZ);
+			}
+		}
+		secs[0] = chrono::duration<double>(chrono::high_resolution_clock::now() -
+										   t0)
+					  .count();
+
+		// Time the encode and decode with each kernel
+		for (pass = 0; pass < 2; pass++) {
+			bfsErasureCode::setSimdEnabled(pass == 1);
+			auto t1 = chrono::high_resolution_clock::now();
+			for (st = 0; st < stripes; st++) {
+				ec.encode(&ptrs[0], &ptrs[k], BLK_SZ);
+			}
+			auto t2 = chrono::high_resolution_clock::now();
+			for (c = 0; c < k + m; c++) {
+				present[c] = (c >= min(k, m));
+			}
+			for (st = 0; st < stripes; st++) {
+				if (ec.decode(&ptrs[0], present, BLK_SZ)) {
+					bfsErasureCode::setSimdEnabled(true);
+					return (-1);
+				}
+			}
+			auto t3 = chrono::high_resolution_clock::now();
+			secs[1 + pass] = chrono::duration<double>(t2 - t1).count();
+			secs[3 + pass] = chrono::duration<double>(t3 - t2).count();
+
+			// Make sure the data was rebuilt
+			if (memcmp(&src[0], &chunks[0], k * BLK_SZ) != 0) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Erasure benchmark %u+%u failed to rebuild data.",
+						   k, m);
+				bfsErasureCode::setSimdEnabled(true);
+				return (-1);
+			}
+		}
+		bfsErasureCode::setSimdEnabled(true);
+
+		// Report the throughput (of the data, not the parity)
+		bytes = (double)stripes * k * BLK_SZ / 1e9;
+		logMessage(LOG_OUTPUT_LEVEL, "%u+%u, %.2f, %.2f, %.2f, %.2f, %.2f", k,
+				   m, bytes / secs[0], bytes / secs[1], bytes / secs[2],
+				   bytes / secs[3], bytes / secs[4]);
+	}
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Benchmark sequential block reads (as the fs layer issues them, one
+ * block per call) with readahead off and on, each over its own uncached run
+ * of blocks.  Reports the time per block and the readahead counters.
+ *
+ * @param blocks - the number of blocks in each sequential run
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsBlockLayer::bfsBlockLayerReadaheadBench(int blocks) {
+
+	// Local variables
+	bfs_vblock_list_t vlist;
+	bfs_vblock_list_t::iterator vit;
+	blk_ra_stats before, after;
+	bfs_vbid_t base[2], vbid;
+	uint32_t ra_max = 0;
+	double usecs[2];
+	char blk[BLK_SZ];
+	int pass, i;
+
+	// Setup the block layer and cluster, readahead needs the block cache
+	if ((bfsBlockLayerInit() != BFS_SUCCESS) ||
+		(set_vbc(bfsVertBlockCluster::bfsClusterFactory()) != BFS_SUCCESS)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed to initalize block layer for benchmark, aborting.");
+		return (-1);
+	}
+	if ((!bfsUtilLayer::cache_enabled()) || (getReadaheadMax() == 0) ||
+		((bfs_vbid_t)blocks * 2 > get_vbc()->getMaxVertBlocNum())) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Readahead benchmark needs the cache, readahead and %d "
+				   "blocks, aborting.",
+				   blocks * 2);
+		return (-1);
+	}
+
+	// Write the two runs of blocks (around the cache, so reads start cold)
+	base[0] = get_random_value(0, get_vbc()->getMaxVertBlocNum() - blocks * 2);
+	base[1] = base[0] + (bfs_vbid_t)blocks;
+	for (vbid = base[0]; vbid < base[1] + (bfs_vbid_t)blocks; vbid++) {
+		get_random_data(blk, BLK_SZ);
+		vlist[vbid] = new VBfsBlock(blk, BLK_SZ, 0, 0, vbid);
+		if ((vlist.size() == BFS_BLK_UTEST_RA_BLOCKS) ||
+			(vbid + 1 == base[1] + (bfs_vbid_t)blocks)) {
+			if (get_vbc()->writeBlocks(vlist)) {
+				return (-1);
+			}
+			for (vit = vlist.begin(); vit != vlist.end(); vit++) {
+				delete vit->second;
+			}
+			vlist.clear();
+		}
+	}
+
+	// Read each run one block at a time, without and then with readahead
+	VBfsBlock vblk(NULL, BLK_SZ, 0, 0, 0);
+	before = get_vbc()->getReadaheadStats();
+	for (pass = 0; pass < 2; pass++) {
+		ra_max = bfsBlockRAMax;
+		bfsBlockRAMax = (pass == 0) ? 0 : ra_max;
+		auto start = chrono::high_resolution_clock::now();
+		for (i = 0; i < blocks; i++) {
+			vblk.set_vbid(base[pass] + (bfs_vbid_t)i);
+			if (readBlock(vblk) == BFS_FAILURE) {
+				bfsBlockRAMax = ra_max;
+				return (-1);
+			}
+		}
+		usecs[pass] = chrono::duration<double, micro>(
+						  chrono::high_resolution_clock::now() - start)
+						  .count() /
+					  (double)blocks;
+		bfsBlockRAMax = ra_max;
+	}
+	after = get_vbc()->getReadaheadStats();
+
+	// Report the per block times and the readahead counters
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Read %d sequential blocks over %lu devices (readahead %u-%u)",
+			   blocks, get_vbc()->get_devices().size(), getReadaheadMin(),
+			   ra_max);
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "no readahead %.2f us/block, readahead %.2f us/block, "
+			   "speedup %.2f",
+			   usecs[0], usecs[1], usecs[0] / usecs[1]);
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "%lu windows, %lu prefetched, %lu hits, %lu wasted",
+			   after.windows - before.windows,
+			   after.prefetched - before.prefetched, after.hits - before.hits,
+			   after.waste - before.waste);
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Benchmark the data copied on the block path, as the fs layer calls
+ * it (one block per call).  Writes (and flushes) a set of random blocks,
+ * rewrites them synchronously, reads them back, then reads them again in one
+ * batch, reporting the bytes copied, the time and the buffers allocated from
+ * the heap per block for each.
+ *
+ * @param ops - the number of blocks read/written by each step
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsBlockLayer::bfsBlockLayerCopyBench(int ops) {
+
+	// Local variables
+	const char *steps[] = {"write", "sync write", "read", "batched read"};
+	bfs_vblock_list_t vlist;
+	bfs_vblock_list_t::iterator vit;
+	vector<bfs_vbid_t> vbids;
+	bfs_vbid_t vbid;
+	uint64_t copied[4], heap[4];
+	double usecs[4];
+	char blk[BLK_SZ];
+	int step, i;
+
+	// Setup the block layer and cluster, pick the blocks
+	if ((bfsBlockLayerInit() != BFS_SUCCESS) ||
+		(set_vbc(bfsVertBlockCluster::bfsClusterFactory()) != BFS_SUCCESS)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed to initalize block layer for benchmark, aborting.");
+		return (-1);
+	}
+	while (vlist.size() < (size_t)ops) {
+		vbid = get_random_value(0, get_vbc()->getMaxVertBlocNum() - 1);
+		if (vlist.find(vbid) == vlist.end()) {
+			vbids.push_back(vbid);
+			vlist[vbid] = NULL;
+		}
+	}
+	for (vit = vlist.begin(); vit != vlist.end(); vit++) {
+		get_random_data(blk, BLK_SZ);
+		vit->second = new VBfsBlock(blk, BLK_SZ, 0, 0, vit->first);
+	}
+
+	// Run each of the steps, counting the bytes copied
+	VBfsBlock vblk(NULL, BLK_SZ, 0, 0, 0);
+	for (step = 0; step < 4; step++) {
+		copied[step] = bfsFlexibleBuffer::getCopiedBytes();
+		heap[step] = BfsBlockPool::getHeapAllocations();
+		auto start = chrono::high_resolution_clock::now();
+		for (i = 0; (step < 3) && (i < ops); i++) {
+			if (step < 2) {
+				vblk.setData(vlist[vbids[i]]->getBuffer(), BLK_SZ);
+			}
+			vblk.set_vbid(vbids[i]);
+			if (((step == 0) && (writeBlock(vblk) == BFS_FAILURE)) ||
+				((step == 1) &&
+				 (writeBlock(vblk, _bfs__O_SYNC) == BFS_FAILURE)) ||
+				((step == 2) && (readBlock(vblk) == BFS_FAILURE))) {
+				return (-1);
+			}
+			if ((step == 2) && (memcmp(vblk.getBuffer(),
+									   vlist[vbids[i]]->getBuffer(),
+									   BLK_SZ) != 0)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Benchmark read of block [%lu] failed validation.",
+						   vbids[i]);
+				return (-1);
+			}
+		}
+		if (((step == 0) && (flushBlocks())) ||
+			((step == 3) && (get_vbc()->readBlocks(vlist)))) {
+			return (-1);
+		}
+		usecs[step] = chrono::duration<double, micro>(
+						  chrono::high_resolution_clock::now() - start)
+						  .count() /
+					  (double)ops;
+		copied[step] = bfsFlexibleBuffer::getCopiedBytes() - copied[step];
+		heap[step] = BfsBlockPool::getHeapAllocations() - heap[step];
+
+		// (the vblk setup copies are the caller's, not the block path's)
+		if (step < 2) {
+			copied[step] -= (uint64_t)ops * BLK_SZ;
+		}
+	}
+
+	// Report the copies and times per block
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Copied per %u byte block over %lu devices (%d blocks, cache "
+			   "%s, write-back %s, block pool %s)",
+			   BLK_SZ, get_vbc()->get_devices().size(), ops,
+			   bfsUtilLayer::cache_enabled() ? "on" : "off",
+			   writeBackEnabled() ? "on" : "off",
+			   BfsBlockPool::enabled() ? "on" : "off");
+	for (step = 0; step < 4; step++) {
+		logMessage(LOG_OUTPUT_LEVEL,
+				   "%12s : %8.1f bytes, %8.2f us, %6.2f heap allocs",
+				   steps[step], (double)copied[step] / ops, usecs[step],
+				   (double)heap[step] / ops);
+	}
+
+	// Release the blocks, return successfully
+	for (vit = vlist.begin(); vit != vlist.end(); vit++) {
+		delete vit->second;
+	}
+	return (0);
+}
 #endif
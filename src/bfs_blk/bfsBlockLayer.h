@@ -30,18 +30,37 @@
 #define BLOCK_VRBLOG_LEVEL bfsBlockLayer::getVerboseBlockLayerLogLevel()
 #define BFS_BLKLYR_CONFIG "bfsBlockLayer"
 #define BFS_BLKLYR_ALLOC_DSP "allocation_discipline"
+#define BFS_BLKLYR_STRIPE_UNIT "stripe_unit"
+#define BFS_BLKLYR_REPLICAS "replicas"
+#define BFS_BLKLYR_EC_DATA "erasure_data"
+#define BFS_BLKLYR_EC_PARITY "erasure_parity"
+#define BFS_BLKLYR_WRITE_BACK "write_back"
+#define BFS_BLKLYR_DIRTY_HIGH "dirty_high_watermark"
+#define BFS_BLKLYR_DIRTY_LOW "dirty_low_watermark"
+#define BFS_BLKLYR_FLUSH_INTERVAL "flush_interval"
+#define BFS_BLKLYR_RA_MIN "readahead_min"
+#define BFS_BLKLYR_RA_MAX "readahead_max"
 #define BFS_DEV_UNIT_TEST_SLOTS 256
 #define BFS_DEV_UNIT_TEST_ITERATIONS 1024
+#define BFS_BLK_BENCH_ITERATIONS 32
+#define BFS_BLK_BENCH_DEVICES 4
+#define BFS_BLK_BENCH_DEV_BLOCKS 16384
+#define BFS_BLK_BENCH_LATENCY 10000
+#define BFS_BLK_BENCH_VBIDS (1 << 20)
+#define BFS_BLK_BENCH_EC_CODES 3
+#define BFS_BLK_UTEST_RA_BLOCKS 64
 #define BFS_UTEST_UNUSED (bfs_vbid_t) - 1
 
 //
 // Class types
+class bfsLatencyDevice;
 
 // Block allocation strategy
 typedef enum {
 	BFSBLK_LINEAR_ALLOC = 0,	 // Linear block allocation
 	BFSBLK_INTERLEAVE_ALLOC = 1, // Disk interleaving block allocation
-	BFSBLK_MAX_ALLOC = 2,		 // Guard value
+	BFSBLK_ERASURE_ALLOC = 2,	 // Reed-Solomon (k+m) erasure coded stripes
+	BFSBLK_MAX_ALLOC = 3,		 // Guard value
 } bfs_vert_cluster_alloc_t;
 
 //
@@ -63,6 +82,21 @@ public:
 #ifdef __BFS_DEBUG_NO_ENCLAVE
 	static int bfsBlockLayerUtest(void);
 	// Perform a unit test on the block layer implementation
+
+	static int bfsBlockLayerFanoutBench(int blocks);
+	// Benchmark multi-block reads/writes as a function of device count
+
+	static int bfsBlockLayerTranslateBench(uint64_t lookups);
+	// Benchmark virtual to physical block address translation
+
+	static int bfsBlockLayerErasureBench(uint64_t mbytes);
+	// Benchmark erasure encode/decode throughput against plain striping
+
+	static int bfsBlockLayerReadaheadBench(int blocks);
+	// Benchmark sequential block reads with and without readahead
+
+	static int bfsBlockLayerCopyBench(int ops);
+	// Benchmark the bytes copied per block read/write (as the fs layer calls)
 #endif
 
 	//
@@ -83,6 +117,36 @@ public:
 		return (bfsBlockAllocAlgorithm);
 	}
 
+	// Stripe unit (blocks per device) for interleaved allocation
+	static bfs_vbid_t getStripeUnit(void) { return (bfsBlockStripeUnit); }
+
+	// Number of copies of each block kept (on different devices)
+	static uint32_t getReplicaCount(void) { return (bfsBlockReplicas); }
+
+	// Number of data chunks in an erasure coded stripe
+	static uint32_t getErasureDataChunks(void) { return (bfsBlockECData); }
+
+	// Number of parity chunks in an erasure coded stripe
+	static uint32_t getErasureParityChunks(void) { return (bfsBlockECParity); }
+
+	// Flag indicating writes are cached and flushed in the background
+	static bool writeBackEnabled(void) { return (bfsBlockWriteBack); }
+
+	// Dirty share of the cache (percent) at which the flusher starts
+	static uint32_t getDirtyHighWatermark(void) { return (bfsBlockDirtyHigh); }
+
+	// Dirty share of the cache (percent) the flusher brings it down to
+	static uint32_t getDirtyLowWatermark(void) { return (bfsBlockDirtyLow); }
+
+	// Time (msec) between background flushes of all dirty blocks
+	static uint64_t getFlushInterval(void) { return (bfsBlockFlushInterval); }
+
+	// Initial readahead window (blocks) of a sequential stream
+	static uint32_t getReadaheadMin(void) { return (bfsBlockRAMin); }
+
+	// Largest readahead window (blocks), 0 disables readahead
+	static uint32_t getReadaheadMax(void) { return (bfsBlockRAMax); }
+
 	// Return a descriptive string for the state
 	static const char *getClusterStateStr(bfs_vert_cluster_state_t st) {
 		if ((st < 0) || (st >= BFSBLK_MAXSTATE)) {
@@ -171,8 +235,16 @@ public:
 		// ret = vbc->readBlock_helper(vblk.get_vbid(), pblk->getBuffer());
 		ret = vbc->readBlock_helper(vblk.get_vbid(), &pblk);
 
-		if ((ret == BFS_SUCCESS) || (ret == BFS_SUCCESS_CACHE_HIT))
-			vblk.setData(pblk->getBuffer(), pblk->getLength());
+		// Copy the block out, or (outside the enclave, for uncached blocks)
+		// just take its data
+		if ((ret == BFS_SUCCESS) || (ret == BFS_SUCCESS_CACHE_HIT)) {
+#ifndef __BFS_ENCLAVE_MODE
+			if (!bfsUtilLayer::cache_enabled())
+				vblk.swapData(*pblk);
+			else
+#endif
+				vblk.setData(pblk->getBuffer(), pblk->getLength());
+		}
 
 		// #ifdef __BFS_ENCLAVE_MODE
 		// 		double bl_read_end_time = 0.0;
@@ -196,6 +268,11 @@ public:
 		if (!bfsUtilLayer::cache_enabled())
 			delete pblk;
 
+		// prefetch ahead of sequential reads (after the copy, as the prefetch
+		// may push the block out of the cache)
+		if ((ret == BFS_SUCCESS) || (ret == BFS_SUCCESS_CACHE_HIT))
+			vbc->readAhead(vblk.get_vbid());
+
 		return ret;
 	}
 	// Read a block of data from the cluster
@@ -236,19 +313,30 @@ public:
 	// Write a block to the cluster at a virtual block address
 
 	/**
-	 * @brief Release a previously allocated block
+	 * @brief Write all dirty (write-back cached) blocks out to the devices,
+	 * returning once they are there (e.g., for fsync)
+	 *
+	 * @return int: 0 if successful, -1 if failure
+	 */
+	static int flushBlocks(void) {
+		if (vbc == NULL) {
+			return (BFS_SUCCESS);
+		}
+		return (vbc->flushBlocks());
+	}
+
+	/**
+	 * @brief Release a previously allocated block (its device blocks are
+	 * discarded at the next flush)
 	 *
 	 * @param blkid - the virtual block ID to deallocate
-	 * @return the block or NULL if failure
+	 * @return int: 0 if successful, -1 if failure
 	 */
 	static int deallocBlock(bfs_vbid_t id) {
-
-		(void)id;
-		// FOR NOW, NOTHING TO DO
-		// TODO: call into vbc::deallocBlock
-
-		// Return successfully
-		return BFS_SUCCESS;
+		if (vbc == NULL) {
+			return (BFS_SUCCESS);
+		}
+		return (vbc->deallocBlock(id));
 	}
 
 private:
@@ -258,6 +346,12 @@ private:
 	bfsBlockLayer(void) {}
 	// Default constructor (prevents creation of any instance)
 
+#ifdef __BFS_DEBUG_NO_ENCLAVE
+	static uint64_t
+	bfsBlockLayerStubRequests(vector<bfsLatencyDevice *> &stubs);
+	// Count the requests sent to the stub devices of a benchmark
+#endif
+
 	//
 	// Static Class Variables
 
@@ -267,6 +361,39 @@ private:
 	static bfs_vert_cluster_alloc_t bfsBlockAllocAlgorithm;
 	// The allocation algorithm used for assigning blocks
 
+	static bfs_vbid_t bfsBlockStripeUnit;
+	// The consecutive blocks placed on a device before moving to the next
+
+	static uint32_t bfsBlockReplicas;
+	// The number of replicas of each block (1 is no replication)
+
+	static uint32_t bfsBlockECData;
+	// The number of data chunks (blocks) in an erasure coded stripe
+
+	static uint32_t bfsBlockECParity;
+	// The number of parity chunks (blocks) in an erasure coded stripe
+
+	static bool bfsBlockWriteBack;
+	// Flag indicating if writes are cached and flushed in the background
+
+	static bool bfsBlockWriteBackConfigured;
+	// Flag indicating the write-back settings have been read from the config
+
+	static uint32_t bfsBlockDirtyHigh;
+	// The dirty share of the cache (percent) that starts a flush
+
+	static uint32_t bfsBlockDirtyLow;
+	// The dirty share of the cache (percent) a flush brings it down to
+
+	static uint64_t bfsBlockFlushInterval;
+	// The time (msec) between background flushes of all dirty blocks
+
+	static uint32_t bfsBlockRAMin;
+	// The initial readahead window (blocks) of a sequential stream
+
+	static uint32_t bfsBlockRAMax;
+	// The largest readahead window (blocks), 0 disables readahead
+
 	static unsigned long bfsBlockLogLevel;
 	// The log level for all of the block information
 
@@ -0,0 +1,479 @@
+/**
+ *
+ * @file   bfsErasureCode.cpp
+ * @brief  This is the class implementing the systematic Reed-Solomon (k+m)
+ *         erasure code used by the virtual block cluster.  The region kernels
+ *         (dst ^= c * src) do the bulk of the work, the scalar one uses a full
+ *         multiplication table and the SIMD one (SSSE3, where available) the
+ *         split nibble tables looked up with byte shuffles.
+ *
+ */
+
+/* Include files  */
+#include <string.h>
+#if defined(__x86_64__) && !defined(__BFS_ENCLAVE_MODE)
+#include <immintrin.h>
+#define BFS_EC_SSSE3 1
+#endif
+
+/* Project include files */
+#include <bfsBlockLayer.h>
+#include <bfsErasureCode.h>
+#include <bfs_log.h>
+#include <bfs_util.h>
+
+/* Macros */
+#define BFS_GF_POLY 0x11d // x^8 + x^4 + x^3 + x^2 + 1
+
+//
+// Class Data
+
+bool bfsErasureCode::tablesInitialized = false;
+bool bfsErasureCode::simdEnabled = true;
+uint8_t bfsErasureCode::gfLog[256];
+uint8_t bfsErasureCode::gfExp[510];
+uint8_t bfsErasureCode::gfMulTable[256][256];
+
+//
+// Local functions
+
+#ifdef BFS_EC_SSSE3
+/**
+ * @brief Add c times the source region into the destination 16 bytes at a
+ * time, where lo/hi are the products of c with the low/high nibble values.
+ *
+ * @param dst - the destination region
+ * @param src - the source region
+ * @param lo - c times each low nibble (16 entries)
+ * @param hi - c times each high nibble (16 entries)
+ * @param len - the length of the regions
+ * @return size_t : the number of bytes processed (a multiple of 16)
+ */
+
+__attribute__((target("ssse3"))) static size_t
+gf_mul_region_xor_ssse3(uint8_t *dst, const uint8_t *src, const uint8_t *lo,
+						const uint8_t *hi, size_t len) {
+
+	// Local variables
+	__m128i tlo = _mm_loadu_si128((const __m128i *)lo);
+	__m128i thi = _mm_loadu_si128((const __m128i *)hi);
+	__m128i mask = _mm_set1_epi8(0x0f), s, d, p;
+	size_t i;
+
+	// Look up the nibble products, add them into the destination
+	for (i = 0; i + 16 <= len; i += 16) {
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		p = _mm_xor_si128(
+			_mm_shuffle_epi8(tlo, _mm_and_si128(s, mask)),
+			_mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, p));
+	}
+
+	// Return the bytes processed
+	return (i);
+}
+#endif
+
+//
+// Class Functions
+
+/**
+ * @brief The attribute constructor for the class (builds the parity matrix)
+ *
+ * @param k - the number of data chunks in a stripe
+ * @param m - the number of parity chunks in a stripe
+ */
+
+bfsErasureCode::bfsErasureCode(uint32_t k, uint32_t m)
+	: ec_k(k), ec_m(m), ec_matrix(k * m) {
+
+	// Local variables
+	uint32_t i, j;
+
+	// Setup the field, then the Cauchy matrix 1/(x_i + y_j), with x_i = i and
+	// y_j = m + j (all distinct, so every square submatrix is invertible)
+	initTables();
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < k; j++) {
+			ec_matrix[i * k + j] = gfInv((uint8_t)(i ^ (m + j)));
+		}
+	}
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Compute the m parity chunks of the k data chunks
+ *
+ * @param data - the k data chunks
+ * @param parity - the m parity chunks (filled in)
+ * @param len - the length of each chunk
+ * @return none
+ */
+
+void bfsErasureCode::encode(char **data, char **parity, size_t len) {
+
+	// Local variables
+	uint32_t i, j;
+
+	// Each parity chunk is the sum of its coefficients times the data
+	for (i = 0; i < ec_m; i++) {
+		memset(parity[i], 0x0, len);
+		for (j = 0; j < ec_k; j++) {
+			gfMulRegionXor((uint8_t *)parity[i], (const uint8_t *)data[j],
+						   ec_matrix[i * ec_k + j], len);
+		}
+	}
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Rebuild the missing chunks of a stripe from k of the present ones.
+ * The chunks are the k data chunks followed by the m parity chunks, missing
+ * chunks must still point to a buffer the rebuilt data is written into.
+ *
+ * @param chunks - the k+m chunks of the stripe
+ * @param present - flags indicating which chunks hold valid data
+ * @param len - the length of each chunk
+ * @return int : 0 is success, -1 is failure (fewer than k chunks present)
+ */
+
+int bfsErasureCode::decode(char **chunks, const bool *present, size_t len) {
+
+	// Local variables
+	vector<uint32_t> sel;
+	vector<uint8_t> mat(ec_k * ec_k, 0);
+	uint32_t i, j, t;
+
+	// Pick the first k chunks present
+	for (i = 0; (i < ec_k + ec_m) && (sel.size() < ec_k); i++) {
+		if (present[i]) {
+			sel.push_back(i);
+		}
+	}
+	if (sel.size() < ec_k) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Erasure decode needs %u chunks, only %lu present", ec_k,
+				   sel.size());
+		return (-1);
+	}
+
+	// Build the rows of the generator for the chunks selected, invert it
+	for (t = 0; t < ec_k; t++) {
+		if (sel[t] < ec_k) {
+			mat[t * ec_k + sel[t]] = 1;
+		} else {
+			memcpy(&mat[t * ec_k], &ec_matrix[(sel[t] - ec_k) * ec_k], ec_k);
+		}
+	}
+	if (invertMatrix(mat, ec_k)) {
+		logMessage(LOG_ERROR_LEVEL, "Erasure decode matrix is singular.");
+		return (-1);
+	}
+
+	// Rebuild the missing data chunks from the selected ones
+	for (j = 0; j < ec_k; j++) {
+		if (present[j]) {
+			continue;
+		}
+		memset(chunks[j], 0x0, len);
+		for (t = 0; t < ec_k; t++) {
+			gfMulRegionXor((uint8_t *)chunks[j],
+						   (const uint8_t *)chunks[sel[t]], mat[j * ec_k + t],
+						   len);
+		}
+	}
+
+	// Now recompute any missing parity from the (complete) data
+	for (i = 0; i < ec_m; i++) {
+		if (present[ec_k + i]) {
+			continue;
+		}
+		memset(chunks[ec_k + i], 0x0, len);
+		for (j = 0; j < ec_k; j++) {
+			gfMulRegionXor((uint8_t *)chunks[ec_k + i],
+						   (const uint8_t *)chunks[j], ec_matrix[i * ec_k + j],
+						   len);
+		}
+	}
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Multiply two elements of GF(2^8)
+ *
+ * @param a - the first element
+ * @param b - the second element
+ * @return uint8_t : the product
+ */
+
+uint8_t bfsErasureCode::gfMul(uint8_t a, uint8_t b) {
+	if ((a == 0) || (b == 0)) {
+		return (0);
+	}
+	return (gfExp[gfLog[a] + gfLog[b]]);
+}
+
+/**
+ * @brief Return the multiplicative inverse of a (non-zero) element
+ *
+ * @param a - the element to invert
+ * @return uint8_t : the inverse (0 for 0)
+ */
+
+uint8_t bfsErasureCode::gfInv(uint8_t a) {
+	if (a == 0) {
+		return (0);
+	}
+	return (gfExp[255 - gfLog[a]]);
+}
+
+/**
+ * @brief Add c times the source region into the destination (dst ^= c * src)
+ *
+ * @param dst - the destination region
+ * @param src - the source region
+ * @param c - the coefficient to multiply by
+ * @param len - the length of the regions
+ * @return none
+ */
+
+void bfsErasureCode::gfMulRegionXor(uint8_t *dst, const uint8_t *src,
+									uint8_t c, size_t len) {
+
+	// Local variables
+	const uint8_t *row = gfMulTable[c];
+	size_t i = 0;
+
+	// Nothing to add for zero coefficients
+	if (c == 0) {
+		return;
+	}
+
+#ifdef BFS_EC_SSSE3
+	// Use the shuffle kernel for the bulk of the region
+	if (simdEnabled && simdAvailable()) {
+		uint8_t lo[16], hi[16];
+		for (uint8_t x = 0; x < 16; x++) {
+			lo[x] = row[x];
+			hi[x] = row[(uint8_t)(x << 4)];
+		}
+		i = gf_mul_region_xor_ssse3(dst, src, lo, hi, len);
+	}
+#endif
+
+	// Do the rest with the multiplication table
+	for (; i < len; i++) {
+		dst[i] ^= row[src[i]];
+	}
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Check if the SIMD region kernel can be used on this CPU
+ *
+ * @param none
+ * @return bool : true if available, false otherwise
+ */
+
+bool bfsErasureCode::simdAvailable(void) {
+#ifdef BFS_EC_SSSE3
+	static int ssse3 = -1;
+	if (ssse3 == -1) {
+		ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	}
+	return (ssse3 == 1);
+#else
+	return (false);
+#endif
+}
+
+//
+// Private class functions
+
+/**
+ * @brief Setup the log/exp and multiplication tables (once)
+ *
+ * @param none
+ * @return none
+ */
+
+void bfsErasureCode::initTables(void) {
+
+	// Local variables
+	uint32_t i, j, x = 1;
+
+	// Only do this once
+	if (tablesInitialized) {
+		return;
+	}
+
+	// Walk the powers of the generator
+	for (i = 0; i < 255; i++) {
+		gfExp[i] = gfExp[i + 255] = (uint8_t)x;
+		gfLog[x] = (uint8_t)i;
+		x <<= 1;
+		if (x & 0x100) {
+			x ^= BFS_GF_POLY;
+		}
+	}
+	gfLog[0] = 0;
+
+	// Now fill in the multiplication table
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j++) {
+			gfMulTable[i][j] = gfMul((uint8_t)i, (uint8_t)j);
+		}
+	}
+	tablesInitialized = true;
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Invert an n x n matrix over GF(2^8) in place (Gauss-Jordan)
+ *
+ * @param mat - the matrix (row major), replaced with its inverse
+ * @param n - the dimension of the matrix
+ * @return int : 0 is success, -1 is failure (singular)
+ */
+
+int bfsErasureCode::invertMatrix(vector<uint8_t> &mat, uint32_t n) {
+
+	// Local variables
+	vector<uint8_t> inv(n * n, 0);
+	uint32_t r, c, p;
+	uint8_t f;
+
+	// Start with the identity, reduce mat to it
+	for (r = 0; r < n; r++) {
+		inv[r * n + r] = 1;
+	}
+	for (c = 0; c < n; c++) {
+
+		// Find a pivot, swap it into place
+		for (p = c; (p < n) && (mat[p * n + c] == 0); p++)
+			;
+		if (p == n) {
+			return (-1);
+		}
+		if (p != c) {
+			for (r = 0; r < n; r++) {
+				swap(mat[p * n + r], mat[c * n + r]);
+				swap(inv[p * n + r], inv[c * n + r]);
+			}
+		}
+
+		// Scale the pivot row, eliminate the column from the others
+		f = gfInv(mat[c * n + c]);
+		for (r = 0; r < n; r++) {
+			mat[c * n + r] = gfMul(mat[c * n + r], f);
+			inv[c * n + r] = gfMul(inv[c * n + r], f);
+		}
+		for (p = 0; p < n; p++) {
+			if ((p == c) || ((f = mat[p * n + c]) == 0)) {
+				continue;
+			}
+			for (r = 0; r < n; r++) {
+				mat[p * n + r] ^= gfMul(f, mat[c * n + r]);
+				inv[p * n + r] ^= gfMul(f, inv[c * n + r]);
+			}
+		}
+	}
+	mat = inv;
+
+	// Return successfully
+	return (0);
+}
+
+#ifdef __BFS_DEBUG_NO_ENCLAVE
+/**
+ * @brief Perform a unit test on the erasure code, encode random stripes then
+ * erase up to m random chunks and check the rebuilt stripe matches (with the
+ * scalar and SIMD kernels).
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsErasureCode::bfsErasureCodeUtest(void) {
+
+	// Local variables
+	uint32_t k, m, i, e, it;
+	size_t len;
+	bool simd;
+	int ret;
+
+	for (it = 0; it < BFS_EC_UNIT_TEST_ITERATIONS; it++) {
+
+		// Pick a code and chunk length (exercising the kernel tails)
+		k = get_random_value(1, 10);
+		m = get_random_value(1, 4);
+		len = get_random_value(1, 2) * 4096 + get_random_value(0, 17);
+		simd = (it % 2) == 0;
+		setSimdEnabled(simd);
+		bfsErasureCode ec(k, m);
+		vector<vector<char>> chunks(k + m, vector<char>(len)),
+			orig(k + m, vector<char>(len));
+		vector<char *> ptrs(k + m);
+		bool present[BFS_EC_MAX_CHUNKS];
+
+		// Encode a random stripe, save it
+		for (i = 0; i < k + m; i++) {
+			ptrs[i] = chunks[i].data();
+			present[i] = true;
+		}
+		for (i = 0; i < k; i++) {
+			get_random_data(ptrs[i], (uint32_t)len);
+		}
+		ec.encode(&ptrs[0], &ptrs[k], len);
+		orig = chunks;
+
+		// Erase up to m chunks, rebuild and compare
+		for (e = get_random_value(1, m); e > 0; e--) {
+			i = get_random_value(0, k + m - 1);
+			present[i] = false;
+			memset(ptrs[i], 0xa5, len);
+		}
+		if ((ec.decode(&ptrs[0], present, len)) || (chunks != orig)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Erasure code %u+%u (%s) failed to rebuild stripe.", k,
+					   m, simd ? "simd" : "scalar");
+			setSimdEnabled(true);
+			return (-1);
+		}
+
+		// Make sure too many erasures are refused (once, quietly, as the
+		// refusal is logged as an error)
+		for (i = 0; (it == 0) && (i <= m); i++) {
+			present[i] = false;
+		}
+		disableLogLevels(LOG_ERROR_LEVEL);
+		ret = (it == 0) ? ec.decode(&ptrs[0], present, len) : -1;
+		enableLogLevels(LOG_ERROR_LEVEL);
+		if (ret == 0) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Erasure code %u+%u decoded with %u chunks missing.", k,
+					   m, m + 1);
+			setSimdEnabled(true);
+			return (-1);
+		}
+	}
+	setSimdEnabled(true);
+
+	// Log, return successfully
+	logMessage(BLOCK_LOG_LEVEL,
+			   "Erasure code unit test completed successfully (simd %s).",
+			   simdAvailable() ? "available" : "unavailable");
+	return (0);
+}
+#endif
@@ -0,0 +1,129 @@
+#ifndef BFS_ERASURE_CODE_INCLUDED
+#define BFS_ERASURE_CODE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsErasureCode.h
+//  Description   : This is the class implementing the systematic Reed-Solomon
+//                  (k data + m parity) erasure code used to stripe blocks
+//                  over the devices of the virtual block cluster.  Parity is
+//                  computed over GF(2^8) with a Cauchy coding matrix, so any
+//                  k of the k+m chunks of a stripe recover the data.
+//
+
+// Include files
+#include <stddef.h>
+#include <stdint.h>
+
+// STL-isms
+#include <vector>
+using namespace std;
+
+//
+// Class definitions
+#define BFS_EC_MAX_CHUNKS 255 // The most chunks (data+parity) in a stripe
+#define BFS_EC_UNIT_TEST_ITERATIONS 64 // Random stripes per unit test
+
+//
+// Class Definition
+
+class bfsErasureCode {
+
+public:
+	//
+	// Public Interfaces
+
+	// Constructors and destructors
+
+	bfsErasureCode(uint32_t k, uint32_t m);
+	// Attribute constructor (k data, m parity chunks per stripe)
+
+	virtual ~bfsErasureCode(void) {}
+	// Destructor
+
+	//
+	// Getter and Setter Methods
+
+	// Return the number of data chunks in a stripe
+	uint32_t getDataChunks(void) { return (ec_k); }
+
+	// Return the number of parity chunks in a stripe
+	uint32_t getParityChunks(void) { return (ec_m); }
+
+	//
+	// Class Methods
+
+	void encode(char **data, char **parity, size_t len);
+	// Compute the m parity chunks of the k data chunks
+
+	int decode(char **chunks, const bool *present, size_t len);
+	// Rebuild the missing chunks (k+m, data first) from any k present
+
+	//
+	// Static class methods
+
+	static uint8_t gfMul(uint8_t a, uint8_t b);
+	// Multiply two elements of GF(2^8)
+
+	static uint8_t gfInv(uint8_t a);
+	// Return the multiplicative inverse of a (non-zero) element
+
+	static void gfMulRegionXor(uint8_t *dst, const uint8_t *src, uint8_t c,
+							   size_t len);
+	// Add c times the source region into the destination (dst ^= c * src)
+
+	// Enable/disable the SIMD region kernel (where the CPU supports it)
+	static void setSimdEnabled(bool en) { simdEnabled = en; }
+
+	static bool simdAvailable(void);
+	// Check if the SIMD region kernel can be used on this CPU
+
+#ifdef __BFS_DEBUG_NO_ENCLAVE
+	static int bfsErasureCodeUtest(void);
+	// Perform a unit test on the erasure code
+#endif
+
+private:
+	// Private class methods
+
+	bfsErasureCode(void) {}
+	// Default constructor (prevents creation of an unsized code)
+
+	static void initTables(void);
+	// Setup the log/exp and multiplication tables
+
+	int invertMatrix(vector<uint8_t> &mat, uint32_t n);
+	// Invert an n x n matrix over GF(2^8) in place
+
+	//
+	// Class Data
+
+	uint32_t ec_k;
+	// The number of data chunks in a stripe
+
+	uint32_t ec_m;
+	// The number of parity chunks in a stripe
+
+	vector<uint8_t> ec_matrix;
+	// The m x k Cauchy coefficients generating the parity
+
+	//
+	// Static Class Data
+
+	static bool tablesInitialized;
+	// Flag indicating the tables have been computed
+
+	static bool simdEnabled;
+	// Flag indicating if the SIMD kernel should be used (when available)
+
+	static uint8_t gfLog[256];
+	// The discrete log of each element (generator 2)
+
+	static uint8_t gfExp[510];
+	// The powers of the generator (doubled to skip the modulo)
+
+	static uint8_t gfMulTable[256][256];
+	// The full multiplication table (scalar region kernel)
+};
+
+#endif
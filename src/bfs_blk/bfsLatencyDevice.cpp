@@ -0,0 +1,247 @@
+/**
+ *
+ * @file   bfsLatencyDevice.cpp
+ * @brief  This is the class implementing an in-memory stub device with an
+ *         injected request latency (see the header).
+ *
+ */
+
+/* Include files  */
+#include <string.h>
+#include <unistd.h>
+
+/* Project include files */
+#include <bfsLatencyDevice.h>
+#include <bfs_log.h>
+#include <chrono>
+
+/* Macros */
+
+/* Globals  */
+
+/**
+ * @brief Get the current time (usec) on a monotonic clock
+ *
+ * @param none
+ * @return uint64_t : the time
+ */
+
+static uint64_t latencyTimeUsecs(void) {
+	return ((uint64_t)chrono::duration_cast<chrono::microseconds>(
+				chrono::steady_clock::now().time_since_epoch())
+				.count());
+}
+
+/**
+ * @brief The attribute constructor for the class
+ *
+ * @param did - the device ID of the device
+ * @param blks - the number of blocks in the device
+ * @param usecs - the latency of a request
+ */
+
+bfsLatencyDevice::bfsLatencyDevice(bfs_device_id_t did, uint64_t blks,
+								   uint64_t usecs)
+	: deviceID(did), numBlocks(blks), latency(usecs), nextTag(1),
+	  requests(0) {
+	pthread_mutex_init(&devLock, NULL);
+}
+
+/**
+ * @brief The destructor function for the class
+ *
+ * @param none
+ */
+
+bfsLatencyDevice::~bfsLatencyDevice(void) {
+	pthread_mutex_destroy(&devLock);
+}
+
+/**
+ * @brief Return the number of requests sent to the device
+ *
+ * @param none
+ * @return uint64_t : the number of requests
+ */
+
+uint64_t bfsLatencyDevice::getRequests(void) {
+	uint64_t n;
+	pthread_mutex_lock(&devLock);
+	n = requests;
+	pthread_mutex_unlock(&devLock);
+	return (n);
+}
+
+/**
+ * @brief Get a block from the device (one request)
+ *
+ * @param blk - the block to read into (at its block id)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::getBlock(PBfsBlock &blk) {
+	bfs_block_list_t blks;
+	blks[blk.get_pbid()] = &blk;
+	return (getBlocks(blks));
+}
+
+/**
+ * @brief Get a block from the device (one request)
+ *
+ * @param pbid - the block id
+ * @param blk - the buffer to read into
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::getBlock(bfs_block_id_t pbid, char *blk) {
+	PBfsBlock pblk(blk, BLK_SZ, 0, 0, pbid, this);
+	if (getBlock(pblk)) {
+		return (-1);
+	}
+	memcpy(blk, pblk.getBuffer(), BLK_SZ);
+	return (0);
+}
+
+/**
+ * @brief Put a block into the device (one request)
+ *
+ * @param blk - the block to write (at its block id)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::putBlock(PBfsBlock &blk) {
+	bfs_block_list_t blks;
+	blks[blk.get_pbid()] = &blk;
+	return (putBlocks(blks));
+}
+
+/**
+ * @brief Get the blocks from the device (one request)
+ *
+ * @param blks - the blocks to read into
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::getBlocks(bfs_block_list_t &blks) {
+	return (waitBlocks(getBlocksAsync(blks), blks));
+}
+
+/**
+ * @brief Put the blocks into the device (one request)
+ *
+ * @param blks - the blocks to write
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::putBlocks(bfs_block_list_t &blks) {
+	return (waitBlocks(putBlocksAsync(blks), blks));
+}
+
+/**
+ * @brief Start getting the blocks, completing a latency from now
+ *
+ * @param blks - the blocks to read into
+ * @return bfs_device_tag_t : the tag of the request (0 if failed)
+ */
+
+bfs_device_tag_t bfsLatencyDevice::getBlocksAsync(bfs_block_list_t &blks) {
+	return (startRequest(blks, false));
+}
+
+/**
+ * @brief Start putting the blocks, completing a latency from now
+ *
+ * @param blks - the blocks to write
+ * @return bfs_device_tag_t : the tag of the request (0 if failed)
+ */
+
+bfs_device_tag_t bfsLatencyDevice::putBlocksAsync(bfs_block_list_t &blks) {
+	return (startRequest(blks, true));
+}
+
+/**
+ * @brief Wait for a get/put blocks request to complete (sleeping out what
+ * is left of its latency), then move the blocks
+ *
+ * @param tag - the tag of the request
+ * @param blks - the blocks of the request
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsLatencyDevice::waitBlocks(bfs_device_tag_t tag,
+								 bfs_block_list_t &blks) {
+
+	// Local variables
+	map<bfs_device_tag_t, std::pair<bool, uint64_t>>::iterator it;
+	map<bfs_block_id_t, string>::iterator sit;
+	bfs_block_list_t::iterator bit;
+	uint64_t now, done;
+	bool write;
+
+	// Find the request, wait for it to complete
+	pthread_mutex_lock(&devLock);
+	if ((it = pending.find(tag)) == pending.end()) {
+		pthread_mutex_unlock(&devLock);
+		logMessage(LOG_ERROR_LEVEL, "Latency device [%lu] bad tag [%lu]",
+				   deviceID, tag);
+		return (-1);
+	}
+	write = it->second.first;
+	done = it->second.second;
+	pending.erase(it);
+	pthread_mutex_unlock(&devLock);
+	if ((now = latencyTimeUsecs()) < done) {
+		usleep((useconds_t)(done - now));
+	}
+
+	// Move the blocks
+	pthread_mutex_lock(&devLock);
+	for (bit = blks.begin(); bit != blks.end(); bit++) {
+		if (write) {
+			store[bit->first].assign(bit->second->getBuffer(), BLK_SZ);
+		} else if ((sit = store.find(bit->first)) != store.end()) {
+			memcpy(bit->second->getBuffer(), sit->second.data(), BLK_SZ);
+		} else {
+			memset(bit->second->getBuffer(), 0x0, BLK_SZ);
+		}
+	}
+	pthread_mutex_unlock(&devLock);
+	return (0);
+}
+
+//
+// Private class functions
+
+/**
+ * @brief Start a request (checking its blocks), completing a latency from
+ * now
+ *
+ * @param blks - the blocks of the request
+ * @param write - flag indicating the request is a put
+ * @return bfs_device_tag_t : the tag of the request (0 if failed)
+ */
+
+bfs_device_tag_t bfsLatencyDevice::startRequest(bfs_block_list_t &blks,
+												bool write) {
+
+	// Local variables
+	bfs_block_list_t::iterator bit;
+	bfs_device_tag_t tag;
+
+	// Check the blocks
+	for (bit = blks.begin(); bit != blks.end(); bit++) {
+		if ((bit->first >= numBlocks) || (bit->second == NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "Latency device [%lu] bad block [%lu]",
+					   deviceID, bit->first);
+			return (0);
+		}
+	}
+
+	// Start the request
+	pthread_mutex_lock(&devLock);
+	tag = nextTag++;
+	pending[tag] = std::make_pair(write, latencyTimeUsecs() + latency);
+	requests++;
+	pthread_mutex_unlock(&devLock);
+	return (tag);
+}
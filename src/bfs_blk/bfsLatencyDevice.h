@@ -0,0 +1,130 @@
+#ifndef BFS_LATENCY_DEVICE_INCLUDED
+#define BFS_LATENCY_DEVICE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsLatencyDevice.h
+//  Description   : This is the class describing an in-memory stub device
+//                  with an injected request latency, for benchmarking the
+//                  block cluster without a network.  A request is started
+//                  when sent and completes a fixed latency later, so
+//                  requests sent to several devices before waiting on them
+//                  overlap (as on real devices).
+//
+
+// Include files
+#include <pthread.h>
+
+// STL-isms
+#include <map>
+#include <string>
+using namespace std;
+
+// Project Includes
+#include <bfsDevice.h>
+#include <bfs_block.h>
+
+//
+// Class definitions
+
+//
+// Class Definition
+
+class bfsLatencyDevice : public bfsDevice {
+
+public:
+	//
+	// Public Interfaces
+
+	// Constructors and destructors
+
+	bfsLatencyDevice(bfs_device_id_t did, uint64_t blks, uint64_t usecs);
+	// Attribute constructor (blocks in the device, latency of a request)
+
+	virtual ~bfsLatencyDevice(void);
+	// Destructor
+
+	//
+	// Getter and Setter Methods
+
+	// Return the device ID
+	virtual bfs_device_id_t getDeviceIdenfier(void) { return (deviceID); }
+
+	// Return the number of blocks in the storage
+	virtual uint64_t getNumBlocks(void) { return (numBlocks); }
+
+	// Set the security association (none needed)
+	virtual void setSecurityAssociation(bfsSecAssociation *sa) { (void)sa; }
+
+	uint64_t getRequests(void);
+	// Return the number of requests sent to the device
+
+	//
+	// Class Methods
+
+	virtual int bfsDeviceInitialize(void) { return (0); }
+	// Initialize the device
+
+	virtual int bfsDeviceUninitialize(void) { return (0); }
+	// De-initialze the device
+
+	virtual int getBlock(PBfsBlock &blk);
+	virtual int getBlock(bfs_block_id_t pbid, char *blk);
+	// Get a block from the device (at block id)
+
+	virtual int putBlock(PBfsBlock &blk);
+	// Put a block into the device
+
+	virtual int getBlocks(bfs_block_list_t &blks);
+	// Get the blocks associated with the IDS
+
+	virtual int putBlocks(bfs_block_list_t &blks);
+	// Put the blocks associated with the following IDs
+
+	virtual bfs_device_tag_t getBlocksAsync(bfs_block_list_t &blks);
+	// Start getting the blocks (completing after the latency)
+
+	virtual bfs_device_tag_t putBlocksAsync(bfs_block_list_t &blks);
+	// Start putting the blocks (completing after the latency)
+
+	virtual int waitBlocks(bfs_device_tag_t tag, bfs_block_list_t &blks);
+	// Wait for a get/put blocks request to complete, then complete it
+
+private:
+	// Private class methods
+
+	bfsLatencyDevice(void);
+	// Default constructor
+
+	bfs_device_tag_t startRequest(bfs_block_list_t &blks, bool write);
+	// Start a request, returning its tag (0 if failed)
+
+	//
+	// Class Data
+
+	bfs_device_id_t deviceID;
+	// The device ID
+
+	uint64_t numBlocks;
+	// The number of blocks in the device
+
+	uint64_t latency;
+	// The latency of a request (usecs)
+
+	map<bfs_block_id_t, string> store;
+	// The blocks written to the device (the others are zeros)
+
+	map<bfs_device_tag_t, std::pair<bool, uint64_t>> pending;
+	// The requests started (write flag, completion time in usecs)
+
+	bfs_device_tag_t nextTag;
+	// The tag of the next request
+
+	uint64_t requests;
+	// The number of requests sent to the device
+
+	pthread_mutex_t devLock;
+	// The lock protecting the blocks and requests
+};
+
+#endif
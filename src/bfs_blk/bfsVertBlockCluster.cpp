@@ -8,7 +8,10 @@
  */
 
 /* Include files  */
+#include <errno.h>
+#include <float.h>
 #include <string.h>
+#include <time.h>
 #ifdef __BFS_NONENCLAVE_MODE
 #include <sys/mman.h>
 #endif
@@ -24,6 +27,28 @@
 
 /* Globals  */
 
+/**
+ * @brief Get the current time (usec), for timing the device reads (the
+ * enclave has no clock, so ask the untrusted side for it)
+ *
+ * @param none
+ * @return double : the time
+ */
+
+static double blkTimeUsecs(void) {
+	double t = 0.0;
+#ifdef __BFS_ENCLAVE_MODE
+	if (ocall_get_time2(&t) != SGX_SUCCESS) {
+		return (0.0);
+	}
+#else
+	t = std::chrono::duration<double, std::micro>(
+			std::chrono::high_resolution_clock::now().time_since_epoch())
+			.count();
+#endif
+	return (t);
+}
+
 //
 // Class Data
 
@@ -41,6 +66,11 @@ bfsVertBlockCluster::~bfsVertBlockCluster(void) {
 
 	// De initialize the cluser object
 	bfsVertBlockClusterUninitialize();
+	pthread_cond_destroy(&ioCond);
+	pthread_cond_destroy(&wbCond);
+	pthread_mutex_destroy(&wbMutex);
+	pthread_mutex_destroy(&loadMutex);
+	pthread_mutex_destroy(&ecMutex);
 
 	// Return, no return code
 	return;
@@ -57,7 +87,10 @@ int bfsVertBlockCluster::readBlock_helper(bfs_vbid_t vbid, PBfsBlock **pblk) {
 	// Local variables
 	bfsDevice *dev;
 	bfs_block_id_t pbid;
+	PBfsBlock *evicted = NULL;
+	uint64_t turn, evturn = 0;
 	bool cache_hit = false;
+	int ret;
 
 	// #ifndef __BFS_ENCLAVE_MODE
 	// 	double vbc_start_time = 0.0;
@@ -81,7 +114,6 @@ int bfsVertBlockCluster::readBlock_helper(bfs_vbid_t vbid, PBfsBlock **pblk) {
 	// Check the block cache for the block first, otherwise get the block from
 	// the device and copy to the vblock object. Note that here we do the
 	// untrusted->trusted memory copy from the pblock into the vblock
-	PBfsBlock *cached_blk = NULL;
 	CacheableObject *obj;
 
 	// #ifndef __BFS_ENCLAVE_MODE
@@ -101,10 +133,30 @@ int bfsVertBlockCluster::readBlock_helper(bfs_vbid_t vbid, PBfsBlock **pblk) {
 	// 	double vbc_read_start_time = vbc_buf_end_time;
 	// #endif
 
-	// cache on vbids now and get the pbid object
-	if (!bfsUtilLayer::cache_enabled() ||
-		(bfsUtilLayer::cache_enabled() &&
-		 !(obj = blk_cache.checkCache(intCacheKey(vbid), 1, false)))) {
+	// cache on vbids now and get the pbid object (the flusher may be walking
+	// the cache, so hold it off while looking). On a miss, wait out the I/O
+	// queued on the block ahead of the read (e.g., the write of an evicted
+	// copy), which may have cached it again meanwhile
+	obj = NULL;
+	pthread_mutex_lock(&wbMutex);
+	if (bfsUtilLayer::cache_enabled()) {
+		obj = blk_cache.checkCache(intCacheKey(vbid), 1, false);
+	}
+	if (obj == NULL) {
+		turn = queueBlockIO(vbid, false);
+		waitBlockIO(vbid, turn);
+		if (bfsUtilLayer::cache_enabled()) {
+			obj = blk_cache.checkCache(intCacheKey(vbid), 1, false);
+		}
+		if (obj != NULL) {
+			doneBlockIO(vbid, false);
+		}
+	}
+	if ((obj != NULL) && (raPending.erase(vbid) > 0)) {
+		raStats.hits++;
+	}
+	pthread_mutex_unlock(&wbMutex);
+	if (obj == NULL) {
 		// pblk = new PBfsBlock(NULL, BLK_SZ, 0, 0, pbid, dev);
 
 		// if it wasnt cached, do the getblock normally and then (potentially)
@@ -125,27 +177,48 @@ int bfsVertBlockCluster::readBlock_helper(bfs_vbid_t vbid, PBfsBlock **pblk) {
 
 		// set back pointer so block can be flushed appropriately
 		(*pblk)->set_rd(dev);
+		(*pblk)->set_vbid(vbid);
 
-		if (dev->getBlock(pbid, (*pblk)->getBuffer())) {
-			logMessage(
-				LOG_ERROR_LEVEL,
-				"Failed getting virtual block [%lu] from physical [%lu/%d]",
-				vbid, pbid, dev->getDeviceIdenfier());
-			return (BFS_FAILURE);
+		// Read from the least loaded replica, falling back to the others
+		ret = readReplicas(vbid, **pblk, NULL);
+		if (ret && (ecCode != NULL)) {
+			ret = readDegraded(vbid, (*pblk)->getBuffer());
 		}
 
-		if (bfsUtilLayer::cache_enabled() &&
-			(obj = blk_cache.insertCache(intCacheKey(vbid), 1, *pblk))) {
-			// sanity check
-			if (!(cached_blk = dynamic_cast<PBfsBlock *>(obj))) {
-				logMessage(LOG_ERROR_LEVEL, "Failed cast for block ptr\n");
-				return BFS_FAILURE;
+		// Cache the block, unless a writer cached it while it was being read
+		// (its copy is the newer one, so drop the one read). The I/O queued
+		// behind the read on a block it evicts waits for the evicted write.
+		pthread_mutex_lock(&wbMutex);
+		if ((ret == 0) && bfsUtilLayer::cache_enabled()) {
+			obj = blk_cache.checkCache(intCacheKey(vbid), 1, false);
+			if (obj == NULL) {
+				obj = blk_cache.insertCache(intCacheKey(vbid), 1, *pblk);
+				if ((obj == *pblk) ||
+					!(evicted = dynamic_cast<PBfsBlock *>(obj))) {
+					obj = NULL;
+				} else {
+					evturn = queueBlockIO(evicted->get_vbid(), true);
+				}
+			} else {
+				delete *pblk;
+				if (!(*pblk = dynamic_cast<PBfsBlock *>(obj))) {
+					ret = -1;
+				}
+				cache_hit = true;
 			}
+		}
+		doneBlockIO(vbid, false);
+		pthread_mutex_unlock(&wbMutex);
 
-			if (cached_blk != *pblk) {
-				flush_blk(cached_blk, vbid);
-				delete cached_blk;
-			}
+		// (a failed write of the evicted block is reported by the next
+		// flush, the read itself is fine)
+		if (evicted != NULL) {
+			flushEvicted(evicted, evturn);
+		}
+		if (ret) {
+			logMessage(LOG_ERROR_LEVEL, "Failed reading virtual block [%lu]",
+					   vbid);
+			return (BFS_FAILURE);
 		}
 	} else {
 		// otherwise, the block was cached
@@ -284,8 +357,11 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 	// Local variables
 	bfsDevice *dev;
 	bfs_block_id_t pbid;
-	CacheableObject *obj;
-	bool cache_hit = false;
+	CacheableObject *obj = NULL;
+	PBfsBlock *evicted = NULL;
+	uint64_t turn = 0, evturn = 0;
+	bool cache_hit = false, write_back = false, sync, failed = false;
+	size_t dirty = 0;
 
 	// #ifdef __BFS_ENCLAVE_MODE
 	// 	double vbc_start_time = 0.0;
@@ -308,6 +384,7 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 
 	// set back pointer so block can be flushed appropriately
 	pblk->set_rd(dev);
+	pblk->set_vbid(vbid);
 
 	// Put the block in the cache, and if write-through flag included then also
 	// synch with the device. For now we just copy the virtual block data into a
@@ -324,19 +401,47 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 
 	// if (bfsUtilLayer::cache_enabled() &&
 	// 	(obj = blk_cache.insertCache(intCacheKey(pbid), pblk))) {
-	if (bfsUtilLayer::cache_enabled() &&
-		(obj = blk_cache.insertCache(intCacheKey(vbid), 1, pblk))) {
-		// sanity check
-		if (!(cached_blk = dynamic_cast<PBfsBlock *>(obj))) {
-			logMessage(LOG_ERROR_LEVEL, "Failed cast for block ptr\n");
-			return BFS_FAILURE;
+	// Blocks not written through are tracked until flushed (with write-back
+	// caching, by the flusher), synchronous writes always go through (queued
+	// on the block, after any write of an older copy)
+	sync = !bfsUtilLayer::cache_enabled() || (flags & _bfs__O_SYNC);
+	pthread_mutex_lock(&wbMutex);
+	trimPending.erase(vbid);
+	if (bfsUtilLayer::cache_enabled()) {
+		obj = blk_cache.insertCache(intCacheKey(vbid), 1, pblk);
+		if (raPending.erase(vbid) > 0) {
+			raStats.waste++;
+		}
+		write_back = wbRunning && !(flags & _bfs__O_SYNC);
+		if (!(flags & _bfs__O_SYNC)) {
+			dirtyBlocks.insert(vbid);
+			dirty = dirtyBlocks.size();
+		} else {
+			dirtyBlocks.erase(vbid);
 		}
+	}
 
-		if (cached_blk != pblk) {
-			flush_blk(cached_blk, vbid);
+	// (an older copy of this block being replaced needn't be written, an
+	// evicted block is written in its turn)
+	if ((obj != NULL) && (obj != pblk)) {
+		if (!(cached_blk = dynamic_cast<PBfsBlock *>(obj))) {
+			logMessage(LOG_ERROR_LEVEL, "Failed cast for block ptr\n");
+			failed = true;
+		} else if (cached_blk->get_vbid() != vbid) {
+			evicted = cached_blk;
+			evturn = queueBlockIO(evicted->get_vbid(), true);
+		} else {
 			delete cached_blk;
 		}
-	} else {
+	}
+	if (sync) {
+		turn = queueBlockIO(vbid, true);
+	}
+	pthread_mutex_unlock(&wbMutex);
+	if ((evicted != NULL) && (flushEvicted(evicted, evturn))) {
+		failed = true;
+	}
+	if (obj == NULL) {
 		// either it was in cache (and overwrote), or it wasnt in cache but
 		// there was space to insert; in either case, defer merkle update unless
 		// its a synchronous write (which for now they all are; see below)
@@ -346,7 +451,13 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 	}
 
 	// if no cache or it's a synchronous write, just do the write to device
-	if (!bfsUtilLayer::cache_enabled() || (flags & _bfs__O_SYNC)) {
+	// (even with write-back caching, only the other writes are deferred)
+	if (write_back) {
+		if (dirty >= (size_t)bfsUtilLayer::getUtilLayerCacheSizeLimit() *
+						 bfsBlockLayer::getDirtyHighWatermark() / 100) {
+			pthread_cond_signal(&wbCond);
+		}
+	} else if (sync) {
 		// #ifdef __BFS_ENCLAVE_MODE
 		// 		double vbc_buf_end_time = 0.0;
 
@@ -363,13 +474,28 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 		// 		double vbc_read_start_time = vbc_buf_end_time;
 		// #endif
 
-		if (dev->putBlock(*pblk)) {
+		// (uncached blocks are released after the write, so can be consumed)
+		pthread_mutex_lock(&wbMutex);
+		waitBlockIO(vbid, turn);
+		pthread_mutex_unlock(&wbMutex);
+		if ((!failed) &&
+			(putReplicas(vbid, *pblk, !bfsUtilLayer::cache_enabled()))) {
 			logMessage(
 				LOG_ERROR_LEVEL,
 				"Failed putting virtual block [%lu] from physical [%lu/%d]",
 				vbid, pblk->get_pbid(), dev->getDeviceIdenfier());
+			failed = true;
+		}
+		pthread_mutex_lock(&wbMutex);
+		if (failed && bfsUtilLayer::cache_enabled()) {
+			dirtyBlocks.insert(vbid);
+		}
+		doneBlockIO(vbid, true);
+		pthread_mutex_unlock(&wbMutex);
+		if (failed) {
 			return (-1);
 		}
+		pblk->set_dirty(false);
 
 		// #ifdef __BFS_ENCLAVE_MODE
 		// 		double vbc_read_end_time = 0.0;
@@ -385,6 +511,9 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 		// 		}
 		// #endif
 	}
+	if (failed) {
+		return (BFS_FAILURE);
+	}
 
 	// Return sucesfully (the buffer containing the data)
 	logMessage(BLOCK_VRBLOG_LEVEL,
@@ -451,10 +580,16 @@ int bfsVertBlockCluster::writeBlock_helper(bfs_vbid_t vbid, PBfsBlock *pblk,
 // }
 
 /**
- * @brief Read a set of blocks of data from the cluster
+ * @brief Read a set of blocks of data from the cluster.  The blocks are
+ * grouped by device and the per-device requests are all sent before any of
+ * the responses are waited on, so the devices service them concurrently.
+ * Blocks on devices that fail are read from their other replicas, or rebuilt
+ * from the rest of their stripes if erasure coded.  This goes around the
+ * block cache (after flushing any dirty blocks to the devices, and waiting
+ * out the I/O already queued on the blocks).
  *
  * @param blks - the set of blocks to read (and places to put data)
- * @return the block or NULL if failure
+ * @return int : 0 is success, -1 is failure
  */
 
 int bfsVertBlockCluster::readBlocks(bfs_vblock_list_t &blks) {
@@ -466,29 +601,91 @@ int bfsVertBlockCluster::readBlocks(bfs_vblock_list_t &blks) {
 	map<bfsDevice *, bfs_block_list_t> dev_blocks;
 	map<bfsDevice *, bfs_block_list_t>::iterator bit;
 	map<bfs_vbid_t, std::pair<bfsDevice *, bfs_block_id_t>> virt_phys_map;
+	map<bfs_vbid_t, uint64_t> turns;
+	set<bfsDevice *> failed;
+	PBfsBlock *pblk;
+	int ret = 0;
+
+	// Make sure the devices have the latest copies of the blocks
+	if (flushDirty(0, true)) {
+		return (-1);
+	}
+	pthread_mutex_lock(&wbMutex);
+	for (it = blks.begin(); it != blks.end(); it++) {
+		turns[it->first] = queueBlockIO(it->first, false);
+	}
+	for (it = blks.begin(); it != blks.end(); it++) {
+		waitBlockIO(it->first, turns[it->first]);
+	}
+	pthread_mutex_unlock(&wbMutex);
 
-	// Walk the block list and find the devices and blocks they have. Also map
+	// Walk the block list and find the devices and blocks they have (the
+	// least loaded replica, counting the blocks already assigned). Also map
 	// the virtual->physical block so that we can trace later when allocating
 	// the virtual block objects
+	pthread_mutex_lock(&loadMutex);
 	for (it = blks.begin(); it != blks.end(); it++) {
-		getPhyBlockAddr(it->first, dev, block);
+		if (getReplicaAddr(it->first, selectReadReplica(it->first), dev,
+						   block)) {
+			ret = -1;
+			break;
+		}
+		devLoad[dev].inflight++;
 		dev_blocks[dev][block] = new PBfsBlock(NULL, BLK_SZ, 0, 0, block, dev);
 		virt_phys_map[it->first] = std::make_pair(dev, block);
 	}
+	if (ret != 0) {
+		for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+			devLoad[bit->first].inflight -= (uint32_t)bit->second.size();
+		}
+	}
+	pthread_mutex_unlock(&loadMutex);
 
-	// Now walk the list of devices to send requests to
-	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
-		bit->first->getBlocks(bit->second);
+	// Fan out the requests to all of the devices, then join on them (the
+	// blocks of devices that fail are read again below)
+	if (ret == 0) {
+		dispatchBlocks(dev_blocks, false, &failed);
+	}
+
+	// Now move the physical block data into the virtual blocks for the fs
+	// layer (reading those lost with a device from the other replicas, or
+	// rebuilding them from the rest of their stripes)
+	for (auto vit = blks.begin(); (ret == 0) && (vit != blks.end()); vit++) {
+		if (virt_phys_map.find(vit->first) == virt_phys_map.end()) {
+			continue;
+		}
+		dev = virt_phys_map[vit->first].first;
+		pblk = dev_blocks[dev][virt_phys_map[vit->first].second];
+		if ((failed.find(dev) != failed.end()) &&
+			(readReplicas(vit->first, *pblk, &failed)) &&
+			((ecCode == NULL) ||
+			 (readDegraded(vit->first, pblk->getBuffer())))) {
+			logMessage(LOG_ERROR_LEVEL, "Failed reading virtual block [%lu]",
+					   vit->first);
+			ret = -1;
+			break;
+		}
+#ifdef __BFS_ENCLAVE_MODE
+		blks[vit->first]->setData(pblk->getBuffer(), BLK_SZ);
+#else
+		// (same memory outside the enclave, so just hand over the data)
+		blks[vit->first]->swapData(*pblk);
+#endif
 	}
 
-	// Now copy the physical blocks into virtual blocks for the fs layer
-	for (auto vit = blks.begin(); vit != blks.end(); vit++) {
-		if (virt_phys_map.find(vit->first) != virt_phys_map.end())
-			blks[vit->first]->setData(
-				dev_blocks[virt_phys_map[vit->first].first]
-						  [virt_phys_map[vit->first].second]
-							  ->getBuffer(),
-				BLK_SZ);
+	// Release the physical blocks (and the turns on the blocks)
+	pthread_mutex_lock(&wbMutex);
+	for (it = blks.begin(); it != blks.end(); it++) {
+		doneBlockIO(it->first, false);
+	}
+	pthread_mutex_unlock(&wbMutex);
+	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+		for (auto pit = bit->second.begin(); pit != bit->second.end(); pit++) {
+			delete pit->second;
+		}
+	}
+	if (ret) {
+		return (-1);
 	}
 
 	// Log and return successfully
@@ -497,31 +694,61 @@ int bfsVertBlockCluster::readBlocks(bfs_vblock_list_t &blks) {
 }
 
 /**
- * @brief Write a set of blocks to the cluster
+ * @brief Write a set of blocks to the cluster (the per-device requests are
+ * sent concurrently, see readBlocks), after the I/O already queued on the
+ * blocks.  Cached copies of the blocks are refreshed with the written data.
  *
- * @param blks - the list of blocks to read
- * @return the block or NULL if failure
+ * @param blks - the list of blocks to write
+ * @return int : 0 is success, -1 is failure
  */
 
 int bfsVertBlockCluster::writeBlocks(bfs_vblock_list_t &blks) {
 
 	// Local variables
 	bfs_vblock_list_t::iterator it;
-	bfs_block_id_t block;
-	bfsDevice *dev;
-	map<bfsDevice *, bfs_block_list_t> dev_blocks;
-	map<bfsDevice *, bfs_block_list_t>::iterator bit;
+	map<bfs_vbid_t, char *> vblks;
+	map<bfs_vbid_t, uint64_t> turns;
+	PBfsBlock *cached;
+	int ret;
 
-	// Walk the block list and find the devices and blocks they have
+	// Flush the dirty blocks first (so they don't overwrite these later)
+	if (flushDirty(0, true)) {
+		return (-1);
+	}
+
+	// Write out the blocks (no longer to be trimmed)
+	pthread_mutex_lock(&wbMutex);
+	for (it = blks.begin(); it != blks.end(); it++) {
+		vblks[it->first] = it->second->getBuffer();
+		trimPending.erase(it->first);
+		turns[it->first] = queueBlockIO(it->first, true);
+	}
 	for (it = blks.begin(); it != blks.end(); it++) {
-		getPhyBlockAddr(it->first, dev, block);
-		dev_blocks[dev][block] =
-			new PBfsBlock(it->second->getBuffer(), BLK_SZ, 0, 0, block, dev);
+		waitBlockIO(it->first, turns[it->first]);
 	}
+	pthread_mutex_unlock(&wbMutex);
+	ret = writeVirtBlocks(vblks);
 
-	// Now walk the list of devices to send requests to
-	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
-		bit->first->putBlocks(bit->second);
+	// Refresh any cached copies of the blocks (else reads return old data)
+	pthread_mutex_lock(&wbMutex);
+	for (it = blks.begin(); it != blks.end(); it++) {
+		doneBlockIO(it->first, true);
+		if (ret) {
+			continue;
+		}
+		cached = dynamic_cast<PBfsBlock *>(
+			blk_cache.checkCache(intCacheKey(it->first), 1, false, false));
+		if (cached != NULL) {
+			cached->setData(it->second->getBuffer(), BLK_SZ);
+			cached->set_dirty(false);
+		}
+		if (raPending.erase(it->first) > 0) {
+			raStats.waste++;
+		}
+	}
+	pthread_mutex_unlock(&wbMutex);
+	if (ret) {
+		return (-1);
 	}
 
 	// Log and return successfully
@@ -529,24 +756,182 @@ int bfsVertBlockCluster::writeBlocks(bfs_vblock_list_t &blks) {
 	return (0);
 }
 
-// /**
-//  * @brief Release a previously allocated block
-//  *
-//  * @param blkid - the virtual block ID to deallocate
-//  * @return the block or NULL if failure
-//  */
+/**
+ * @brief Write all dirty cached blocks to the devices, returning once they
+ * (and any the flusher is writing) are there and the devices have made them
+ * durable.  This is the barrier for write-back caching (e.g., fsync), one
+ * flush per device rather than a sync per block.
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::flushBlocks(void) {
+	if (flushDirty(0, true)) {
+		return (-1);
+	}
 
-// int bfsVertBlockCluster::deallocBlock(bfs_vbid_t id) {
+	// Wait out the writes picked before (e.g., by the flusher)
+	pthread_mutex_lock(&wbMutex);
+	while (ioWrites > 0) {
+		pthread_cond_wait(&ioCond, &wbMutex);
+	}
+	pthread_mutex_unlock(&wbMutex);
+	return (flushDevices());
+}
+
+/**
+ * @brief Return the number of cached blocks not yet written to the devices
+ *
+ * @param none
+ * @return size_t : the number of dirty blocks
+ */
 
-// 	// FOR NOW, NOTHING TO DO
-// 	// TODO
+size_t bfsVertBlockCluster::getDirtyCount(void) {
 
-// 	// Return successfully
-// 	return BFS_SUCCESS;
-// }
+	// Local variables
+	size_t dirty;
+
+	pthread_mutex_lock(&wbMutex);
+	dirty = dirtyBlocks.size();
+	pthread_mutex_unlock(&wbMutex);
+	return (dirty);
+}
+
+/**
+ * @brief Note the read of a block, prefetching ahead of sequential streams
+ * (on-demand, as in Linux).  The second sequential read of a stream
+ * prefetches the initial window, and reading the first block of a window
+ * prefetches the next one at twice the size (up to the maximum), so the
+ * stream stays one window ahead of the reader.  Reads outside of the tracked
+ * streams start a new stream (replacing the least recently used).
+ *
+ * @param vbid - the virtual block read
+ * @return none
+ */
+
+void bfsVertBlockCluster::readAhead(bfs_vbid_t vbid) {
+
+	// Local variables
+	uint32_t max = min(bfsBlockLayer::getReadaheadMax(),
+					   (uint32_t)bfsUtilLayer::getUtilLayerCacheSizeLimit() /
+						   BFS_BLK_RA_CACHE_SHARE),
+			 count = 0, i;
+	blk_ra_stream *st = NULL;
+	bfs_vbid_t start = 0;
+
+	// Readahead prefetches into the block cache
+	if ((max == 0) || (!bfsUtilLayer::cache_enabled()) ||
+		(vbid >= maxBlockID)) {
+		return;
+	}
+
+	// Find the stream the read continues (or re-reads)
+	pthread_mutex_lock(&wbMutex);
+	for (i = 0; (st == NULL) && (i < BFS_BLK_RA_STREAMS); i++) {
+		if ((raStreams[i].last != 0) && (vbid + 1 >= raStreams[i].next) &&
+			((vbid <= raStreams[i].next) || (vbid < raStreams[i].ra_end))) {
+			st = &raStreams[i];
+		}
+	}
+
+	// Not sequential, start a new stream in place of the oldest
+	if (st == NULL) {
+		for (st = &raStreams[0], i = 1; i < BFS_BLK_RA_STREAMS; i++) {
+			if (raStreams[i].last < st->last) {
+				st = &raStreams[i];
+			}
+		}
+		st->next = st->ra_end = vbid + 1;
+		st->marker = 0;
+		st->size = 0;
+		st->last = ++raClock;
+		pthread_mutex_unlock(&wbMutex);
+		return;
+	}
+	st->last = ++raClock;
+	if (vbid + 1 == st->next) {
+		pthread_mutex_unlock(&wbMutex);
+		return;
+	}
+	st->next = vbid + 1;
+
+	// Open the initial window, or grow the next one once the marker is read
+	if (st->size == 0) {
+		st->size = min(bfsBlockLayer::getReadaheadMin(), max);
+		start = vbid + 1;
+	} else if (vbid >= st->marker) {
+		st->size = min(st->size * 2, max);
+		start = (st->ra_end > vbid + 1) ? st->ra_end : vbid + 1;
+	}
+	if ((start != 0) && (start < maxBlockID)) {
+		count = (uint32_t)min((bfs_vbid_t)st->size, maxBlockID - start);
+		st->ra_end = start + count;
+		st->marker = start;
+		raStats.windows++;
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Prefetch the window (failures are only lost prefetches)
+	if (count > 0) {
+		prefetchBlocks(start, count);
+	}
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Return a snapshot of the readahead counters
+ *
+ * @param none
+ * @return blk_ra_stats : the counters
+ */
+
+blk_ra_stats bfsVertBlockCluster::getReadaheadStats(void) {
+
+	// Local variables
+	blk_ra_stats stats;
+
+	pthread_mutex_lock(&wbMutex);
+	stats = raStats;
+	pthread_mutex_unlock(&wbMutex);
+	return (stats);
+}
+
+/**
+ * @brief Release a previously allocated block.  Its replicas are trimmed on
+ * the devices (in one request per device) at the next flush, unless it is
+ * written again first.  Erasure coded blocks are not trimmed, the parity of
+ * their stripes still covers them.
+ *
+ * @param id - the virtual block ID to deallocate
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::deallocBlock(bfs_vbid_t id) {
+
+	// Check the address
+	if (id >= maxBlockID) {
+		logMessage(LOG_ERROR_LEVEL, "Deallocating bad virtual block [%lu]",
+				   id);
+		return (-1);
+	}
+
+	// Note the block for trimming
+	if (ecCode == NULL) {
+		pthread_mutex_lock(&wbMutex);
+		trimPending.insert(id);
+		pthread_mutex_unlock(&wbMutex);
+	}
+
+	// Return successfully
+	return (0);
+}
 
 /**
- * @brief The factory function for the cluster
+ * @brief The factory function for the cluster (of the devices in the device
+ * layer manifest)
  *
  * @param none
  * @return pointer to cluster object or NULL on failure
@@ -554,9 +939,30 @@ int bfsVertBlockCluster::writeBlocks(bfs_vblock_list_t &blks) {
 
 bfsVertBlockCluster *bfsVertBlockCluster::bfsClusterFactory(void) {
 
+	// Call the layer manifest
+	bfs_device_list_t manifest;
+	if (bfsDeviceLayer::getDeviceManifest(manifest)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Unable to get device manifest data, aborting");
+		return (NULL);
+	}
+	return (bfsClusterFactory(manifest));
+}
+
+/**
+ * @brief The factory function for a cluster of the given devices (e.g., stub
+ * devices for benchmarking)
+ *
+ * @param devs - the devices of the cluster
+ * @return pointer to cluster object or NULL on failure
+ */
+
+bfsVertBlockCluster *bfsVertBlockCluster::bfsClusterFactory(
+	bfs_device_list_t &devs) {
+
 	// Create the cluster, initalize it
 	bfsVertBlockCluster *cluster = new bfsVertBlockCluster();
-	if (cluster->bfsVertBlockClusterInitialize()) {
+	if (cluster->bfsVertBlockClusterInitialize(devs)) {
 		logMessage(LOG_ERROR_LEVEL,
 				   "Virtual Block Cluster failed to initialize");
 		return (NULL);
@@ -577,7 +983,35 @@ bfsVertBlockCluster *bfsVertBlockCluster::bfsClusterFactory(void) {
  */
 
 bfsVertBlockCluster::bfsVertBlockCluster(void)
-	: clusterState(BFSBLK_UNINITIALIZED), maxBlockID(0), blkAllocTable(NULL) {
+	: clusterState(BFSBLK_UNINITIALIZED), maxBlockID(0), stripeDepth(0),
+	  ecCode(NULL), ioWrites(0), wbRunning(false), wbStop(false),
+	  flushFailed(false), raClock(0), seqDispatch(false), blkAllocTable(NULL) {
+
+	// Local variables
+#ifdef __BFS_ENCLAVE_MODE
+	pthread_mutex_t recursive = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#else
+	pthread_mutexattr_t attr;
+#endif
+
+	// No readahead yet
+	memset(&raStats, 0x0, sizeof(raStats));
+
+	// Setup the write-back and device I/O state (stripe updates may nest,
+	// e.g. degraded reads, the enclave threading library has no mutex
+	// attributes)
+#ifdef __BFS_ENCLAVE_MODE
+	ecMutex = recursive;
+#else
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&ecMutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+	pthread_mutex_init(&wbMutex, NULL);
+	pthread_mutex_init(&loadMutex, NULL);
+	pthread_cond_init(&wbCond, NULL);
+	pthread_cond_init(&ioCond, NULL);
 
 	// De initialize the cluser object
 	bfsVertBlockClusterUninitialize();
@@ -592,14 +1026,14 @@ bfsVertBlockCluster::bfsVertBlockCluster(void)
 /**
  * @brief Initialize the cluster
  *
- * @param none
+ * @param manifest - the devices of the cluster
  * @return int : 0 is success, -1 is failure
  */
 
-int bfsVertBlockCluster::bfsVertBlockClusterInitialize(void) {
+int bfsVertBlockCluster::bfsVertBlockClusterInitialize(
+	bfs_device_list_t &manifest) {
 
 	// Local variavbles
-	bfs_device_list_t manifest;
 	bfs_device_list_t::iterator it;
 
 	// Check the state of the device
@@ -609,19 +1043,69 @@ int bfsVertBlockCluster::bfsVertBlockClusterInitialize(void) {
 		return (-1);
 	}
 
-	// Call the layer manifest
-	if (bfsDeviceLayer::getDeviceManifest(manifest)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Unable to get device manifest data, aborting");
-		return (-1);
-	}
-
 	// Walk the device list printing out detail on the device geometry, saving
 	// IDs
 	for (it = manifest.begin(); it != manifest.end(); it++) {
 		addBlockDevice(it->second);
 	}
 
+	// Interleaving needs a whole stripe unit on every device
+	for (size_t d = 0;
+		 (bfsBlockLayer::getAllocationAlgorithm() == BFSBLK_INTERLEAVE_ALLOC) &&
+		 (d < devices.size());
+		 d++) {
+		if (devices[d]->getNumBlocks() < bfsBlockLayer::getStripeUnit()) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Stripe unit %lu larger than device %lu (%lu blocks)",
+					   bfsBlockLayer::getStripeUnit(),
+					   devices[d]->getDeviceIdenfier(),
+					   devices[d]->getNumBlocks());
+			changeClusterState(BFSBLK_ERRORED);
+			return (-1);
+		}
+	}
+
+	// Make sure each replica of a block can be placed on its own device
+	if (devices.size() < bfsBlockLayer::getReplicaCount()) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Cluster needs %u devices for replication, has %lu",
+				   bfsBlockLayer::getReplicaCount(), devices.size());
+		changeClusterState(BFSBLK_ERRORED);
+		return (-1);
+	}
+
+	// Erasure coded stripes need a device for each of their chunks
+	if (bfsBlockLayer::getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC) {
+		if (devices.size() < bfsBlockLayer::getErasureDataChunks() +
+								 bfsBlockLayer::getErasureParityChunks()) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Cluster needs %u devices for erasure coding, has %lu",
+					   bfsBlockLayer::getErasureDataChunks() +
+						   bfsBlockLayer::getErasureParityChunks(),
+					   devices.size());
+			changeClusterState(BFSBLK_ERRORED);
+			return (-1);
+		}
+		ecCode = new bfsErasureCode(bfsBlockLayer::getErasureDataChunks(),
+									bfsBlockLayer::getErasureParityChunks());
+	}
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Start the flusher for write-back caching (needs the block cache)
+	if (bfsBlockLayer::writeBackEnabled() && !bfsUtilLayer::cache_enabled()) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Write-back needs the block cache enabled, writing through");
+	} else if (bfsBlockLayer::writeBackEnabled()) {
+		wbStop = false;
+		if (pthread_create(&wbThread, NULL, flusherEntry, this) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Failed to start the block flusher");
+			changeClusterState(BFSBLK_ERRORED);
+			return (-1);
+		}
+		wbRunning = true;
+	}
+#endif
+
 	changeClusterState(BFSBLK_READY);
 
 	// Return successfully
@@ -638,11 +1122,32 @@ int bfsVertBlockCluster::bfsVertBlockClusterInitialize(void) {
 
 int bfsVertBlockCluster::bfsVertBlockClusterUninitialize(void) {
 
+	// Stop the flusher, write out whatever it left
+#ifndef __BFS_ENCLAVE_MODE
+	if (wbRunning) {
+		pthread_mutex_lock(&wbMutex);
+		wbStop = true;
+		pthread_cond_signal(&wbCond);
+		pthread_mutex_unlock(&wbMutex);
+		pthread_join(wbThread, NULL);
+		wbRunning = false;
+	}
+#endif
+	flushDirty(0, false);
+	flushDevices();
+
+	// Forget the readahead streams
+	memset(raStreams, 0x0, sizeof(raStreams));
+
 	// Cleanup the devices
 	free(blkAllocTable);
 	blkAllocTable = NULL;
+	delete ecCode;
+	ecCode = NULL;
 	devices.clear();
+	devLoad.clear();
 	maxBlockID = 0;
+	stripeDepth = 0;
 
 	// Change state, return successfully
 	changeClusterState(BFSBLK_UNINITIALIZED);
@@ -685,25 +1190,10 @@ int bfsVertBlockCluster::changeClusterState(bfs_vert_cluster_state_t st) {
 
 int bfsVertBlockCluster::addBlockDevice(bfsDevice *dev) {
 
-	// Local variables
-	bfs_vbid_t i, curBlocks;
-
-	// Add a new device to the cluster
+	// Add a new device to the cluster, remap the blocks
 	devices.push_back(dev);
-	curBlocks = maxBlockID;
-	maxBlockID += dev->getNumBlocks();
-
-	// Resize and initlize the block allocation tables
-	blkAllocTable = (blk_alloc_entry *)realloc(
-		blkAllocTable, maxBlockID * sizeof(blk_alloc_entry));
-	// blkAllocTable =
-	// 	(blk_alloc_entry *)malloc(maxBlockID * sizeof(blk_alloc_entry));
-	for (i = curBlocks; i < maxBlockID; i++) {
-		blkAllocTable[i].used = false;
-		blkAllocTable[i].device = 0;
-		blkAllocTable[i].block = 0;
-		blkAllocTable[i].timestamp = 0;
-	}
+	devLoad[dev] = {0, 0.0, 0};
+	mapBlockDevices();
 
 	// Log and return succesfully
 	logMessage(LOG_INFO_LEVEL,
@@ -713,62 +1203,1125 @@ int bfsVertBlockCluster::addBlockDevice(bfsDevice *dev) {
 }
 
 /**
- * @brief Get the physical address associated with a virtual block address
+ * @brief Compute the physical address of every virtual block and record it
+ * in the allocation table (done when the devices change, so translation is a
+ * table lookup).  The first stripeDepth blocks of every device form a uniform
+ * region.  With interleaved allocation the region is striped round-robin a
+ * stripe unit at a time (so consecutive virtual blocks spread over the
+ * devices), otherwise the devices' regions are concatenated.  Without
+ * replication, anything left over on the devices (all of it for linear
+ * allocation) is concatenated after the region.  With N replicas the region
+ * is a 1/N of the (smallest) device holding the primary copies, replica r of
+ * a block is at the same offset in region r of the r-th next device.  With
+ * erasure coding, each row of k data and m parity chunks occupies n = k+m
+ * consecutive slots of the devices' (smallest) capacity laid out round-robin
+ * (slot q is block q/ndevs of device q%ndevs), so the chunks of a row are on
+ * different devices; the chunks are rotated by the row to spread the parity.
  *
- * @param dev - the new device to add to the cluster
- * @return int : 0 is success, -1 is failure
+ * @param none
+ * @return none
  */
 
-int bfsVertBlockCluster::getPhyBlockAddr(bfs_vbid_t addr, bfsDevice *&dev,
-										 bfs_block_id_t &blk) {
+void bfsVertBlockCluster::mapBlockDevices(void) {
 
 	// Local variables
-	bfs_vbid_t saddr = 0;
+	bfs_vbid_t addr, saddr, unit, stripe, curBlocks;
 	bfs_device_vec_t::iterator it;
-	string message;
-
-	// TODO: brute force, do something more clever later
+	bfs_block_id_t blk;
+	uint32_t i, ndevs = (uint32_t)devices.size();
+	uint32_t reps = bfsBlockLayer::getReplicaCount();
+	bool interleave =
+		(bfsBlockLayer::getAllocationAlgorithm() == BFSBLK_INTERLEAVE_ALLOC);
+	bool erasure =
+		(bfsBlockLayer::getAllocationAlgorithm() == BFSBLK_ERASURE_ALLOC);
+	uint32_t k = bfsBlockLayer::getErasureDataChunks(),
+			 n = k + bfsBlockLayer::getErasureParityChunks();
+
+	// Find the size of the uniform region (the whole stripe units that fit
+	// on every device, or a replica's share of every device)
+	stripeDepth = (ndevs > 0) ? devices[0]->getNumBlocks() : 0;
 	for (it = devices.begin(); it != devices.end(); it++) {
-		if (saddr + (*it)->getNumBlocks() > addr) {
-			dev = (*it);
-			blk = addr - saddr;
-			return (0);
+		stripeDepth = min(stripeDepth, (bfs_vbid_t)(*it)->getNumBlocks());
+	}
+	if (erasure) {
+		stripeDepth = (ndevs >= n) ? stripeDepth : 0;
+	} else if (reps > 1) {
+		stripeDepth = (ndevs >= reps) ? stripeDepth / reps : 0;
+	} else if (!interleave) {
+		stripeDepth = 0;
+	}
+	unit = bfsBlockLayer::getStripeUnit();
+	if (interleave) {
+		stripeDepth -= stripeDepth % unit;
+	}
+
+	// Size the cluster, resize and initialize the block allocation tables
+	curBlocks = maxBlockID;
+	maxBlockID = erasure ? (stripeDepth * ndevs / n) * k : stripeDepth * ndevs;
+	if ((reps == 1) && (!erasure)) {
+		for (it = devices.begin(); it != devices.end(); it++) {
+			maxBlockID += (*it)->getNumBlocks() - stripeDepth;
 		}
-		saddr += (*it)->getNumBlocks();
+	}
+	blkAllocTable = (blk_alloc_entry *)realloc(
+		blkAllocTable, maxBlockID * sizeof(blk_alloc_entry));
+	for (addr = curBlocks; addr < maxBlockID; addr++) {
+		blkAllocTable[addr].used = false;
+		blkAllocTable[addr].device = 0;
+		blkAllocTable[addr].block = 0;
+		blkAllocTable[addr].timestamp = 0;
 	}
 
-	// Throw on failure
-	message = "Unmappable virtual block address " + to_string(addr);
-	throw new bfsBlockError(message);
-}
+	// Map addresses in the uniform region
+	saddr = erasure ? maxBlockID : stripeDepth * ndevs;
+	for (addr = 0; addr < saddr; addr++) {
+		if (erasure) {
+			stripe = (addr / k) * n + ((addr % k) + (addr / k)) % n;
+			blkAllocTable[addr].device = (uint32_t)(stripe % ndevs);
+			blkAllocTable[addr].block = stripe / ndevs;
+		} else if (interleave) {
+			stripe = addr / unit;
+			blkAllocTable[addr].device = (uint32_t)(stripe % ndevs);
+			blkAllocTable[addr].block = (stripe / ndevs) * unit + (addr % unit);
+		} else {
+			blkAllocTable[addr].device = (uint32_t)(addr / stripeDepth);
+			blkAllocTable[addr].block = addr % stripeDepth;
+		}
+	}
 
-/**
- * @brief Gets a reference to the block cache object.
- *
- * @return const BfsCache&: the reference to the block cache
- */
-const BfsCache &bfsVertBlockCluster::get_blk_cache() { return blk_cache; }
+	// Now concatenate the rest of each device (unreplicated only)
+	for (i = 0; (reps == 1) && (!erasure) && (i < ndevs); i++) {
+		for (blk = stripeDepth; blk < devices[i]->getNumBlocks(); blk++) {
+			blkAllocTable[addr].device = i;
+			blkAllocTable[addr].block = blk;
+			addr++;
+		}
+	}
+
+	// Return, no return code
+	return;
+}
 
 /**
- * @brief Cleanup callback for dirty blocks.
+ * @brief Get the physical address associated with a virtual block address
+ * (see mapBlockDevices), this is the primary copy for replicated blocks.
  *
- * @param pblk: the blk to flush
- * @return bool: true if cleanup OK, false otherwise
+ * @param addr - the virtual block address
+ * @param dev - the device holding the block (returned)
+ * @param blk - the physical block on the device (returned)
+ * @return int : 0 is success, -1 is failure
  */
 
-void bfsVertBlockCluster::flush_blk(PBfsBlock *pblk, bfs_vbid_t vbid) {
-	logMessage(BLOCK_VRBLOG_LEVEL, "Flushing block [vbid=%lu, pbid=%lu] ", vbid,
-			   pblk->get_pbid());
+int bfsVertBlockCluster::getPhyBlockAddr(bfs_vbid_t addr, bfsDevice *&dev,
+										 bfs_block_id_t &blk) {
+
+	// Check the address, then just look it up
+	if (addr >= maxBlockID) {
+		logMessage(LOG_ERROR_LEVEL, "Unmappable virtual block address [%lu]",
+				   addr);
+		return (-1);
+	}
+	dev = devices[blkAllocTable[addr].device];
+	blk = blkAllocTable[addr].block;
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Get the physical address of a replica of a virtual block (replica
+ * 0 is the primary copy, see mapBlockDevices)
+ *
+ * @param addr - the virtual block address
+ * @param rep - the replica to get the address of
+ * @param dev - the device holding the replica (returned)
+ * @param blk - the physical block on the device (returned)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::getReplicaAddr(bfs_vbid_t addr, uint32_t rep,
+										bfsDevice *&dev, bfs_block_id_t &blk) {
+
+	// Check the address and replica, then look it up
+	if ((addr >= maxBlockID) || (rep >= bfsBlockLayer::getReplicaCount())) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Unmappable virtual block address [%lu], replica %u", addr,
+				   rep);
+		return (-1);
+	}
+	dev = devices[(blkAllocTable[addr].device + rep) % devices.size()];
+	blk = blkAllocTable[addr].block + rep * stripeDepth;
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Get the physical address of a chunk of an erasure coded stripe, the
+ * data chunks (0..k-1) hold virtual blocks row*k+chunk, the rest are parity
+ * (see mapBlockDevices)
+ *
+ * @param row - the stripe (row of chunks)
+ * @param chunk - the chunk of the stripe
+ * @param dev - the device holding the chunk (returned)
+ * @param blk - the physical block on the device (returned)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::getStripeChunkAddr(bfs_vbid_t row, uint32_t chunk,
+											bfsDevice *&dev,
+											bfs_block_id_t &blk) {
+
+	// Local variables
+	uint32_t k, n;
+	bfs_vbid_t slot;
+
+	// Check the stripe and chunk, then compute the slot
+	if ((ecCode == NULL) ||
+		(row >= maxBlockID / (k = ecCode->getDataChunks())) ||
+		(chunk >= (n = k + ecCode->getParityChunks()))) {
+		logMessage(LOG_ERROR_LEVEL, "Unmappable stripe chunk [%lu/%u]", row,
+				   chunk);
+		return (-1);
+	}
+	slot = row * n + (chunk + row) % n;
+	dev = devices[slot % devices.size()];
+	blk = slot / devices.size();
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Rebuild a block from the rest of its erasure coded stripe (for when
+ * the device holding it is unavailable).  The other chunks are all read, any
+ * k of them that arrive rebuild the block.
+ *
+ * @param vbid - the virtual block to rebuild
+ * @param buf - the buffer to place the block in
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::readDegraded(bfs_vbid_t vbid, char *buf) {
+
+	// Local variables
+	map<bfsDevice *, bfs_block_list_t> dev_blocks;
+	set<bfsDevice *> failed;
+	uint32_t c, k, n;
+	bool present[BFS_EC_MAX_CHUNKS];
+	bfs_block_id_t pbid;
+	int ret = 0;
+
+	// Make sure this is an erasure coded block
+	if ((ecCode == NULL) || (vbid >= maxBlockID)) {
+		logMessage(LOG_ERROR_LEVEL, "Cannot rebuild virtual block [%lu]",
+				   vbid);
+		return (-1);
+	}
+	k = ecCode->getDataChunks();
+	n = k + ecCode->getParityChunks();
+	vector<bfsDevice *> devs(n);
+	vector<PBfsBlock *> chunks(n);
+	vector<char *> ptrs(n);
+
+	// Read the rest of the stripe (not while it is being updated)
+	pthread_mutex_lock(&ecMutex);
+	pthread_mutex_lock(&loadMutex);
+	for (c = 0; c < n; c++) {
+		getStripeChunkAddr(vbid / k, c, devs[c], pbid);
+		chunks[c] = new PBfsBlock(NULL, BLK_SZ, 0, 0, pbid, devs[c]);
+		ptrs[c] = chunks[c]->getBuffer();
+		if (c != vbid % k) {
+			devLoad[devs[c]].inflight++;
+			dev_blocks[devs[c]][pbid] = chunks[c];
+		}
+	}
+	pthread_mutex_unlock(&loadMutex);
+	dispatchBlocks(dev_blocks, false, &failed);
+	pthread_mutex_unlock(&ecMutex);
+
+	// Rebuild the missing chunks, hand back the one asked for
+	for (c = 0; c < n; c++) {
+		present[c] = (c != vbid % k) && (failed.find(devs[c]) == failed.end());
+	}
+	if (ecCode->decode(&ptrs[0], present, BLK_SZ)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Failed rebuilding virtual block [%lu] from its stripe",
+				   vbid);
+		ret = -1;
+	} else {
+		memcpy(buf, ptrs[vbid % k], BLK_SZ);
+		logMessage(BLOCK_VRBLOG_LEVEL,
+				   "Rebuilt virtual block [%lu] from its stripe", vbid);
+	}
+
+	// Release the chunks, return the status
+	for (c = 0; c < n; c++) {
+		delete chunks[c];
+	}
+	return (ret);
+}
+
+/**
+ * @brief Pick the replica of the block to read, the one on the device with
+ * the lowest expected time to service it (the outstanding reads times the
+ * average read time).  Devices with no reads yet are tried first, devices
+ * which have failed (errored) last.  The caller holds the load lock.
+ *
+ * @param addr - the virtual block address
+ * @return uint32_t : the replica to read
+ */
+
+uint32_t bfsVertBlockCluster::selectReadReplica(bfs_vbid_t addr) {
+
+	// Local variables
+	uint32_t rep, best = 0, reps = bfsBlockLayer::getReplicaCount();
+	double cost, bestCost = 0.0;
+	bfsDevice *dev;
+
+	// Walk the replicas, looking for the cheapest
+	for (rep = 0; (reps > 1) && (addr < maxBlockID) && (rep < reps); rep++) {
+		dev = devices[(blkAllocTable[addr].device + rep) % devices.size()];
+		cost = (devLoad[dev].inflight + 1) * devLoad[dev].latency;
+		if (dev->getDeviceState() == BFSDEV_ERRORED) {
+			cost = DBL_MAX;
+		}
+		if ((rep == 0) || (cost < bestCost)) {
+			best = rep;
+			bestCost = cost;
+		}
+	}
+
+	// Return the selected replica
+	return (best);
+}
+
+/**
+ * @brief Record the completion of a read on a device, update the load and
+ * fold the per-block read time into the device's latency average
+ *
+ * @param dev - the device the blocks were read from
+ * @param usecs - the time the read took
+ * @param blocks - the number of blocks read
+ * @return none
+ */
+
+void bfsVertBlockCluster::completeDeviceRead(bfsDevice *dev, double usecs,
+											 uint64_t blocks) {
+
+	// Local variables
+	double sample = usecs / (double)blocks;
+
+	// Update the moving average and the load
+	pthread_mutex_lock(&loadMutex);
+	blk_device_load &load = devLoad[dev];
+	load.latency = (load.reads == 0)
+					   ? sample
+					   : ((1.0 - BFS_BLK_LATENCY_EWMA_ALPHA) * load.latency) +
+							 (BFS_BLK_LATENCY_EWMA_ALPHA * sample);
+	load.inflight -= (uint32_t)min((uint64_t)load.inflight, blocks);
+	load.reads += blocks;
+	pthread_mutex_unlock(&loadMutex);
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Read a block from its replicas, starting at the least loaded and
+ * falling back to the others (skipping errored devices and those known to
+ * have failed, which gain any that fail here).
+ *
+ * @param vbid - the virtual block to read
+ * @param pblk - the block to read into (received in place, its physical
+ * address is left as it was)
+ * @param failed - the devices to skip (and add failures to), if not NULL
+ * @return int : 0 is success, -1 is failure (no replica could be read)
+ */
+
+int bfsVertBlockCluster::readReplicas(bfs_vbid_t vbid, PBfsBlock &pblk,
+									  set<bfsDevice *> *failed) {
+
+	// Local variables
+	uint32_t rep, try_rep, reps = bfsBlockLayer::getReplicaCount();
+	bfs_block_id_t pbid, orig_pbid = pblk.get_pbid();
+	bfsDevice *dev;
+	double start;
+	int ret = -1;
+
+	// Walk the replicas from the cheapest, until one can be read
+	pthread_mutex_lock(&loadMutex);
+	rep = selectReadReplica(vbid);
+	pthread_mutex_unlock(&loadMutex);
+	for (try_rep = 0; (ret != 0) && (try_rep < reps); try_rep++) {
+		if (getReplicaAddr(vbid, (rep + try_rep) % reps, dev, pbid)) {
+			ret = -1;
+			break;
+		}
+		if ((dev->getDeviceState() == BFSDEV_ERRORED) ||
+			((failed != NULL) && (failed->find(dev) != failed->end()))) {
+			continue;
+		}
+		pthread_mutex_lock(&loadMutex);
+		devLoad[dev].inflight++;
+		pthread_mutex_unlock(&loadMutex);
+		start = blkTimeUsecs();
+		pblk.set_pbid(pbid);
+		ret = dev->getBlock(pblk);
+		completeDeviceRead(dev, blkTimeUsecs() - start, 1);
+		if (ret) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed getting virtual block [%lu] from physical "
+					   "[%lu/%d]",
+					   vbid, pbid, dev->getDeviceIdenfier());
+			if (failed != NULL) {
+				failed->insert(dev);
+			}
+
+			// The block may hold a partial response, make it a block again
+			pblk.resetWithAlloc(BLK_SZ, 0x0, BFS_BLOCK_HEADROOM,
+								BFS_BLOCK_TAILROOM);
+		}
+	}
+
+	// Return the status
+	pblk.set_pbid(orig_pbid);
+	return (ret);
+}
+
+/**
+ * @brief Write a block to all of its replicas, the writes to the replicas
+ * are all sent before any are waited on (erasure coded blocks are written
+ * with their stripe's parity).
+ *
+ * @param vbid - the virtual block being written
+ * @param pblk - the block to write (primary physical address)
+ * @param consume - flag indicating the write may consume the block (saves
+ * copying it, for blocks released after the write)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::putReplicas(bfs_vbid_t vbid, PBfsBlock &pblk,
+									 bool consume) {
+
+	// Local variables
+	uint32_t rep, reps = bfsBlockLayer::getReplicaCount();
+	map<bfsDevice *, bfs_block_list_t> dev_blocks;
+	map<bfsDevice *, bfs_block_list_t>::iterator bit;
+	map<bfs_vbid_t, char *> stripe_blocks;
+	bfs_block_id_t pbid;
+	bfsDevice *dev;
+	int ret = 0;
+
+	// Erasure coded, update the stripe
+	if (ecCode != NULL) {
+		stripe_blocks[vbid] = pblk.getBuffer();
+		return (writeStripes(stripe_blocks));
+	}
+
+	// Unreplicated, just write the block (or a copy of it, as the put
+	// consumes it)
+	if (reps == 1) {
+		dev = static_cast<bfsDevice *>(pblk.get_rd());
+		if (consume) {
+			ret = dev->putBlock(pblk);
+		} else {
+			PBfsBlock put(pblk.getBuffer(), BLK_SZ, 0, 0, pblk.get_pbid(),
+						  dev);
+			ret = dev->putBlock(put);
+		}
+		return (ret);
+	}
+
+	// Send the block to each of the replicas, then wait for them all
+	for (rep = 0; rep < reps; rep++) {
+		if (getReplicaAddr(vbid, rep, dev, pbid)) {
+			ret = -1;
+			break;
+		}
+		dev_blocks[dev][pbid] =
+			new PBfsBlock(pblk.getBuffer(), BLK_SZ, 0, 0, pbid, dev);
+	}
+	if ((ret == 0) && (dispatchBlocks(dev_blocks, true))) {
+		logMessage(LOG_ERROR_LEVEL, "Failed putting replicas of block [%lu]",
+				   vbid);
+		ret = -1;
+	}
+	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+		delete bit->second.begin()->second;
+	}
+
+	// Return the status
+	return (ret);
+}
+
+/**
+ * @brief Send per-device block requests concurrently, all of the requests
+ * are sent before any of the responses are waited on (unless the dispatch is
+ * sequential, where each is waited on before the next is sent, the baseline
+ * the fan-out benchmark compares against).  Reads are recorded in the load
+ * of the devices (the caller counts them as in flight).
+ *
+ * @param dev_blocks - the blocks to read/write, by device
+ * @param write - flag indicating the blocks are written (else read)
+ * @param failed - the devices whose requests failed (returned, if not NULL)
+ * @return int : 0 is success, -1 is failure (of any device)
+ */
+
+int bfsVertBlockCluster::dispatchBlocks(
+	map<bfsDevice *, bfs_block_list_t> &dev_blocks, bool write,
+	set<bfsDevice *> *failed) {
+
+	// Local variables
+	map<bfsDevice *, bfs_block_list_t>::iterator bit, sent;
+	map<bfsDevice *, bfs_device_tag_t> dev_tags;
+	double start;
+	int ret = 0;
+
+	// Fan out the requests to all of the devices (or the next one only, if
+	// sequential), then join on those sent
+	for (bit = sent = dev_blocks.begin(); bit != dev_blocks.end();) {
+		start = blkTimeUsecs();
+		do {
+			dev_tags[sent->first] =
+				write ? sent->first->putBlocksAsync(sent->second)
+					  : sent->first->getBlocksAsync(sent->second);
+			sent++;
+		} while ((!seqDispatch) && (sent != dev_blocks.end()));
+		for (; bit != sent; bit++) {
+			if ((dev_tags[bit->first] == 0) ||
+				(bit->first->waitBlocks(dev_tags[bit->first], bit->second))) {
+				logMessage(LOG_ERROR_LEVEL, "Failed %s blocks %s device [%lu]",
+						   write ? "writing" : "reading", write ? "to" : "from",
+						   bit->first->getDeviceIdenfier());
+				if (failed != NULL) {
+					failed->insert(bit->first);
+				}
+				ret = -1;
+			}
+			if (!write) {
+				completeDeviceRead(bit->first, blkTimeUsecs() - start,
+								   bit->second.size());
+			}
+		}
+	}
+
+	// Return the status
+	return (ret);
+}
+
+/**
+ * @brief Write blocks into their erasure coded stripes.  The data chunks of
+ * the stripes not being written are read (rebuilt if their device fails),
+ * the parity is recomputed, then the new data and parity are written out
+ * (one update at a time, as each rewrites the parity of its stripes).
+ *
+ * @param blks - the blocks to write (virtual block to data)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::writeStripes(map<bfs_vbid_t, char *> &blks) {
+
+	// Local variables
+	map<bfs_vbid_t, vector<PBfsBlock *>> rows;
+	map<bfs_vbid_t, vector<PBfsBlock *>>::iterator rit;
+	map<bfsDevice *, bfs_block_list_t> rd_blocks, wr_blocks;
+	set<bfsDevice *> failed;
+	vector<char *> ptrs;
+	uint32_t c, k, n;
+	bfs_block_id_t pbid;
+	bfsDevice *dev;
+	int ret = 0;
+
+	// Place the new data in the chunks of the stripes
+	pthread_mutex_lock(&ecMutex);
+	k = ecCode->getDataChunks();
+	n = k + ecCode->getParityChunks();
+	ptrs.resize(n);
+	for (auto it = blks.begin(); it != blks.end(); it++) {
+		if (getStripeChunkAddr(it->first / k, (uint32_t)(it->first % k), dev,
+							   pbid)) {
+			ret = -1;
+			break;
+		}
+		vector<PBfsBlock *> &chunks = rows[it->first / k];
+		chunks.resize(n, NULL);
+		chunks[it->first % k] =
+			new PBfsBlock(it->second, BLK_SZ, 0, 0, pbid, dev);
+		wr_blocks[dev][pbid] = chunks[it->first % k];
+	}
+
+	// Read the rest of the data, make room for the parity
+	pthread_mutex_lock(&loadMutex);
+	for (rit = rows.begin(); (ret == 0) && (rit != rows.end()); rit++) {
+		for (c = 0; c < n; c++) {
+			if (rit->second[c] != NULL) {
+				continue;
+			}
+			getStripeChunkAddr(rit->first, c, dev, pbid);
+			rit->second[c] = new PBfsBlock(NULL, BLK_SZ, 0, 0, pbid, dev);
+			if (c < k) {
+				devLoad[dev].inflight++;
+				rd_blocks[dev][pbid] = rit->second[c];
+			} else {
+				wr_blocks[dev][pbid] = rit->second[c];
+			}
+		}
+	}
+	pthread_mutex_unlock(&loadMutex);
+	if (ret == 0) {
+		dispatchBlocks(rd_blocks, false, &failed);
+	}
+
+	// Compute the parity of each stripe (rebuilding unreadable data first)
+	for (rit = rows.begin(); (ret == 0) && (rit != rows.end()); rit++) {
+		for (c = 0; c < n; c++) {
+			ptrs[c] = rit->second[c]->getBuffer();
+			if ((c < k) && (blks.find(rit->first * k + c) == blks.end()) &&
+				(failed.find(static_cast<bfsDevice *>(
+					 rit->second[c]->get_rd())) != failed.end()) &&
+				(readDegraded(rit->first * k + c, ptrs[c]))) {
+				ret = -1;
+			}
+		}
+		ecCode->encode(&ptrs[0], &ptrs[k], BLK_SZ);
+	}
+
+	// Write out the new data and parity
+	if ((ret == 0) && (dispatchBlocks(wr_blocks, true))) {
+		ret = -1;
+	}
+
+	// Release the chunks, return the status
+	pthread_mutex_unlock(&ecMutex);
+	for (rit = rows.begin(); rit != rows.end(); rit++) {
+		for (c = 0; c < rit->second.size(); c++) {
+			delete rit->second[c];
+		}
+	}
+	return (ret);
+}
+
+/**
+ * @brief Write blocks to the devices, to all of their replicas or into their
+ * erasure coded stripes (the caller holds the turns on the blocks)
+ *
+ * @param blks - the blocks to write (virtual block to data)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::writeVirtBlocks(map<bfs_vbid_t, char *> &blks) {
+
+	// Local variables
+	map<bfsDevice *, bfs_block_list_t> dev_blocks;
+	map<bfsDevice *, bfs_block_list_t>::iterator bit;
+	bfs_block_id_t block;
+	bfsDevice *dev;
+	uint32_t rep;
+	int ret = 0;
+
+	// Erasure coded blocks are written with their stripes' parity
+	if (ecCode != NULL) {
+		return (writeStripes(blks));
+	}
+
+	// Walk the block list and find the devices and blocks they have (for
+	// each of the replicas)
+	for (auto it = blks.begin(); (ret == 0) && (it != blks.end()); it++) {
+		for (rep = 0; rep < bfsBlockLayer::getReplicaCount(); rep++) {
+			if (getReplicaAddr(it->first, rep, dev, block)) {
+				ret = -1;
+				break;
+			}
+			dev_blocks[dev][block] =
+				new PBfsBlock(it->second, BLK_SZ, 0, 0, block, dev);
+		}
+	}
+
+	// Fan out the requests to all of the devices, then join on them
+	if ((ret == 0) && (dispatchBlocks(dev_blocks, true))) {
+		ret = -1;
+	}
+
+	// Release the physical blocks, return the status
+	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+		for (auto pit = bit->second.begin(); pit != bit->second.end(); pit++) {
+			delete pit->second;
+		}
+	}
+	return (ret);
+}
+
+/**
+ * @brief Write dirty cached blocks out (in virtual block order, so they are
+ * batched per device) until at most target remain dirty.  The writes are
+ * queued on the blocks as they are picked, so they land after any I/O
+ * queued on the blocks earlier and before any queued later.  Blocks that
+ * fail to write are left dirty.
+ *
+ * @param target - the number of dirty blocks to leave
+ * @param report - flag to also fail on (and clear) failed evicted writes
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::flushDirty(size_t target, bool report) {
+
+	// Local variables
+	map<bfs_vbid_t, char *> blks;
+	map<bfs_vbid_t, char *>::iterator it;
+	map<bfs_vbid_t, uint64_t> turns;
+	set<bfs_vbid_t>::iterator dit;
+	vector<PBfsBlock *> copies;
+	PBfsBlock *cached;
+	int ret = 0;
+
+	// Copy out the dirty blocks (the callers may replace them meanwhile),
+	// picking up any failed write of an evicted block since the last flush
+	pthread_mutex_lock(&wbMutex);
+	if (report && flushFailed) {
+		flushFailed = false;
+		ret = -1;
+	}
+	for (dit = dirtyBlocks.begin();
+		 (dirtyBlocks.size() > target) && (dit != dirtyBlocks.end());) {
+		cached = dynamic_cast<PBfsBlock *>(
+			blk_cache.checkCache(intCacheKey(*dit), 1, false, false));
+		if ((cached != NULL) && (cached->is_dirty())) {
+			copies.push_back(new PBfsBlock(cached->getBuffer(), BLK_SZ, 0, 0,
+										   cached->get_pbid(),
+										   cached->get_rd()));
+			blks[*dit] = copies.back()->getBuffer();
+			turns[*dit] = queueBlockIO(*dit, true);
+			cached->set_dirty(false);
+		}
+		dit = dirtyBlocks.erase(dit);
+	}
+	for (it = blks.begin(); it != blks.end(); it++) {
+		waitBlockIO(it->first, turns[it->first]);
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Write them out, putting back any that failed
+	if ((!blks.empty()) && (writeVirtBlocks(blks))) {
+		logMessage(LOG_ERROR_LEVEL, "Failed flushing %lu dirty blocks",
+				   blks.size());
+		ret = -1;
+	}
+	pthread_mutex_lock(&wbMutex);
+	for (it = blks.begin(); it != blks.end(); it++) {
+		cached = (ret == 0) ? NULL
+							: dynamic_cast<PBfsBlock *>(blk_cache.checkCache(
+								  intCacheKey(it->first), 1, false, false));
+		if (cached != NULL) {
+			cached->set_dirty(true);
+			dirtyBlocks.insert(it->first);
+		}
+		doneBlockIO(it->first, true);
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Release the copies, log and return the status
+	for (size_t i = 0; i < copies.size(); i++) {
+		delete copies[i];
+	}
+	if ((ret == 0) && (!blks.empty())) {
+		logMessage(BLOCK_VRBLOG_LEVEL, "Flushed %lu dirty blocks", blks.size());
+	}
+	return (ret);
+}
+
+/**
+ * @brief Trim the released blocks on the devices, then flush each of the
+ * devices (the flushes are sent together, then waited on).  The trims are
+ * queued on the blocks, so a block written after it was released is either
+ * no longer pending or written after the trim.  Failed trims are
+ * only logged, the space is reclaimed when the block is next written.
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::flushDevices(void) {
+
+	// Local variables
+	map<bfsDevice *, vector<bfs_block_id_t>> dev_trims;
+	map<bfsDevice *, vector<bfs_block_id_t>>::iterator tit;
+	map<bfsDevice *, bfs_device_tag_t> dev_tags;
+	set<bfs_vbid_t> trims;
+	map<bfs_vbid_t, uint64_t> turns;
+	bfs_block_id_t pbid;
+	bfsDevice *dev;
+	uint32_t rep;
+	size_t i;
+	int ret = 0;
+
+	// Collect the replicas of the released blocks, by device
+	pthread_mutex_lock(&wbMutex);
+	trims.swap(trimPending);
+	for (auto it = trims.begin(); it != trims.end(); it++) {
+		turns[*it] = queueBlockIO(*it, false);
+	}
+	for (auto it = trims.begin(); it != trims.end(); it++) {
+		waitBlockIO(*it, turns[*it]);
+	}
+	pthread_mutex_unlock(&wbMutex);
+	for (auto it = trims.begin(); it != trims.end(); it++) {
+		for (rep = 0; rep < bfsBlockLayer::getReplicaCount(); rep++) {
+			if (getReplicaAddr(*it, rep, dev, pbid) == 0) {
+				dev_trims[dev].push_back(pbid);
+			}
+		}
+	}
+
+	// Trim them
+	for (tit = dev_trims.begin(); tit != dev_trims.end(); tit++) {
+		if (tit->first->trimBlocks(tit->second.data(),
+								   (uint32_t)tit->second.size())) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed trimming %lu blocks of device [%lu]",
+					   tit->second.size(), tit->first->getDeviceIdenfier());
+		}
+	}
+	pthread_mutex_lock(&wbMutex);
+	for (auto it = trims.begin(); it != trims.end(); it++) {
+		doneBlockIO(*it, false);
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Flush all of the devices, then wait for them
+	for (i = 0; i < devices.size(); i++) {
+		dev_tags[devices[i]] = devices[i]->flushDeviceAsync();
+	}
+	for (i = 0; i < devices.size(); i++) {
+		if ((dev_tags[devices[i]] == 0) ||
+			(devices[i]->waitFlush(dev_tags[devices[i]]))) {
+			logMessage(LOG_ERROR_LEVEL, "Failed flushing device [%lu]",
+					   devices[i]->getDeviceIdenfier());
+			ret = -1;
+		}
+	}
+
+	// Log and return the status
+	logMessage(BLOCK_VRBLOG_LEVEL, "Flushed %lu devices (%lu blocks trimmed)",
+			   devices.size(), trims.size());
+	return (ret);
+}
+
+#ifndef __BFS_ENCLAVE_MODE
+/**
+ * @brief The body of the background flusher thread.  It wakes every flush
+ * interval to write out all of the dirty blocks, or when the dirty share of
+ * the cache passes the high watermark to bring it down to the low one.
+ *
+ * @param none
+ * @return none
+ */
+
+void bfsVertBlockCluster::flusherLoop(void) {
+
+	// Local variables
+	size_t limit = (size_t)bfsUtilLayer::getUtilLayerCacheSizeLimit(),
+		   high = limit * bfsBlockLayer::getDirtyHighWatermark() / 100,
+		   low = limit * bfsBlockLayer::getDirtyLowWatermark() / 100, target;
+	uint64_t interval = bfsBlockLayer::getFlushInterval();
+	struct timespec deadline;
+	int ret;
+
+	pthread_mutex_lock(&wbMutex);
+	while (!wbStop) {
+
+		// Wait for the interval (or to be woken)
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += (time_t)(interval / 1000);
+		deadline.tv_nsec += (long)((interval % 1000) * 1000000);
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		ret = pthread_cond_timedwait(&wbCond, &wbMutex, &deadline);
+		if (wbStop) {
+			break;
+		}
+
+		// Flush everything on the interval, down to the low watermark if woken
+		target = (ret == ETIMEDOUT) ? 0 : low;
+		if ((ret != ETIMEDOUT) && (dirtyBlocks.size() < high)) {
+			continue;
+		}
+		pthread_mutex_unlock(&wbMutex);
+		flushDirty(target, false);
+		pthread_mutex_lock(&wbMutex);
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief The entry point of the background flusher thread
+ *
+ * @param arg - the cluster to flush
+ * @return void * : NULL
+ */
+
+void *bfsVertBlockCluster::flusherEntry(void *arg) {
+	static_cast<bfsVertBlockCluster *>(arg)->flusherLoop();
+	return (NULL);
+}
+#endif
+
+/**
+ * @brief Read a window of blocks into the block cache (as clean blocks), the
+ * per-device requests are sent concurrently (see readBlocks).  Blocks
+ * already cached are skipped (as are those cached while waiting out the I/O
+ * already queued on them), and those on failing devices are just not
+ * prefetched (a later read will retry or rebuild them).
+ *
+ * @param start - the first block of the window
+ * @param count - the number of blocks in the window
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::prefetchBlocks(bfs_vbid_t start, uint32_t count) {
+
+	// Local variables
+	map<bfsDevice *, bfs_block_list_t> dev_blocks;
+	map<bfsDevice *, bfs_block_list_t>::iterator bit;
+	map<bfs_vbid_t, std::pair<bfsDevice *, bfs_block_id_t>> virt_phys_map;
+	map<bfs_vbid_t, uint64_t> turns;
+	vector<bfs_vbid_t> wanted;
+	vector<std::pair<PBfsBlock *, uint64_t>> evicted;
+	set<bfsDevice *> failed;
+	CacheableObject *obj;
+	PBfsBlock *pblk, *cached;
+	bfs_block_id_t block, pbid;
+	bfsDevice *dev, *pdev;
+	bfs_vbid_t vbid;
+	int ret = 0;
+
+	// Skip the blocks already in the cache, queue the reads of the others
+	pthread_mutex_lock(&wbMutex);
+	for (vbid = start; vbid < start + count; vbid++) {
+		if (blk_cache.checkCache(intCacheKey(vbid), 1, false, false) == NULL) {
+			wanted.push_back(vbid);
+			turns[vbid] = queueBlockIO(vbid, false);
+		}
+	}
+	for (size_t i = 0; i < wanted.size(); i++) {
+		waitBlockIO(wanted[i], turns[wanted[i]]);
+	}
+	pthread_mutex_unlock(&wbMutex);
+	if (wanted.empty()) {
+		return (0);
+	}
+
+	// Read the blocks from the least loaded replicas
+	pthread_mutex_lock(&loadMutex);
+	for (size_t i = 0; i < wanted.size(); i++) {
+		if (getReplicaAddr(wanted[i], selectReadReplica(wanted[i]), dev,
+						   block)) {
+			ret = -1;
+			break;
+		}
+		devLoad[dev].inflight++;
+		dev_blocks[dev][block] = new PBfsBlock(NULL, BLK_SZ, 0, 0, block, dev);
+		virt_phys_map[wanted[i]] = std::make_pair(dev, block);
+	}
+	if (ret != 0) {
+		for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+			devLoad[bit->first].inflight -= (uint32_t)bit->second.size();
+		}
+		virt_phys_map.clear();
+	}
+	pthread_mutex_unlock(&loadMutex);
+	if (ret == 0) {
+		ret = dispatchBlocks(dev_blocks, false, &failed);
+	}
+
+	// Cache the blocks that arrived (unless read/written meanwhile), the I/O
+	// queued behind the reads on blocks they evict waits for those writes
+	pthread_mutex_lock(&wbMutex);
+	for (auto vit = virt_phys_map.begin(); vit != virt_phys_map.end(); vit++) {
+		dev = vit->second.first;
+		pblk = dev_blocks[dev][vit->second.second];
+		if ((failed.find(dev) != failed.end()) ||
+			(blk_cache.checkCache(intCacheKey(vit->first), 1, false, false) !=
+			 NULL) ||
+			(getPhyBlockAddr(vit->first, pdev, pbid))) {
+			continue;
+		}
+		pblk->set_pbid(pbid);
+		pblk->set_rd(pdev);
+		pblk->set_vbid(vit->first);
+		pblk->unlock(); // (locked on create, nobody is using it yet)
+		obj = blk_cache.insertCache(intCacheKey(vit->first), 1, pblk);
+		dev_blocks[dev][vit->second.second] = NULL;
+		raPending.insert(vit->first);
+		raStats.prefetched++;
+		if ((obj != NULL) && (obj != pblk)) {
+			if (!(cached = dynamic_cast<PBfsBlock *>(obj))) {
+				logMessage(LOG_ERROR_LEVEL, "Failed cast for block ptr\n");
+				continue;
+			}
+			evicted.push_back(std::make_pair(
+				cached, queueBlockIO(cached->get_vbid(), true)));
+		}
+	}
+	for (size_t i = 0; i < wanted.size(); i++) {
+		doneBlockIO(wanted[i], false);
+	}
+	pthread_mutex_unlock(&wbMutex);
+
+	// Write out (as needed) and release the blocks pushed out of the cache
+	for (size_t i = 0; i < evicted.size(); i++) {
+		if (flushEvicted(evicted[i].first, evicted[i].second)) {
+			ret = -1;
+		}
+	}
+
+	// Release the blocks not cached, log and return the status
+	for (bit = dev_blocks.begin(); bit != dev_blocks.end(); bit++) {
+		for (auto pit = bit->second.begin(); pit != bit->second.end(); pit++) {
+			delete pit->second;
+		}
+	}
+	logMessage(BLOCK_VRBLOG_LEVEL, "Prefetched blocks [%lu-%lu]", start,
+			   start + count - 1);
+	return (ret);
+}
+
+/**
+ * @brief Gets a reference to the block cache object.
+ *
+ * @return const BfsCache&: the reference to the block cache
+ */
+const BfsCache &bfsVertBlockCluster::get_blk_cache() { return blk_cache; }
+
+/**
+ * @brief Cleanup callback for dirty blocks.  A failed write is also
+ * remembered, and reported by the next flush (e.g., fsync).
+ *
+ * @param pblk: the blk to flush
+ * @return int: 0 if cleanup OK, -1 otherwise
+ */
+
+int bfsVertBlockCluster::flush_blk(PBfsBlock *pblk, bfs_vbid_t vbid) {
+	logMessage(BLOCK_VRBLOG_LEVEL, "Flushing block [vbid=%lu, pbid=%lu] ", vbid,
+			   pblk->get_pbid());
+
+	pthread_mutex_lock(&wbMutex);
+	dirtyBlocks.erase(vbid);
+	if (raPending.erase(vbid) > 0) {
+		raStats.waste++;
+	}
+	pthread_mutex_unlock(&wbMutex);
 
 	if (!pblk->is_dirty())
-		return;
+		return (0);
 
-	if (static_cast<bfsDevice *>(pblk->get_rd())->putBlock(*pblk)) {
+	if (putReplicas(vbid, *pblk)) {
 		logMessage(
 			LOG_ERROR_LEVEL,
 			"Failed flushing physical block [blk=%lu / dev=%d]",
 			pblk->get_pbid(),
 			static_cast<bfsDevice *>(pblk->get_rd())->getDeviceIdenfier());
-		abort();
+		pthread_mutex_lock(&wbMutex);
+		flushFailed = true;
+		pthread_mutex_unlock(&wbMutex);
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Write out a block pushed out of the cache (if dirty) in its turn
+ * on the block, queued when it was evicted so reads of the block wait for
+ * it, then release the block.
+ *
+ * @param pblk - the evicted block
+ * @param turn - the turn of the write on the block
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsVertBlockCluster::flushEvicted(PBfsBlock *pblk, uint64_t turn) {
+
+	// Local variables
+	bfs_vbid_t vbid = pblk->get_vbid();
+	int ret;
+
+	// Wait for the turn, write the block out
+	pthread_mutex_lock(&wbMutex);
+	waitBlockIO(vbid, turn);
+	pthread_mutex_unlock(&wbMutex);
+	ret = flush_blk(pblk, vbid);
+
+	// Pass the turn on, release the block and return the status
+	pthread_mutex_lock(&wbMutex);
+	doneBlockIO(vbid, true);
+	pthread_mutex_unlock(&wbMutex);
+	delete pblk;
+	return (ret);
+}
+
+/**
+ * @brief Queue device I/O on a block, taking the next turn.  The device I/O
+ * on a block (reads that fill the cache, writes and trims) runs one at a
+ * time in the order queued, while the I/O on different blocks runs
+ * concurrently.  The caller holds wbMutex, so the turns follow the cache and
+ * dirty state (e.g., a read missing the cache queues behind the write of the
+ * evicted copy).  Operations on many blocks queue on all of them at once,
+ * so their turns are in the same order on every block.
+ *
+ * @param vbid - the virtual block
+ * @param write - flag indicating the I/O is a write (see flushBlocks)
+ * @return uint64_t : the turn of the I/O
+ */
+
+uint64_t bfsVertBlockCluster::queueBlockIO(bfs_vbid_t vbid, bool write) {
+	if (write) {
+		ioWrites++;
 	}
+	return (ioQueues[vbid].next++);
+}
+
+/**
+ * @brief Wait for the turn of device I/O on a block (the caller holds
+ * wbMutex, which is released while waiting)
+ *
+ * @param vbid - the virtual block
+ * @param turn - the turn of the I/O (from queueBlockIO)
+ * @return none
+ */
+
+void bfsVertBlockCluster::waitBlockIO(bfs_vbid_t vbid, uint64_t turn) {
+	while (ioQueues[vbid].serving != turn) {
+		pthread_cond_wait(&ioCond, &wbMutex);
+	}
+	return;
+}
+
+/**
+ * @brief Finish the device I/O whose turn it is on a block, passing the turn
+ * to the next (the caller holds wbMutex)
+ *
+ * @param vbid - the virtual block
+ * @param write - flag indicating the I/O was a write
+ * @return none
+ */
+
+void bfsVertBlockCluster::doneBlockIO(bfs_vbid_t vbid, bool write) {
+
+	// Local variables
+	blk_io_queue &queue = ioQueues[vbid];
+
+	// Pass the turn on, forget the block once nothing is queued on it
+	if (write) {
+		ioWrites--;
+	}
+	if (++queue.serving == queue.next) {
+		ioQueues.erase(vbid);
+	}
+	pthread_cond_broadcast(&ioCond);
+	return;
 }
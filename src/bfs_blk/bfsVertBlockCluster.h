@@ -12,6 +12,9 @@
 //
 
 // STL-isms
+#include <map>
+#include <pthread.h>
+#include <set>
 #include <string>
 #include <vector>
 using namespace std;
@@ -19,10 +22,14 @@ using namespace std;
 // Project Includes
 #include "bfs_block.h"
 #include <bfsDeviceLayer.h>
+#include <bfsErasureCode.h>
 #include <bfs_cache.h>
 
 //
 // Class definitions
+#define BFS_BLK_LATENCY_EWMA_ALPHA 0.125
+#define BFS_BLK_RA_STREAMS 16 // The sequential streams tracked for readahead
+#define BFS_BLK_RA_CACHE_SHARE 4 // Windows are at most 1/n of the cache
 
 //
 // Class types
@@ -39,12 +46,42 @@ typedef vector<bfsDevice *> bfs_device_vec_t;
 
 // The block allocation structure
 typedef struct {
-	bool used;				// Flag indicating that this block is being used
-	bfs_device_id_t device; // The device on which the block is placed
-	bfs_block_id_t block;	// The block number on the remote device
+	bool used;			  // Flag indicating that this block is being used
+	uint32_t device;	  // The device holding the block (index in devices)
+	bfs_block_id_t block; // The block number on the remote device
 	uint64_t timestamp;
 } blk_alloc_entry;
 
+// The load on a device (used to pick which replica of a block to read)
+typedef struct {
+	uint32_t inflight; // The block reads outstanding on the device
+	double latency;	   // EWMA of the time to read a block (usec)
+	uint64_t reads;	   // The number of blocks read from the device
+} blk_device_load;
+
+// The device I/O queued on a block (run one at a time, in the order queued)
+typedef struct {
+	uint64_t next;	  // The turn the next I/O queued on the block takes
+	uint64_t serving; // The turn of the I/O allowed to run
+} blk_io_queue;
+
+// A sequential read stream (detected for readahead)
+typedef struct {
+	bfs_vbid_t next;   // The block expected to be read next
+	bfs_vbid_t ra_end; // The end of the prefetched window (exclusive)
+	bfs_vbid_t marker; // The block whose read prefetches the next window
+	uint32_t size;	   // The current window size (blocks), 0 if none yet
+	uint64_t last;	   // The last use of the stream (for replacement)
+} blk_ra_stream;
+
+// The readahead counters (for tuning the windows)
+typedef struct {
+	uint64_t windows;	 // The readahead windows issued
+	uint64_t prefetched; // The blocks prefetched into the cache
+	uint64_t hits;		 // The prefetched blocks later read
+	uint64_t waste;		 // The prefetched blocks evicted/overwritten unread
+} blk_ra_stats;
+
 //
 // Class Definition
 
@@ -68,6 +105,9 @@ public:
 	// Returns the list of devices in the cluster
 	bfs_device_vec_t &get_devices(void) { return devices; }
 
+	// Send the per-device requests one at a time (the fan-out baseline)
+	void setSequentialDispatch(bool seq) { seqDispatch = seq; }
+
 	const BfsCache &get_blk_cache();
 	// Get reference to the block cache object
 
@@ -96,10 +136,39 @@ public:
 	int writeBlocks(bfs_vblock_list_t &blks);
 	// Write a set of blocks to the cluster
 
-	// LIKELY DONT NEED THIS SINCE FS DECIDES ALLOCS (edit: need it for block
-	// allocation at blk layer)
-	// int deallocBlock(bfs_vbid_t id);
-	// Release a previously allocated block
+	int getPhyBlockAddr(bfs_vbid_t addr, bfsDevice *&dev, bfs_block_id_t &blk);
+	// Get the physical address associated with a virtual block address
+
+	int getReplicaAddr(bfs_vbid_t addr, uint32_t rep, bfsDevice *&dev,
+					   bfs_block_id_t &blk);
+	// Get the physical address of a replica of a virtual block
+
+	int getStripeChunkAddr(bfs_vbid_t row, uint32_t chunk, bfsDevice *&dev,
+						   bfs_block_id_t &blk);
+	// Get the physical address of a chunk of an erasure coded stripe
+
+	int readDegraded(bfs_vbid_t vbid, char *buf);
+	// Rebuild a block from the rest of its erasure coded stripe
+
+	int flushBlocks(void);
+	// Write all dirty cached blocks to the devices (barrier, e.g. for fsync)
+
+	size_t getDirtyCount(void);
+	// Return the number of cached blocks not yet written to the devices
+
+	void readAhead(bfs_vbid_t vbid);
+	// Note a block read, prefetching ahead of sequential streams
+
+	blk_ra_stats getReadaheadStats(void);
+	// Return a snapshot of the readahead counters
+
+	// Returns the load tracked for a device
+	const blk_device_load &get_device_load(bfsDevice *dev) {
+		return devLoad[dev];
+	}
+
+	int deallocBlock(bfs_vbid_t id);
+	// Release a previously allocated block (trimmed at the next flush)
 
 	uint64_t get_block_timestamp(bfs_vbid_t vbid) {
 		// return timestamp_tab.at(vbid);
@@ -124,6 +193,9 @@ public:
 	static bfsVertBlockCluster *bfsClusterFactory(void);
 	// The factory function for the cluster
 
+	static bfsVertBlockCluster *bfsClusterFactory(bfs_device_list_t &devs);
+	// The factory function for a cluster of the given devices (e.g., stubs)
+
 private:
 	// Private class methods
 
@@ -131,7 +203,7 @@ private:
 	// Default constructor
 	// Note: Force all creation to use factory functions
 
-	int bfsVertBlockClusterInitialize(void);
+	int bfsVertBlockClusterInitialize(bfs_device_list_t &manifest);
 	// Initialize the device
 
 	int bfsVertBlockClusterUninitialize(void);
@@ -143,12 +215,63 @@ private:
 	int addBlockDevice(bfsDevice *dev);
 	// Add a block device to the cluster
 
-	int getPhyBlockAddr(bfs_vbid_t addr, bfsDevice *&dev, bfs_block_id_t &blk);
-	// Get the physical address associated with a virtual block address
+	void mapBlockDevices(void);
+	// Compute the physical address of every virtual block (in blkAllocTable)
+
+	uint32_t selectReadReplica(bfs_vbid_t addr);
+	// Pick the replica of the block on the least loaded device
+
+	void completeDeviceRead(bfsDevice *dev, double usecs, uint64_t blocks);
+	// Record the completion of a read on a device (load and latency)
+
+	int readReplicas(bfs_vbid_t vbid, PBfsBlock &pblk,
+					 set<bfsDevice *> *failed);
+	// Read a block from the first of its replicas that can be read
+
+	int putReplicas(bfs_vbid_t vbid, PBfsBlock &pblk, bool consume = false);
+	// Write a block to all of its replicas (concurrently)
+
+	int dispatchBlocks(map<bfsDevice *, bfs_block_list_t> &dev_blocks,
+					   bool write, set<bfsDevice *> *failed = NULL);
+	// Send per-device block requests concurrently, then wait for them all
+	// (or one at a time, if the dispatch is sequential)
+
+	int writeStripes(map<bfs_vbid_t, char *> &blks);
+	// Write blocks into their erasure coded stripes (updating the parity)
+
+	int writeVirtBlocks(map<bfs_vbid_t, char *> &blks);
+	// Write blocks to the devices (all replicas, or into their stripes)
 
-	void flush_blk(PBfsBlock *, bfs_vbid_t);
+	int flushDirty(size_t target, bool report);
+	// Write dirty cached blocks out until at most target remain dirty
+
+	int flushDevices(void);
+	// Trim the released blocks, then flush each of the devices (barrier)
+
+	void flusherLoop(void);
+	// The body of the background flusher thread
+
+	static void *flusherEntry(void *arg);
+	// The entry point of the background flusher thread
+
+	int prefetchBlocks(bfs_vbid_t start, uint32_t count);
+	// Read a window of blocks into the block cache (one batched fan-out)
+
+	int flush_blk(PBfsBlock *, bfs_vbid_t);
 	// Cleanup callback for dirty blocks
 
+	int flushEvicted(PBfsBlock *pblk, uint64_t turn);
+	// Write out (in its turn, as needed) and release an evicted block
+
+	uint64_t queueBlockIO(bfs_vbid_t vbid, bool write);
+	// Queue device I/O on a block, returning its turn (under wbMutex)
+
+	void waitBlockIO(bfs_vbid_t vbid, uint64_t turn);
+	// Wait for the turn of device I/O on a block (under wbMutex)
+
+	void doneBlockIO(bfs_vbid_t vbid, bool write);
+	// Finish the device I/O whose turn it is on a block (under wbMutex)
+
 	//
 	// Class Data
 
@@ -161,6 +284,69 @@ private:
 	bfs_device_vec_t devices;
 	// The list of available block devices on which to rest the cluster
 
+	bfs_vbid_t stripeDepth;
+	// The blocks of each device in the striped/replicated region
+
+	map<bfsDevice *, blk_device_load> devLoad;
+	// The load on each of the devices (for balancing reads over replicas)
+
+	bfsErasureCode *ecCode;
+	// The erasure code for the stripes (NULL unless erasure allocation)
+
+	set<bfs_vbid_t> dirtyBlocks;
+	// The blocks written to the cache but not the devices (write-back)
+
+	pthread_mutex_t wbMutex;
+	// Protects the dirty blocks and the cached blocks' lifetimes
+
+	pthread_mutex_t loadMutex;
+	// Protects the device load (never held across device I/O)
+
+	pthread_mutex_t ecMutex;
+	// Serializes the stripe reads and updates (erasure coding, recursive)
+
+	map<bfs_vbid_t, blk_io_queue> ioQueues;
+	// The device I/O queued on the blocks, by block (under wbMutex)
+
+	uint64_t ioWrites;
+	// The block writes queued or in flight (under wbMutex)
+
+	pthread_cond_t ioCond;
+	// Wakes the device I/O waiting for its turn on a block
+
+	pthread_cond_t wbCond;
+	// Wakes the flusher (watermark crossed or shutdown)
+
+	pthread_t wbThread;
+	// The background flusher thread
+
+	bool wbRunning;
+	// Flag indicating the flusher thread is running
+
+	bool wbStop;
+	// Flag telling the flusher thread to exit
+
+	bool flushFailed;
+	// Flag indicating a write of an evicted block failed (since last flush)
+
+	blk_ra_stream raStreams[BFS_BLK_RA_STREAMS];
+	// The sequential streams being read ahead (under wbMutex)
+
+	uint64_t raClock;
+	// The logical clock ordering the use of the streams
+
+	set<bfs_vbid_t> raPending;
+	// The prefetched blocks not yet read (under wbMutex)
+
+	set<bfs_vbid_t> trimPending;
+	// The released blocks not yet trimmed on the devices (under wbMutex)
+
+	blk_ra_stats raStats;
+	// The readahead counters (under wbMutex)
+
+	bool seqDispatch;
+	// Flag making dispatchBlocks wait on each device before the next
+
 	blk_alloc_entry *blkAllocTable;
 	// The allocation of blocks in the cluster
 
@@ -20,14 +20,20 @@
 #include <bfs_util.h>
 
 // Defines
-#define BFSBLOCKUT_ARGUMENTS "vhl:p:d:b:"
+#define BFSBLOCKUT_ARGUMENTS "vhl:p:d:b:t:e:r:c:"
 #define USAGE                                                                  \
-	"USAGE: bfs_device [-h] [-v] [-l <logfile>]\n"                             \
+	"USAGE: bfs_blk_utest [-h] [-v] [-l <logfile>] [-b <blocks>] [-t <n>]\n"   \
+	"                     [-e <mbytes>] [-r <blocks>] [-c <blocks>]\n"         \
 	"\n"                                                                       \
 	"where:\n"                                                                 \
 	"    -h - help mode (display this message)\n"                              \
 	"    -v - verbose output\n"                                                \
 	"    -l - write log messages to the filename <logfile>\n"                  \
+	"    -b - benchmark device fan-out with <blocks> per read/write\n"         \
+	"    -t - benchmark translation of <n> virtual block addresses\n"          \
+	"    -e - benchmark erasure encode/decode of <mbytes> per code\n"          \
+	"    -r - benchmark readahead over <blocks> sequential reads\n"            \
+	"    -c - benchmark bytes copied reading/writing <blocks> blocks\n"        \
 	"\n"
 
 // Global data
@@ -49,7 +55,9 @@
 int main(int argc, char *argv[]) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, bench_blocks = 0, bench_seq = 0,
+		bench_copy = 0;
+	uint64_t bench_lookups = 0, bench_mbytes = 0;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, BFSBLOCKUT_ARGUMENTS)) != -1) {
@@ -68,6 +76,26 @@ int main(int argc, char *argv[]) {
 			log_initialized = 1;
 			break;
 
+		case 'b': // Benchmark the device fan-out
+			bench_blocks = atoi(optarg);
+			break;
+
+		case 't': // Benchmark the address translation
+			bench_lookups = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'e': // Benchmark the erasure code
+			bench_mbytes = strtoull(optarg, NULL, 10);
+			break;
+
+		case 'r': // Benchmark the readahead
+			bench_seq = atoi(optarg);
+			break;
+
+		case 'c': // Benchmark the block copies
+			bench_copy = atoi(optarg);
+			break;
+
 		default: // Default (unknown)
 			fprintf(stderr, "Unknown command line option, aborting.\n");
 			return (-1);
@@ -84,6 +112,43 @@ int main(int argc, char *argv[]) {
 
 	// bfsBlockLayer::bfsBlockLayerInit();
 
+	// Run the benchmark instead of the unit test, if asked
+	if (bench_blocks > 0) {
+		if (bfsBlockLayer::bfsBlockLayerFanoutBench(bench_blocks)) {
+			logMessage(LOG_ERROR_LEVEL, "BFS block benchmark failed, aborting.");
+			return (-1);
+		}
+		return (0);
+	}
+	if (bench_lookups > 0) {
+		if (bfsBlockLayer::bfsBlockLayerTranslateBench(bench_lookups)) {
+			logMessage(LOG_ERROR_LEVEL, "BFS block benchmark failed, aborting.");
+			return (-1);
+		}
+		return (0);
+	}
+	if (bench_mbytes > 0) {
+		if (bfsBlockLayer::bfsBlockLayerErasureBench(bench_mbytes)) {
+			logMessage(LOG_ERROR_LEVEL, "BFS block benchmark failed, aborting.");
+			return (-1);
+		}
+		return (0);
+	}
+	if (bench_seq > 0) {
+		if (bfsBlockLayer::bfsBlockLayerReadaheadBench(bench_seq)) {
+			logMessage(LOG_ERROR_LEVEL, "BFS block benchmark failed, aborting.");
+			return (-1);
+		}
+		return (0);
+	}
+	if (bench_copy > 0) {
+		if (bfsBlockLayer::bfsBlockLayerCopyBench(bench_copy)) {
+			logMessage(LOG_ERROR_LEVEL, "BFS block benchmark failed, aborting.");
+			return (-1);
+		}
+		return (0);
+	}
+
 	// Call the UNIT test code, check for error
 // #if 0
     if ( bfsBlockLayer::bfsBlockLayerUtest() ) {
@@ -12,6 +12,7 @@
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -81,14 +82,37 @@ private:
 
 static bfsNetworkConnection *client = NULL;	 /* handle for sending data */
 static bfsSecAssociation *secContext = NULL; /* handle for crypto ops */
+static bfsSecAssociation *recvContext =
+	NULL; /* opens responses (receiver thread only) */
 static bfsConnectionMux *mux = NULL; /* for waiting on data from server */
 uint64_t bfs_client_log_level = 0, bfs_client_vrb_log_level = 0; /* log lvls */
 bool do_mkfs = false;			 /* flag indicating to format on init */
-static pthread_mutex_t mux_lock; /* for concurrency with multi-threaded FUSE */
+static pthread_mutex_t mux_lock; /* serializes tagging and sending requests */
 static bool direct_io_flag = false;
 static std::string bfs_server_ip = "";
 static unsigned short bfs_server_port = -1;
-static uint32_t send_seq, recv_seq;
+static uint32_t send_seq; /* the tag (request id) of the next request */
+
+/**
+ * A request sent to the server that is waiting for its responses. Responses
+ * carry the tag of their request in clear (bound to the sealed message as
+ * AAD), so the receiver thread can find the request, open the response, and
+ * hand it to the waiting caller; many FUSE threads can have requests in flight
+ * at once.
+ */
+typedef struct {
+	std::deque<bfsFlexibleBuffer *> resps; /* opened responses (NULL if bad) */
+	uint32_t nresps;   /* the number of responses the request expects */
+	uint32_t resp_seq; /* the sequence of the next response to take */
+	pthread_cond_t cond; /* signalled when a response arrives */
+} bfs_client_req_t;
+static std::unordered_map<uint32_t, bfs_client_req_t *>
+	pending_reqs;				 /* requests in flight, by tag */
+static pthread_mutex_t req_lock; /* protects pending_reqs */
+static pthread_t recv_thread;	 /* dispatches responses to the callers */
+static bool recv_running = false, recv_failed = false;
+static void *client_recv_worker_entry(void *);
+#define BFS_CLIENT_RECV_WAIT 100 /* msecs to wait before checking for exit */
 const struct fuse_operations bfs_oper = {
 	/* bfs fops hooks */
 	.getattr = bfs_getattr,
@@ -161,9 +185,10 @@ static std::vector<double> c_read__lats, c_read__c_lats, c_read__net_send_lats,
 	c_write__net_send_lats, c_write__net_recv_lats;
 static void write_client_latencies();
 
-static void send_msgp(bfsFlexibleBuffer &);
-static uint64_t recv_msgp(bfsFlexibleBuffer &, uint32_t, msg_type_t, op_type_t,
-						  bool);
+static uint32_t send_msgp(bfsFlexibleBuffer &, uint32_t = 1);
+static uint64_t recv_msgp(bfsFlexibleBuffer &, uint32_t, uint32_t, msg_type_t,
+						  op_type_t, bool);
+static int client_connect();
 static void cleanup();
 
 /**
@@ -203,22 +228,15 @@ int bfs_getattr(const char *path, struct stat *stbuf,
 		mtype = TO_SERVER;
 		otype = CLIENT_GETATTR_OP;
 		spkt << path_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		/**
 		 * Receive and deserialize getattr response from bfs server. Expects
 		 * lengths to be 32-bit, and interprets a bad inode number as a
 		 * non-existent file.
 		 */
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_GETATTR_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_GETATTR_OP, false);
 		rpkt >> ret >> stbuf->st_uid >> recv_ctime >> recv_mtime >>
 			recv_atime >> stbuf->st_ino; // mtype and otype already pulled out
 		stbuf->st_ctime = recv_ctime;	 // force cast to 32-bit
@@ -286,18 +304,11 @@ int bfs_mkdir(const char *path, uint32_t mode) {
 		mtype = TO_SERVER;
 		otype = CLIENT_MKDIR_OP;
 		spkt << path_len << _mode << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		/* Receive and deserialize mkdir response from the server */
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_MKDIR_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_MKDIR_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -349,18 +360,11 @@ int bfs_unlink(const char *path) {
 		mtype = TO_SERVER;
 		otype = CLIENT_UNLINK_OP;
 		spkt << path_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		/* Receive and deserialize unlink response from the server */
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_UNLINK_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_UNLINK_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -434,18 +438,11 @@ int bfs_rmdir(const char *path) {
 		mtype = TO_SERVER;
 		otype = CLIENT_RMDIR_OP;
 		spkt << path_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive rmdir response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_RMDIR_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_RMDIR_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -516,18 +513,11 @@ int bfs_rename(const char *from, const char *to, unsigned int flags) {
 		mtype = TO_SERVER;
 		otype = CLIENT_RENAME_OP;
 		spkt << to_copy_len << from_copy_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive rename response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_RENAME_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_RENAME_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -583,18 +573,11 @@ int bfs_chmod(const char *path, mode_t new_mode, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_CHMOD_OP;
 		spkt << path_len << new_mode << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive chmod response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_CHMOD_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_CHMOD_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -766,17 +749,11 @@ int bfs_open(const char *path, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_OPEN_OP;
 		spkt << path_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive open response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_OPEN_OP, false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER, CLIENT_OPEN_OP,
+				  false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -932,11 +909,6 @@ int bfs_read(const char *path, char *buf, size_t size, off_t offset,
 		mtype = TO_SERVER;
 		otype = CLIENT_READ_OP;
 		spkt << _offset << _size << fi->fh << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
 
 		if (bfsUtilLayer::perf_test())
 			net_send_start_time =
@@ -945,8 +917,7 @@ int bfs_read(const char *path, char *buf, size_t size, off_t offset,
 					.time_since_epoch()
 					.count();
 
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		if (bfsUtilLayer::perf_test()) {
 			net_send_end_time =
@@ -960,8 +931,8 @@ int bfs_read(const char *path, char *buf, size_t size, off_t offset,
 			net_recv_start_time = net_send_end_time;
 		}
 
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_READ_OP, true);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER, CLIENT_READ_OP,
+				  true);
 
 		if (bfsUtilLayer::perf_test()) {
 			net_recv_end_time =
@@ -1286,11 +1257,6 @@ begin_write:
 			otype = CLIENT_WRITE_OP;
 			spkt << _offset << _size << fi->fh << otype << mtype;
 
-			pthread_mutex_lock(&mux_lock);
-			bfsFlexibleBuffer *aad =
-				new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-			secContext->encryptData(spkt, aad, true);
-			send_seq++;
 
 			if (bfsUtilLayer::perf_test())
 				net_send_start_time =
@@ -1300,8 +1266,7 @@ begin_write:
 							.time_since_epoch()
 							.count();
 
-			send_msgp(spkt);
-			delete aad;
+			uint32_t req_id = send_msgp(spkt);
 
 			if (bfsUtilLayer::perf_test()) {
 				net_send_end_time =
@@ -1316,9 +1281,8 @@ begin_write:
 				net_recv_start_time = net_send_end_time;
 			}
 
-			recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_WRITE_OP,
-					  true);
-			pthread_mutex_unlock(&mux_lock);
+			recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+					  CLIENT_WRITE_OP, true);
 
 			if (bfsUtilLayer::perf_test()) {
 				net_recv_end_time =
@@ -1519,11 +1483,6 @@ int bfs_release(const char *path, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_RELEASE_OP;
 		spkt << fi->fh << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
 
 		if (bfsUtilLayer::perf_test())
 			release_start_time =
@@ -1532,7 +1491,7 @@ int bfs_release(const char *path, struct fuse_file_info *fi) {
 					.time_since_epoch()
 					.count();
 
-		send_msgp(spkt);
+		uint32_t req_id = send_msgp(spkt);
 
 		if (bfsUtilLayer::perf_test())
 			release_end_time =
@@ -1544,12 +1503,10 @@ int bfs_release(const char *path, struct fuse_file_info *fi) {
 		logMessage(CLIENT_VRB_LOG_LEVEL, "send latency: %f\n",
 				   release_end_time - release_start_time);
 
-		delete aad;
 
 		// Receive release response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_RELEASE_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_RELEASE_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -1635,10 +1592,6 @@ int bfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_FSYNC_OP;
 		spkt << datasync << fi->fh << otype << mtype;
-		pthread_mutex_lock(&mux_lock); bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
 
 		if (bfsUtilLayer::perf_test())
 			fsync_start_time =
@@ -1647,7 +1600,7 @@ int bfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
 					.time_since_epoch()
 					.count();
 
-		send_msgp(spkt);
+		uint32_t req_id = send_msgp(spkt);
 
 		if (bfsUtilLayer::perf_test())
 			fsync_end_time =
@@ -1659,11 +1612,10 @@ int bfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
 		logMessage(CLIENT_VRB_LOG_LEVEL, "send latency: %f\n",
 				   fsync_end_time - fsync_start_time);
 
-		delete aad;
 
 		// Receive fsync response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_FSYNC_OP,
-				  false);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_FSYNC_OP, false);
 
 		if (bfsUtilLayer::perf_test())
 			fsync_end_time =
@@ -1674,7 +1626,7 @@ int bfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
 		logMessage(CLIENT_VRB_LOG_LEVEL, "recv latency: %f\n",
 				   fsync_end_time - fsync_start_time);
 
-		pthread_mutex_unlock(&mux_lock); rpkt >> ret;
+		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
 				   err->getMessage().c_str());
@@ -1738,18 +1690,11 @@ int bfs_opendir(const char *path, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_OPENDIR_OP;
 		spkt << path_len << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive opendir response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_OPENDIR_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_OPENDIR_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -1824,18 +1769,11 @@ int bfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		mtype = TO_SERVER;
 		otype = CLIENT_READDIR_OP;
 		spkt << fi->fh << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt, 2); // headers, then the dentries
 
 		// Receive readdir response
-		recv_msgp(rpkt, total_recv_hdr_len, FROM_SERVER, CLIENT_READDIR_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_hdr_len, FROM_SERVER,
+				  CLIENT_READDIR_OP, false);
 
 		// get number of entries
 		rpkt >> num_ents;
@@ -1845,7 +1783,8 @@ int bfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 							(uint32_t)(num_ents * de_len), 0);
 
 		// reuse pkt
-		recv_msgp(rpkt, (uint32_t)(total_recv_data_len + num_ents * de_len),
+		recv_msgp(rpkt, req_id,
+				  (uint32_t)(total_recv_data_len + num_ents * de_len),
 				  INVALID_MSG, INVALID_OP, false);
 
 		// Read the dentries. Assumes the message is structured like:
@@ -2098,25 +2037,11 @@ void *bfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
 	try {
 		logMessage(CLIENT_LOG_LEVEL, "Initializing client...\n");
 
-		client = bfsNetworkConnection::bfsChannelFactory(bfs_server_ip,
-														 bfs_server_port);
-		logMessage(CLIENT_LOG_LEVEL, "Connected to server [%s:%d]\n",
-				   bfs_server_ip.c_str(), bfs_server_port);
-
-		if (client->connect() != BFS_SUCCESS) {
+		if (client_connect() != BFS_SUCCESS) {
 			logMessage(LOG_ERROR_LEVEL, "Client connection failed, aborting.");
 			abort();
 		}
 
-		mux = new bfsConnectionMux();
-		mux->addConnection(client);
-
-		if (pthread_mutex_init(&mux_lock, NULL) != 0) {
-			logMessage(LOG_ERROR_LEVEL,
-					   "Client failed to initialize mux lock, aborting.");
-			abort();
-		}
-
 		// pthread_mutexattr_t attr;
 		// pthread_mutexattr_init(&attr);
 		// pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
@@ -2132,17 +2057,11 @@ void *bfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
 		mtype = TO_SERVER;
 		otype = do_mkfs ? CLIENT_INIT_MKFS_OP : CLIENT_INIT_OP;
 		spkt << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive init response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_INIT_OP, false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER, CLIENT_INIT_OP,
+				  false);
 		rpkt >> ret; // mtype and otype already pulled out
 	} catch (bfsUtilError *err) {
 		logMessage(LOG_ERROR_LEVEL, err->getMessage().c_str());
@@ -2204,18 +2123,11 @@ void bfs_destroy(void *private_data) {
 		mtype = TO_SERVER;
 		otype = CLIENT_DESTROY_OP;
 		spkt << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive destroy response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_DESTROY_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_DESTROY_OP, false);
 		rpkt >> ret;
 	} catch (bfsUtilError *err) {
 		logMessage(LOG_ERROR_LEVEL, err->getMessage().c_str());
@@ -2270,18 +2182,11 @@ int bfs_create(const char *path, uint32_t mode, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_CREATE_OP;
 		spkt << path_len << _mode << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive create response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_CREATE_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_CREATE_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -2384,18 +2289,11 @@ int bfs_truncate(const char *path, off_t length, struct fuse_file_info *fi) {
 		mtype = TO_SERVER;
 		otype = CLIENT_TRUNCATE_OP;
 		spkt << path_len << _length << fi->fh << otype << mtype;
-		pthread_mutex_lock(&mux_lock);
-		bfsFlexibleBuffer *aad =
-			new bfsFlexibleBuffer((char *)&send_seq, sizeof(uint32_t));
-		secContext->encryptData(spkt, aad, true);
-		send_seq++;
-		send_msgp(spkt);
-		delete aad;
+		uint32_t req_id = send_msgp(spkt);
 
 		// Receive truncate response
-		recv_msgp(rpkt, total_recv_msg_len, FROM_SERVER, CLIENT_TRUNCATE_OP,
-				  false);
-		pthread_mutex_unlock(&mux_lock);
+		recv_msgp(rpkt, req_id, total_recv_msg_len, FROM_SERVER,
+				  CLIENT_TRUNCATE_OP, false);
 		rpkt >> ret;
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
@@ -2497,111 +2395,131 @@ off_t bfs_lseek(const char *path, off_t off, int whence,
 }
 
 /**
- * @brief Send a message containing a request to the server.
+ * @brief Seal and send a request to the server. The request is tagged with the
+ * next request id (in clear in front of the sealed message, and bound to it as
+ * AAD) and registered as waiting for its responses before it is sent, so the
+ * receiver thread can dispatch them. Only the tagging, sealing, and sending are
+ * serialized (by mux_lock); the caller waits for the responses in recv_msgp.
  *
- * @param len: the number of bytes to send
- * @param buf: buffer containing bytes to send
- * @return uint32_t: 0 if success, throw exception if failure
+ * @param spkt: the request to send (sealed in place)
+ * @param nresps: the number of responses the request expects
+ * @return uint32_t: the tag of the request if success, throw exception if
+ * failure
  */
-static void send_msgp(bfsFlexibleBuffer &spkt) {
+static uint32_t send_msgp(bfsFlexibleBuffer &spkt, uint32_t nresps) {
+	bfs_client_req_t *req;
 	int32_t bytes_sent = 0;
+	uint32_t tag;
 
-	// if (pthread_mutex_lock(&mux_lock) != 0) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Error when acquiring lock in send_msg\n");
-	// 	return;
-	// }
+	req = new bfs_client_req_t;
+	req->nresps = nresps;
+	req->resp_seq = 0;
+	pthread_cond_init(&req->cond, NULL);
 
-	// bytes_sent = client->sendPacketizedDataL(len, buf);
-	bytes_sent = client->sendPacketizedBuffer(spkt);
+	pthread_mutex_lock(&mux_lock);
+	tag = send_seq;
+	try {
+		bfsFlexibleBuffer aad((char *)&tag, sizeof(uint32_t));
+		secContext->encryptData(spkt, &aad, true);
+	} catch (bfsCryptoError *err) {
+		pthread_mutex_unlock(&mux_lock);
+		pthread_cond_destroy(&req->cond);
+		delete req;
+		throw err;
+	}
+	spkt << tag;
+	send_seq++;
 
-	// if (pthread_mutex_unlock(&mux_lock) != 0) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Error when releasing lock in send_msg\n");
-	// 	abort(); // very bad
-	// }
+	// register before sending, so the response always finds its request
+	pthread_mutex_lock(&req_lock);
+	pending_reqs[tag] = req;
+	pthread_mutex_unlock(&req_lock);
 
-	if ((bytes_sent < 0) || ((uint32_t)bytes_sent != spkt.getLength()))
+	bytes_sent = client->sendPacketizedBuffer(spkt);
+	pthread_mutex_unlock(&mux_lock);
+
+	if ((bytes_sent < 0) || ((uint32_t)bytes_sent != spkt.getLength())) {
+		pthread_mutex_lock(&req_lock);
+		pending_reqs.erase(tag);
+		pthread_mutex_unlock(&req_lock);
+		pthread_cond_destroy(&req->cond);
+		delete req;
 		throw std::runtime_error("Send message failed, aborting\n");
+	}
+
+	return tag;
 }
 
 /**
- * @brief Receive a message from the server. Calls wait on the socket to block
- * for an incoming message, returning the length received. Technically reads
- * shouldn't be short since the rawnet code blocks until length is read. The
- * function expects a message of a certain message type and operation type, and
- * it returns the current offset in the buffer that the caller should begin
- * reading from. Throws an exception if the read message is invalid.
+ * @brief Receive a response to a request from the server. Blocks until the
+ * receiver thread hands over the next response carrying the request's tag
+ * (already opened by the receiver thread). The function expects a message of a
+ * certain message type and operation type, and it returns the number of bytes
+ * the caller should read. Throws an exception if the message is invalid, could
+ * not be opened, or the connection failed.
  *
- * @param len: the number of bytes to read
- * @param buf: the buffer to fill
- * @param off_out: the offset for the caller to continue reading at
+ * @param rpkt: the buffer to fill
+ * @param tag: the tag of the request (from send_msgp)
+ * @param len: the number of bytes to expect
  * @param mtype: message type to expect
  * @param otype: operation type to expect
  * @param allow_short: flag for whether or not to allow short reads/writes
  * @return uint64_t: number of bytes read on success; exception on failure
  */
-static uint64_t recv_msgp(bfsFlexibleBuffer &rpkt, uint32_t len,
+static uint64_t recv_msgp(bfsFlexibleBuffer &rpkt, uint32_t tag, uint32_t len,
 						  msg_type_t mtype, op_type_t otype, bool allow_short) {
-	bfsConnectionList ready;
+	std::unordered_map<uint32_t, bfs_client_req_t *>::iterator it;
+	bfs_client_req_t *req;
+	bfsFlexibleBuffer *resp = NULL;
+	bool received = false;
 	int64_t bytes_read = 0;
 	int32_t r_mtype = INVALID_MSG;
 	int32_t r_otype = INVALID_OP;
 	char err_msg[MAX_LOG_MESSAGE_SIZE] = {0};
 
-	// if (pthread_mutex_lock(&mux_lock) != 0) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Error when acquiring lock in recv_msg\n");
-	// 	return 0;
-	// }
-
-	while (1) { // just block and wait for incoming data
-		if (mux->waitConnections(ready, 0)) {
-			throw std::runtime_error("Mux wait failed, aborting recv_msg\n");
-		} else {
-			// Check to see if the client is in the ready list
-			if (ready.find(client->getSocket()) != ready.end()) {
-				// Just receive the incoming data
-				bytes_read = client->recvPacketizedBuffer(rpkt);
-				if ((bytes_read == 0) || (bytes_read == -1)) {
-					// if 0, server side socket closed, bail out; if -1, failed
-					// during recvPacketizedDataL (buffer too short for incoming
-					// data), ignore message and bail out
-					if (pthread_mutex_unlock(&mux_lock) != 0) {
-						logMessage(LOG_ERROR_LEVEL,
-								   "Error when releasing lock in recv_msg\n");
-						abort(); // very bad
-					}
-					snprintf(err_msg, MAX_LOG_MESSAGE_SIZE,
-							 "Failed during recvPacketizedDataL on [%d] in "
-							 "main loop: "
-							 "bytes_read is %ld\n",
-							 client->getSocket(), bytes_read);
-					throw std::runtime_error(err_msg);
-				} else {
-					// Data received, check to see if the data is sane (might be
-					// short, but let the caller handle that)
-					logMessage(CLIENT_VRB_LOG_LEVEL,
-							   "Received [%d] bytes on connection [%d]",
-							   bytes_read, client->getSocket());
-					break;
-				}
-			}
-		}
+	// wait for the receiver thread to hand over the next response
+	pthread_mutex_lock(&req_lock);
+	if ((it = pending_reqs.find(tag)) == pending_reqs.end()) {
+		pthread_mutex_unlock(&req_lock);
+		snprintf(err_msg, MAX_LOG_MESSAGE_SIZE,
+				 "Client recv on unknown request [%u]\n", tag);
+		throw std::runtime_error(err_msg);
+	}
+	req = it->second;
+	while (req->resps.empty() && !recv_failed)
+		pthread_cond_wait(&req->cond, &req_lock);
+	if (!req->resps.empty()) {
+		resp = req->resps.front();
+		req->resps.pop_front();
+		received = true;
 	}
+	req->resp_seq++;
 
-	// if (pthread_mutex_unlock(&mux_lock) != 0) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Error when releasing lock in recv_msg\n");
-	// 	abort(); // very bad
-	// }
+	// the request is done after its last response (or the connection failed)
+	if (!received || (req->resp_seq == req->nresps)) {
+		pending_reqs.erase(it);
+		pthread_cond_destroy(&req->cond);
+		delete req;
+	}
+	pthread_mutex_unlock(&req_lock);
 
-	// decrypt the data (headers are encrypted now for protection so decrypt
-	// before beginning processing)
-	// pthread_mutex_lock(&mux_lock);
-	bfsFlexibleBuffer *aad =
-		new bfsFlexibleBuffer((char *)&recv_seq, sizeof(uint32_t));
-	secContext->decryptData(rpkt, aad, true);
-	recv_seq++;
-	delete aad;
+	if (!received) {
+		snprintf(err_msg, MAX_LOG_MESSAGE_SIZE,
+				 "Connection to server failed while waiting on request [%u]\n",
+				 tag);
+		throw std::runtime_error(err_msg);
+	}
+	if (resp == NULL) {
+		snprintf(err_msg, MAX_LOG_MESSAGE_SIZE,
+				 "Failed opening response to request [%u]\n", tag);
+		throw std::runtime_error(err_msg);
+	}
+	rpkt.swapData(*resp);
+	delete resp;
 	bytes_read = rpkt.getLength(); // set to the actual number of bytes read
 								   // (minus iv+mac+pad)
+	logMessage(CLIENT_VRB_LOG_LEVEL, "Received [%d] bytes for request [%u]",
+			   bytes_read, tag);
 
 	// only copy out a header if caller gives valid message/op types
 	if ((mtype != INVALID_MSG) && (otype != INVALID_OP)) {
@@ -2627,6 +2545,101 @@ static uint64_t recv_msgp(bfsFlexibleBuffer &rpkt, uint32_t len,
 	return bytes_read;
 }
 
+/**
+ * @brief Receives the responses from the server and hands each one to the
+ * request waiting on it (by the tag in front of the sealed response). The
+ * responses are opened here, under the receive direction's own SA, so no two
+ * threads ever share a cipher handle (the callers' requests are sealed under
+ * secContext by send_msgp); the AAD binds the tag and the response's sequence
+ * within the request. A response that fails to open is handed over as NULL so
+ * its caller fails. Responses with an unknown tag (or beyond what the request
+ * expects) are dropped. When the connection fails, every waiting request is
+ * woken to fail rather than hang.
+ *
+ * @param arg: unused
+ * @return void*: unused
+ */
+static void *client_recv_worker_entry(void *arg) {
+	(void)arg;
+	std::unordered_map<uint32_t, bfs_client_req_t *>::iterator it;
+	bfsConnectionList ready;
+	bfs_client_req_t *req;
+	bfsFlexibleBuffer *resp = NULL;
+	int64_t bytes_read = 0;
+	uint32_t tag, aad_ids[2];
+
+	while (recv_running) {
+		if (mux->waitConnections(ready, BFS_CLIENT_RECV_WAIT)) {
+			logMessage(LOG_ERROR_LEVEL, "Mux wait failed in client receiver\n");
+			break;
+		}
+		if (ready.find(client->getSocket()) == ready.end())
+			continue; // timed out, check if we should exit
+
+		if (resp == NULL)
+			resp = new bfsFlexibleBuffer();
+		bytes_read = client->recvPacketizedBuffer(*resp);
+		if ((bytes_read == 0) || (bytes_read == -1)) {
+			// if 0, server side socket closed, bail out; if -1, failed during
+			// recvPacketizedDataL (buffer too short for incoming data)
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed during recvPacketizedDataL on [%d] in client "
+					   "receiver: bytes_read is %ld\n",
+					   client->getSocket(), bytes_read);
+			break;
+		}
+		if (resp->getLength() < sizeof(tag)) {
+			logMessage(LOG_ERROR_LEVEL, "Dropping untagged server response\n");
+			continue;
+		}
+		*resp >> tag;
+
+		// find the request (it stays registered until the caller takes its
+		// last response, which only this thread hands over)
+		pthread_mutex_lock(&req_lock);
+		if (((it = pending_reqs.find(tag)) == pending_reqs.end()) ||
+			(it->second->resp_seq + it->second->resps.size() >=
+			 it->second->nresps)) {
+			pthread_mutex_unlock(&req_lock);
+			logMessage(LOG_ERROR_LEVEL,
+					   "Dropping server response for bad request [%u]\n", tag);
+			continue;
+		}
+		req = it->second;
+		aad_ids[0] = tag;
+		aad_ids[1] = req->resp_seq + (uint32_t)req->resps.size();
+		pthread_mutex_unlock(&req_lock);
+
+		// open the response, then hand it to the request
+		try {
+			bfsFlexibleBuffer aad((char *)aad_ids, sizeof(aad_ids));
+			recvContext->decryptData(*resp, &aad, true);
+		} catch (bfsCryptoError *err) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed opening server response for request [%u]: %s\n",
+					   tag, err->getMessage().c_str());
+			delete err;
+			delete resp;
+			resp = NULL;
+		}
+		pthread_mutex_lock(&req_lock);
+		req->resps.push_back(resp);
+		pthread_cond_signal(&req->cond);
+		pthread_mutex_unlock(&req_lock);
+		resp = NULL;
+	}
+	delete resp;
+
+	// wake the requests still waiting so they fail
+	pthread_mutex_lock(&req_lock);
+	recv_failed = true;
+	for (it = pending_reqs.begin(); it != pending_reqs.end(); it++)
+		pthread_cond_signal(&it->second->cond);
+	pthread_mutex_unlock(&req_lock);
+
+	return NULL;
+}
+
 /**
  * @brief Initializes the utils, config, and crypto layers. Then finishes
  * initializing the client so the FUSE entry point can be called.
@@ -2688,6 +2701,7 @@ int client_init() {
 		// Now get the security context (keys etc.)
 		sacfg = config->getSubItemByName("cl_serv_sa");
 		secContext = new bfsSecAssociation(sacfg);
+		recvContext = new bfsSecAssociation(sacfg);
 
 		// get common configs
 		config = bfsConfigLayer::getConfigItem(BFS_COMMON_CONFIG);
@@ -2709,6 +2723,46 @@ int client_init() {
 	return BFS_SUCCESS;
 }
 
+/**
+ * @brief Connects to the server and starts the receiver thread that dispatches
+ * the responses to the callers by their tags.
+ *
+ * @return int: BFS_SUCCESS if success, BFS_FAILURE if failure
+ */
+static int client_connect() {
+	client = bfsNetworkConnection::bfsChannelFactory(bfs_server_ip,
+													 bfs_server_port);
+	if (client->connect() != BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL, "Failed connecting to server [%s:%d]\n",
+				   bfs_server_ip.c_str(), bfs_server_port);
+		return BFS_FAILURE;
+	}
+	logMessage(CLIENT_LOG_LEVEL, "Connected to server [%s:%d]\n",
+			   bfs_server_ip.c_str(), bfs_server_port);
+
+	mux = new bfsConnectionMux();
+	mux->addConnection(client);
+
+	if ((pthread_mutex_init(&mux_lock, NULL) != 0) ||
+		(pthread_mutex_init(&req_lock, NULL) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Client failed to initialize mux lock\n");
+		return BFS_FAILURE;
+	}
+
+	// Start the receiver thread, responses are dispatched by their tags
+	send_seq = 0;
+	recv_failed = false;
+	recv_running = true;
+	if (pthread_create(&recv_thread, NULL, client_recv_worker_entry, NULL) !=
+		0) {
+		recv_running = false;
+		logMessage(LOG_ERROR_LEVEL, "Failed to spawn receiver thread\n");
+		return BFS_FAILURE;
+	}
+
+	return BFS_SUCCESS;
+}
+
 /**
  * @brief Cleans up client data structures on a fatal failure.
  *
@@ -2716,9 +2770,15 @@ int client_init() {
  */
 static void cleanup() {
 	logMessage(CLIENT_LOG_LEVEL, "Cleaning up client\n");
+	if (recv_running) {
+		recv_running = false;
+		if (pthread_join(recv_thread, NULL) != 0)
+			logMessage(LOG_ERROR_LEVEL, "Failed to join receiver thread\n");
+	}
 	mux->removeConnection(client);
 	client->disconnect();
 	delete secContext;
+	delete recvContext;
 	delete client;
 	delete mux;
 }
@@ -2838,4 +2898,242 @@ void write_client_latencies() {
 	logMessage(CLIENT_LOG_LEVEL,
 			   "Write latencies (network recvs, us, %lu records):\n[%s]\n",
 			   c_write__net_recv_lats.size(), __c_write__net_recv_lats.c_str());
-}
\ No newline at end of file
+}
+/**
+ * The stub server of client_dispatch_utest, which answers the requests on its
+ * one connection in pairs and sends each pair's responses back swapped.
+ */
+typedef struct {
+	bfsNetworkConnection *server; /* the listening connection */
+	bfsSecAssociation *sa;		  /* opens the requests, seals the responses */
+	uint32_t nreqs;				  /* the number of requests to answer */
+	int ret;					  /* BFS_SUCCESS if all were answered */
+} bfs_client_stub_t;
+
+/**
+ * A caller of client_dispatch_utest, which keeps one request in flight at a
+ * time and checks each response echoes the value its request carried.
+ */
+typedef struct {
+	uint32_t id;   /* the caller's id (the high half of its values) */
+	uint32_t reqs; /* the number of requests to make */
+	int ret;	   /* BFS_SUCCESS if every response was the caller's own */
+} bfs_client_caller_t;
+
+#define BFS_CLIENT_UTEST_CALLERS 2 /* one request each is a pair to swap */
+#define BFS_CLIENT_UTEST_REQS 64   /* requests made by each caller */
+#define BFS_CLIENT_UTEST_WAIT 30   /* secs to wait before failing the test */
+
+/**
+ * @brief Runs the stub server: accepts the client, then opens each pair of
+ * requests and answers the second one first, echoing the value carried by each
+ * request (sealed as the server would, under the tag and sequence 0).
+ *
+ * @param arg: the stub (bfs_client_stub_t)
+ * @return void*: unused
+ */
+static void *client_stub_server_entry(void *arg) {
+	bfs_client_stub_t *stub = (bfs_client_stub_t *)arg;
+	bfsNetworkConnection *conn;
+	bfsFlexibleBuffer pkts[2];
+	uint32_t tags[2], aad_ids[2], r;
+	int32_t mtype, otype, bytes_sent;
+	uint64_t value;
+	int i;
+
+	stub->ret = BFS_FAILURE;
+	if ((conn = stub->server->accept()) == NULL)
+		return NULL;
+
+	try {
+		for (r = 0; r < stub->nreqs; r += 2) {
+			// open the pair of requests, building their responses
+			for (i = 0; i < 2; i++) {
+				if (conn->recvPacketizedBuffer(pkts[i]) <=
+					(int32_t)sizeof(uint32_t))
+					throw std::runtime_error("Stub server recv failed\n");
+				pkts[i] >> tags[i];
+				bfsFlexibleBuffer aad((char *)&tags[i], sizeof(uint32_t));
+				stub->sa->decryptData(pkts[i], &aad, true);
+				pkts[i] >> mtype >> otype >> value;
+				if (mtype != TO_SERVER)
+					throw std::runtime_error("Stub server bad request\n");
+
+				mtype = FROM_SERVER;
+				pkts[i].resetWithAlloc(0, 0,
+									   sizeof(mtype) + sizeof(otype) +
+										   sizeof(value),
+									   0);
+				pkts[i] << value << otype << mtype;
+				aad_ids[0] = tags[i];
+				aad_ids[1] = 0;
+				bfsFlexibleBuffer resp_aad((char *)aad_ids, sizeof(aad_ids));
+				stub->sa->encryptData(pkts[i], &resp_aad, true);
+				pkts[i] << tags[i];
+			}
+
+			// answer them out of order
+			for (i = 1; i >= 0; i--) {
+				bytes_sent = conn->sendPacketizedBuffer(pkts[i]);
+				if ((bytes_sent < 0) ||
+					((uint32_t)bytes_sent != pkts[i].getLength()))
+					throw std::runtime_error("Stub server send failed\n");
+			}
+		}
+		stub->ret = BFS_SUCCESS;
+	} catch (bfsCryptoError *err) {
+		logMessage(LOG_ERROR_LEVEL, "Stub server crypto failure: %s\n",
+				   err->getMessage().c_str());
+		delete err;
+	} catch (std::runtime_error &re) {
+		logMessage(LOG_ERROR_LEVEL, re.what());
+	}
+
+	conn->disconnect();
+	delete conn;
+	return NULL;
+}
+
+/**
+ * @brief Runs a caller: sends its requests one at a time, checking that each
+ * response handed back carries the value of the caller's own request.
+ *
+ * @param arg: the caller (bfs_client_caller_t)
+ * @return void*: unused
+ */
+static void *client_utest_caller_entry(void *arg) {
+	bfs_client_caller_t *caller = (bfs_client_caller_t *)arg;
+	int32_t mtype, otype = CLIENT_INIT_OP,
+				   len = (int32_t)(sizeof(mtype) + sizeof(otype) +
+								   sizeof(uint64_t));
+	bfsFlexibleBuffer spkt, rpkt;
+	uint64_t value, echoed;
+	uint32_t i, tag;
+
+	caller->ret = BFS_FAILURE;
+	try {
+		for (i = 0; i < caller->reqs; i++) {
+			value = ((uint64_t)caller->id << 32) | i;
+			mtype = TO_SERVER;
+			spkt.resetWithAlloc(0, 0, len, 0);
+			spkt << value << otype << mtype;
+			tag = send_msgp(spkt);
+
+			recv_msgp(rpkt, tag, len, FROM_SERVER, CLIENT_INIT_OP, false);
+			rpkt >> echoed;
+			if (echoed != value) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Caller [%u] request [%u] got the response for "
+						   "%lx, want %lx\n",
+						   caller->id, tag, echoed, value);
+				break;
+			}
+		}
+		if (i == caller->reqs)
+			caller->ret = BFS_SUCCESS;
+	} catch (bfsCryptoError *err) {
+		logMessage(LOG_ERROR_LEVEL, "Caller [%u] crypto failure: %s\n",
+				   caller->id, err->getMessage().c_str());
+		delete err;
+	} catch (bfsUtilError *err) {
+		logMessage(LOG_ERROR_LEVEL, err->getMessage().c_str());
+		delete err;
+	} catch (std::runtime_error &re) {
+		logMessage(LOG_ERROR_LEVEL, re.what());
+	}
+
+	// on failure, drop the connection so the other callers and the stub
+	// server fail rather than wait on requests that will never pair up
+	if (caller->ret != BFS_SUCCESS)
+		shutdown(client->getSocket(), SHUT_RDWR);
+	return NULL;
+}
+
+/**
+ * @brief Tests dispatching responses that come back out of order. A stub
+ * server on a local port answers the requests in pairs, second one first,
+ * while several callers keep requests in flight; each caller must get the
+ * response to its own request. Must run after client_init (for the SAs) and
+ * in place of bfs_init.
+ *
+ * @param port: the local port to run the stub server on
+ * @return int: BFS_SUCCESS if success, BFS_FAILURE if failure
+ */
+int client_dispatch_utest(unsigned short port) {
+	bfs_client_caller_t callers[BFS_CLIENT_UTEST_CALLERS];
+	pthread_t stub_thread, caller_threads[BFS_CLIENT_UTEST_CALLERS];
+	bfs_client_stub_t stub;
+	bfsCfgItem *config;
+	struct timespec deadline;
+	int i, ret = BFS_SUCCESS;
+
+	// Start the stub server, sealing as the server does
+	config = bfsConfigLayer::getConfigItem(BFS_CLIENT_LAYER_CONFIG);
+	stub.sa = new bfsSecAssociation(config->getSubItemByName("cl_serv_sa"));
+	stub.sa->setIVContext(true);
+	stub.nreqs = BFS_CLIENT_UTEST_CALLERS * BFS_CLIENT_UTEST_REQS;
+	stub.ret = BFS_FAILURE;
+	stub.server = bfsNetworkConnection::bfsChannelFactory(port);
+	if (stub.server->connect() != BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL, "Failed starting stub server on [%d]\n",
+				   port);
+		delete stub.server;
+		delete stub.sa;
+		return BFS_FAILURE;
+	}
+	if (pthread_create(&stub_thread, NULL, client_stub_server_entry, &stub) !=
+		0) {
+		logMessage(LOG_ERROR_LEVEL, "Failed to spawn stub server thread\n");
+		stub.server->disconnect();
+		delete stub.server;
+		delete stub.sa;
+		return BFS_FAILURE;
+	}
+
+	// Connect to it, then run the callers against it
+	bfs_server_ip = "127.0.0.1";
+	bfs_server_port = port;
+	if (client_connect() != BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL, "Failed connecting to stub server\n");
+		abort();
+	}
+	for (i = 0; i < BFS_CLIENT_UTEST_CALLERS; i++) {
+		callers[i].id = (uint32_t)i;
+		callers[i].reqs = BFS_CLIENT_UTEST_REQS;
+		callers[i].ret = BFS_FAILURE;
+		if (pthread_create(&caller_threads[i], NULL, client_utest_caller_entry,
+						   &callers[i]) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Failed to spawn caller thread\n");
+			abort();
+		}
+	}
+	// a lost response leaves its caller waiting, so drop the connection
+	// (failing the waiting callers) if they do not finish in time
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += BFS_CLIENT_UTEST_WAIT;
+	for (i = 0; i < BFS_CLIENT_UTEST_CALLERS; i++) {
+		if (pthread_timedjoin_np(caller_threads[i], NULL, &deadline) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "Caller [%d] timed out\n", i);
+			shutdown(client->getSocket(), SHUT_RDWR);
+			pthread_join(caller_threads[i], NULL);
+		}
+		if (callers[i].ret != BFS_SUCCESS)
+			ret = BFS_FAILURE;
+	}
+
+	// Disconnect, then collect the stub server
+	cleanup();
+	pthread_join(stub_thread, NULL);
+	if (stub.ret != BFS_SUCCESS)
+		ret = BFS_FAILURE;
+	stub.server->disconnect();
+	delete stub.server;
+	delete stub.sa;
+
+	if (ret == BFS_SUCCESS) {
+		logMessage(LOG_INFO_LEVEL,
+				   "Dispatched %u out of order responses to %d callers\n",
+				   stub.nreqs, BFS_CLIENT_UTEST_CALLERS);
+	}
+	return ret;
+}
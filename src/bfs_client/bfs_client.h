@@ -90,4 +90,7 @@ off_t bfs_lseek(const char *, off_t, int, struct fuse_file_info *);
 /* Initialize the client subsystem */
 int client_init();
 
+/* Test dispatching responses that arrive out of order (after client_init) */
+int client_dispatch_utest(unsigned short);
+
 #endif /* BFS_CLIENT_H */
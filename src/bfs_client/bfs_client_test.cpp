@@ -80,6 +80,7 @@ const int fsz = 1048576;
 // const int fsz = 1039872;
 
 const int iterations_per_sample = 8;
+const unsigned short dispatch_test_port = 50100; // stub server for -d
 const int op_sz = fsz / iterations_per_sample;
 const int write_sz = op_sz, read_sz = op_sz;
 
@@ -330,7 +331,14 @@ std::string vec_to_str(std::vector<double> &v) {
 }
 
 int main(int argc, char **argv) {
-	(void)argc;
-	(void)argv;
+	// -d tests dispatching out of order responses (against a stub server)
+	if ((argc > 1) && (strcmp(argv[1], "-d") == 0)) {
+		if (client_init() != BFS_SUCCESS) {
+			logMessage(LOG_ERROR_LEVEL, "Failed client_init\n");
+			return BFS_FAILURE;
+		}
+		return client_dispatch_utest(dispatch_test_port);
+	}
+
 	return bfs_unit__bfs_client();
 }
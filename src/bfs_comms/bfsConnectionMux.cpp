@@ -8,6 +8,8 @@
 #include "bfs_enclave_t.h" /* For ocalls */
 #include "sgx_trts.h"
 #else
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -23,6 +25,10 @@
 
 int64_t num_file_worker_threads = -1;
 
+// The most events taken from the epoll instance per wait (the rest stay
+// queued for the next wait)
+#define BFS_MUX_MAX_EVENTS 256
+
 /**
  * @brief The constructor for the class
  *
@@ -30,7 +36,15 @@ int64_t num_file_worker_threads = -1;
  * @return none
  */
 
-bfsConnectionMux::bfsConnectionMux(void) {
+bfsConnectionMux::bfsConnectionMux(void) : epfd(-1) {
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Create the epoll instance the connections are registered with
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "MUX epoll_create1() failed : [%s]",
+				   strerror(errno));
+	}
+#endif
 
 	// Return, no return code
 	return;
@@ -44,15 +58,80 @@ bfsConnectionMux::bfsConnectionMux(void) {
  */
 bfsConnectionMux::~bfsConnectionMux(void) {
 
+#ifndef __BFS_ENCLAVE_MODE
+	// Close the epoll instance
+	if (epfd != -1) {
+		close(epfd);
+	}
+#endif
+
 	// Return, no return code
 	return;
 }
 
 /**
- * @brief Wait for incoming data on all of the connections.
+ * @brief Add the connection object to the list (registering it with the epoll
+ * instance, edge triggered, until removed)
+ *
+ * @param cn - the connection to add
+ * @return none
+ */
+
+void bfsConnectionMux::addConnection(bfsNetworkConnection *cn) {
+
+	connections[cn->getSocket()] = cn;
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Local variables
+	struct epoll_event ev;
+
+	// Register the socket (or update it, if its number was reused before the
+	// old connection was removed)
+	memset(&ev, 0x0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = cn->getSocket();
+	if ((epoll_ctl(epfd, EPOLL_CTL_ADD, cn->getSocket(), &ev) == -1) &&
+		((errno != EEXIST) ||
+		 (epoll_ctl(epfd, EPOLL_CTL_MOD, cn->getSocket(), &ev) == -1))) {
+		logMessage(LOG_ERROR_LEVEL, "MUX epoll_ctl() add failed [%d] : [%s]",
+				   cn->getSocket(), strerror(errno));
+	}
+
+	// It may already have data waiting (which no edge will report)
+	pending.insert(cn->getSocket());
+#endif
+
+	return;
+}
+
+/**
+ * @brief Remove the connection from the list
+ *
+ * @param cn - the connection to remove
+ * @return none
+ */
+
+void bfsConnectionMux::removeConnection(bfsNetworkConnection *cn) {
+
+	connections.erase(cn->getSocket());
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Deregister the socket (closing it would have done so already, so ignore
+	// failures)
+	pending.erase(cn->getSocket());
+	epoll_ctl(epfd, EPOLL_CTL_DEL, cn->getSocket(), NULL);
+#endif
+
+	return;
+}
+
+/**
+ * @brief Wait for incoming data on all of the connections.  The connections
+ * stay registered with the epoll instance, so a wakeup costs the number of
+ * ready connections rather than all of them.
  *
  * @param dready - list to put connections with activity
- * @param wait - the length of time to wai
+ * @param wait - the length of time to wait (msecs, 0 waits until ready)
  * @return 0 if successful, -1 if failure
  */
 
@@ -74,6 +153,19 @@ int bfsConnectionMux::waitConnections(bfsConnectionList &dready, uint16_t wt) {
 		ix++;
 	}
 
+	// Connections with packets already read ahead are ready (the socket
+	// may not say so), do not wait on the others
+	dready.clear();
+	for (auto itc = connections.begin(); itc != connections.end(); itc++) {
+		if (itc->second->getBufferedBytes() > 0) {
+			dready[itc->first] = itc->second;
+		}
+	}
+	if (!dready.empty()) {
+		free(all_socks);
+		return (0);
+	}
+
     // unused
 	// ocall_waitConnections(&ret, wt, socks_count, all_socks, ready_cnt,
 	//                       &ready_socks);
@@ -87,33 +179,42 @@ int bfsConnectionMux::waitConnections(bfsConnectionList &dready, uint16_t wt) {
 
 #else
 	// Local variables
-	fd_set rfds;
-	int nfds, ret;
+	struct epoll_event events[BFS_MUX_MAX_EVENTS];
+	vector<struct pollfd> pfds;
+	vector<int> buffered;
+	set<int>::iterator pit;
 	bfsConnectionList::iterator it;
-	struct timeval wait;
-
-	// Setup and perform the select
-	FD_ZERO(&rfds);
-	nfds = 0;
-	for (it = connections.begin(); it != connections.end(); it++) {
-		if (it->first >= nfds) {
-			nfds = it->first + 1;
-		}
-		FD_SET(it->first, &rfds);
+	int nev, npend = 0, tmo, i;
+
+	if (epfd == -1) {
+		logMessage(LOG_ERROR_LEVEL, "MUX has no epoll instance, failed.");
+		return (-1);
 	}
 
-	// Do the select, wait or not
-	if (wt > 0) {
-		wait.tv_sec = (int)wt / 1000;
-		wait.tv_usec = (wt % 1000) * 1000;
-		ret = select(nfds, &rfds, NULL, NULL, &wait);
-	} else {
-		ret = select(nfds, &rfds, NULL, NULL, NULL);
+	// The sockets reported last time may still be readable (e.g., the caller
+	// took only one packet), so check those without waiting (those with
+	// packets already read ahead are ready, whatever the socket says)
+	for (pit = pending.begin(); pit != pending.end(); pit++) {
+		if (((it = connections.find(*pit)) != connections.end()) &&
+			(it->second->getBufferedBytes() > 0)) {
+			buffered.push_back(*pit);
+			continue;
+		}
+		struct pollfd pfd = {*pit, POLLIN | POLLRDHUP, 0};
+		pfds.push_back(pfd);
+	}
+	if ((!pfds.empty()) &&
+		((npend = poll(pfds.data(), pfds.size(), 0)) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "MUX poll() failed : [%s]",
+				   strerror(errno));
+		return (-1);
 	}
+	npend += (int)buffered.size();
 
-	// Check the return value
-	if (ret == -1) {
-		logMessage(LOG_ERROR_LEVEL, "MUX select() failed : [%s]",
+	// Wait for the new data (not at all if the pending sockets are ready)
+	tmo = (npend > 0) ? 0 : ((wt > 0) ? (int)wt : -1);
+	if ((nev = epoll_wait(epfd, events, BFS_MUX_MAX_EVENTS, tmo)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "MUX epoll_wait() failed : [%s]",
 				   strerror(errno));
 		return (-1);
 	}
@@ -136,9 +237,27 @@ int bfsConnectionMux::waitConnections(bfsConnectionList &dready, uint16_t wt) {
 		}
 	}
 #else
-	for (it = connections.begin(); it != connections.end(); it++) {
-		if (FD_ISSET(it->first, &rfds)) {
+	// Report the sockets with data (an error alone is not data, e.g., the
+	// completions of zero copy sends queued for the sender to reap)
+	pending.clear();
+	for (i = 0; i < (int)buffered.size(); i++) {
+		dready[buffered[i]] = connections[buffered[i]];
+		pending.insert(buffered[i]);
+	}
+	for (i = 0; i < (int)pfds.size(); i++) {
+		if ((pfds[i].revents & (POLLIN | POLLRDHUP | POLLHUP)) &&
+			((it = connections.find(pfds[i].fd)) != connections.end()) &&
+			it->second->checkReadable()) {
+			dready[it->first] = it->second;
+			pending.insert(it->first);
+		}
+	}
+	for (i = 0; i < nev; i++) {
+		if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) &&
+			((it = connections.find(events[i].data.fd)) != connections.end()) &&
+			it->second->checkReadable()) {
 			dready[it->first] = it->second;
+			pending.insert(it->first);
 		}
 	}
 #endif
@@ -161,6 +280,7 @@ int bfsConnectionMux::cleanup(void) {
 	bfsNetworkConnection *con;
 
 	// Keep cleaning up the connections and freeing them
+	pending.clear();
 	while (!connections.empty()) {
 		it = connections.begin();
 		it->second->disconnect();
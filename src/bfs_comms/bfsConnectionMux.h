@@ -19,6 +19,7 @@
 
 // STL-isms
 #include <map>
+#include <set>
 #include <string>
 using namespace std;
 
@@ -58,16 +59,11 @@ public:
 	//
 	// Class Methods
 
+	void addConnection(bfsNetworkConnection *cn);
 	// Add the connectection object to the list
-	void addConnection(bfsNetworkConnection *cn) {
-		connections[cn->getSocket()] = cn;
-		return;
-	}
 
+	void removeConnection(bfsNetworkConnection *cn);
 	// Remove the connection from the list
-	void removeConnection(bfsNetworkConnection *cn) {
-		connections.erase(cn->getSocket());
-	}
 
 	int waitConnections(bfsConnectionList &dataready, uint16_t wait);
 	// Wait for incoming data on all of the connections.
@@ -82,6 +78,13 @@ private:
 	bfsConnectionList connections;
 	// The list of the connections for this MUX
 
+	int epfd;
+	// The epoll instance the connections are registered with (edge triggered)
+
+	set<int> pending;
+	// The sockets last reported ready (they may hold more data, as the epoll
+	// instance will not report them again until new data arrives)
+
 	//
 	// Static Class Variables
 };
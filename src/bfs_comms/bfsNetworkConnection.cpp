@@ -12,12 +12,23 @@
 #else
 #include <arpa/inet.h>
 #include <bfs_rawnet.h>
+#include <sys/socket.h>
+#include <bfs_shmnet.h>
 #endif
 
+#include <string.h>
+
+#include <algorithm>
+
 #include <bfsNetworkConnection.h>
 #include <bfs_log.h>
 
 /* Macros */
+#ifdef __BFS_ENCLAVE_MODE
+// The frame length headers are big endian (no arpa/inet.h in the enclave)
+#define htonl(x) __builtin_bswap32(x)
+#define ntohl(x) __builtin_bswap32(x)
+#endif
 
 /* Globals  */
 
@@ -31,7 +42,8 @@
  */
 
 bfsNetworkConnection::bfsNetworkConnection(void)
-	: chState(SCH_INITIALIZED), chType(SCH_UKNOWN), chPort(0), socket(-1) {
+	: chState(SCH_INITIALIZED), chType(SCH_UKNOWN), chPort(0), socket(-1),
+	  rdBuffer(NULL), rdStart(0), rdEnd(0), chShared(false), shmChannel(NULL) {
 
 	// Return, no return code
 	return;
@@ -46,7 +58,8 @@ bfsNetworkConnection::bfsNetworkConnection(void)
 
 bfsNetworkConnection::~bfsNetworkConnection(void) {
 
-	// Return, no return code
+	// Release the read ahead buffer, no return code
+	free(rdBuffer);
 	return;
 }
 
@@ -68,7 +81,8 @@ int bfsNetworkConnection::connect(void) {
 			SGX_SUCCESS)
 			return 0;
 #else
-		socket = rawnet_connect_server(chPort);
+		socket = chShared ? shmnet_connect_server(chPort)
+						  : rawnet_connect_server(chPort);
 #endif
 		// Attempt to connect to the server (listen socket)
 		if (socket <= 0) {
@@ -90,7 +104,8 @@ int bfsNetworkConnection::connect(void) {
 			SGX_SUCCESS)
 			return -1;
 #else
-		socket = rawnet_client_connect(chAddress.c_str(), chPort);
+		socket = chShared ? shmnet_client_connect(chPort, &shmChannel)
+						  : rawnet_client_connect(chAddress.c_str(), chPort);
 #endif
 		if (socket <= 0) {
 			logMessage(LOG_ERROR_LEVEL,
@@ -130,15 +145,42 @@ int bfsNetworkConnection::disconnect(void) {
 	if ((ocall_status = ocall_rawnet_close(&retval, socket)) != SGX_SUCCESS)
 		return -1;
 #else
-	retval = rawnet_close(socket);
+	if (shmChannel != NULL) {
+		retval = shmnet_close(shmChannel);
+		shmChannel = NULL;
+	} else {
+		retval = rawnet_close(socket);
+	}
 #endif
 	socket = -1;
+	rdStart = rdEnd = 0;
 	setState(SCH_INITIALIZED);
 
 	// Return successfully
 	return (retval);
 }
 
+/**
+ * @brief Shut the channel down both ways, without releasing it: the peer sees
+ * it closed and reads here return closed (e.g., to drop a connection others
+ * are still using, which is then disconnected when they are done)
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsNetworkConnection::shutdown(void) {
+#ifdef __BFS_ENCLAVE_MODE
+	logMessage(LOG_ERROR_LEVEL, "Connection shutdown unsupported in enclave.");
+	return (-1);
+#else
+	if (shmChannel != NULL) {
+		return (shmnet_shutdown(shmChannel));
+	}
+	return (::shutdown(socket, SHUT_RDWR));
+#endif
+}
+
 /**
  * @brief Accept and incoming connection (on server socket)
  *
@@ -151,6 +193,7 @@ bfsNetworkConnection *bfsNetworkConnection::accept(void) {
 
 	// Local variables
 	bfsNetworkConnection *newconn;
+	struct bfs_shmnet *newchan = NULL;
 	int newsock;
 
 #ifdef __BFS_ENCLAVE_MODE
@@ -159,7 +202,8 @@ bfsNetworkConnection *bfsNetworkConnection::accept(void) {
 		SGX_SUCCESS)
 		return NULL;
 #else
-	newsock = rawnet_accept_connection(socket);
+	newsock = chShared ? shmnet_accept_connection(socket, &newchan)
+					   : rawnet_accept_connection(socket);
 #endif
 
 	// Accept the new socket, check for error
@@ -173,6 +217,8 @@ bfsNetworkConnection *bfsNetworkConnection::accept(void) {
 	newconn->chType = SCH_CLIENT;
 	newconn->chState = SCH_CONNECTED;
 	newconn->socket = newsock;
+	newconn->chShared = chShared;
+	newconn->shmChannel = newchan;
 	return (newconn);
 }
 
@@ -198,7 +244,12 @@ int bfsNetworkConnection::sendDataL(uint32_t len, char *buf) {
 		SGX_SUCCESS)
 		return -1;
 #else
-	ret = rawnet_send_bytes(socket, len, buf);
+	if (shmChannel != NULL) {
+		struct iovec iov = {buf, len};
+		ret = shmnet_send_iov(shmChannel, &iov, 1);
+	} else {
+		ret = rawnet_send_bytes(socket, len, buf);
+	}
 #endif
 
 	if (ret == 0) {
@@ -224,29 +275,8 @@ int bfsNetworkConnection::sendDataL(uint32_t len, char *buf) {
 
 int bfsNetworkConnection::recvDataL(uint32_t len, char *buf) {
 
-	// Send the data, check for closed and errored comms
-	int ret;
-
-#ifdef __BFS_ENCLAVE_MODE
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_rawnet_read_bytes(&ret, socket, len, buf)) !=
-		SGX_SUCCESS)
-		return -1;
-#else
-	ret = rawnet_read_bytes(socket, len, buf);
-#endif
-
-	if (ret == 0) {
-		chState = SCH_CLOSED;
-		return (0);
-	}
-	if (ret < 0) {
-		chState = SCH_ERRORED;
-		return (0);
-	}
-
-	// Return the number of bytes sent
-	return (ret);
+	// Receive the data (through the read ahead)
+	return (readFramed(len, buf));
 }
 
 /**
@@ -259,32 +289,8 @@ int bfsNetworkConnection::recvDataL(uint32_t len, char *buf) {
 
 int bfsNetworkConnection::sendPacketizedDataL(bfs_size_t len, char *buf) {
 
-	// Return the number of bytes received
-	int ret;
-
-// Do the send, check for closed socket or
-#ifdef __BFS_ENCLAVE_MODE
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_sendPacketizedDataHdrL(&ret, socket, len)) !=
-		SGX_SUCCESS)
-		return -1;
-	if (ret == 0) {
-		chState = SCH_CLOSED;
-		return (0);
-	}
-	if (ret < 0) {
-		chState = SCH_ERRORED;
-		return (0);
-	}
-#else
-	uint32_t slen = htonl(len);
-	ret = sendDataL((unsigned short)sizeof(uint32_t), (char *)&slen);
-#endif
-
-	if (ret != sizeof(uint32_t)) {
-		return (ret);
-	}
-	return (sendDataL(len, buf));
+	// Send the header and data together (no headroom to put the header in)
+	return (sendFramed(len, buf, 0));
 }
 
 /**
@@ -297,37 +303,19 @@ int bfsNetworkConnection::sendPacketizedDataL(bfs_size_t len, char *buf) {
 
 int bfsNetworkConnection::recvPacketizedDataL(bfs_size_t len, char *buf) {
 
-	// Return the number of bytes received
-	uint32_t slen;
-
-#ifdef __BFS_ENCLAVE_MODE
-	uint32_t uret;
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_recvPacketizedDataHdrL((uint32_t *)&uret,
-													 socket)) != SGX_SUCCESS)
-		return -1;
-	if (uret == 0) {
-		chState = SCH_ERRORED;
-		return (0);
-	}
-	slen = uret;
-#else
+	// Receive the length header, check for bad return
+	bfs_size_t slen;
 	int ret;
-	// Do the recv, check for bad return
-	ret = recvDataL((unsigned short)sizeof(uint32_t), (char *)&slen);
-	if (ret != sizeof(uint32_t)) {
+	if ((ret = recvPacketizedLength(slen)) != (int)sizeof(bfs_size_t)) {
 		return (ret);
 	}
 
 	// Make sure there is enough memory to receive data
-	slen = ntohl(slen);
-#endif
-
 	if (len < slen) {
 		logMessage(LOG_ERROR_LEVEL, "Buffer too short on packetized read.");
 		return (-1);
 	}
-	return (recvDataL(slen, buf));
+	return (readFramed(slen, buf));
 }
 
 //
@@ -350,7 +338,12 @@ int bfsNetworkConnection::sendBuffer(bfsFlexibleBuffer &buf) {
 			 &ret, socket, buf.getLength(), buf.getBuffer())) != SGX_SUCCESS)
 		return 0;
 #else
-	ret = rawnet_send_bytes(socket, buf.getLength(), buf.getBuffer());
+	if (shmChannel != NULL) {
+		struct iovec iov = {buf.getBuffer(), buf.getLength()};
+		ret = shmnet_send_iov(shmChannel, &iov, 1);
+	} else {
+		ret = rawnet_send_bytes(socket, buf.getLength(), buf.getBuffer());
+	}
 #endif
 
 	if (ret == 0) {
@@ -375,34 +368,16 @@ int bfsNetworkConnection::sendBuffer(bfsFlexibleBuffer &buf) {
  */
 
 int bfsNetworkConnection::recvBuffer(bfsFlexibleBuffer &buf, bfs_size_t len) {
-	// Send the data, check for closed and errored comms
-	int ret;
-	buf.resetWithAlloc(len);
-
-#ifdef __BFS_ENCLAVE_MODE
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_rawnet_read_bytes(
-			 &ret, socket, len, buf.getBuffer())) != SGX_SUCCESS)
-		return -1;
-#else
-	ret = rawnet_read_bytes(socket, len, buf.getBuffer());
-#endif
 
-	if (ret == 0) {
-		chState = SCH_CLOSED;
-		return (0);
-	}
-	if (ret < 0) {
-		chState = SCH_ERRORED;
-		return (0);
-	}
-
-	// Return the number of bytes received
-	return (ret);
+	// Size the buffer, receive the data into it
+	buf.resetWithAlloc(len);
+	return (readFramed(len, buf.getBuffer()));
 }
 
 /**
  * @brief Send data over the connection (with header) using a 32-bit length.
+ * The header goes in the headroom of the buffer, so it is sent with the data
+ * in one call.
  *
  * @param len - the length of the data to send
  * @param buf - the buffer to send (32 bit)
@@ -410,71 +385,243 @@ int bfsNetworkConnection::recvBuffer(bfsFlexibleBuffer &buf, bfs_size_t len) {
  */
 
 int bfsNetworkConnection::sendPacketizedBuffer(bfsFlexibleBuffer &buf) {
+	return (sendFramed(buf.getLength(), buf.getBuffer(), buf.getHLength()));
+}
+
+/**
+ * @brief Receive data from the connection (with header) using a 32-bit length.
+ *
+ * @param buf - the buffer object to receive on
+ * @return int : bytes recved if success, -1 is failure
+ */
+
+int bfsNetworkConnection::recvPacketizedBuffer(bfsFlexibleBuffer &buf) {
 	// Return the number of bytes received
+	bfs_size_t slen;
 	int ret;
 
-#ifdef __BFS_ENCLAVE_MODE
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_sendPacketizedDataHdrL(
-			 &ret, socket, buf.getLength())) != SGX_SUCCESS)
-		return -1;
-	if (ret == 0) {
-		chState = SCH_CLOSED;
-		return (0);
+	// Receive the length header, then the body of the packet
+	if ((ret = recvPacketizedLength(slen)) != (int)sizeof(bfs_size_t)) {
+		return (ret);
 	}
-	if (ret < 0) {
-		chState = SCH_ERRORED;
-		return (0);
+	return (recvBuffer(buf, slen));
+}
+
+/**
+ * @brief Receive only the length header of a packetized buffer.  This allows
+ * the caller to peek at the front of the packet (e.g., a request tag) before
+ * deciding which buffer to receive the body into.
+ *
+ * @param len - the length of the packet body (host order)
+ * @return int : sizeof(bfs_size_t) if success, 0 if closed, -1 is failure
+ */
+
+int bfsNetworkConnection::recvPacketizedLength(bfs_size_t &len) {
+
+	// Do the recv, check for bad return
+	bfs_size_t slen;
+	int ret = readFramed((bfs_size_t)sizeof(bfs_size_t), (char *)&slen);
+	if (ret != (int)sizeof(bfs_size_t)) {
+		return (ret);
+	}
+	len = ntohl(slen);
+
+	// Return the size of the header
+	return ((int)sizeof(bfs_size_t));
+}
+
+/**
+ * @brief Get the bytes received and not yet read: those read ahead, or those
+ * waiting in the ring of a shared memory connection (the socket will not
+ * report them as readable)
+ *
+ * @param none
+ * @return bfs_size_t : the number of bytes
+ */
+
+bfs_size_t bfsNetworkConnection::getBufferedBytes(void) {
+#ifndef __BFS_ENCLAVE_MODE
+	if (shmChannel != NULL) {
+		return ((bfs_size_t)shmnet_available(shmChannel));
 	}
-#else
-	// Do the length send, check for closed socket
-	bfs_size_t slen = htonl(buf.getLength());
-	ret = sendDataL(sizeof(bfs_size_t), (char *)&slen);
 #endif
+	return (rdEnd - rdStart);
+}
 
-	// Check for an error, send if it looks good
-	if (ret != sizeof(bfs_size_t)) {
-		return (ret);
+/**
+ * @brief Check if a socket reported readable has something to read.  The
+ * doorbell of a shared memory connection is rung for every send, so it can
+ * be left rung after the bytes were read (it is cleared here if so).
+ *
+ * @param none
+ * @return bool : true if there is something to read (or a close)
+ */
+
+bool bfsNetworkConnection::checkReadable(void) {
+#ifndef __BFS_ENCLAVE_MODE
+	if (shmChannel != NULL) {
+		return (shmnet_ready(shmChannel) == 1);
 	}
-	return (sendBuffer(buf));
+#endif
+	return (true);
 }
 
+//
+// Private class methods
+
 /**
- * @brief Receive data from the connection (with header) using a 32-bit length.
+ * @brief Receive bytes through the read ahead buffer: what was read ahead is
+ * taken first, then one read pulls in as much as has arrived (e.g., the
+ * header and body of a frame, and the frames after it).  Remainders too large
+ * for the buffer are read straight into place.
  *
- * @param len - the length of the data to recv (32 bit)
- * @param buf - maximum bytes to receive
- * @return int : bytes recved if success, -1 is failure
+ * @param len - the length of the data to recv
+ * @param buf - the buffer to receive into
+ * @return int : bytes recved if success, 0 if closed or failed
  */
 
-int bfsNetworkConnection::recvPacketizedBuffer(bfsFlexibleBuffer &buf) {
-	// Return the number of bytes received
-	bfs_size_t slen;
+int bfsNetworkConnection::readFramed(bfs_size_t len, char *buf) {
 
-#ifdef __BFS_ENCLAVE_MODE
-	uint32_t uret;
-	int32_t ocall_status = 0;
-	if ((ocall_status = ocall_recvPacketizedDataHdrL((uint32_t *)&uret,
-													 socket)) != SGX_SUCCESS)
-		return -1;
-	if (uret == 0) {
-		chState = SCH_ERRORED;
-		return (0);
+	// Local variables
+	bfs_size_t got, n = 0;
+	int ret;
+
+	// Take what was read ahead
+	got = min(len, rdEnd - rdStart);
+	if (got > 0) {
+		memcpy(buf, &rdBuffer[rdStart], got);
+		rdStart += got;
 	}
-	slen = uret;
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Shared memory is read straight from the ring (no read ahead)
+	if (shmChannel != NULL) {
+		if ((ret = shmnet_read_bytes(shmChannel, (int)len, buf)) <= 0) {
+			chState = (ret == 0) ? SCH_CLOSED : SCH_ERRORED;
+			return (0);
+		}
+		return ((int)len);
+	}
+#endif
+
+	// Read the rest (ahead, unless it is large)
+	while (got < len) {
+		if (len - got >= BFS_NETCONN_READ_AHEAD) {
+#ifdef __BFS_ENCLAVE_MODE
+			if (ocall_rawnet_read_bytes(&ret, socket, len - got, &buf[got]) !=
+				SGX_SUCCESS) {
+				ret = -1;
+			}
 #else
-	int ret;
-	// Do the recv, check for bad return
-	ret = recvDataL((unsigned short)sizeof(uint32_t), (char *)&slen);
-	if (ret != sizeof(uint32_t)) {
-		return (ret);
+			ret = rawnet_read_bytes(socket, (int)(len - got), &buf[got]);
+#endif
+			n = len - got;
+		} else {
+			if ((rdBuffer == NULL) &&
+				((rdBuffer = (char *)malloc(BFS_NETCONN_READ_AHEAD)) == NULL)) {
+				logMessage(LOG_ERROR_LEVEL, "Read ahead alloc failed.");
+				ret = -1;
+			} else {
+#ifdef __BFS_ENCLAVE_MODE
+				if (ocall_rawnet_read_available(&ret, socket,
+												BFS_NETCONN_READ_AHEAD,
+												rdBuffer) != SGX_SUCCESS) {
+					ret = -1;
+				}
+#else
+				ret = rawnet_read_available(socket, BFS_NETCONN_READ_AHEAD,
+											rdBuffer);
+#endif
+			}
+			if (ret > 0) {
+				rdEnd = (bfs_size_t)ret;
+				n = rdStart = min(len - got, rdEnd);
+				memcpy(&buf[got], rdBuffer, n);
+			}
+		}
+
+		// Check for closed and errored comms
+		if (ret == 0) {
+			chState = SCH_CLOSED;
+			return (0);
+		}
+		if (ret < 0) {
+			chState = SCH_ERRORED;
+			return (0);
+		}
+		got += n;
 	}
 
-	// Make sure there is enough memory to receive data
-	slen = ntohl(slen);
+	// Return the number of bytes received
+	return ((int)len);
+}
+
+/**
+ * @brief Send a length header and body together: the header is written into
+ * the headroom in front of the body (if there is room) and sent with it in
+ * one call, else the two are gathered into one send.
+ *
+ * @param len - the length of the body
+ * @param buf - the body to send
+ * @param hroom - the bytes of headroom in front of the body
+ * @return int : bytes of the body sent if success, 0 if closed or failed
+ */
+
+int bfsNetworkConnection::sendFramed(bfs_size_t len, char *buf,
+									 bfs_size_t hroom) {
+
+	// Local variables
+	bfs_size_t slen = htonl(len);
+	int ret;
+
+	// Send the header from the headroom with the body
+	if (hroom >= sizeof(bfs_size_t)) {
+		memcpy(buf - sizeof(bfs_size_t), &slen, sizeof(bfs_size_t));
+#ifdef __BFS_ENCLAVE_MODE
+		if (ocall_rawnet_send_bytes(&ret, socket, len + sizeof(bfs_size_t),
+									buf - sizeof(bfs_size_t)) != SGX_SUCCESS) {
+			return (-1);
+		}
+#else
+		if (shmChannel != NULL) {
+			struct iovec iov = {buf - sizeof(bfs_size_t),
+								len + sizeof(bfs_size_t)};
+			ret = shmnet_send_iov(shmChannel, &iov, 1);
+		} else {
+			ret = rawnet_send_bytes(socket, (int)(len + sizeof(bfs_size_t)),
+									buf - sizeof(bfs_size_t));
+		}
+#endif
+	} else {
+#ifdef __BFS_ENCLAVE_MODE
+		// No gathered send from the enclave, send them in turn
+		if ((ocall_rawnet_send_bytes(&ret, socket, sizeof(bfs_size_t),
+									 (char *)&slen) != SGX_SUCCESS) ||
+			((ret == (int)sizeof(bfs_size_t)) &&
+			 (ocall_rawnet_send_bytes(&ret, socket, len, buf) !=
+			  SGX_SUCCESS))) {
+			return (-1);
+		}
+		ret = (ret == (int)len) ? (int)(len + sizeof(bfs_size_t)) : ret;
+#else
+		struct iovec iov[2] = {{&slen, sizeof(bfs_size_t)}, {buf, len}};
+		ret = (shmChannel != NULL) ? shmnet_send_iov(shmChannel, iov, 2)
+								   : rawnet_send_iov(socket, iov, 2);
 #endif
+	}
 
-	return (recvBuffer(buf, slen));
+	// Check for closed and errored comms
+	if (ret == 0) {
+		chState = SCH_CLOSED;
+		return (0);
+	}
+	if (ret < 0) {
+		chState = SCH_ERRORED;
+		return (0);
+	}
+
+	// Return the number of bytes of the body sent
+	return (ret - (int)sizeof(bfs_size_t));
 }
 
 //
@@ -490,30 +637,50 @@ int bfsNetworkConnection::recvPacketizedBuffer(bfsFlexibleBuffer &buf) {
 bfsNetworkConnection *
 bfsNetworkConnection::bfsChannelFactory(string addr, unsigned short pt) {
 
+	// The shared memory transport is only available outside the enclave
+#ifdef __BFS_ENCLAVE_MODE
+	if (addr == BFS_NETCONN_SHM_ADDRESS) {
+		logMessage(LOG_ERROR_LEVEL, "No shared memory connections in enclave.");
+		return (NULL);
+	}
+#endif
+
 	// Create, then connect the socket
 	bfsNetworkConnection *conn = new bfsNetworkConnection();
 	conn->chType = SCH_CLIENT;
 	conn->chAddress = addr;
 	conn->chPort = pt;
+	conn->chShared = (addr == BFS_NETCONN_SHM_ADDRESS);
 
 	// Return the connected client socket
 	return (conn);
 }
 
 /**
- * @brief Server factory (INET domain)
+ * @brief Server factory (INET domain, or shared memory for clients on the
+ * same host connecting to the BFS_NETCONN_SHM_ADDRESS address)
  *
  * @param pt - the local port to bind to
+ * @param shared - flag indicating to listen for shared memory connections
  * @return int : 0 is success, -1 is failure
  */
 
 bfsNetworkConnection *
-bfsNetworkConnection::bfsChannelFactory(unsigned short pt) {
+bfsNetworkConnection::bfsChannelFactory(unsigned short pt, bool shared) {
+
+	// The shared memory transport is only available outside the enclave
+#ifdef __BFS_ENCLAVE_MODE
+	if (shared) {
+		logMessage(LOG_ERROR_LEVEL, "No shared memory connections in enclave.");
+		return (NULL);
+	}
+#endif
 
 	// Create, then connect the socket
 	bfsNetworkConnection *conn = new bfsNetworkConnection();
 	conn->chType = SCH_SERVER;
 	conn->chPort = pt;
+	conn->chShared = shared;
 
 	// Return the connected client socket
 	return (conn);
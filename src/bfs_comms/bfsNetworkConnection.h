@@ -20,9 +20,20 @@ using namespace std;
 #include <bfs_common.h>
 #include <bfs_rawnet.h>
 
+// The shared memory connection (non-enclave only, see bfs_shmnet.h)
+struct bfs_shmnet;
+
 //
 // Class definitions
 
+// The bytes a connection reads ahead of the frames it receives (so one read
+// pulls in many small frames, larger bodies are read in place)
+#define BFS_NETCONN_READ_AHEAD (64 * 1024)
+
+// The client address selecting the shared memory transport (to a server on
+// the same host, listening for the port with a shared server factory)
+#define BFS_NETCONN_SHM_ADDRESS "shm"
+
 // These are the states the channel can be in
 typedef enum {
 	SCH_INITIALIZED,
@@ -62,6 +73,10 @@ public:
 	int disconnect(void);
 	// Disconnect the channel
 
+	int shutdown(void);
+	// Shut the channel down both ways, without releasing it (the peer sees
+	// it closed)
+
 	bfsNetworkConnection *accept(void);
 	// Accept and incoming connection (on server socket)
 
@@ -95,6 +110,9 @@ public:
 	int recvPacketizedBuffer(bfsFlexibleBuffer &buf);
 	// Receive buffer from the connection (with header)
 
+	int recvPacketizedLength(bfs_size_t &len);
+	// Receive only the length header of a packetized buffer
+
 	//
 	// Access methods
 
@@ -107,6 +125,17 @@ public:
 	// Get the socket (handle)
 	int getSocket(void) { return (socket); }
 
+	// Get the bytes read ahead and not yet received (the socket will not
+	// report them as readable)
+	bfs_size_t getBufferedBytes(void);
+
+	// Check if a socket reported readable has something to read (a shared
+	// memory doorbell may be left over from bytes already read)
+	bool checkReadable(void);
+
+	// Check if the connection is over shared memory
+	bool isShared(void) { return (chShared); }
+
 	//
 	// Static methods
 
@@ -114,8 +143,9 @@ public:
 												   unsigned short pt);
 	// Client factory (INET domain), string address
 
-	static bfsNetworkConnection *bfsChannelFactory(unsigned short pt);
-	// Server factory (INET domain)
+	static bfsNetworkConnection *bfsChannelFactory(unsigned short pt,
+												   bool shared = false);
+	// Server factory (INET domain, or shared memory)
 
 protected:
 	// Set the state for the channel
@@ -128,6 +158,12 @@ private:
 	// Default constructor
 	// Note: Force all creation to use factory functions
 
+	int readFramed(bfs_size_t len, char *buf);
+	// Receive bytes through the read ahead buffer
+
+	int sendFramed(bfs_size_t len, char *buf, bfs_size_t hroom);
+	// Send a length header and body together (header in the headroom)
+
 	//
 	// Class Data
 
@@ -146,6 +182,18 @@ private:
 	int socket;
 	// This is the socket for the communication.
 
+	char *rdBuffer;
+	// The bytes read ahead of the frames received (allocated on first use)
+
+	bfs_size_t rdStart, rdEnd;
+	// The bytes of the read ahead buffer not yet received
+
+	bool chShared;
+	// Flag indicating the connection is over shared memory (same host)
+
+	struct bfs_shmnet *shmChannel;
+	// The shared memory connection (client connections, NULL if socket)
+
 	//
 	// Static Class Variables
 };
@@ -36,6 +36,11 @@ int32_t ocall_rawnet_read_bytes(int socket, uint32_t len, char *buf) {
   return rawnet_read_bytes(socket, len, buf);
 }
 
+int32_t ocall_rawnet_read_available(int socket, uint32_t len, char *buf) {
+  // read ahead of the frames (copied into the enclave)
+  return rawnet_read_available(socket, len, buf);
+}
+
 int32_t ocall_sendPacketizedDataHdrL(int socket, uint32_t len) {
   uint32_t slen = htonl(len);
   return rawnet_send_bytes(socket, sizeof(uint32_t), (char *)&slen);
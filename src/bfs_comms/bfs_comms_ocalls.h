@@ -17,6 +17,7 @@ int32_t ocall_rawnet_client_connect(const char *, uint32_t, unsigned short);
 int32_t ocall_rawnet_close(int);
 int32_t ocall_rawnet_send_bytes(int, uint32_t, char *);
 int32_t ocall_rawnet_read_bytes(int, uint32_t, char *);
+int32_t ocall_rawnet_read_available(int, uint32_t, char *);
 
 int32_t ocall_sendPacketizedDataHdrL(int, uint32_t);
 uint32_t ocall_recvPacketizedDataHdrL(int);
@@ -11,14 +11,18 @@
 //
 
 // Include Files
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 // STL includes
+#include <algorithm>
 #include <string>
+#include <vector>
 using namespace std;
 
 // Project Include Files
@@ -28,10 +32,10 @@ using namespace std;
 #include <bfs_util.h>
 
 // Defines
-#define BFSCOMMS_ARGUMENTS "vhl:p:a:r"
+#define BFSCOMMS_ARGUMENTS "vhl:p:a:rm:f:st:"
 #define USAGE                                                                  \
 	"USAGE: bfs_commutest [-h] [-v] [-l <logfile>] [-p <port>] [-a "           \
-	"<address>]\n"                                                             \
+	"<address>] [-m <conns>] [-f <msgs>] [-s] [-t <MB>]\n"                     \
 	"\n"                                                                       \
 	"where:\n"                                                                 \
 	"    -h - help mode (display this message)\n"                              \
@@ -40,14 +44,34 @@ using namespace std;
 	"    -p - port number of server to bind to, client to connect to.\n"       \
 	"    -a - address to connect to (enables client mode).\n"                  \
 	"    -r - enables the \"raw\" communication mode (low level U/O).\n"       \
+	"    -m - benchmark mux wakeups with up to <conns> connections.\n"         \
+	"    -f - benchmark the message rate, <msgs> framed messages per size.\n"  \
+	"    -s - use the shared memory transport for the message rate bench.\n"   \
+	"    -t - benchmark throughput (copy and zero copy), <MB> per size.\n"     \
 	"\n"
 #define BFS_COMM_MAX_TEST_BUF 2048
+#define BFS_COMM_MUX_BENCH_WAKEUPS 10000
+#define BFS_COMM_FRAME_BENCH_WINDOW 32
+#define BFS_COMM_FRAME_BENCH_BYTES 32768
+#define BFS_COMM_TPUT_BENCH_MIN (64 * 1024)
+#define BFS_COMM_TPUT_BENCH_MAX (4 * 1024 * 1024)
+
+// The receiving end of the throughput bench
+typedef struct {
+	bfsNetworkConnection *conn; // The connection to receive on
+	int nmsgs;					// The messages to receive
+	bfs_size_t size;			// The size of the messages
+	int ret;					// The status of the receives
+} bfs_tput_recv_t;
 
 // Global data
 
 // Functional Prototypes
 int bfsServerTest(unsigned short port);
 int bfsClientTest(unsigned short port, string address);
+int bfsMuxBench(unsigned short port, int nconns);
+int bfsFrameBench(unsigned short port, int nmsgs, bool shared);
+int bfsThroughputBench(unsigned short port, int mbytes);
 
 //
 // Functions
@@ -64,10 +88,11 @@ int bfsClientTest(unsigned short port, string address);
 int main(int argc, char *argv[]) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, retval;
+	int ch, verbose = 0, log_initialized = 0, retval, bench = 0, frames = 0,
+		tput = 0;
 	uint16_t port;
 	string address;
-	bool client = false, raw = false;
+	bool client = false, raw = false, shared = false;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, BFSCOMMS_ARGUMENTS)) != -1) {
@@ -102,6 +127,22 @@ int main(int argc, char *argv[]) {
 			raw = true;
 			break;
 
+		case 'm': // Benchmark the mux
+			bench = atoi(optarg);
+			break;
+
+		case 'f': // Benchmark the message rate
+			frames = atoi(optarg);
+			break;
+
+		case 's': // Use shared memory (message rate)
+			shared = true;
+			break;
+
+		case 't': // Benchmark the throughput
+			tput = atoi(optarg);
+			break;
+
 		default: // Default (unknown)
 			fprintf(stderr, "Unknown command line option (%c), aborting.\n",
 					ch);
@@ -126,8 +167,14 @@ int main(int argc, char *argv[]) {
 		enableLogLevels(LOG_INFO_LEVEL);
 	}
 
-	// Run in raw mode or normal mode
-	if (raw == true) {
+	// Run in raw mode or normal mode (or benchmark the mux, message rate)
+	if (bench > 0) {
+		retval = bfsMuxBench(port, bench);
+	} else if (frames > 0) {
+		retval = bfsFrameBench(port, frames, shared);
+	} else if (tput > 0) {
+		retval = bfsThroughputBench(port, tput);
+	} else if (raw == true) {
 		retval = (client == true)
 					 ? rawnet_client_unittest(address.c_str(), port)
 					 : rawnet_server_unittest(port);
@@ -381,4 +428,327 @@ int bfsClientTest(unsigned short port, string address) {
 	// Return successfully, log completion
 	logMessage(LOG_OUTPUT_LEVEL, "Client test shutdown, complete.");
 	return (0);
-}
\ No newline at end of file
+}
+/**
+ * @brief Benchmark the mux wakeups, connecting the connections to ourselves
+ * and timing the wait for data sent on a random one of them as more of them
+ * are added to the mux (the cost should stay flat with the connections)
+ *
+ * @param port - port to listen for the connections on
+ * @param nconns - the most connections to add to the mux
+ * @return 0 if successful, -1 if failure
+ */
+
+int bfsMuxBench(unsigned short port, int nconns) {
+
+	// Local variables
+	vector<bfsNetworkConnection *> clients, servers;
+	bfsNetworkConnection *server, *client;
+	bfsConnectionMux *mux;
+	bfsConnectionList ready;
+	struct timeval start, end;
+	struct rlimit rl;
+	int i, j, size, added, ret = 0;
+	char byte = 0x0;
+	double usecs;
+
+	// Allow the descriptors for both ends of the connections
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	// Listen, connect the connections to ourselves
+	server = bfsNetworkConnection::bfsChannelFactory(port);
+	if (server->connect()) {
+		logMessage(LOG_ERROR_LEVEL, "Server connection failed, bench aborting.");
+		delete server;
+		return (-1);
+	}
+	for (i = 0; i < nconns; i++) {
+		client = bfsNetworkConnection::bfsChannelFactory("127.0.0.1", port);
+		if (client->connect()) {
+			logMessage(LOG_ERROR_LEVEL, "Connection [%d] failed, aborting.", i);
+			delete client;
+			ret = -1;
+			break;
+		}
+		clients.push_back(client);
+		if ((client = server->accept()) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Accept failed, aborting.");
+			ret = -1;
+			break;
+		}
+		servers.push_back(client);
+	}
+
+	// Time the wakeups as the mux grows (doubling the connections)
+	mux = new bfsConnectionMux();
+	added = 0;
+	for (size = 16; (ret == 0) && (added < nconns); size *= 2) {
+		for (; (added < size) && (added < nconns); added++) {
+			mux->addConnection(servers[added]);
+		}
+		usecs = 0.0;
+		for (i = 0; (ret == 0) && (i < BFS_COMM_MUX_BENCH_WAKEUPS); i++) {
+			j = get_random_value(0, added - 1);
+			if (clients[j]->sendDataL(1, &byte) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Bench send failed, aborting.");
+				ret = -1;
+				break;
+			}
+			gettimeofday(&start, NULL);
+			if (mux->waitConnections(ready, 0) ||
+				(ready.find(servers[j]->getSocket()) == ready.end())) {
+				logMessage(LOG_ERROR_LEVEL, "Bench wait failed, aborting.");
+				ret = -1;
+				break;
+			}
+			gettimeofday(&end, NULL);
+			usecs += (double)compareTimes(&start, &end);
+			if (servers[j]->recvDataL(1, &byte) != 1) {
+				logMessage(LOG_ERROR_LEVEL, "Bench recv failed, aborting.");
+				ret = -1;
+			}
+		}
+		if (ret == 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "%6d connections : %8.3f usec/wakeup",
+					   added, usecs / BFS_COMM_MUX_BENCH_WAKEUPS);
+		}
+	}
+
+	// Close everything down
+	for (i = 0; i < (int)clients.size(); i++) {
+		clients[i]->disconnect();
+		delete clients[i];
+	}
+	mux->cleanup();
+	for (i = added; i < (int)servers.size(); i++) {
+		servers[i]->disconnect();
+		delete servers[i];
+	}
+	server->disconnect();
+	delete server;
+	delete mux;
+
+	// Return the status
+	return (ret);
+}
+
+/**
+ * @brief Benchmark the message rate, connecting a connection to ourselves and
+ * bouncing windows of small framed (packetized) messages across it, so the
+ * cost is dominated by the per-message system calls
+ *
+ * @param port - port to listen for the connection on
+ * @param nmsgs - the messages to send each way per message size
+ * @param shared - flag indicating to connect over shared memory
+ * @return 0 if successful, -1 if failure
+ */
+
+int bfsFrameBench(unsigned short port, int nmsgs, bool shared) {
+
+	// Local variables
+	bfsNetworkConnection *server, *client, *peer;
+	bfsFlexibleBuffer msg, rmsg;
+	struct timeval start, end;
+	bfs_size_t sizes[] = {64, 1024, 4096};
+	int s, i, j, win, ret = 0;
+	double usecs;
+
+	// Listen, connect to ourselves
+	server = bfsNetworkConnection::bfsChannelFactory(port, shared);
+	if (server->connect()) {
+		logMessage(LOG_ERROR_LEVEL, "Server connection failed, bench aborting.");
+		delete server;
+		return (-1);
+	}
+	client = bfsNetworkConnection::bfsChannelFactory(
+		shared ? BFS_NETCONN_SHM_ADDRESS : "127.0.0.1", port);
+	if (client->connect() || ((peer = server->accept()) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "Connect failed, bench aborting.");
+		delete client;
+		server->disconnect();
+		delete server;
+		return (-1);
+	}
+
+	// Bounce windows of messages of each size (small enough to stay queued in
+	// the socket buffers while the other end is not reading)
+	for (s = 0; (ret == 0) && (s < (int)(sizeof(sizes) / sizeof(bfs_size_t)));
+		 s++) {
+		win = min(BFS_COMM_FRAME_BENCH_WINDOW,
+				  (int)(BFS_COMM_FRAME_BENCH_BYTES / sizes[s]));
+		gettimeofday(&start, NULL);
+		for (i = 0; (ret == 0) && (i < nmsgs); i += win) {
+			for (j = 0; (ret == 0) && (j < win); j++) {
+				msg.resetWithAlloc(sizes[s], (char)j);
+				if ((client->sendPacketizedBuffer(msg) != (int)sizes[s]) ||
+					(peer->recvPacketizedBuffer(rmsg) != (int)sizes[s])) {
+					ret = -1;
+				}
+			}
+			for (j = 0; (ret == 0) && (j < win); j++) {
+				msg.resetWithAlloc(sizes[s], (char)j);
+				if ((peer->sendPacketizedBuffer(msg) != (int)sizes[s]) ||
+					(client->recvPacketizedBuffer(rmsg) != (int)sizes[s])) {
+					ret = -1;
+				}
+			}
+		}
+		gettimeofday(&end, NULL);
+		usecs = (double)compareTimes(&start, &end);
+		if (ret == 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "%5u byte messages : %9.0f msgs/sec",
+					   sizes[s], (2.0 * i) / (usecs / 1000000.0));
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "Bench message failed, aborting.");
+		}
+	}
+
+	// Close everything down
+	client->disconnect();
+	peer->disconnect();
+	server->disconnect();
+	delete client;
+	delete peer;
+	delete server;
+
+	// Return the status
+	return (ret);
+}
+
+/**
+ * @brief Receive the messages of the throughput bench (thread entry)
+ *
+ * @param arg - the receiving end (bfs_tput_recv_t)
+ * @return NULL
+ */
+
+static void *bfsThroughputRecv(void *arg) {
+
+	// Local variables
+	bfs_tput_recv_t *rcv = (bfs_tput_recv_t *)arg;
+	bfsFlexibleBuffer rmsg;
+	int i;
+
+	// Receive all of the messages
+	for (i = 0; (rcv->ret == 0) && (i < rcv->nmsgs); i++) {
+		if (rcv->conn->recvPacketizedBuffer(rmsg) != (int)rcv->size) {
+			rcv->ret = -1;
+		}
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Benchmark the throughput of large framed messages (64 KB to 4 MB),
+ * sent by copying and with zero copy (MSG_ZEROCOPY) over a connection to
+ * ourselves while a thread receives them.  The CPU time of the sending thread
+ * per GB shows what not copying saves (over loopback the kernel copies the
+ * zero copy sends on delivery, which is reported).
+ *
+ * @param port - port to listen for the connection on
+ * @param mbytes - the MB to send per message size and mode
+ * @return 0 if successful, -1 if failure
+ */
+
+int bfsThroughputBench(unsigned short port, int mbytes) {
+
+	// Local variables
+	bfsNetworkConnection *server, *client, *peer;
+	rawnet_options_t opts, saved;
+	bfs_tput_recv_t rcv;
+	bfsFlexibleBuffer msg;
+	struct timeval start, end;
+	struct rusage ru1, ru2;
+	pthread_t thread;
+	bfs_size_t size;
+	uint64_t copied;
+	double usecs, cpu;
+	int zc, i, ret = 0;
+
+	// Enable zero copy on the sockets (the sends toggle it below)
+	rawnet_get_options(&saved);
+	opts = saved;
+	opts.zerocopyBytes = BFS_COMM_TPUT_BENCH_MIN;
+	rawnet_set_options(&opts);
+
+	// Listen, connect to ourselves
+	server = bfsNetworkConnection::bfsChannelFactory(port);
+	if (server->connect()) {
+		logMessage(LOG_ERROR_LEVEL, "Server connection failed, bench aborting.");
+		delete server;
+		rawnet_set_options(&saved);
+		return (-1);
+	}
+	client = bfsNetworkConnection::bfsChannelFactory("127.0.0.1", port);
+	if (client->connect() || ((peer = server->accept()) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "Connect failed, bench aborting.");
+		delete client;
+		server->disconnect();
+		delete server;
+		rawnet_set_options(&saved);
+		return (-1);
+	}
+
+	// Send each size copying, then without copying
+	for (size = BFS_COMM_TPUT_BENCH_MIN;
+		 (ret == 0) && (size <= BFS_COMM_TPUT_BENCH_MAX); size *= 4) {
+		msg.resetWithAlloc(size, 0x5a);
+		for (zc = 0; (ret == 0) && (zc < 2); zc++) {
+			opts.zerocopyBytes = zc ? BFS_COMM_TPUT_BENCH_MIN : 0;
+			rawnet_set_options(&opts);
+			rcv.conn = peer;
+			rcv.nmsgs = max(1, (int)(((uint64_t)mbytes << 20) / size));
+			rcv.size = size;
+			rcv.ret = 0;
+			copied = rawnet_zerocopy_copied();
+			pthread_create(&thread, NULL, bfsThroughputRecv, &rcv);
+			getrusage(RUSAGE_THREAD, &ru1);
+			gettimeofday(&start, NULL);
+			for (i = 0; (ret == 0) && (i < rcv.nmsgs); i++) {
+				if (client->sendPacketizedBuffer(msg) != (int)size) {
+					logMessage(LOG_ERROR_LEVEL, "Bench send failed, aborting.");
+					ret = -1;
+				}
+			}
+			pthread_join(thread, NULL);
+			gettimeofday(&end, NULL);
+			getrusage(RUSAGE_THREAD, &ru2);
+			if ((ret == 0) && (rcv.ret != 0)) {
+				logMessage(LOG_ERROR_LEVEL, "Bench receive failed, aborting.");
+				ret = -1;
+			}
+
+			// Report the rate and the CPU of the sender per GB sent
+			if (ret == 0) {
+				usecs = (double)compareTimes(&start, &end);
+				cpu = (double)compareTimes(&ru1.ru_utime, &ru2.ru_utime) +
+					  (double)compareTimes(&ru1.ru_stime, &ru2.ru_stime);
+				logMessage(LOG_OUTPUT_LEVEL,
+						   "%5u KB %-9s : %8.1f MB/sec, sender %7.1f CPU "
+						   "ms/GB%s",
+						   size / 1024, zc ? "zerocopy" : "copy",
+						   ((double)rcv.nmsgs * size) / usecs,
+						   (cpu / 1000.0) /
+							   (((double)rcv.nmsgs * size) / (1 << 30)),
+						   (zc && (rawnet_zerocopy_copied() != copied))
+							   ? " (copied by kernel)"
+							   : "");
+			}
+		}
+	}
+
+	// Close everything down
+	client->disconnect();
+	peer->disconnect();
+	server->disconnect();
+	delete client;
+	delete peer;
+	delete server;
+	rawnet_set_options(&saved);
+
+	// Return the status
+	return (ret);
+}
@@ -12,8 +12,11 @@
 // Include Files
 #include <arpa/inet.h>
 #include <errno.h>
+#include <linux/errqueue.h>
 #include <list>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -36,14 +39,61 @@
 
 unsigned char *rawnet_network_address = NULL; // Address of RAWNET server
 unsigned short rawnet_network_port = 0;		  // Port of RAWNET server
+static rawnet_options_t rawnet_options = {1, 0, 0, 0, 0}; // Socket tuning
+static uint64_t rawnet_zc_copied = 0; // Zero copy sends completed by copying
 
 // Functional Prototypes (local methods)
 int rawnetNetworkUnitSend(int sock, int len, char *buf);
 int rawnetNetworkUnitRecv(int sock, int len, char *buf);
+static int rawnet_tune_socket(int sock);
+static bool rawnet_use_zerocopy(int sock, long len);
+static int rawnet_reap_zerocopy(int sock, int nsends);
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_set_options
+// Description  : Set the tuning of the sockets (applied to those created
+//                after, the zero copy size applies to all sends)
+//
+// Inputs       : opts - the options to set
+// Outputs      : none
+
+void rawnet_set_options(rawnet_options_t *opts) {
+	rawnet_options = *opts;
+	logMessage(LOG_INFO_LEVEL,
+			   "RAWNET options nodelay=%d, sndbuf=%d, rcvbuf=%d, busy_poll=%d, "
+			   "zerocopy=%d",
+			   opts->nodelay, opts->sndbufBytes, opts->rcvbufBytes,
+			   opts->busyPollUsecs, opts->zerocopyBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_get_options
+// Description  : Get the tuning of the sockets
+//
+// Inputs       : opts - the options (out)
+// Outputs      : none
+
+void rawnet_get_options(rawnet_options_t *opts) { *opts = rawnet_options; }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_zerocopy_copied
+// Description  : Get the zero copy sends the kernel completed by copying the
+//                payload after all (e.g., over loopback, or a NIC without
+//                scatter-gather)
+//
+// Inputs       : none
+// Outputs      : the number of sends
+
+uint64_t rawnet_zerocopy_copied(void) {
+	return (__atomic_load_n(&rawnet_zc_copied, __ATOMIC_RELAXED));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : rawnet_connect_server
@@ -78,30 +128,12 @@ int rawnet_connect_server(unsigned short port) {
 		return (-1);
 	}
 
-	// Disable nagles alg on the socket to prevent delays for small reqs
-	optval = 1;
-	if (setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) !=
-		0) {
-		// Error out
-		logMessage(LOG_ERROR_LEVEL,
-				   "RAWNET set socket option [%d] create failed : [%s]",
-				   TCP_NODELAY, strerror(errno));
+	// Tune the socket (Nagle's algorithm, buffers, busy poll, zero copy)
+	if (rawnet_tune_socket(server)) {
 		close(server);
 		return (-1);
 	}
 
-	// zero-copy reads/writes
-	// optval = 1;
-	// if (setsockopt(server, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) !=
-	// 	0) {
-	// 	// Error out
-	// 	logMessage(LOG_ERROR_LEVEL,
-	// 			   "RAWNET set socket option [%d] create failed : [%s]",
-	// 			   SO_ZEROCOPY, strerror(errno));
-	// 	close(server);
-	// 	return (-1);
-	// }
-
 	// Setup address and bind the server to a particular port
 	saddr.sin_family = AF_INET;
 	saddr.sin_port = htons(port);
@@ -145,7 +177,7 @@ int rawnet_accept_connection(int server) {
 
 	// Local variables
 	struct sockaddr_in caddr;
-	int client, optval;
+	int client;
 	unsigned int inet_len;
 
 	// Accept the connection, error out if failure
@@ -157,30 +189,12 @@ int rawnet_accept_connection(int server) {
 		return (-1);
 	}
 
-	// Disable nagles alg on the socket to prevent delays for small reqs
-	optval = 1;
-	if (setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) !=
-		0) {
-		// Error out
-		logMessage(LOG_ERROR_LEVEL,
-				   "RAWNET set socket option [%d] create failed : [%s]",
-				   TCP_NODELAY, strerror(errno));
+	// Tune the socket (Nagle's algorithm, buffers, busy poll, zero copy)
+	if (rawnet_tune_socket(client)) {
 		close(client);
 		return (-1);
 	}
 
-	// zero-copy reads/writes
-	// optval = 1;
-	// if (setsockopt(client, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) !=
-	// 	0) {
-	// 	// Error out
-	// 	logMessage(LOG_ERROR_LEVEL,
-	// 			   "RAWNET set socket option [%d] create failed : [%s]",
-	// 			   SO_ZEROCOPY, strerror(errno));
-	// 	close(client);
-	// 	return (-1);
-	// }
-
 	// Log the creation of the new connection, return the new client connection
 	logMessage(LOG_INFO_LEVEL, "Server new client connection [%s/%d]",
 			   inet_ntoa(caddr.sin_addr), caddr.sin_port);
@@ -220,29 +234,12 @@ int rawnet_client_connect(const char *ip, uint16_t port) {
 		return (-1);
 	}
 
-	int optval = 1;
-	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) !=
-		0) {
-		// Error out
-		logMessage(LOG_ERROR_LEVEL,
-				   "RAWNET set socket option [%d] create failed : [%s]",
-				   TCP_NODELAY, strerror(errno));
+	// Tune the socket (Nagle's algorithm, buffers, busy poll, zero copy)
+	if (rawnet_tune_socket(sock)) {
 		close(sock);
 		return (-1);
 	}
 
-	// zero-copy reads/writes
-	// optval = 1;
-	// if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) !=
-	// 	0) {
-	// 	// Error out
-	// 	logMessage(LOG_ERROR_LEVEL,
-	// 			   "RAWNET set socket option [%d] create failed : [%s]",
-	// 			   SO_ZEROCOPY, strerror(errno));
-	// 	close(sock);
-	// 	return (-1);
-	// }
-
 	// Now connect to the server
 	if (connect(sock, (const struct sockaddr *)&caddr,
 				sizeof(struct sockaddr)) == -1) {
@@ -271,10 +268,25 @@ int rawnet_send_bytes(int sock, int len, char *buf) {
 	// Local variables
 	long sentBytes = 0, sb;
 
+	// Large payloads may go without copying (see rawnet_send_iov)
+	if ((rawnet_options.zerocopyBytes > 0) &&
+		(len >= rawnet_options.zerocopyBytes)) {
+		struct iovec iov = {buf, (size_t)len};
+		return (rawnet_send_iov(sock, &iov, 1));
+	}
+
 	// Loop until you have read all the bytes
 	while (sentBytes < len) {
-		// Read the bytes and check for error
-		if ((sb = write(sock, &buf[sentBytes], len - sentBytes)) < 0) {
+		// Send the bytes and check for error (without SIGPIPE, a peer that
+		// has gone away is reported as a closed socket)
+		if ((sb = send(sock, &buf[sentBytes], len - sentBytes,
+					   MSG_NOSIGNAL)) < 0) {
+			if ((errno == EPIPE) || (errno == ECONNRESET)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "RAWNET client socket closed on snd : [%s]",
+						   strerror(errno));
+				return (0);
+			}
 			logMessage(LOG_ERROR_LEVEL, "RAWNET send bytes failed : [%s]",
 					   strerror(errno));
 			return (-1);
@@ -339,6 +351,128 @@ int rawnet_read_bytes(int sock, int len, char *buf) {
 	return (len);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_send_iov
+// Description  : Send a set of buffers to socket, gathered into one send
+//                (e.g., a frame header and its body) rather than one each.
+//                Large payloads are sent with MSG_ZEROCOPY (the kernel sends
+//                from the pages of the buffers), their completions reaped
+//                before returning so the caller can reuse the buffers.
+//
+// Inputs       : sock - the socket filehandle of the client connection
+//                iov - the buffers to send (consumed as they are sent)
+//                cnt - the number of buffers
+// Outputs      : length if successful, 0 if closed, -1 if failure
+
+int rawnet_send_iov(int sock, struct iovec *iov, int cnt) {
+
+	// Local variables
+	struct msghdr msg;
+	long sentBytes = 0, len = 0, sb;
+	int i, flags = MSG_NOSIGNAL, zsends = 0;
+
+	// Send without copying if large enough (and the socket allows it)
+	for (i = 0; i < cnt; i++) {
+		len += (long)iov[i].iov_len;
+	}
+	if (rawnet_use_zerocopy(sock, len)) {
+		flags |= MSG_ZEROCOPY;
+	}
+
+	// Loop until all of the buffers are sent
+	memset(&msg, 0x0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = cnt;
+	while (msg.msg_iovlen > 0) {
+		// Send the bytes and check for error (without SIGPIPE, as above)
+		if ((sb = sendmsg(sock, &msg, flags)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno == ENOBUFS) && (flags & MSG_ZEROCOPY)) {
+				// Out of memory to pin pages, reap what is pending (or copy)
+				if (zsends == 0) {
+					flags &= ~MSG_ZEROCOPY;
+				} else if (rawnet_reap_zerocopy(sock, zsends) != 1) {
+					return (-1);
+				}
+				zsends = 0;
+				continue;
+			}
+			if ((errno == EPIPE) || (errno == ECONNRESET)) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "RAWNET client socket closed on snd : [%s]",
+						   strerror(errno));
+				return (0);
+			}
+			logMessage(LOG_ERROR_LEVEL, "RAWNET send iov failed : [%s]",
+					   strerror(errno));
+			return (-1);
+		} else if (sb == 0) {
+			logMessage(LOG_ERROR_LEVEL, "RAWNET client socket closed on snd");
+			return (0);
+		}
+
+		// Skip past what was sent (a short send leaves part of a buffer)
+		sentBytes += sb;
+		zsends += (flags & MSG_ZEROCOPY) ? 1 : 0;
+		while ((sb > 0) && (msg.msg_iovlen > 0)) {
+			if ((size_t)sb < msg.msg_iov->iov_len) {
+				msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + sb;
+				msg.msg_iov->iov_len -= (size_t)sb;
+				break;
+			}
+			sb -= (long)msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+	}
+
+	// Wait for the kernel to be done with the buffers
+	if ((zsends > 0) && ((i = rawnet_reap_zerocopy(sock, zsends)) != 1)) {
+		return (i);
+	}
+
+	// Return successfully
+	return ((int)sentBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_read_available
+// Description  : Receive the bytes that have arrived on the socket (up to a
+//                length), waiting only if none have
+//
+// Inputs       : sock - the socket filehandle of the client connection
+//                len - the most bytes to read
+//                buf - the buffer to read into
+// Outputs      : bytes read if successful, 0 if closed, -1 if failure
+
+int rawnet_read_available(int sock, int len, char *buf) {
+
+	// Local variables
+	long rb;
+
+	// Read the bytes, check for error
+	while ((rb = read(sock, buf, len)) < 0) {
+		if (errno != EINTR) {
+			logMessage(LOG_ERROR_LEVEL, "RAWNET read bytes failed : [%s]",
+					   strerror(errno));
+			return (-1);
+		}
+	}
+
+	// Check for closed file (not an error)
+	if (rb == 0) {
+		logMessage(LOG_ERROR_LEVEL, "RAWNET client socket closed on rd");
+		return (0);
+	}
+
+	// Return the bytes read
+	return ((int)rb);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : rawnet_wait_read
@@ -393,6 +527,167 @@ int rawnet_close(int sock) {
 	return (close(sock));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_tune_socket
+// Description  : Tune a socket as set in the options (buffer sizes must be
+//                set before connecting or listening to size the window)
+//
+// Inputs       : sock - the socket to tune
+// Outputs      : 0 if successful, -1 if failure
+
+static int rawnet_tune_socket(int sock) {
+
+	// Local variables
+	int optval;
+
+	// Disable nagles alg on the socket to prevent delays for small reqs
+	optval = rawnet_options.nodelay;
+	if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) !=
+		0) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "RAWNET set socket option [%d] create failed : [%s]",
+				   TCP_NODELAY, strerror(errno));
+		return (-1);
+	}
+
+	// Size the buffers (else the kernel autotunes them)
+	if ((rawnet_options.sndbufBytes > 0) &&
+		(setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &rawnet_options.sndbufBytes,
+					sizeof(int)) != 0)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "RAWNET set socket option [%d] create failed : [%s]",
+				   SO_SNDBUF, strerror(errno));
+		return (-1);
+	}
+	if ((rawnet_options.rcvbufBytes > 0) &&
+		(setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rawnet_options.rcvbufBytes,
+					sizeof(int)) != 0)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "RAWNET set socket option [%d] create failed : [%s]",
+				   SO_RCVBUF, strerror(errno));
+		return (-1);
+	}
+
+	// Busy poll and zero copy are best effort (they may need privileges or a
+	// newer kernel), the socket works without them
+	if ((rawnet_options.busyPollUsecs > 0) &&
+		(setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL,
+					&rawnet_options.busyPollUsecs, sizeof(int)) != 0)) {
+		logMessage(LOG_WARNING_LEVEL, "RAWNET busy poll not enabled : [%s]",
+				   strerror(errno));
+	}
+	optval = 1;
+	if ((rawnet_options.zerocopyBytes > 0) &&
+		(setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval)) !=
+		 0)) {
+		logMessage(LOG_WARNING_LEVEL, "RAWNET zero copy not enabled : [%s]",
+				   strerror(errno));
+	}
+
+	// Return successfully
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_use_zerocopy
+// Description  : Check if a send should go without copying: it is large
+//                enough and the socket has zero copy enabled (else the flag
+//                is ignored and no completion would ever come)
+//
+// Inputs       : sock - the socket to send on
+//                len - the bytes to send
+// Outputs      : true if zero copy, false if not
+
+static bool rawnet_use_zerocopy(int sock, long len) {
+
+	// Local variables
+	socklen_t olen = sizeof(int);
+	int optval = 0;
+
+	// Check the size first (the socket option is a system call)
+	return ((rawnet_options.zerocopyBytes > 0) &&
+			(len >= rawnet_options.zerocopyBytes) &&
+			(getsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &optval, &olen) == 0) &&
+			(optval != 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rawnet_reap_zerocopy
+// Description  : Reap the completions of zero copy sends from the socket
+//                error queue, waiting until the kernel is done with the
+//                buffers of all of them (each notification covers a range of
+//                the sends, numbered in order on the socket)
+//
+// Inputs       : sock - the socket sent on
+//                nsends - the sends to reap
+// Outputs      : 1 if successful, 0 if closed, -1 if failure
+
+static int rawnet_reap_zerocopy(int sock, int nsends) {
+
+	// Local variables
+	char ctl[CMSG_SPACE(sizeof(struct sock_extended_err) +
+						sizeof(struct sockaddr_in6))];
+	struct sock_extended_err *serr;
+	struct pollfd pfd = {sock, 0, 0};
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	int reaped = 0;
+
+	// Keep reaping until all of the sends are complete
+	while (reaped < nsends) {
+		memset(&msg, 0x0, sizeof(msg));
+		msg.msg_control = ctl;
+		msg.msg_controllen = sizeof(ctl);
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if ((errno != EAGAIN) && (errno != EINTR)) {
+				logMessage(LOG_ERROR_LEVEL, "RAWNET zero copy reap failed : [%s]",
+						   strerror(errno));
+				return (-1);
+			}
+
+			// Wait for the error queue (a hung up socket will not complete)
+			if ((poll(&pfd, 1, -1) == -1) && (errno != EINTR)) {
+				logMessage(LOG_ERROR_LEVEL, "RAWNET zero copy poll failed : [%s]",
+						   strerror(errno));
+				return (-1);
+			}
+			if ((pfd.revents & POLLHUP) && !(pfd.revents & POLLERR)) {
+				logMessage(LOG_ERROR_LEVEL, "RAWNET client socket closed on snd");
+				return (0);
+			}
+			continue;
+		}
+
+		// Count the sends completed (noting those the kernel copied)
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) ||
+				  ((cm->cmsg_level == SOL_IPV6) &&
+				   (cm->cmsg_type == IPV6_RECVERR)))) {
+				continue;
+			}
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if ((serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) ||
+				(serr->ee_errno != 0)) {
+				logMessage(LOG_ERROR_LEVEL, "RAWNET zero copy send failed : [%s]",
+						   strerror((int)serr->ee_errno));
+				return (-1);
+			}
+			reaped += (int)(serr->ee_data - serr->ee_info + 1);
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				__atomic_fetch_add(&rawnet_zc_copied,
+								   serr->ee_data - serr->ee_info + 1,
+								   __ATOMIC_RELAXED);
+			}
+		}
+	}
+
+	// Return successfully
+	return (1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : rawnet_server_unittest
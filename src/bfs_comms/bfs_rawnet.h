@@ -14,6 +14,7 @@
 #include <list>
 #include <pthread.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <tuple>
 
 // Defines
@@ -21,9 +22,29 @@
 //
 // Type Definitions
 
+// The tuning of the sockets of the process (see rawnet_set_options)
+typedef struct {
+	int nodelay;	   // Disable Nagle's algorithm (small requests not delayed)
+	int sndbufBytes;   // Socket send buffer size (0 for the kernel default)
+	int rcvbufBytes;   // Socket receive buffer size (0 for the kernel default)
+	int busyPollUsecs; // Busy poll the device queue on reads (0 to not)
+	int zerocopyBytes; // Send at least this many bytes with MSG_ZEROCOPY (0 to
+					   // always copy)
+} rawnet_options_t;
+
 //
 // Network utility functions
 
+void rawnet_set_options(rawnet_options_t *opts);
+// Set the tuning of the sockets (those created after, the zero copy size
+// applies to all sends)
+
+void rawnet_get_options(rawnet_options_t *opts);
+// Get the tuning of the sockets
+
+uint64_t rawnet_zerocopy_copied(void);
+// Get the zero copy sends the kernel completed by copying after all
+
 int rawnet_connect_server(unsigned short port);
 // This function makes a server connection on a bound port.
 
@@ -40,6 +61,12 @@ int rawnet_send_bytes(int sock, int len, char *buf);
 int rawnet_read_bytes(int sock, int len, char *buf);
 // Read some bytes from the network
 
+int rawnet_send_iov(int sock, struct iovec *iov, int cnt);
+// Send a set of buffers over the network (gathered into one send)
+
+int rawnet_read_available(int sock, int len, char *buf);
+// Read whatever bytes have arrived (up to len, waiting for at least one)
+
 int rawnet_wait_read(int sock);
 // Wait until the socket has bytes to read
 
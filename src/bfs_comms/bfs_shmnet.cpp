@@ -0,0 +1,750 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfs_shmnet.cpp
+//  Description   : This is the shared memory I/O for BFS endpoints on the same
+//                  host (see bfs_shmnet.h).  Each ring has a single writer and
+//                  a single reader, which only move their own (free running)
+//                  counter, so the rings need no locks.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Sat 17 Oct 2026 09:12:40 AM EDT
+//
+
+// Include Files
+#include <errno.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Project Include Files
+#include <bfs_log.h>
+#include <bfs_shmnet.h>
+
+// Defines
+#define SHMNET_MAX_BACKLOG 16
+#define SHMNET_RING_MASK ((uint64_t)SHMNET_RING_SIZE - 1)
+#define SHMNET_HDR_SIZE 4096
+#define SHMNET_MAP_SIZE (2 * (SHMNET_HDR_SIZE + SHMNET_RING_SIZE))
+#define SHMNET_SPACE_WAIT_NS 100000000 // Wait for space before checking peer
+
+//
+// Type Definitions
+
+// The shared header of a ring (the counters on their own cache lines)
+typedef struct {
+	uint64_t head;	  // Bytes written to the ring (moved by the writer)
+	char pad1[56];	  // Padding to the next cache line
+	uint64_t tail;	  // Bytes read from the ring (moved by the reader)
+	char pad2[56];	  // Padding to the next cache line
+	uint32_t space;	  // Futex bumped when space is freed for a waiting writer
+	uint32_t waiting; // Flag indicating the writer is waiting for space
+	uint32_t closed;  // Flag indicating the writer closed the connection
+} shmnet_ring_t;
+
+// A shared memory connection (the server sends on ring 0, the client ring 1)
+struct bfs_shmnet {
+	char *map;				// The mapping of the shared memory
+	shmnet_ring_t *tx, *rx; // The headers of the rings sent and received on
+	char *txData, *rxData;	// The bytes of the rings sent and received on
+	int txBell, rxBell;		// The doorbells of the peer, and of this end
+	int sock;				// The unix socket (hung up when the peer exits)
+};
+
+// Functional Prototypes (local methods)
+static socklen_t shmnet_address(unsigned short port, struct sockaddr_un *addr);
+static int shmnet_send_fds(int sock, int *fds);
+static int shmnet_recv_fds(int sock, int *fds);
+static bfs_shmnet_t *shmnet_setup(int memfd, int *bells, int sock, bool srv);
+static void shmnet_copy_in(char *ring, uint64_t pos, const char *src,
+						   uint64_t len);
+static void shmnet_copy_out(const char *ring, uint64_t pos, char *dst,
+							uint64_t len);
+static void shmnet_publish(bfs_shmnet_t *chan, uint64_t head);
+static int shmnet_wait_space(bfs_shmnet_t *chan, uint64_t head);
+static int shmnet_wait_bell(bfs_shmnet_t *chan);
+static bool shmnet_closed(bfs_shmnet_t *chan);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_connect_server
+// Description  : Listen for shared memory connections, on an abstract unix
+//                socket named for the port (no file to clean up)
+//
+// Inputs       : port - the port the server is listening for
+// Outputs      : the server socket if successful, -1 if failure
+
+int shmnet_connect_server(unsigned short port) {
+
+	// Local variables
+	struct sockaddr_un addr;
+	socklen_t alen;
+	int server;
+
+	// Create the socket, bind and listen on it
+	alen = shmnet_address(port, &addr);
+	if ((server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET socket() create failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+	if (bind(server, (struct sockaddr *)&addr, alen) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET bind() failed for port [%u] : [%s]",
+				   port, strerror(errno));
+		close(server);
+		return (-1);
+	}
+	if (listen(server, SHMNET_MAX_BACKLOG) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET listen() failed : [%s]",
+				   strerror(errno));
+		close(server);
+		return (-1);
+	}
+
+	// Return the server socket
+	logMessage(LOG_INFO_LEVEL, "SHMNET server listening for port [%u]", port);
+	return (server);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_accept_connection
+// Description  : Accept a connection, receiving the shared memory and
+//                doorbells of the connection over the unix socket
+//
+// Inputs       : server - the server socket
+//                chan - the connection created (out)
+// Outputs      : the doorbell of this end if successful, -1 if failure
+
+int shmnet_accept_connection(int server, bfs_shmnet_t **chan) {
+
+	// Local variables
+	struct stat st;
+	int sock, fds[3];
+
+	// Accept the connection, receive the memory and doorbells
+	if ((sock = accept4(server, NULL, NULL, SOCK_CLOEXEC)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET accept() failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+	if (shmnet_recv_fds(sock, fds) == -1) {
+		close(sock);
+		return (-1);
+	}
+
+	// Map the memory (which must be laid out as we expect)
+	if ((fstat(fds[0], &st) == -1) || (st.st_size != SHMNET_MAP_SIZE) ||
+		((*chan = shmnet_setup(fds[0], &fds[1], sock, true)) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET shared memory map failed.");
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+		close(sock);
+		return (-1);
+	}
+
+	// The mapping keeps the memory, return the doorbell to wait on
+	close(fds[0]);
+	return ((*chan)->rxBell);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_client_connect
+// Description  : Connect to the server: create the shared memory and
+//                doorbells and hand them over the unix socket (so, like a
+//                TCP connect, this does not wait for the server to accept)
+//
+// Inputs       : port - the port the server is listening for
+//                chan - the connection created (out)
+// Outputs      : the doorbell of this end if successful, -1 if failure
+
+int shmnet_client_connect(unsigned short port, bfs_shmnet_t **chan) {
+
+	// Local variables
+	struct sockaddr_un addr;
+	socklen_t alen;
+	int sock, fds[3] = {-1, -1, -1};
+
+	// Connect to the server
+	alen = shmnet_address(port, &addr);
+	if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET socket() create failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+	if (connect(sock, (struct sockaddr *)&addr, alen) == -1) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "SHMNET connect() failed for port [%u] : [%s]", port,
+				   strerror(errno));
+		close(sock);
+		return (-1);
+	}
+
+	// Create the memory and doorbells, hand them to the server and map
+	if (((fds[0] = memfd_create("bfs_shmnet", MFD_CLOEXEC)) == -1) ||
+		(ftruncate(fds[0], SHMNET_MAP_SIZE) == -1) ||
+		((fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) ||
+		((fds[2] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) ||
+		(shmnet_send_fds(sock, fds) == -1) ||
+		((*chan = shmnet_setup(fds[0], &fds[1], sock, false)) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET connection setup failed : [%s]",
+				   strerror(errno));
+		for (int i = 0; i < 3; i++) {
+			if (fds[i] != -1) {
+				close(fds[i]);
+			}
+		}
+		close(sock);
+		return (-1);
+	}
+
+	// The mapping keeps the memory, return the doorbell to wait on
+	close(fds[0]);
+	return ((*chan)->rxBell);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_send_iov
+// Description  : Send a set of buffers over the connection: the bytes are
+//                copied into the ring, then published and the doorbell rung
+//                once (or each time the ring fills and we wait for space)
+//
+// Inputs       : chan - the connection
+//                iov - the buffers to send
+//                cnt - the number of buffers
+// Outputs      : bytes sent if successful, 0 if closed, -1 if failure
+
+int shmnet_send_iov(bfs_shmnet_t *chan, struct iovec *iov, int cnt) {
+
+	// Local variables
+	uint64_t head, tail, room, n, done;
+	long sentBytes = 0;
+	int i, ret;
+
+	// Sending to a closed peer is like a broken pipe
+	if (shmnet_closed(chan)) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET connection closed on snd");
+		return (0);
+	}
+
+	// Copy each buffer in, waiting for space as needed
+	head = chan->tx->head;
+	for (i = 0; i < cnt; i++) {
+		done = 0;
+		while (done < iov[i].iov_len) {
+			tail = __atomic_load_n(&chan->tx->tail, __ATOMIC_ACQUIRE);
+			if ((room = SHMNET_RING_SIZE - (head - tail)) == 0) {
+				shmnet_publish(chan, head);
+				if ((ret = shmnet_wait_space(chan, head)) != 1) {
+					return (ret);
+				}
+				continue;
+			}
+			n = (iov[i].iov_len - done < room) ? iov[i].iov_len - done : room;
+			shmnet_copy_in(chan->txData, head,
+						   (char *)iov[i].iov_base + done, n);
+			head += n;
+			done += n;
+		}
+		sentBytes += (long)iov[i].iov_len;
+	}
+	shmnet_publish(chan, head);
+
+	// Return the bytes sent
+	return ((int)sentBytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_read_bytes
+// Description  : Read the bytes from the connection (waiting for all of them)
+//
+// Inputs       : chan - the connection
+//                len - the number of bytes to read
+//                buf - the buffer to read into
+// Outputs      : bytes read if successful, 0 if closed, -1 if failure
+
+int shmnet_read_bytes(bfs_shmnet_t *chan, int len, char *buf) {
+
+	// Local variables
+	int got = 0, ret;
+
+	// Keep reading until we have all of the bytes
+	while (got < len) {
+		if ((ret = shmnet_read_available(chan, len - got, &buf[got])) <= 0) {
+			return (ret);
+		}
+		got += ret;
+	}
+
+	// Return the bytes read
+	return (got);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_read_available
+// Description  : Read whatever bytes have arrived (up to len), waiting on the
+//                doorbell for at least one
+//
+// Inputs       : chan - the connection
+//                len - the most bytes to read
+//                buf - the buffer to read into
+// Outputs      : bytes read if successful, 0 if closed, -1 if failure
+
+int shmnet_read_available(bfs_shmnet_t *chan, int len, char *buf) {
+
+	// Local variables
+	uint64_t head, tail = chan->rx->tail, n;
+	int ret;
+
+	// Wait for some bytes (the ones sent before a close are still read)
+	while ((head = __atomic_load_n(&chan->rx->head, __ATOMIC_ACQUIRE)) ==
+		   tail) {
+		if (__atomic_load_n(&chan->rx->closed, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&chan->rx->head, __ATOMIC_ACQUIRE) == tail) {
+				logMessage(LOG_ERROR_LEVEL, "SHMNET connection closed on rd");
+				return (0);
+			}
+			continue;
+		}
+		if ((ret = shmnet_wait_bell(chan)) != 1) {
+			return (ret);
+		}
+	}
+
+	// Copy the bytes out, then free their space (waking a waiting writer)
+	n = ((uint64_t)len < head - tail) ? (uint64_t)len : head - tail;
+	shmnet_copy_out(chan->rxData, tail, buf, n);
+	__atomic_store_n(&chan->rx->tail, tail + n, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&chan->rx->waiting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(&chan->rx->space, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &chan->rx->space, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+
+	// Return the bytes read
+	return ((int)n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_available
+// Description  : Get the bytes that have arrived and are not yet read
+//
+// Inputs       : chan - the connection
+// Outputs      : the number of bytes
+
+uint64_t shmnet_available(bfs_shmnet_t *chan) {
+	return (__atomic_load_n(&chan->rx->head, __ATOMIC_ACQUIRE) -
+			chan->rx->tail);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_ready
+// Description  : Check if there is something to read (bytes or a close).  The
+//                doorbell is rung for every send, so it may be left rung after
+//                the bytes were read; if there is nothing, clear it (then look
+//                again, for bytes sent since) so a wait does not wake for it.
+//
+// Inputs       : chan - the connection
+// Outputs      : 1 if ready, 0 if not
+
+int shmnet_ready(bfs_shmnet_t *chan) {
+
+	// Local variables
+	uint64_t cnt;
+
+	// Check for bytes or a close, clear the doorbell if none
+	if ((shmnet_available(chan) > 0) ||
+		__atomic_load_n(&chan->rx->closed, __ATOMIC_ACQUIRE)) {
+		return (1);
+	}
+	if (read(chan->rxBell, &cnt, sizeof(cnt)) == -1) {
+		// Not rung (EAGAIN), nothing to clear
+	}
+	return (((shmnet_available(chan) > 0) ||
+			 __atomic_load_n(&chan->rx->closed, __ATOMIC_ACQUIRE))
+				? 1
+				: 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_shutdown
+// Description  : Shut the connection down both ways, without releasing it:
+//                the peer reads what was sent then a close, and reads here
+//                return a close once what arrived is read (both doorbells are
+//                rung, to wake any waits)
+//
+// Inputs       : chan - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int shmnet_shutdown(bfs_shmnet_t *chan) {
+
+	// Local variables
+	uint64_t one = 1;
+
+	// Mark both rings closed and ring both ends
+	__atomic_store_n(&chan->tx->closed, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&chan->rx->closed, 1, __ATOMIC_RELEASE);
+	if ((write(chan->txBell, &one, sizeof(one)) == -1) ||
+		(write(chan->rxBell, &one, sizeof(one)) == -1)) {
+		// The doorbell is saturated, the waits are woken anyway
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_close
+// Description  : Close the connection: mark our ring closed and ring the
+//                peer (which reads what was sent, then sees the close)
+//
+// Inputs       : chan - the connection (freed)
+// Outputs      : 0 if successful, -1 if failure
+
+int shmnet_close(bfs_shmnet_t *chan) {
+
+	// Local variables
+	uint64_t one = 1;
+
+	// Mark closed, ring the peer, release everything
+	logMessage(LOG_INFO_LEVEL, "SHMNET closing connection [%d]", chan->rxBell);
+	__atomic_store_n(&chan->tx->closed, 1, __ATOMIC_RELEASE);
+	if (write(chan->txBell, &one, sizeof(one)) == -1) {
+		// The doorbell is saturated, the peer is woken anyway
+	}
+	munmap(chan->map, SHMNET_MAP_SIZE);
+	close(chan->txBell);
+	close(chan->rxBell);
+	close(chan->sock);
+	free(chan);
+
+	// Return successfully
+	return (0);
+}
+
+//
+// Local methods
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_address
+// Description  : Get the (abstract) unix socket address for a port
+//
+// Inputs       : port - the port
+//                addr - the address (out)
+// Outputs      : the length of the address
+
+static socklen_t shmnet_address(unsigned short port, struct sockaddr_un *addr) {
+
+	// The abstract name starts with a NUL (and is not NUL terminated)
+	memset(addr, 0x0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	snprintf(&addr->sun_path[1], sizeof(addr->sun_path) - 1, "bfs_shm_%u",
+			 port);
+	return ((socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 +
+						strlen(&addr->sun_path[1])));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_send_fds
+// Description  : Send the shared memory and doorbells over the unix socket
+//
+// Inputs       : sock - the unix socket
+//                fds - the memory and the doorbells of rings 0 and 1
+// Outputs      : 0 if successful, -1 if failure
+
+static int shmnet_send_fds(int sock, int *fds) {
+
+	// Local variables
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * 3)];
+		struct cmsghdr align;
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char byte = 0;
+
+	// Send one byte carrying the descriptors
+	memset(&msg, 0x0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 3);
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET sendmsg() failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_recv_fds
+// Description  : Receive the shared memory and doorbells over the unix socket
+//
+// Inputs       : sock - the unix socket
+//                fds - the memory and the doorbells of rings 0 and 1 (out)
+// Outputs      : 0 if successful, -1 if failure
+
+static int shmnet_recv_fds(int sock, int *fds) {
+
+	// Local variables
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * 3)];
+		struct cmsghdr align;
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char byte;
+
+	// Receive the byte carrying the descriptors
+	memset(&msg, 0x0, sizeof(msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	while (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) == -1) {
+		if (errno != EINTR) {
+			logMessage(LOG_ERROR_LEVEL, "SHMNET recvmsg() failed : [%s]",
+					   strerror(errno));
+			return (-1);
+		}
+	}
+	if (((cmsg = CMSG_FIRSTHDR(&msg)) == NULL) ||
+		(cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+		(cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3))) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET connection handoff malformed.");
+		return (-1);
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_setup
+// Description  : Map the shared memory and create the connection for one end
+//
+// Inputs       : memfd - the shared memory
+//                bells - the doorbells of the rings (0 and 1)
+//                sock - the unix socket
+//                srv - flag indicating this is the server end
+// Outputs      : the connection if successful, NULL if failure
+
+static bfs_shmnet_t *shmnet_setup(int memfd, int *bells, int sock, bool srv) {
+
+	// Local variables
+	bfs_shmnet_t *chan;
+	char *map;
+
+	// Map the memory
+	if ((map = (char *)mmap(NULL, SHMNET_MAP_SIZE, PROT_READ | PROT_WRITE,
+							MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET mmap() failed : [%s]",
+				   strerror(errno));
+		return (NULL);
+	}
+
+	// Setup the rings (the server sends on ring 0, the client on ring 1)
+	chan = (bfs_shmnet_t *)calloc(1, sizeof(bfs_shmnet_t));
+	chan->map = map;
+	chan->tx = (shmnet_ring_t *)&map[srv ? 0 : SHMNET_HDR_SIZE];
+	chan->rx = (shmnet_ring_t *)&map[srv ? SHMNET_HDR_SIZE : 0];
+	chan->txData = &map[2 * SHMNET_HDR_SIZE + (srv ? 0 : SHMNET_RING_SIZE)];
+	chan->rxData = &map[2 * SHMNET_HDR_SIZE + (srv ? SHMNET_RING_SIZE : 0)];
+	chan->txBell = bells[srv ? 0 : 1];
+	chan->rxBell = bells[srv ? 1 : 0];
+	chan->sock = sock;
+	return (chan);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_copy_in
+// Description  : Copy bytes into a ring (wrapping at the end)
+//
+// Inputs       : ring - the ring
+//                pos - the (free running) position to copy to
+//                src - the bytes
+//                len - the number of bytes
+// Outputs      : none
+
+static void shmnet_copy_in(char *ring, uint64_t pos, const char *src,
+						   uint64_t len) {
+	uint64_t off = pos & SHMNET_RING_MASK;
+	uint64_t first = (len < SHMNET_RING_SIZE - off) ? len : SHMNET_RING_SIZE - off;
+	memcpy(&ring[off], src, first);
+	if (first < len) {
+		memcpy(ring, &src[first], len - first);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_copy_out
+// Description  : Copy bytes out of a ring (wrapping at the end)
+//
+// Inputs       : ring - the ring
+//                pos - the (free running) position to copy from
+//                dst - the buffer
+//                len - the number of bytes
+// Outputs      : none
+
+static void shmnet_copy_out(const char *ring, uint64_t pos, char *dst,
+							uint64_t len) {
+	uint64_t off = pos & SHMNET_RING_MASK;
+	uint64_t first = (len < SHMNET_RING_SIZE - off) ? len : SHMNET_RING_SIZE - off;
+	memcpy(dst, &ring[off], first);
+	if (first < len) {
+		memcpy(&dst[first], ring, len - first);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_publish
+// Description  : Publish the bytes copied into the ring, ring the doorbell
+//
+// Inputs       : chan - the connection
+//                head - the new head of the ring
+// Outputs      : none
+
+static void shmnet_publish(bfs_shmnet_t *chan, uint64_t head) {
+
+	// Local variables
+	uint64_t one = 1;
+
+	// Publish (if anything was copied) and ring
+	if (head == chan->tx->head) {
+		return;
+	}
+	__atomic_store_n(&chan->tx->head, head, __ATOMIC_RELEASE);
+	if (write(chan->txBell, &one, sizeof(one)) == -1) {
+		// The doorbell is saturated, the peer is woken anyway
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_wait_space
+// Description  : Wait for the reader to free space in the ring.  The writer
+//                flags that it is waiting before looking again, and the reader
+//                bumps the futex after freeing space if it sees the flag, so a
+//                wakeup is never lost.  The wait is bounded so a peer that went
+//                away is noticed.
+//
+// Inputs       : chan - the connection
+//                head - the head of the ring (published)
+// Outputs      : 1 if successful, 0 if closed
+
+static int shmnet_wait_space(bfs_shmnet_t *chan, uint64_t head) {
+
+	// Local variables
+	struct timespec tmo = {0, SHMNET_SPACE_WAIT_NS};
+	uint32_t seq;
+
+	// Flag we are waiting, then sleep if the ring is still full
+	seq = __atomic_load_n(&chan->tx->space, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&chan->tx->waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (head - __atomic_load_n(&chan->tx->tail, __ATOMIC_ACQUIRE) ==
+		SHMNET_RING_SIZE) {
+		syscall(SYS_futex, &chan->tx->space, FUTEX_WAIT, seq, &tmo, NULL, 0);
+	}
+	__atomic_store_n(&chan->tx->waiting, 0, __ATOMIC_RELAXED);
+
+	// Check the peer is still there
+	if (shmnet_closed(chan)) {
+		logMessage(LOG_ERROR_LEVEL, "SHMNET connection closed on snd");
+		return (0);
+	}
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_wait_bell
+// Description  : Wait for the doorbell to be rung (or the peer to go away),
+//                then clear it
+//
+// Inputs       : chan - the connection
+// Outputs      : 1 if successful, -1 if failure
+
+static int shmnet_wait_bell(bfs_shmnet_t *chan) {
+
+	// Local variables
+	struct pollfd pfds[2] = {{chan->rxBell, POLLIN, 0},
+							 {chan->sock, POLLIN | POLLRDHUP, 0}};
+	uint64_t cnt;
+
+	// Wait for the doorbell or the unix socket to hang up
+	while (poll(pfds, 2, -1) == -1) {
+		if (errno != EINTR) {
+			logMessage(LOG_ERROR_LEVEL, "SHMNET doorbell poll() failed : [%s]",
+					   strerror(errno));
+			return (-1);
+		}
+	}
+
+	// A peer that went away without closing is treated as closed
+	if (pfds[1].revents != 0) {
+		__atomic_store_n(&chan->rx->closed, 1, __ATOMIC_RELEASE);
+	}
+	if (read(chan->rxBell, &cnt, sizeof(cnt)) == -1) {
+		// Not rung (EAGAIN), nothing to clear
+	}
+	return (1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmnet_closed
+// Description  : Check if the connection can no longer be sent on (it was
+//                shut down, or the peer closed it or went away)
+//
+// Inputs       : chan - the connection
+// Outputs      : true if closed, false if not
+
+static bool shmnet_closed(bfs_shmnet_t *chan) {
+
+	// Local variables
+	struct pollfd pfd = {chan->sock, POLLIN | POLLRDHUP, 0};
+
+	// Closed either way, or the unix socket hung up
+	return (__atomic_load_n(&chan->tx->closed, __ATOMIC_ACQUIRE) ||
+			__atomic_load_n(&chan->rx->closed, __ATOMIC_ACQUIRE) ||
+			(poll(&pfd, 1, 0) > 0));
+}
@@ -0,0 +1,66 @@
+#ifndef SHMNET_NETWORK_INCLUDED
+#define SHMNET_NETWORK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfs_shmnet.h
+//  Description   : This is the shared memory I/O for BFS endpoints on the same
+//                  host.  A connection is a pair of byte rings (one each way)
+//                  in a memfd, which the client hands to the server over an
+//                  abstract unix socket.  A writer copies into its ring and
+//                  rings the reader's doorbell (an eventfd, so the reader can
+//                  wait on it with the other sockets), and waits for space on
+//                  a futex; no bytes go through the kernel.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Sat 17 Oct 2026 09:12:40 AM EDT
+//
+
+// Include Files
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Defines
+#define SHMNET_RING_SIZE (4 * 1024 * 1024) // Bytes of each ring (power of 2)
+
+//
+// Type Definitions
+
+typedef struct bfs_shmnet bfs_shmnet_t;
+// A shared memory connection (see bfs_shmnet.cpp)
+
+//
+// Shared memory utility functions
+
+int shmnet_connect_server(unsigned short port);
+// Listen for shared memory connections (for the port), returns the socket
+
+int shmnet_accept_connection(int server, bfs_shmnet_t **chan);
+// Accept a connection, returns the doorbell to wait on for incoming bytes
+
+int shmnet_client_connect(unsigned short port, bfs_shmnet_t **chan);
+// Connect to the server (for the port), returns the doorbell to wait on
+
+int shmnet_send_iov(bfs_shmnet_t *chan, struct iovec *iov, int cnt);
+// Send a set of buffers over the connection
+
+int shmnet_read_bytes(bfs_shmnet_t *chan, int len, char *buf);
+// Read the bytes from the connection (waiting for all of them)
+
+int shmnet_read_available(bfs_shmnet_t *chan, int len, char *buf);
+// Read whatever bytes have arrived (up to len, waiting for at least one)
+
+uint64_t shmnet_available(bfs_shmnet_t *chan);
+// Get the bytes that have arrived and are not yet read
+
+int shmnet_ready(bfs_shmnet_t *chan);
+// Check if there is something to read (bytes or a close), clearing the
+// doorbell if not
+
+int shmnet_shutdown(bfs_shmnet_t *chan);
+// Shut the connection down both ways (without releasing it)
+
+int shmnet_close(bfs_shmnet_t *chan);
+// Close the connection (the peer reads the bytes sent, then a close)
+
+#endif
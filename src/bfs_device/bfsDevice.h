@@ -57,6 +57,9 @@ public:
 	virtual void setSecurityAssociation(bfsSecAssociation *sa) = 0;
 	// Set the security association
 
+	virtual bfs_device_state_t getDeviceState(void) { return (BFSDEV_READY); }
+	// Return the state of the device (errored once it has failed)
+
 	//
 	// Class Methods
 
@@ -80,6 +83,47 @@ public:
 	virtual int putBlocks(bfs_block_list_t &blks) = 0;
 	// Put the blocks associated with the following IDs
 
+	// Start getting the blocks, complete with waitBlocks (returns tag, 0 fail)
+	virtual bfs_device_tag_t getBlocksAsync(bfs_block_list_t &blks) {
+		return (getBlocks(blks) ? 0 : BFS_DEVICE_TAG_DONE);
+	}
+
+	// Start putting the blocks, complete with waitBlocks (returns tag, 0 fail)
+	virtual bfs_device_tag_t putBlocksAsync(bfs_block_list_t &blks) {
+		return (putBlocks(blks) ? 0 : BFS_DEVICE_TAG_DONE);
+	}
+
+	// Wait for a get/put blocks request to complete (0 success, -1 failure)
+	virtual int waitBlocks(bfs_device_tag_t tag, bfs_block_list_t &blks) {
+		(void)blks;
+		return ((tag == BFS_DEVICE_TAG_DONE) ? 0 : -1);
+	}
+
+	// Put a block, durable on the device before returning (default barrier)
+	virtual int putBlockFua(PBfsBlock &blk) {
+		return ((putBlock(blk) || flushDevice()) ? -1 : 0);
+	}
+
+	// Make the blocks put so far durable on the device (0 success, -1 fail)
+	virtual int flushDevice(void) { return (0); }
+
+	// Start a flush, complete with waitFlush (returns tag, 0 fail)
+	virtual bfs_device_tag_t flushDeviceAsync(void) {
+		return (flushDevice() ? 0 : BFS_DEVICE_TAG_DONE);
+	}
+
+	// Wait for a flush to complete (0 success, -1 failure)
+	virtual int waitFlush(bfs_device_tag_t tag) {
+		return ((tag == BFS_DEVICE_TAG_DONE) ? 0 : -1);
+	}
+
+	// Discard the (freed) blocks, a hint the device may ignore (0 success)
+	virtual int trimBlocks(bfs_block_id_t *pbids, uint32_t nblks) {
+		(void)pbids;
+		(void)nblks;
+		return (0);
+	}
+
 	//
 	// Static class methods
 
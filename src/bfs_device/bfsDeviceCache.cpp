@@ -0,0 +1,449 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsDeviceCache.cpp
+//  Description   : This is the class implementing the block cache of a device
+//                  storage (W-TinyLFU eviction, see the header).
+//
+//  Author  : Patrick McDaniel
+//  Created : Fri 16 Oct 2026 10:12:41 AM EDT
+//
+
+// Include files
+#include <stdlib.h>
+#include <string.h>
+
+// STL-isms
+#include <algorithm>
+
+// Project Includes
+#include <bfsDeviceCache.h>
+#include <bfsDeviceError.h>
+
+// The lists of the cache (the window, then the two segments of the main area)
+#define BFS_DCACHE_WINDOW 0
+#define BFS_DCACHE_PROBATION 1
+#define BFS_DCACHE_PROTECTED 2
+#define BFS_DCACHE_NONE ((uint32_t)-1)
+
+// The sketch geometry: rows, smallest row, counters per block (a row), the
+// counter ceiling, and the accesses per cached block between halvings (so old
+// popularity fades)
+#define BFS_DCACHE_SKETCH_ROWS 4
+#define BFS_DCACHE_SKETCH_MIN_WIDTH 64
+#define BFS_DCACHE_SKETCH_WIDTH 4
+#define BFS_DCACHE_SKETCH_MAX 15
+#define BFS_DCACHE_SKETCH_SAMPLE 10
+
+// The seeds of the sketch row hashes
+static const uint64_t sketchSeeds[BFS_DCACHE_SKETCH_ROWS] = {
+	0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL,
+	0xd6e8feb86659fd93ULL};
+
+static uint64_t cache_hash(uint64_t x);
+
+//
+// Class Functions
+
+/**
+ * @brief The cache size constructor for the class.  1% of the blocks are the
+ * window, 80% of the rest the protected segment of the main area.
+ *
+ * @param nblks - the number of blocks the cache holds
+ */
+
+bfsDeviceCache::bfsDeviceCache(uint64_t nblks)
+	: capacity(nblks), blockData(NULL), sketchAdds(0), writeTicket(0) {
+
+	// Local variables
+	uint64_t width = BFS_DCACHE_SKETCH_MIN_WIDTH;
+	uint32_t i;
+
+	// Size the window and segments
+	if ((capacity == 0) || (capacity >= BFS_DCACHE_NONE)) {
+		throw new bfsDeviceError("Bad device cache size");
+	}
+	windowCap = (capacity / 100 > 0) ? capacity / 100 : 1;
+	protectedCap = (capacity - windowCap) * 80 / 100;
+
+	// Allocate the slots (all free)
+	if ((blockData = (char *)malloc((capacity + 1) * BLK_SZ)) == NULL) {
+		throw new bfsDeviceError("Cannot allocate device cache");
+	}
+	slotBlock.resize(capacity + 1);
+	slotPrev.resize(capacity + 1, BFS_DCACHE_NONE);
+	slotNext.resize(capacity + 1, BFS_DCACHE_NONE);
+	slotList.resize(capacity + 1, -1);
+	for (i = 0; i <= capacity; i++) {
+		freeSlots.push_back((uint32_t)(capacity - i));
+	}
+	for (i = 0; i < 3; i++) {
+		listHead[i] = listTail[i] = BFS_DCACHE_NONE;
+		listSize[i] = 0;
+	}
+	blockSlots.reserve(capacity + 1);
+
+	// Size the sketch (a row per hash, 4+ counters per block a row, so the
+	// blocks passing through between halvings seldom share all counters)
+	while (width < capacity * BFS_DCACHE_SKETCH_WIDTH) {
+		width *= 2;
+	}
+	sketch.resize(BFS_DCACHE_SKETCH_ROWS * width, 0);
+	sketchMask = width - 1;
+	sketchSample = capacity * BFS_DCACHE_SKETCH_SAMPLE;
+
+	memset(&stats, 0x0, sizeof(stats));
+	pthread_mutex_init(&cacheLock, NULL);
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief The destructor function for the class
+ *
+ * @param none
+ */
+
+bfsDeviceCache::~bfsDeviceCache(void) {
+
+	// Release the slots, return (no return code)
+	free(blockData);
+	pthread_mutex_destroy(&cacheLock);
+	return;
+}
+
+/**
+ * @brief Get the counters of the cache
+ *
+ * @param none
+ * @return bfs_device_cache_stats_t : the counters
+ */
+
+bfs_device_cache_stats_t bfsDeviceCache::getStats(void) {
+
+	// Copy them under the lock
+	bfs_device_cache_stats_t st;
+	pthread_mutex_lock(&cacheLock);
+	st = stats;
+	pthread_mutex_unlock(&cacheLock);
+	return (st);
+}
+
+/**
+ * @brief Get a block from the cache, counting the access either way.  A hit
+ * in the probation segment moves the block to the protected segment.
+ *
+ * @param blkid - the block ID of the block to get
+ * @param blk - the buffer to copy the block into
+ * @param ticket - the ticket to admit the block with (if not cached)
+ * @return bool : true if cached (copied), false if not
+ */
+
+bool bfsDeviceCache::getBlock(bfs_block_id_t blkid, char *blk,
+							  uint64_t &ticket) {
+
+	// Local variables
+	unordered_map<bfs_block_id_t, uint32_t>::iterator it;
+	uint32_t slot, dem;
+	int list;
+
+	// Count the access, look the block up
+	pthread_mutex_lock(&cacheLock);
+	sketchIncrement(blkid);
+	if ((it = blockSlots.find(blkid)) == blockSlots.end()) {
+		stats.misses++;
+		ticket = writeTicket;
+		pthread_mutex_unlock(&cacheLock);
+		return (false);
+	}
+
+	// Copy it out, then move it up its list (or to the protected segment)
+	slot = it->second;
+	memcpy(blk, &blockData[(size_t)slot * BLK_SZ], BLK_SZ);
+	list = slotList[slot];
+	listRemove(slot);
+	listPush(slot,
+			 (list == BFS_DCACHE_PROBATION) ? BFS_DCACHE_PROTECTED : list);
+	while (listSize[BFS_DCACHE_PROTECTED] > protectedCap) {
+		dem = listTail[BFS_DCACHE_PROTECTED];
+		listRemove(dem);
+		listPush(dem, BFS_DCACHE_PROBATION);
+	}
+	stats.hits++;
+	pthread_mutex_unlock(&cacheLock);
+	return (true);
+}
+
+/**
+ * @brief Offer a block read from the storage after a miss.  It enters the
+ * window, and the block it pushes out of the window competes with the main
+ * area's victim on estimated frequency.  Blocks put (or invalidated) since
+ * the miss may have been read stale, so the block is dropped then.
+ *
+ * @param blkid - the block ID of the block read
+ * @param blk - the block read
+ * @param ticket - the ticket of the miss (from getBlock)
+ * @return none
+ */
+
+void bfsDeviceCache::admitBlock(bfs_block_id_t blkid, char *blk,
+								uint64_t ticket) {
+
+	// Local variables
+	unordered_map<bfs_block_id_t, uint32_t>::iterator it;
+	uint32_t slot;
+
+	// Drop stale reads, refresh blocks admitted since the miss
+	pthread_mutex_lock(&cacheLock);
+	if (ticket != writeTicket) {
+		pthread_mutex_unlock(&cacheLock);
+		return;
+	}
+	if ((it = blockSlots.find(blkid)) != blockSlots.end()) {
+		memcpy(&blockData[(size_t)it->second * BLK_SZ], blk, BLK_SZ);
+		pthread_mutex_unlock(&cacheLock);
+		return;
+	}
+
+	// Put it in a free slot at the front of the window, then rebalance
+	slot = freeSlots.back();
+	freeSlots.pop_back();
+	slotBlock[slot] = blkid;
+	blockSlots[blkid] = slot;
+	memcpy(&blockData[(size_t)slot * BLK_SZ], blk, BLK_SZ);
+	listPush(slot, BFS_DCACHE_WINDOW);
+	balanceCache();
+	pthread_mutex_unlock(&cacheLock);
+	return;
+}
+
+/**
+ * @brief Update the cached copy of a block put into the storage
+ *
+ * @param blkid - the block ID of the block put
+ * @param blk - the block put
+ * @return none
+ */
+
+void bfsDeviceCache::updateBlock(bfs_block_id_t blkid, char *blk) {
+
+	// Local variables
+	unordered_map<bfs_block_id_t, uint32_t>::iterator it;
+
+	// Copy it over (if cached)
+	pthread_mutex_lock(&cacheLock);
+	writeTicket++;
+	if ((it = blockSlots.find(blkid)) != blockSlots.end()) {
+		memcpy(&blockData[(size_t)it->second * BLK_SZ], blk, BLK_SZ);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return;
+}
+
+/**
+ * @brief Drop the cached copy of a block (e.g., trimmed, or a failed put)
+ *
+ * @param blkid - the block ID of the block
+ * @return none
+ */
+
+void bfsDeviceCache::invalidateBlock(bfs_block_id_t blkid) {
+
+	// Local variables
+	unordered_map<bfs_block_id_t, uint32_t>::iterator it;
+
+	// Free its slot (if cached)
+	pthread_mutex_lock(&cacheLock);
+	writeTicket++;
+	if ((it = blockSlots.find(blkid)) != blockSlots.end()) {
+		releaseSlot(it->second);
+	}
+	pthread_mutex_unlock(&cacheLock);
+	return;
+}
+
+//
+// Private class methods
+
+/**
+ * @brief Unlink a slot from the list it is on
+ *
+ * @param slot - the slot to unlink
+ * @return none
+ */
+
+void bfsDeviceCache::listRemove(uint32_t slot) {
+
+	// Local variables
+	int list = slotList[slot];
+
+	// Fix the neighbours (or the ends of the list)
+	if (slotPrev[slot] != BFS_DCACHE_NONE) {
+		slotNext[slotPrev[slot]] = slotNext[slot];
+	} else {
+		listHead[list] = slotNext[slot];
+	}
+	if (slotNext[slot] != BFS_DCACHE_NONE) {
+		slotPrev[slotNext[slot]] = slotPrev[slot];
+	} else {
+		listTail[list] = slotPrev[slot];
+	}
+	slotPrev[slot] = slotNext[slot] = BFS_DCACHE_NONE;
+	slotList[slot] = -1;
+	listSize[list]--;
+	return;
+}
+
+/**
+ * @brief Link a slot at the most recently used end (head) of a list
+ *
+ * @param slot - the slot to link
+ * @param list - the list to link it on
+ * @return none
+ */
+
+void bfsDeviceCache::listPush(uint32_t slot, int list) {
+	slotPrev[slot] = BFS_DCACHE_NONE;
+	slotNext[slot] = listHead[list];
+	if (listHead[list] != BFS_DCACHE_NONE) {
+		slotPrev[listHead[list]] = slot;
+	} else {
+		listTail[list] = slot;
+	}
+	listHead[list] = slot;
+	slotList[slot] = list;
+	listSize[list]++;
+	return;
+}
+
+/**
+ * @brief Drop the block in a slot, freeing the slot
+ *
+ * @param slot - the slot to free
+ * @return none
+ */
+
+void bfsDeviceCache::releaseSlot(uint32_t slot) {
+	listRemove(slot);
+	blockSlots.erase(slotBlock[slot]);
+	freeSlots.push_back(slot);
+	return;
+}
+
+/**
+ * @brief Count an access to a block in each row of the sketch (saturating),
+ * halving all the counters every sample period
+ *
+ * @param blkid - the block ID of the block accessed
+ * @return none
+ */
+
+void bfsDeviceCache::sketchIncrement(bfs_block_id_t blkid) {
+
+	// Local variables
+	uint64_t h;
+	size_t i;
+	int r;
+
+	// Bump the block's counter in each row
+	for (r = 0; r < BFS_DCACHE_SKETCH_ROWS; r++) {
+		h = cache_hash(blkid ^ sketchSeeds[r]);
+		i = (size_t)r * (sketchMask + 1) + (h & sketchMask);
+		if (sketch[i] < BFS_DCACHE_SKETCH_MAX) {
+			sketch[i]++;
+		}
+	}
+
+	// Age the counters every sample period
+	if (++sketchAdds >= sketchSample) {
+		for (i = 0; i < sketch.size(); i++) {
+			sketch[i] >>= 1;
+		}
+		sketchAdds /= 2;
+	}
+	return;
+}
+
+/**
+ * @brief Estimate the accesses to a block (the smallest of its counters)
+ *
+ * @param blkid - the block ID of the block
+ * @return uint32_t : the estimated accesses (at most the counter ceiling)
+ */
+
+uint32_t bfsDeviceCache::sketchFrequency(bfs_block_id_t blkid) {
+
+	// Local variables
+	uint32_t freq = BFS_DCACHE_SKETCH_MAX;
+	uint64_t h;
+	size_t i;
+	int r;
+
+	// Take the smallest counter of the rows
+	for (r = 0; r < BFS_DCACHE_SKETCH_ROWS; r++) {
+		h = cache_hash(blkid ^ sketchSeeds[r]);
+		i = (size_t)r * (sketchMask + 1) + (h & sketchMask);
+		freq = min<uint32_t>(freq, sketch[i]);
+	}
+	return (freq);
+}
+
+/**
+ * @brief Move the blocks pushed out of the window to the probation segment.
+ * While the cache is over its capacity, each such candidate competes with
+ * the main area's least recently used block (the victim), the less
+ * frequently accessed of the two being evicted.
+ *
+ * @param none
+ * @return none
+ */
+
+void bfsDeviceCache::balanceCache(void) {
+
+	// Local variables
+	uint32_t cand, victim;
+
+	// Move the window's least recently used blocks into the main area
+	while (listSize[BFS_DCACHE_WINDOW] > windowCap) {
+		cand = listTail[BFS_DCACHE_WINDOW];
+		listRemove(cand);
+		listPush(cand, BFS_DCACHE_PROBATION);
+		if (blockSlots.size() <= capacity) {
+			stats.admitted++;
+			continue;
+		}
+
+		// Full, so the candidate has to beat the victim to stay
+		victim = (listSize[BFS_DCACHE_PROBATION] > 1)
+					 ? listTail[BFS_DCACHE_PROBATION]
+					 : listTail[BFS_DCACHE_PROTECTED];
+		if ((victim != BFS_DCACHE_NONE) &&
+			(sketchFrequency(slotBlock[cand]) >
+			 sketchFrequency(slotBlock[victim]))) {
+			releaseSlot(victim);
+			stats.admitted++;
+			stats.evicted++;
+		} else {
+			releaseSlot(cand);
+			stats.rejected++;
+		}
+	}
+	return;
+}
+
+//
+// Static functions
+
+/**
+ * @brief Hash a block ID (the splitmix64 finalizer, so adjacent blocks
+ * spread over the sketch rows)
+ *
+ * @param x - the value to hash
+ * @return uint64_t : the hash
+ */
+
+static uint64_t cache_hash(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return (x ^ (x >> 31));
+}
@@ -0,0 +1,165 @@
+#ifndef BFS_DEVICE_CACHE_INCLUDED
+#define BFS_DEVICE_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsDeviceCache.h
+//  Description   : This is the class describing the block cache of a device
+//                  storage.  It keeps a bounded set of (ciphertext) blocks in
+//                  memory, evicting with W-TinyLFU: new blocks enter a small
+//                  LRU window, and leave it for the main (segmented LRU) area
+//                  only if a frequency sketch says they are used more often
+//                  than the block they would evict.
+//
+//  Author  : Patrick McDaniel
+//  Created : Fri 16 Oct 2026 10:12:41 AM EDT
+//
+
+// Include files
+#include <pthread.h>
+
+// STL-isms
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Project Includes
+#include <bfs_common.h>
+
+//
+// Class definitions
+
+//
+// Class types
+
+// The counters of a device cache
+typedef struct {
+	uint64_t hits;	   // The gets found in the cache
+	uint64_t misses;   // The gets not found in the cache
+	uint64_t admitted; // The blocks admitted to the main area
+	uint64_t rejected; // The blocks rejected by the frequency sketch
+	uint64_t evicted;  // The blocks evicted from the main area
+} bfs_device_cache_stats_t;
+
+//
+// Class Definition
+
+class bfsDeviceCache {
+
+public:
+	//
+	// Public Interfaces0
+
+	// Constructors and destructors
+
+	bfsDeviceCache(uint64_t nblks);
+	// Cache size constructor (in blocks)
+
+	virtual ~bfsDeviceCache(void);
+	// Destructor
+
+	//
+	// Getter and Setter Methods
+
+	// Return the number of blocks the cache holds (at most)
+	uint64_t getCapacity(void) { return (capacity); }
+
+	bfs_device_cache_stats_t getStats(void);
+	// Get the counters of the cache
+
+	//
+	// Class Methods
+
+	bool getBlock(bfs_block_id_t blkid, char *blk, uint64_t &ticket);
+	// Get a block from the cache (false and an admit ticket if not cached)
+
+	void admitBlock(bfs_block_id_t blkid, char *blk, uint64_t ticket);
+	// Offer a block read after a miss (dropped if written since the miss)
+
+	void updateBlock(bfs_block_id_t blkid, char *blk);
+	// Update the cached copy of a block put (if it is cached)
+
+	void invalidateBlock(bfs_block_id_t blkid);
+	// Drop the cached copy of a block (if it is cached)
+
+private:
+	// Private class methods
+
+	bfsDeviceCache(void);
+	// Default constructor
+	// Note: Force all creation to use factory functions
+
+	void listRemove(uint32_t slot);
+	// Unlink a slot from the list it is on
+
+	void listPush(uint32_t slot, int list);
+	// Link a slot at the most recently used end of a list
+
+	void releaseSlot(uint32_t slot);
+	// Drop the block in a slot, freeing the slot
+
+	void sketchIncrement(bfs_block_id_t blkid);
+	// Count an access to a block in the frequency sketch
+
+	uint32_t sketchFrequency(bfs_block_id_t blkid);
+	// Estimate the accesses to a block from the frequency sketch
+
+	void balanceCache(void);
+	// Move blocks out of the window and evict to stay within the capacity
+
+	//
+	// Class Data
+
+	uint64_t capacity;
+	// The number of blocks the cache holds (at most)
+
+	uint64_t windowCap;
+	// The number of blocks in the window (at most)
+
+	uint64_t protectedCap;
+	// The number of blocks in the protected segment (at most)
+
+	char *blockData;
+	// The block data of the slots (one extra slot to admit through)
+
+	vector<bfs_block_id_t> slotBlock;
+	// The block held in each slot
+
+	vector<uint32_t> slotPrev, slotNext;
+	// The links of each slot on its list
+
+	vector<int> slotList;
+	// The list each slot is on
+
+	uint32_t listHead[3], listTail[3];
+	// The most/least recently used slots of the window, probation, protected
+
+	uint64_t listSize[3];
+	// The number of slots on each list
+
+	vector<uint32_t> freeSlots;
+	// The slots holding no block
+
+	unordered_map<bfs_block_id_t, uint32_t> blockSlots;
+	// The slot holding each cached block
+
+	vector<uint8_t> sketch;
+	// The count-min sketch counters (saturating at 15, halved periodically)
+
+	uint64_t sketchMask;
+	// The index mask of a row of the sketch
+
+	uint64_t sketchAdds, sketchSample;
+	// The accesses counted since the last halving, and the halving period
+
+	uint64_t writeTicket;
+	// Moves on with each update/invalidate (stale admits are dropped)
+
+	bfs_device_cache_stats_t stats;
+	// The counters of the cache
+
+	pthread_mutex_t cacheLock;
+	// The lock protecting the cache (gets of workers are concurrent)
+};
+
+#endif
@@ -0,0 +1,686 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsDeviceJournal.cpp
+//  Description   : This is the class implementing the write-ahead journal of
+//                  a device storage (see the header).
+//
+//  Author  : Patrick McDaniel
+//  Created : Fri 16 Oct 2026 11:05:12 PM EDT
+//
+
+// Include files
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// STL-isms
+#include <algorithm>
+#include <vector>
+
+// Project Includes
+#include <bfsDeviceError.h>
+#include <bfsDeviceJournal.h>
+#include <bfsDeviceStorage.h>
+#include <bfs_log.h>
+
+// The magic numbers of the super block and of a record header
+#define BFS_JOURNAL_SUPER_MAGIC 0x42465321534a524eULL
+#define BFS_JOURNAL_RECORD_MAGIC 0x42465321524a524eULL
+
+// The super block of the journal (the first block of the file), recording
+// where the records not checkpointed start
+typedef struct {
+	uint64_t magic; // BFS_JOURNAL_SUPER_MAGIC
+	uint64_t tail;	// The offset of the oldest record not checkpointed
+	uint64_t seq;	// The sequence of that record
+	uint64_t sum;	// The check of the fields above
+} bfs_journal_super_t;
+
+// The header of a record (followed by the block IDs, padded to a block, then
+// the blocks)
+typedef struct {
+	uint64_t magic; // BFS_JOURNAL_RECORD_MAGIC
+	uint64_t seq;	// The sequence of the record
+	uint64_t nblks; // The number of blocks in the record
+	uint64_t sum;	// The check of the block IDs and blocks
+} bfs_journal_record_t;
+
+static uint64_t journal_sum(uint64_t h, const char *buf, size_t len);
+static uint64_t journal_header_len(uint64_t nblks);
+
+//
+// Class Functions
+
+/**
+ * @brief The journal file and size constructor for the class.  A record holds
+ * at most half of the journal, so one always fits after a checkpoint.
+ *
+ * @param stg - the storage the journal is for
+ * @param path - the path to the journal file
+ * @param nblks - the number of blocks the journal holds
+ */
+
+bfsDeviceJournal::bfsDeviceJournal(bfsDeviceStorage *stg, string path,
+								   uint64_t nblks)
+	: storage(stg), journalPath(path), journalFd(-1), capacity(nblks * BLK_SZ),
+	  maxRecordBlocks(0), headOff(0), tailOff(0), nextSeq(1), tailSeq(1),
+	  appliedOff(0), appliedSeq(1), writtenSeq(1), durableSeq(1),
+	  syncing(false), failed(false), used(0), stopping(false),
+	  ckptRequested(false), ckptRunning(false) {
+
+	// Size the largest record
+	uint64_t n = nblks / 2;
+	while ((n > 0) && (journal_header_len(n) + n * BLK_SZ > capacity / 2)) {
+		n--;
+	}
+	if (n == 0) {
+		throw new bfsDeviceError("Device journal too small");
+	}
+	maxRecordBlocks = (uint32_t)min(n, (uint64_t)UINT32_MAX);
+
+	// Setup the counters and locks
+	memset(&stats, 0x0, sizeof(stats));
+	pthread_mutex_init(&journalLock, NULL);
+	pthread_mutex_init(&ckptLock, NULL);
+	pthread_cond_init(&ckptCond, NULL);
+	pthread_cond_init(&spaceCond, NULL);
+	pthread_cond_init(&syncCond, NULL);
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief The destructor function for the class (stops the checkpoint thread,
+ * checkpoints the records left)
+ *
+ * @param none
+ */
+
+bfsDeviceJournal::~bfsDeviceJournal(void) {
+
+	// Stop the checkpoint thread
+	pthread_mutex_lock(&journalLock);
+	stopping = true;
+	pthread_cond_broadcast(&ckptCond);
+	pthread_cond_broadcast(&spaceCond);
+	pthread_mutex_unlock(&journalLock);
+	if (ckptRunning) {
+		pthread_join(ckptThread, NULL);
+	}
+
+	// Checkpoint the records left, close the file
+	if (journalFd != -1) {
+		checkpoint();
+		close(journalFd);
+	}
+	pthread_mutex_destroy(&journalLock);
+	pthread_mutex_destroy(&ckptLock);
+	pthread_cond_destroy(&ckptCond);
+	pthread_cond_destroy(&spaceCond);
+	pthread_cond_destroy(&syncCond);
+
+	// Return, no return code
+	return;
+}
+
+/**
+ * @brief Get the counters of the journal
+ *
+ * @param none
+ * @return bfs_device_journal_stats_t : the counters
+ */
+
+bfs_device_journal_stats_t bfsDeviceJournal::getStats(void) {
+
+	// Copy the counters out under the lock
+	bfs_device_journal_stats_t st;
+	pthread_mutex_lock(&journalLock);
+	st = stats;
+	pthread_mutex_unlock(&journalLock);
+	return (st);
+}
+
+/**
+ * @brief Open the journal (creating the file as needed), replay the records
+ * not checkpointed into the data area, and start the checkpoint thread
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceJournal::openJournal(void) {
+
+	// Local variables
+	sigset_t sigs, oldsigs;
+	struct stat st;
+	int ret;
+
+	// Open the file, size it (the super block, then the records)
+	if ((journalFd = open(journalPath.c_str(), O_RDWR | O_CREAT, 0600)) ==
+		-1) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal open failed [%s] : [%s]",
+				   journalPath.c_str(), strerror(errno));
+		return (-1);
+	}
+	if ((fstat(journalFd, &st) == -1) ||
+		(((uint64_t)st.st_size < capacity + BLK_SZ) &&
+		 (ftruncate(journalFd, (off_t)(capacity + BLK_SZ)) == -1))) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal sizing failed [%s] : [%s]",
+				   journalPath.c_str(), strerror(errno));
+		return (-1);
+	}
+
+	// Replay the records a crash left
+	if (replayRecords()) {
+		return (-1);
+	}
+
+	// Start the checkpoint thread (with the signals blocked)
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	ret = pthread_create(&ckptThread, NULL, checkpointThread, this);
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+	if (ret) {
+		logMessage(LOG_ERROR_LEVEL, "Failed creating device journal thread");
+		return (-1);
+	}
+	ckptRunning = true;
+
+	// Log, return successfully
+	logMessage(DEVICE_LOG_LEVEL,
+			   "Device journal opened [%s] (%lu blocks, %u per record, %lu "
+			   "replayed)",
+			   journalPath.c_str(), capacity / BLK_SZ, maxRecordBlocks,
+			   stats.replayed);
+	return (0);
+}
+
+/**
+ * @brief Append a batch of blocks to the journal as one record, returning
+ * once it is durable (waiting for a checkpoint if the journal is full).  The
+ * space and sequence of the record are taken under the lock, the record is
+ * written without it, then one of the appends waiting syncs the journal for
+ * all the records written before it (group commit).  A record is only
+ * durable once the records before it are (the replay stops at the first
+ * missing one).  The blocks must then be written to the data area in the
+ * order of the records (see waitApply, markApplied).
+ *
+ * @param blkids - the block IDs of the blocks
+ * @param nblks - the number of blocks (at most getMaxRecordBlocks)
+ * @param blks - the buffers holding the blocks
+ * @param seq - the sequence of the record (returned)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceJournal::appendRecord(bfs_block_id_t *blkids, uint32_t nblks,
+								   char **blks, uint64_t &seq) {
+
+	// Local variables
+	bfs_journal_record_t *rec;
+	bfs_journal_entry_t ent;
+	vector<struct iovec> iovs(nblks + 1);
+	uint64_t hdrlen = journal_header_len(nblks), len, off, pos, sum, target;
+	ssize_t wr = 0;
+	size_t i, n;
+	char *hdr;
+	int ret;
+
+	// Check the record
+	if ((nblks == 0) || (nblks > maxRecordBlocks)) {
+		logMessage(LOG_ERROR_LEVEL, "Bad device journal record size [%u]",
+				   nblks);
+		return (-1);
+	}
+	len = hdrlen + (uint64_t)nblks * BLK_SZ;
+	if ((hdr = (char *)calloc(1, hdrlen)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal header alloc failed");
+		return (-1);
+	}
+
+	// Find the space for it, waiting for a checkpoint as needed, then take it
+	// (counting any gap skipped at the end), checkpoint if filling
+	pthread_mutex_lock(&journalLock);
+	while ((!stopping) && (!failed) && (!findSpace(len, off))) {
+		ckptRequested = true;
+		pthread_cond_signal(&ckptCond);
+		pthread_cond_wait(&spaceCond, &journalLock);
+	}
+	if (stopping || failed) {
+		pthread_mutex_unlock(&journalLock);
+		free(hdr);
+		return (-1);
+	}
+	ent.seq = seq = nextSeq++;
+	ent.off = off;
+	ent.len = len + (((off == 0) && (used > 0)) ? capacity - headOff : 0);
+	ent.end = off + len;
+	ent.written = false;
+	entries.push_back(ent);
+	used += ent.len;
+	headOff = ent.end;
+	stats.records++;
+	stats.blocks += nblks;
+	if (used >= capacity / 2) {
+		ckptRequested = true;
+		pthread_cond_signal(&ckptCond);
+	}
+	pthread_mutex_unlock(&journalLock);
+
+	// Build the header (the block IDs after it)
+	memcpy(hdr + sizeof(bfs_journal_record_t), blkids,
+		   sizeof(bfs_block_id_t) * nblks);
+	sum = journal_sum(seq, hdr + sizeof(bfs_journal_record_t),
+					  sizeof(bfs_block_id_t) * nblks);
+	iovs[0].iov_base = hdr;
+	iovs[0].iov_len = hdrlen;
+	for (i = 0; i < nblks; i++) {
+		sum = journal_sum(sum, blks[i], BLK_SZ);
+		iovs[i + 1].iov_base = blks[i];
+		iovs[i + 1].iov_len = BLK_SZ;
+	}
+	rec = (bfs_journal_record_t *)hdr;
+	rec->magic = BFS_JOURNAL_RECORD_MAGIC;
+	rec->seq = seq;
+	rec->nblks = nblks;
+	rec->sum = sum;
+
+	// Write the record sequentially (IOV_MAX buffers at a time)
+	pos = BLK_SZ + off;
+	for (i = 0; i < iovs.size(); i += n) {
+		n = min(iovs.size() - i, (size_t)IOV_MAX);
+		if ((wr = pwritev(journalFd, &iovs[i], (int)n, (off_t)pos)) !=
+			(ssize_t)((i == 0 ? hdrlen - BLK_SZ : 0) + n * BLK_SZ)) {
+			logMessage(LOG_ERROR_LEVEL, "Device journal write failed : [%s]",
+					   (wr == -1) ? strerror(errno) : "short write");
+			wr = -1;
+			break;
+		}
+		pos += (uint64_t)wr;
+	}
+	free(hdr);
+
+	// Mark it written (a failed record fails the ones after it, which the
+	// replay would not reach), then wait for a sync covering it, taking the
+	// sync for the records written so far if none is running
+	pthread_mutex_lock(&journalLock);
+	if (wr == -1) {
+		failed = true;
+		pthread_cond_broadcast(&spaceCond);
+	}
+	findEntry(seq).written = true;
+	while ((writtenSeq < nextSeq) && findEntry(writtenSeq).written) {
+		writtenSeq++;
+	}
+	pthread_cond_broadcast(&syncCond);
+	while ((!failed) && (durableSeq <= seq)) {
+		if ((syncing) || (writtenSeq <= seq)) {
+			pthread_cond_wait(&syncCond, &journalLock);
+			continue;
+		}
+		syncing = true;
+		target = writtenSeq;
+		pthread_mutex_unlock(&journalLock);
+		ret = fdatasync(journalFd);
+		pthread_mutex_lock(&journalLock);
+		if (ret == -1) {
+			logMessage(LOG_ERROR_LEVEL, "Device journal sync failed : [%s]",
+					   strerror(errno));
+			failed = true;
+			pthread_cond_broadcast(&spaceCond);
+		} else {
+			durableSeq = max(durableSeq, target);
+		}
+		syncing = false;
+		stats.syncs++;
+		pthread_cond_broadcast(&syncCond);
+	}
+	ret = (durableSeq > seq) ? 0 : -1;
+	pthread_mutex_unlock(&journalLock);
+
+	// Return the status
+	logMessage(DEVICE_VRBLOG_LEVEL, "Device journal record [%lu] %u blocks",
+			   seq, nblks);
+	return (ret);
+}
+
+/**
+ * @brief Wait for the records before one to be written to the data area (so
+ * the blocks are written in the order a replay writes them)
+ *
+ * @param seq - the sequence of the record (durable)
+ * @return int : 0 is success, -1 is failure (a record failed)
+ */
+
+int bfsDeviceJournal::waitApply(uint64_t seq) {
+
+	// Wait for the turn of the record
+	int ret;
+	pthread_mutex_lock(&journalLock);
+	while ((!failed) && (appliedSeq != seq)) {
+		pthread_cond_wait(&syncCond, &journalLock);
+	}
+	ret = (failed) ? -1 : 0;
+	pthread_mutex_unlock(&journalLock);
+	return (ret);
+}
+
+/**
+ * @brief Mark a record as written to the data area (the next checkpoint may
+ * release it), passing the turn to the next record.  If it could not be
+ * written the journal fails, leaving the records for the replay.
+ *
+ * @param seq - the sequence of the record (whose turn it is)
+ * @param applied - flag indicating the record was written to the data area
+ */
+
+void bfsDeviceJournal::markApplied(uint64_t seq, bool applied) {
+	pthread_mutex_lock(&journalLock);
+	if (!applied) {
+		failed = true;
+		pthread_cond_broadcast(&spaceCond);
+	}
+	appliedOff = findEntry(seq).end;
+	appliedSeq = seq + 1;
+	pthread_cond_broadcast(&syncCond);
+	pthread_mutex_unlock(&journalLock);
+}
+
+/**
+ * @brief Checkpoint the journal: sync the data area, then record in the
+ * super block that the records written to it need no replay, and release
+ * their space
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceJournal::checkpoint(void) {
+
+	// Local variables
+	uint64_t off, seq;
+	bool fail;
+
+	// Find the records written to the data area (a failed journal keeps its
+	// records for the replay)
+	pthread_mutex_lock(&ckptLock);
+	pthread_mutex_lock(&journalLock);
+	ckptRequested = false;
+	off = appliedOff;
+	seq = appliedSeq;
+	fail = failed;
+	pthread_mutex_unlock(&journalLock);
+	if ((fail) || (seq == tailSeq)) {
+		pthread_mutex_unlock(&ckptLock);
+		return ((fail) ? -1 : 0);
+	}
+
+	// Sync the data area, then move the tail past them
+	if (storage->flushData() || writeSuper(off, seq)) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal checkpoint failed");
+		pthread_mutex_lock(&journalLock);
+		pthread_cond_broadcast(&spaceCond);
+		pthread_mutex_unlock(&journalLock);
+		pthread_mutex_unlock(&ckptLock);
+		return (-1);
+	}
+
+	// Release their space
+	pthread_mutex_lock(&journalLock);
+	while ((!entries.empty()) && (entries.front().seq < seq)) {
+		used -= entries.front().len;
+		entries.pop_front();
+	}
+	tailOff = off;
+	tailSeq = seq;
+	stats.checkpoints++;
+	pthread_cond_broadcast(&spaceCond);
+	pthread_mutex_unlock(&journalLock);
+	pthread_mutex_unlock(&ckptLock);
+
+	// Return successfully
+	logMessage(DEVICE_VRBLOG_LEVEL, "Device journal checkpoint at [%lu]", seq);
+	return (0);
+}
+
+//
+// Private class functions
+
+/**
+ * @brief Write the records not checkpointed (from the tail in the super
+ * block, in sequence, until a record is missing or torn) to the data area,
+ * then checkpoint them.  A record that did not fit at the end of the journal
+ * is at its start.
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceJournal::replayRecords(void) {
+
+	// Local variables
+	bfs_journal_super_t sb;
+	bfs_journal_record_t rec;
+	vector<char *> blks;
+	uint64_t off = 0, seq = 1, hdrlen, len, i;
+	bool wrapped;
+	char *buf;
+	int ret = 0;
+
+	// Find the tail (a new journal has no super block)
+	if ((pread(journalFd, &sb, sizeof(sb), 0) == (ssize_t)sizeof(sb)) &&
+		(sb.magic == BFS_JOURNAL_SUPER_MAGIC) &&
+		(sb.sum == journal_sum(sb.seq, (char *)&sb.tail, sizeof(uint64_t))) &&
+		(sb.tail < capacity)) {
+		off = sb.tail;
+		seq = sb.seq;
+	}
+
+	// Walk the records in sequence
+	for (wrapped = false;;) {
+		if ((capacity - off < BLK_SZ) ||
+			(pread(journalFd, &rec, sizeof(rec), (off_t)(BLK_SZ + off)) !=
+			 (ssize_t)sizeof(rec)) ||
+			(rec.magic != BFS_JOURNAL_RECORD_MAGIC) || (rec.seq != seq) ||
+			(rec.nblks == 0) || (rec.nblks > capacity / BLK_SZ)) {
+			if ((off != 0) && (!wrapped)) {
+				off = 0;
+				wrapped = true;
+				continue;
+			}
+			break;
+		}
+		hdrlen = journal_header_len(rec.nblks);
+		len = hdrlen + rec.nblks * BLK_SZ;
+		if (off + len > capacity) {
+			break;
+		}
+
+		// Read and check the record (a torn record ends the replay)
+		if ((buf = (char *)malloc(len)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Device journal replay alloc failed");
+			return (-1);
+		}
+		if ((pread(journalFd, buf, len, (off_t)(BLK_SZ + off)) !=
+			 (ssize_t)len) ||
+			(journal_sum(journal_sum(seq, buf + sizeof(rec),
+									 sizeof(bfs_block_id_t) * rec.nblks),
+						 buf + hdrlen, rec.nblks * BLK_SZ) != rec.sum)) {
+			logMessage(DEVICE_LOG_LEVEL,
+					   "Device journal record [%lu] torn, replay ends", seq);
+			free(buf);
+			break;
+		}
+
+		// Write the blocks to the data area
+		blks.resize(rec.nblks);
+		for (i = 0; i < rec.nblks; i++) {
+			blks[i] = buf + hdrlen + i * BLK_SZ;
+		}
+		ret = storage->writeBlocks((bfs_block_id_t *)(buf + sizeof(rec)),
+								   (uint32_t)rec.nblks, blks.data(), false);
+		free(buf);
+		if (ret) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Device journal replay of record [%lu] failed", seq);
+			return (-1);
+		}
+		stats.replayed++;
+		off += len;
+		seq++;
+		wrapped = false;
+	}
+
+	// Checkpoint what was replayed (the journal starts out empty)
+	if ((stats.replayed > 0) && storage->flushData()) {
+		return (-1);
+	}
+	if (writeSuper(off, seq)) {
+		return (-1);
+	}
+	headOff = tailOff = appliedOff = off;
+	nextSeq = tailSeq = appliedSeq = writtenSeq = durableSeq = seq;
+	return (0);
+}
+
+/**
+ * @brief Write (and sync) the super block recording the checkpoint
+ *
+ * @param tail - the offset of the oldest record not checkpointed
+ * @param seq - the sequence of that record
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceJournal::writeSuper(uint64_t tail, uint64_t seq) {
+
+	// Fill in and write the super block
+	bfs_journal_super_t sb;
+	sb.magic = BFS_JOURNAL_SUPER_MAGIC;
+	sb.tail = tail;
+	sb.seq = seq;
+	sb.sum = journal_sum(seq, (char *)&sb.tail, sizeof(uint64_t));
+	if ((pwrite(journalFd, &sb, sizeof(sb), 0) != (ssize_t)sizeof(sb)) ||
+		(fdatasync(journalFd) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal super write failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Find the offset to append a record at: after the last record, else
+ * (if it does not fit before the end) at the start (must be called with the
+ * journal lock held)
+ *
+ * @param len - the bytes of the record
+ * @param off - the offset to append at (returned)
+ * @return bool : true if found, false if the journal is too full
+ */
+
+bool bfsDeviceJournal::findSpace(uint64_t len, uint64_t &off) {
+
+	// An empty journal fits any record (at most half of it)
+	if (used == 0) {
+		off = (capacity - headOff >= len) ? headOff : 0;
+		return (true);
+	}
+
+	// Otherwise the free space is after the head, up to the tail
+	if (headOff > tailOff) {
+		if (capacity - headOff >= len) {
+			off = headOff;
+			return (true);
+		}
+		if (tailOff >= len) {
+			off = 0;
+			return (true);
+		}
+	} else if ((headOff < tailOff) && (tailOff - headOff >= len)) {
+		off = headOff;
+		return (true);
+	}
+	return (false);
+}
+
+/**
+ * @brief Find a record not checkpointed by its sequence (must be called with
+ * the journal lock held)
+ *
+ * @param seq - the sequence of the record
+ * @return bfs_journal_entry_t & : the record
+ */
+
+bfs_journal_entry_t &bfsDeviceJournal::findEntry(uint64_t seq) {
+	return (entries[(size_t)(seq - entries.front().seq)]);
+}
+
+/**
+ * @brief The body of the checkpoint thread, checkpointing whenever the
+ * journal is half full (or an append is waiting for space)
+ *
+ * @param arg - the journal
+ * @return void * : NULL
+ */
+
+void *bfsDeviceJournal::checkpointThread(void *arg) {
+
+	// Wait for checkpoints to be wanted, take them
+	bfsDeviceJournal *jnl = (bfsDeviceJournal *)arg;
+	pthread_mutex_lock(&jnl->journalLock);
+	while (!jnl->stopping) {
+		if (!jnl->ckptRequested) {
+			pthread_cond_wait(&jnl->ckptCond, &jnl->journalLock);
+			continue;
+		}
+		pthread_mutex_unlock(&jnl->journalLock);
+		jnl->checkpoint();
+		pthread_mutex_lock(&jnl->journalLock);
+	}
+	pthread_mutex_unlock(&jnl->journalLock);
+	return (NULL);
+}
+
+//
+// Module functions
+
+/**
+ * @brief Add a buffer to a journal check (FNV-1a over 64-bit words, seeded
+ * with the sequence of the record)
+ *
+ * @param h - the check so far (or the seed)
+ * @param buf - the buffer (a multiple of 8 bytes)
+ * @param len - the length of the buffer
+ * @return uint64_t : the check
+ */
+
+static uint64_t journal_sum(uint64_t h, const char *buf, size_t len) {
+
+	// Fold in each word (so a check can be added to buffer by buffer)
+	uint64_t w;
+	size_t i;
+	for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, buf + i, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+/**
+ * @brief Get the length of a record header (the header and block IDs,
+ * padded to a block)
+ *
+ * @param nblks - the number of blocks in the record
+ * @return uint64_t : the length
+ */
+
+static uint64_t journal_header_len(uint64_t nblks) {
+	uint64_t len = sizeof(bfs_journal_record_t) + sizeof(bfs_block_id_t) * nblks;
+	return (((len + BLK_SZ - 1) / BLK_SZ) * BLK_SZ);
+}
@@ -0,0 +1,200 @@
+#ifndef BFS_DEVICE_JOURNAL_INCLUDED
+#define BFS_DEVICE_JOURNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : bfsDeviceJournal.h
+//  Description   : This is the class describing the write-ahead journal of a
+//                  device storage.  Each batch of blocks put is appended to
+//                  the journal as one record (made durable before the put is
+//                  acknowledged, the records appended concurrently sharing a
+//                  sync), then written to the data area without syncing it.  A background thread checkpoints the journal
+//                  (syncs the data area, then releases the records), and the
+//                  records not checkpointed are replayed when the storage is
+//                  opened, so a batch is never torn by a crash.
+//
+//  Author  : Patrick McDaniel
+//  Created : Fri 16 Oct 2026 11:05:12 PM EDT
+//
+
+// Include files
+#include <pthread.h>
+
+// STL-isms
+#include <deque>
+#include <string>
+using namespace std;
+
+// Project Includes
+#include <bfs_common.h>
+
+//
+// Class definitions
+
+//
+// Class types
+class bfsDeviceStorage;
+
+// The counters of a device journal
+typedef struct {
+	uint64_t records;	  // The records appended
+	uint64_t blocks;	  // The blocks appended
+	uint64_t checkpoints; // The checkpoints taken
+	uint64_t replayed;	  // The records replayed when opened
+	uint64_t syncs;		  // The syncs of the records (each covers one or more)
+} bfs_device_journal_stats_t;
+
+// A record appended to the journal (not yet checkpointed)
+typedef struct {
+	uint64_t seq; // The sequence of the record
+	uint64_t off; // The offset of the record in the journal
+	uint64_t len; // The bytes of the record (and the gap skipped before it)
+	uint64_t end; // The offset after the record
+	bool written; // Flag indicating the record is written (maybe not synced)
+} bfs_journal_entry_t;
+
+//
+// Class Definition
+
+class bfsDeviceJournal {
+
+public:
+	//
+	// Public Interfaces
+
+	// Constructors and destructors
+
+	bfsDeviceJournal(bfsDeviceStorage *stg, string path, uint64_t nblks);
+	// Journal file and size constructor (in blocks)
+
+	virtual ~bfsDeviceJournal(void);
+	// Destructor (checkpoints and closes the journal)
+
+	//
+	// Getter and Setter Methods
+
+	// Return the number of blocks the journal holds
+	uint64_t getCapacity(void) { return (capacity / BLK_SZ); }
+
+	// Return the most blocks appended as one record
+	uint32_t getMaxRecordBlocks(void) { return (maxRecordBlocks); }
+
+	bfs_device_journal_stats_t getStats(void);
+	// Get the counters of the journal
+
+	//
+	// Class Methods
+
+	int openJournal(void);
+	// Open the journal, replay the records not checkpointed
+
+	int appendRecord(bfs_block_id_t *blkids, uint32_t nblks, char **blks,
+					 uint64_t &seq);
+	// Append a batch of blocks as one record (durable before returning)
+
+	int waitApply(uint64_t seq);
+	// Wait for the records before one to be written to the data area
+
+	void markApplied(uint64_t seq, bool applied);
+	// Mark a record as written to the data area (or failed to)
+
+	int checkpoint(void);
+	// Sync the data area and release the records written to it
+
+private:
+	// Private class methods
+
+	bfsDeviceJournal(void);
+	// Default constructor
+	// Note: Force all creation to use factory functions
+
+	int replayRecords(void);
+	// Write the records not checkpointed to the data area
+
+	int writeSuper(uint64_t tail, uint64_t seq);
+	// Write (and sync) the super block recording the checkpoint
+
+	bool findSpace(uint64_t len, uint64_t &off);
+	// Find the offset to append a record at (false if not enough space)
+
+	bfs_journal_entry_t &findEntry(uint64_t seq);
+	// Find a record not checkpointed by its sequence
+
+	static void *checkpointThread(void *arg);
+	// The body of the checkpoint thread
+
+	//
+	// Class Data
+
+	bfsDeviceStorage *storage;
+	// The storage the journal is for
+
+	string journalPath;
+	// The path to the journal file
+
+	int journalFd;
+	// The journal file
+
+	uint64_t capacity;
+	// The bytes of the journal holding records (after the super block)
+
+	uint32_t maxRecordBlocks;
+	// The most blocks appended as one record (larger batches are refused)
+
+	uint64_t headOff, tailOff;
+	// The offset to append at, and of the oldest record not checkpointed
+
+	uint64_t nextSeq, tailSeq;
+	// The sequence of the next record, and of the oldest not checkpointed
+
+	uint64_t appliedOff, appliedSeq;
+	// The end of the records written to the data area (and the next seq)
+
+	uint64_t writtenSeq, durableSeq;
+	// The sequences after the records all written, and all synced
+
+	bool syncing;
+	// Flag indicating an append is syncing the journal for the others
+
+	bool failed;
+	// Flag indicating a record failed (the records after it are refused,
+	// and those not checkpointed are left for the replay)
+
+	uint64_t used;
+	// The bytes of the journal holding records not checkpointed
+
+	deque<bfs_journal_entry_t> entries;
+	// The records not checkpointed (in order)
+
+	bfs_device_journal_stats_t stats;
+	// The counters of the journal
+
+	bool stopping;
+	// Flag indicating the checkpoint thread should exit
+
+	bool ckptRequested;
+	// Flag indicating a checkpoint is wanted (the journal is filling)
+
+	pthread_t ckptThread;
+	// The checkpoint thread
+
+	bool ckptRunning;
+	// Flag indicating the checkpoint thread was started
+
+	pthread_mutex_t journalLock;
+	// The lock protecting the journal positions and records
+
+	pthread_mutex_t ckptLock;
+	// Serializes the checkpoints
+
+	pthread_cond_t ckptCond;
+	// Signalled when a checkpoint is wanted (or the thread stops)
+
+	pthread_cond_t spaceCond;
+	// Signalled when a checkpoint releases journal space
+
+	pthread_cond_t syncCond;
+	// Signalled when a record is written, synced or applied (or one fails)
+};
+
+#endif
@@ -13,15 +13,21 @@
 
 /* Project include files */
 #include <bfsConfigLayer.h>
+#include <bfsCryptoError.h>
 #include <bfsCryptoLayer.h>
 #include <bfsDeviceError.h>
 #include <bfsDeviceLayer.h>
 #include <bfsLocalDevice.h>
 #include <bfsRemoteDevice.h>
 #include <bfs_log.h>
+#include <bfs_util.h>
 
 /* Macros */
 
+// The AAD binding a packet to its connection (the epoch, then the tag)
+#define BFS_DEVICE_AAD_LEN                                                     \
+	(sizeof(bfs_device_epoch_t) + sizeof(bfs_device_tag_t))
+
 /* Globals  */
 
 //
@@ -40,8 +46,12 @@ const char *bfsDeviceLayer::bfs_device_state_strings[BFSDEV_MAXSTATE] = {
 	"BFSDEV_UNKNOWN",
 };
 const char *bfsDeviceLayer::bfs_device_message_strings[BFS_DEVICE_MAX_MSG] = {
-	"BFS_DEVICE_GET_TOPO", "BFS_DEVICE_GET_BLOCK", "BFS_DEVICE_PUT_BLOCK",
-	"BFS_DEVICE_GET_BLOCKS", "BFS_DEVICE_PUT_BLOCKS"};
+	"BFS_DEVICE_GET_TOPO",		   "BFS_DEVICE_GET_BLOCK",
+	"BFS_DEVICE_PUT_BLOCK",		   "BFS_DEVICE_GET_BLOCKS",
+	"BFS_DEVICE_PUT_BLOCKS",	   "BFS_DEVICE_PUT_BLOCK_TAGGED",
+	"BFS_DEVICE_GET_BLOCK_TAGGED", "BFS_DEVICE_FLUSH",
+	"BFS_DEVICE_PUT_BLOCK_FUA",	   "BFS_DEVICE_TRIM_BLOCKS",
+	"BFS_DEVICE_GET_EXTENTS",	   "BFS_DEVICE_PUT_EXTENTS"};
 
 // Static initializer, make sure this is idenpendent of other layers
 bool bfsDeviceLayer::bfsDeviceLayerInitialized = false;
@@ -60,6 +70,7 @@ int bfsDeviceLayer::getDeviceManifest(bfs_device_list_t &devs) {
 
 	// Local variables
 	bfsDevice *device;
+	bfsRemoteDevice *rdev;
 	bfsCfgItem *config, *devcfg, *sacfg;
 	bfsSecAssociation *sa;
 	bfs_device_id_t did;
@@ -248,6 +259,9 @@ int bfsDeviceLayer::getDeviceManifest(bfs_device_list_t &devs) {
 			}
 			sa = new bfsSecAssociation(sacfg);
 			device->setSecurityAssociation(sa);
+			if ((rdev = dynamic_cast<bfsRemoteDevice *>(device)) != NULL) {
+				rdev->setSecurityConfig(sacfg);
+			}
 			if (device->bfsDeviceInitialize() != BFS_SUCCESS) {
 				logMessage(LOG_ERROR_LEVEL,
 						   "Failure during bfsDeviceInitialize");
@@ -290,6 +304,9 @@ int bfsDeviceLayer::getDeviceManifest(bfs_device_list_t &devs) {
 			sacfg = devcfg->getSubItemByName("sa");
 			sa = new bfsSecAssociation(sacfg);
 			device->setSecurityAssociation(sa);
+			if ((rdev = dynamic_cast<bfsRemoteDevice *>(device)) != NULL) {
+				rdev->setSecurityConfig(sacfg);
+			}
 			if (device->bfsDeviceInitialize() != BFS_SUCCESS) {
 				logMessage(LOG_ERROR_LEVEL,
 						   "Failure during bfsDeviceInitialize");
@@ -323,6 +340,9 @@ int bfsDeviceLayer::getDeviceManifest(bfs_device_list_t &devs) {
  * @param did - the device identifier
  * @param cmd - the device protocol
  * @param ack - ack flag
+ * @param sa - the security association to encrypt/MAC with
+ * @param epoch - the epoch of the connection (bound as AAD)
+ * @param tag - the request tag (bound as AAD, prepended in the clear)
  * @param buf - the data packet structure
  * @return int : 0 is success, -1 is failure
  */
@@ -330,7 +350,8 @@ int bfsDeviceLayer::getDeviceManifest(bfs_device_list_t &devs) {
 int bfsDeviceLayer::marshalBfsDevicePacket(bfs_uid_t usr, bfs_device_id_t did,
 										   bfs_device_msg_t cmd, bool ack,
 										   bfsSecAssociation *sa,
-										   uint32_t dev_send_seq,
+										   const bfs_device_epoch_t &epoch,
+										   bfs_device_tag_t tag,
 										   bfsFlexibleBuffer &buf) {
 
 	// #ifdef __BFS_ENCLAVE_MODE
@@ -385,10 +406,14 @@ int bfsDeviceLayer::marshalBfsDevicePacket(bfs_uid_t usr, bfs_device_id_t did,
 	// 	}
 	// #endif
 
-	bfsFlexibleBuffer *aad =
-		new bfsFlexibleBuffer((char *)&dev_send_seq, sizeof(uint32_t));
-	sa->encryptData(buf, aad, true);
-	delete aad;
+	// Seal it, binding the epoch and tag (as AAD, kept on the stack)
+	char aad[BFS_DEVICE_AAD_LEN];
+	memcpy(aad, &epoch, sizeof(bfs_device_epoch_t));
+	memcpy(&aad[sizeof(bfs_device_epoch_t)], &tag, sizeof(bfs_device_tag_t));
+	sa->encryptData(buf, aad, BFS_DEVICE_AAD_LEN, true);
+
+	// Prepend the tag so the receiver can match (and verify) the packet
+	buf << tag;
 
 	// #ifdef __BFS_ENCLAVE_MODE
 	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
@@ -413,29 +438,40 @@ int bfsDeviceLayer::marshalBfsDevicePacket(bfs_uid_t usr, bfs_device_id_t did,
  * @param did - the device identifier
  * @param cmd - the device protocol
  * @param ack - ack flag
- * @param len - the length of the buffer
+ * @param sa - the security association to decrypt/verify with
+ * @param epoch - the epoch of the connection (bound as AAD)
+ * @param tag - the request tag (already removed from the front of the packet
+ *              by the caller, and checked against the outstanding requests)
  * @param buf - data contents
- * @param pkt - the data packet structure
  * @return int : 0 is success, -1 is failure
  */
 
 int bfsDeviceLayer::unmarshalBfsDevicePacket(
 	bfs_uid_t &usr, bfs_device_id_t &did, bfs_device_msg_t &cmd, bool &ack,
-	bfsSecAssociation *sa, uint32_t dev_recv_seq, bfsFlexibleBuffer &buf) {
+	bfsSecAssociation *sa, const bfs_device_epoch_t &epoch,
+	bfs_device_tag_t tag, bfsFlexibleBuffer &buf) {
 
 	// Local variables
 	char bstr[129], ccmd;
 	bfs_size_t dlen;
 
-	// First decrypt/verify MAC
+	// Sanity check security association
 	if (sa == NULL) {
 		throw new bfsDeviceError("Cannot unmarshal with NULL security context");
 	}
 
-	bfsFlexibleBuffer *aad =
-		new bfsFlexibleBuffer((char *)&dev_recv_seq, sizeof(uint32_t));
-	sa->decryptData(buf, aad, true);
-	delete aad;
+	// First decrypt/verify MAC (packets from other connections fail it)
+	char aad[BFS_DEVICE_AAD_LEN];
+	memcpy(aad, &epoch, sizeof(bfs_device_epoch_t));
+	memcpy(&aad[sizeof(bfs_device_epoch_t)], &tag, sizeof(bfs_device_tag_t));
+	try {
+		sa->decryptData(buf, aad, BFS_DEVICE_AAD_LEN, true);
+	} catch (bfsCryptoError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Device packet failed verification [%s]",
+				   e->getMessage().c_str());
+		delete e;
+		return (-1);
+	}
 
 	// Pull off the headers, sanity check length
 	buf >> usr >> did >> ccmd >> ack >> dlen;
@@ -463,6 +499,92 @@ int bfsDeviceLayer::unmarshalBfsDevicePacket(
 	return (0);
 }
 
+/**
+ * @brief Choose a fresh (random) nonce for a connection epoch
+ *
+ * @param nonce - the nonce to fill
+ * @return int : 0 is success, -1 is failure
+ */
+
+static int newEpochNonce(uint64_t &nonce) {
+#ifdef __BFS_ENCLAVE_MODE
+	if (sgx_read_rand((unsigned char *)&nonce, sizeof(uint64_t)) !=
+		SGX_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL, "Failed generating epoch nonce.");
+		return (-1);
+	}
+#else
+	get_random_data((char *)&nonce, sizeof(uint64_t));
+#endif
+	return (0);
+}
+
+/**
+ * @brief Agree the epoch of a newly connected device connection (client
+ * side).  The client sends its nonce (in the clear) as the first packet on
+ * the connection and the device answers with its own; both are bound into
+ * every packet that follows, so neither end accepts packets recorded on an
+ * earlier connection (where the tags started over).
+ *
+ * @param conn - the (connected) connection to the device
+ * @param epoch - the epoch agreed for the connection
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceLayer::openDeviceEpoch(bfsNetworkConnection *conn,
+									bfs_device_epoch_t &epoch) {
+
+	// Local variables
+	bfsFlexibleBuffer buf;
+
+	// Send our nonce, receive the device's
+	if (newEpochNonce(epoch.client)) {
+		return (-1);
+	}
+	buf.setData((char *)&epoch.client, sizeof(uint64_t));
+	if (((size_t)conn->sendPacketizedBuffer(buf) != buf.getLength()) ||
+		(conn->recvPacketizedBuffer(buf) != (int)sizeof(uint64_t))) {
+		logMessage(LOG_ERROR_LEVEL, "Device connection epoch exchange failed.");
+		return (-1);
+	}
+	epoch.device = *(uint64_t *)buf.getBuffer();
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Agree the epoch of a new client connection (device side), answering
+ * the client's hello (the first packet on the connection) with our nonce.
+ *
+ * @param conn - the client connection
+ * @param hello - the hello packet received from the client
+ * @param epoch - the epoch agreed for the connection
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceLayer::acceptDeviceEpoch(bfsNetworkConnection *conn,
+									  bfsFlexibleBuffer &hello,
+									  bfs_device_epoch_t &epoch) {
+
+	// Pull the client nonce, answer with ours
+	if ((hello.getLength() != sizeof(uint64_t)) ||
+		(newEpochNonce(epoch.device))) {
+		logMessage(LOG_ERROR_LEVEL, "Bad device connection hello [len=%u].",
+				   hello.getLength());
+		return (-1);
+	}
+	epoch.client = *(uint64_t *)hello.getBuffer();
+	hello.setData((char *)&epoch.device, sizeof(uint64_t));
+	if ((size_t)conn->sendPacketizedBuffer(hello) != hello.getLength()) {
+		logMessage(LOG_ERROR_LEVEL, "Device connection epoch reply failed.");
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+}
+
 /*
  * @brief Initialize the device layer state
  *
@@ -562,6 +684,22 @@ int bfsDeviceLayer::bfsDeviceLayerInit(void) {
 	vrblog =
 		(config->getSubItemByName("log_verbose")->bfsCfgItemValue() == "true");
 	bfsVerboseDeviceLogLevel = registerLogLevel("DEVICE_VRBLOG_LEVEL", vrblog);
+
+	// Tune the sockets of the process (the device connections carry the bulk
+	// block data)
+	rawnet_options_t opts;
+	opts.nodelay =
+		(config->getSubItemByName("tcp_nodelay")->bfsCfgItemValue() == "true");
+	opts.sndbufBytes =
+		(int)config->getSubItemByName("tcp_sndbuf")->bfsCfgItemValueLong();
+	opts.rcvbufBytes =
+		(int)config->getSubItemByName("tcp_rcvbuf")->bfsCfgItemValueLong();
+	opts.busyPollUsecs =
+		(int)config->getSubItemByName("tcp_busy_poll")->bfsCfgItemValueLong();
+	opts.zerocopyBytes =
+		(int)config->getSubItemByName("tcp_zerocopy_bytes")
+			->bfsCfgItemValueLong();
+	rawnet_set_options(&opts);
 #endif
 
 	// Log the device layer being initialized, return successfully
@@ -19,6 +19,7 @@ using namespace std;
 
 // Project Includes
 #include <bfsDevice.h>
+#include <bfsNetworkConnection.h>
 #include <bfsSecAssociation.h>
 #include <bfs_dev_common.h>
 
@@ -58,16 +59,29 @@ public:
 
 	static int marshalBfsDevicePacket(bfs_uid_t usr, bfs_device_id_t did,
 									  bfs_device_msg_t cmd, bool ack,
-									  bfsSecAssociation *sa, uint32_t send_seq,
+									  bfsSecAssociation *sa,
+									  const bfs_device_epoch_t &epoch,
+									  bfs_device_tag_t tag,
 									  bfsFlexibleBuffer &buf);
 	// Marshal the data into the device communication packet
 
 	static int unmarshalBfsDevicePacket(bfs_uid_t &usr, bfs_device_id_t &did,
 										bfs_device_msg_t &cmd, bool &ack,
-										bfsSecAssociation *sa, uint32_t recv_seq,
+										bfsSecAssociation *sa,
+										const bfs_device_epoch_t &epoch,
+										bfs_device_tag_t tag,
 										bfsFlexibleBuffer &buf);
 	// Unmarshal the data into the device communication packet
 
+	static int openDeviceEpoch(bfsNetworkConnection *conn,
+							   bfs_device_epoch_t &epoch);
+	// Agree the epoch of a new connection (client side, sends the hello)
+
+	static int acceptDeviceEpoch(bfsNetworkConnection *conn,
+								 bfsFlexibleBuffer &hello,
+								 bfs_device_epoch_t &epoch);
+	// Agree the epoch of a new connection (device side, answers the hello)
+
 	static int bfsDeviceLayerInit(void);
 	// Initialize the device layer state
 
@@ -13,21 +13,75 @@
 #include "bfs_enclave_t.h"
 #else
 #include <fcntl.h>
+#include <linux/io_uring.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <chrono>
+
 #include "bfs_device_ocalls.h"
 #endif
 
+#include <algorithm>
+#include <vector>
+
 #include <bfsConfigLayer.h>
 #include <bfsDeviceError.h>
 #include <bfsDeviceStorage.h>
 #include <bfs_log.h>
 #include <bfs_util.h>
 
+// The submission queue depth of a direct storage's ring (larger batches are
+// submitted in pieces), and the alignment of its O_DIRECT I/O
+#define BFS_STORAGE_RING_DEPTH 128
+#define BFS_STORAGE_DIRECT_ALIGN 4096
+
+// The size of the writes pre-zeroing a new backing file
+#define BFS_STORAGE_ZERO_CHUNK (1024 * 1024)
+
+#ifndef __BFS_ENCLAVE_MODE
+// The io_uring instance of a direct storage (the rings mapped from the kernel)
+struct bfs_storage_ring {
+	int fd;					   // The ring file descriptor
+	unsigned *sq_head;		   // The submission queue head (kernel moves)
+	unsigned *sq_tail;		   // The submission queue tail (we move)
+	unsigned *sq_mask;		   // The submission queue index mask
+	unsigned *sq_array;		   // The submission queue entry indices
+	struct io_uring_sqe *sqes; // The submission queue entries
+	unsigned *cq_head;		   // The completion queue head (we move)
+	unsigned *cq_tail;		   // The completion queue tail (kernel moves)
+	unsigned *cq_mask;		   // The completion queue index mask
+	struct io_uring_cqe *cqes; // The completion queue entries
+	void *sq_map, *cq_map;	   // The mapped rings (may be the same)
+	size_t sq_map_sz, cq_map_sz, sqes_sz; // The sizes of the mappings
+};
+
+// A range of a backing file being pre-zeroed (and the thread zeroing it)
+typedef struct {
+	int fd;			  // The backing file
+	uint64_t start;	  // The start of the range (bytes)
+	uint64_t end;	  // The end of the range (bytes)
+	int ret;		  // 0 if zeroed, -1 if failed
+	pthread_t thread; // The thread zeroing the range
+} bfs_storage_zero_t;
+
+static double storageTimeUsecs(void);
+static bfs_storage_ring *storage_ring_create(unsigned depth);
+static void storage_ring_destroy(bfs_storage_ring *r);
+static int storage_ring_run(bfs_storage_ring *r, bool write, int fd,
+							struct iovec *iovs, off_t *offs, uint32_t n,
+							bool fua);
+static int storage_direct_run(bfs_storage_ring *r, pthread_mutex_t *lk,
+							  bool write, int fd, struct iovec *iovs,
+							  off_t *offs, uint32_t n, bool fua);
+#endif
+
 //
 // Class Functions
 
@@ -40,9 +94,12 @@
  */
 
 bfsDeviceStorage::bfsDeviceStorage(bfs_device_id_t did, uint64_t noblocks)
-	: deviceID(did), numBlocks(noblocks), storagePath(""), blockStorage(NULL) {
+	: deviceID(did), numBlocks(noblocks), storagePath(""), blockStorage(NULL),
+	  backend(BFS_STORAGE_MMAP), storageFd(-1), alignedIo(false), ring(NULL),
+	  cache(NULL), journal(NULL) {
 
 	// Try to initialize the storage device
+	pthread_mutex_init(&ringLock, NULL);
 	if (bfsDeviceStorageInitialize() != 0) {
 		throw new bfsDeviceError("Cannot initialize device storage");
 	}
@@ -51,6 +108,32 @@ bfsDeviceStorage::bfsDeviceStorage(bfs_device_id_t did, uint64_t noblocks)
 	return;
 }
 
+/**
+ * @brief The attribute constructor for the class, with the backing file and
+ * backend given rather than taken from the config
+ *
+ * @param did - the device ID of this device
+ * @param noblocks - the number of blocks to allocation
+ * @param path - the path to the backing file
+ * @param bkend - the backend to keep the blocks in
+ */
+
+bfsDeviceStorage::bfsDeviceStorage(bfs_device_id_t did, uint64_t noblocks,
+								   string path, bfs_storage_backend_t bkend)
+	: deviceID(did), numBlocks(noblocks), storagePath(path),
+	  blockStorage(NULL), backend(bkend), storageFd(-1), alignedIo(false),
+	  ring(NULL), cache(NULL), journal(NULL) {
+
+	// Try to create the storage
+	pthread_mutex_init(&ringLock, NULL);
+	if (createDiskStorage() != 0) {
+		throw new bfsDeviceError("Cannot initialize device storage");
+	}
+
+	// Return, no return code
+	return;
+}
+
 /**
  * @brief The destructor function for the class
  *
@@ -61,6 +144,7 @@ bfsDeviceStorage::~bfsDeviceStorage(void) {
 
 	// Return, no return code
 	bfsDeviceStorageUninitialize();
+	pthread_mutex_destroy(&ringLock);
 	return;
 }
 
@@ -74,6 +158,11 @@ bfsDeviceStorage::~bfsDeviceStorage(void) {
 
 char *bfsDeviceStorage::getBlock(bfs_block_id_t blkid, char *blk) {
 
+	// Direct storage reads the block from the file
+	if (backend == BFS_STORAGE_DIRECT) {
+		return ((getBlocks(&blkid, 1, &blk) == 0) ? blk : NULL);
+	}
+
 	// Get address/block, check for error
 	char *baddr = getBlockAddress(blkid);
 	if (baddr == NULL) {
@@ -102,10 +191,16 @@ char *bfsDeviceStorage::getBlock(bfs_block_id_t blkid, char *blk) {
  *
  * @param blkid - the block ID for the block to put (at block id)
  * @param buf - buffer to copy contents into (NULL no copy)
+ * @param fua - flag indicating the block must be durable before returning
  * @return int : 0 is success, -1 is failure
  */
 
-char *bfsDeviceStorage::putBlock(bfs_block_id_t blkid, char *blk) {
+char *bfsDeviceStorage::putBlock(bfs_block_id_t blkid, char *blk, bool fua) {
+
+	// Direct (or journaled) storage writes the block as a batch
+	if ((backend == BFS_STORAGE_DIRECT) || (journal != NULL)) {
+		return ((putBlocks(&blkid, 1, &blk, fua) == 0) ? blk : NULL);
+	}
 
 	// Get address/block, check for error
 	char *baddr = getBlockAddress(blkid);
@@ -125,11 +220,391 @@ char *bfsDeviceStorage::putBlock(bfs_block_id_t blkid, char *blk) {
 		logMessage(DEVICE_VRBLOG_LEVEL, "Put block: [%d][%s]", blkid, bstr);
 	}
 
-	// Write the block
+	// Write the block (writing the page back now if it must be durable)
 	memcpy(baddr, blk, BLK_SZ);
+#ifndef __BFS_ENCLAVE_MODE
+	if (fua && (msync(baddr, BLK_SZ, MS_SYNC) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "Put block sync failed [%lu] : [%s]",
+				   blkid, strerror(errno));
+		return (NULL);
+	}
+#endif
 	return (blk);
 }
 
+/**
+ * @brief Get a set of blocks from the device, in one batch (submitted
+ * together to the ring of a direct storage)
+ *
+ * @param blkids - the block IDs of the blocks to get
+ * @param nblks - the number of blocks
+ * @param blks - the buffers to copy the blocks into
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::getBlocks(bfs_block_id_t *blkids, uint32_t nblks,
+								char **blks) {
+
+	// Local variables
+	vector<bfs_block_id_t> mids;
+	vector<char *> mblks;
+	vector<uint64_t> tickets;
+	uint64_t ticket = 0;
+	uint32_t i;
+
+	// Direct storage reads them as one batch (those not cached)
+	if (backend == BFS_STORAGE_DIRECT) {
+		if (cache == NULL) {
+			return (directBlocks(false, blkids, nblks, blks, false));
+		}
+		for (i = 0; i < nblks; i++) {
+			if ((blkids[i] >= numBlocks) || (blks[i] == NULL) ||
+				!cache->getBlock(blkids[i], blks[i], ticket)) {
+				mids.push_back(blkids[i]);
+				mblks.push_back(blks[i]);
+				tickets.push_back(ticket);
+			}
+		}
+		if (mids.empty()) {
+			return (0);
+		}
+		if (directBlocks(false, mids.data(), (uint32_t)mids.size(),
+						 mblks.data(), false)) {
+			return (-1);
+		}
+		for (i = 0; i < mids.size(); i++) {
+			cache->admitBlock(mids[i], mblks[i], tickets[i]);
+		}
+		return (0);
+	}
+
+	// Otherwise copy them out of the map
+	for (i = 0; i < nblks; i++) {
+		if (getBlock(blkids[i], blks[i]) == NULL) {
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Put a set of blocks into the device, in one batch (submitted
+ * together to the ring of a direct storage, or appended to the journal as
+ * one record, so a crash does not tear it)
+ *
+ * @param blkids - the block IDs of the blocks to put
+ * @param nblks - the number of blocks
+ * @param blks - the buffers holding the blocks
+ * @param fua - flag indicating the blocks must be durable before returning
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::putBlocks(bfs_block_id_t *blkids, uint32_t nblks,
+								char **blks, bool fua) {
+
+	// Journaled storage appends them to the journal first (durable then)
+	if (journal != NULL) {
+		return (journalBlocks(blkids, nblks, blks));
+	}
+	return (writeBlocks(blkids, nblks, blks, fua));
+}
+
+/**
+ * @brief Get runs of blocks from the device into one buffer (the blocks of
+ * the runs in order), a copy (or read) per run rather than per block
+ *
+ * @param exts - the runs of blocks to get
+ * @param nexts - the number of runs
+ * @param buf - the buffer to copy the blocks into
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::getExtents(bfs_block_extent_t *exts, uint32_t nexts,
+								 char *buf) {
+
+	// Local variables
+	uint32_t i;
+
+	// Check the runs
+	for (i = 0; i < nexts; i++) {
+		if ((exts[i].count == 0) || (exts[i].start >= numBlocks) ||
+			(exts[i].count > numBlocks - exts[i].start)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad extent in get [%lu, %lu]",
+					   exts[i].start, exts[i].count);
+			return (-1);
+		}
+	}
+
+	// Direct storage reads them as one batch (those not cached)
+	if (backend == BFS_STORAGE_DIRECT) {
+		if (cache != NULL) {
+			return (cachedExtents(exts, nexts, buf));
+		}
+		vector<char *> bufs(nexts);
+		for (i = 0; i < nexts; i++) {
+			bufs[i] = buf;
+			buf += exts[i].count * BLK_SZ;
+		}
+		return (directExtents(false, exts, nexts, bufs.data(), false));
+	}
+
+	// Otherwise copy them out of the map
+	for (i = 0; i < nexts; i++) {
+		memcpy(buf, getBlockAddress(exts[i].start), exts[i].count * BLK_SZ);
+		buf += exts[i].count * BLK_SZ;
+	}
+	return (0);
+}
+
+/**
+ * @brief Put runs of blocks into the device from one buffer (the blocks of
+ * the runs in order), a copy (or write) per run rather than per block
+ *
+ * @param exts - the runs of blocks to put
+ * @param nexts - the number of runs
+ * @param buf - the buffer holding the blocks
+ * @param fua - flag indicating the blocks must be durable before returning
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::putExtents(bfs_block_extent_t *exts, uint32_t nexts,
+								 char *buf, bool fua) {
+
+	// Local variables
+	char *baddr;
+	uint64_t j;
+	uint32_t i;
+	int ret;
+
+	// Check the runs
+	for (i = 0; i < nexts; i++) {
+		if ((exts[i].count == 0) || (exts[i].start >= numBlocks) ||
+			(exts[i].count > numBlocks - exts[i].start)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad extent in put [%lu, %lu]",
+					   exts[i].start, exts[i].count);
+			return (-1);
+		}
+	}
+
+	// Journaled storage puts the blocks of the runs as one batch
+	if (journal != NULL) {
+		vector<bfs_block_id_t> ids;
+		vector<char *> blks;
+		for (i = 0; i < nexts; i++) {
+			for (j = 0; j < exts[i].count; j++) {
+				ids.push_back(exts[i].start + j);
+				blks.push_back(buf);
+				buf += BLK_SZ;
+			}
+		}
+		return (journalBlocks(ids.data(), (uint32_t)ids.size(), blks.data()));
+	}
+
+	// Direct storage writes them as one batch (then updates the cached
+	// copies, dropping them if the write failed)
+	if (backend == BFS_STORAGE_DIRECT) {
+		vector<char *> bufs(nexts);
+		for (i = 0; i < nexts; i++) {
+			bufs[i] = buf;
+			buf += exts[i].count * BLK_SZ;
+		}
+		ret = directExtents(true, exts, nexts, bufs.data(), fua);
+		for (i = 0; (cache != NULL) && (i < nexts); i++) {
+			for (j = 0; j < exts[i].count; j++) {
+				if (ret == 0) {
+					cache->updateBlock(exts[i].start + j, &bufs[i][j * BLK_SZ]);
+				} else {
+					cache->invalidateBlock(exts[i].start + j);
+				}
+			}
+		}
+		return (ret);
+	}
+
+	// Otherwise copy them into the map
+	for (i = 0; i < nexts; i++) {
+		baddr = getBlockAddress(exts[i].start);
+		memcpy(baddr, buf, exts[i].count * BLK_SZ);
+		buf += exts[i].count * BLK_SZ;
+#ifndef __BFS_ENCLAVE_MODE
+		if (fua && (msync(baddr, exts[i].count * BLK_SZ, MS_SYNC) == -1)) {
+			logMessage(LOG_ERROR_LEVEL, "Put extent sync failed [%lu] : [%s]",
+					   exts[i].start, strerror(errno));
+			return (-1);
+		}
+#endif
+	}
+	return (0);
+}
+
+/**
+ * @brief Make the blocks put so far durable (the puts of a journaled storage
+ * already are)
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::flushStorage(void) {
+	return ((journal != NULL) ? 0 : flushData());
+}
+
+/**
+ * @brief Discard a set of blocks, punching them out of the backing file
+ * (runs of adjacent blocks are punched together) so the file system can
+ * reclaim the space.  The blocks read as zeros after, and are zeroed in
+ * place where the file system cannot punch holes.
+ *
+ * @param blkids - the block IDs of the blocks to discard
+ * @param nblks - the number of blocks
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::trimBlocks(bfs_block_id_t *blkids, uint32_t nblks) {
+
+	// Local variables
+	vector<bfs_block_id_t> ids(blkids, blkids + nblks);
+	char *zeros = NULL;
+	uint64_t len;
+	uint32_t i, j;
+	int ret = 0;
+
+	// Check the blocks, then sort them to find the runs
+	for (i = 0; i < nblks; i++) {
+		if (ids[i] >= numBlocks) {
+			logMessage(LOG_ERROR_LEVEL, "Trim of bad block [%lu]", ids[i]);
+			return (-1);
+		}
+	}
+	std::sort(ids.begin(), ids.end());
+
+	// Checkpoint the journal first (a replay must not bring the blocks back)
+#ifndef __BFS_ENCLAVE_MODE
+	if ((journal != NULL) && journal->checkpoint()) {
+		return (-1);
+	}
+#endif
+
+	// Punch out each run of blocks
+	for (i = 0; (ret == 0) && (i < nblks); i = j) {
+		for (j = i + 1; (j < nblks) && (ids[j] <= ids[j - 1] + 1); j++)
+			;
+		len = (ids[j - 1] - ids[i] + 1) * BLK_SZ;
+#ifndef __BFS_ENCLAVE_MODE
+		if (backend == BFS_STORAGE_DIRECT) {
+			if (fallocate(storageFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+						  ids[i] * BLK_SZ, len) == 0) {
+				continue;
+			}
+		} else if (madvise(getBlockAddress(ids[i]), len, MADV_REMOVE) == 0) {
+			continue;
+		}
+		if ((errno != EOPNOTSUPP) && (errno != EINVAL)) {
+			logMessage(LOG_ERROR_LEVEL, "Trim of blocks [%lu-%lu] failed : [%s]",
+					   ids[i], ids[j - 1], strerror(errno));
+			ret = -1;
+			break;
+		}
+#endif
+
+		// No holes in this file system, zero the blocks instead
+		if (backend == BFS_STORAGE_MMAP) {
+			memset(getBlockAddress(ids[i]), 0x0, len);
+			continue;
+		}
+		if (zeros == NULL) {
+			zeros = (char *)calloc(1, BLK_SZ);
+		}
+		for (; (ret == 0) && (i < j); i++) {
+			ret = (putBlock(ids[i], zeros) == NULL) ? -1 : 0;
+		}
+	}
+	free(zeros);
+
+	// Drop the cached copies (after, so no read admits the old blocks)
+	for (i = 0; (cache != NULL) && (i < nblks); i++) {
+		cache->invalidateBlock(ids[i]);
+	}
+
+	// Log and return the status
+	logMessage(DEVICE_VRBLOG_LEVEL, "Trimmed %u blocks of device [%lu]", nblks,
+			   deviceID);
+	return (ret);
+}
+
+/**
+ * @brief Journal the puts to the storage: each batch is appended to a
+ * journal next to the backing file as one record (synced before the put
+ * returns), then written to the data area without syncing it.  The records
+ * not yet checkpointed are replayed when the storage is opened, so a crash
+ * never leaves a batch half written.  A batch is never split over records,
+ * so the journal is refused if its records cannot hold the largest batch.
+ *
+ * @param nblks - the number of blocks the journal holds
+ * @param maxbatch - the most blocks put in one batch
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::enableJournal(uint64_t nblks, uint32_t maxbatch) {
+#ifdef __BFS_ENCLAVE_MODE
+	logMessage(LOG_ERROR_LEVEL, "Device journal unsupported in enclave");
+	return (-1);
+#else
+	// Check that we are not already journaled
+	if (journal != NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Device storage already journaled [%s]",
+				   storagePath.c_str());
+		return (-1);
+	}
+
+	// Create and open (replay) the journal
+	try {
+		journal = new bfsDeviceJournal(this, storagePath + ".journal", nblks);
+	} catch (bfsDeviceError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Device journal create failed : %s",
+				   e->getMessage().c_str());
+		delete e;
+		return (-1);
+	}
+	if (journal->getMaxRecordBlocks() < maxbatch) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device journal of %lu blocks too small, its records hold "
+				   "%u blocks (largest batch %u)",
+				   nblks, journal->getMaxRecordBlocks(), maxbatch);
+		delete journal;
+		journal = NULL;
+		return (-1);
+	}
+	if (journal->openJournal()) {
+		delete journal;
+		journal = NULL;
+		return (-1);
+	}
+
+	// Return successfully
+	return (0);
+#endif
+}
+
+/**
+ * @brief Get a backend from its config name
+ *
+ * @param nm - the name of the backend (mmap or direct)
+ * @return bfs_storage_backend_t : the backend (memory mapped if unknown)
+ */
+
+bfs_storage_backend_t bfsDeviceStorage::getBackendByName(const string &nm) {
+	if (nm == "direct") {
+		return (BFS_STORAGE_DIRECT);
+	}
+	if (nm != "mmap") {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Unknown device storage [%s], using memory map",
+				   nm.c_str());
+	}
+	return (BFS_STORAGE_MMAP);
+}
+
 //
 // Private class functions
 
@@ -272,6 +747,8 @@ int bfsDeviceStorage::bfsDeviceStorageInitialize(void) {
 			if ((bfs_device_id_t)did == deviceID) {
 				storagePath =
 					devcfg->getSubItemByName("path")->bfsCfgItemValue();
+				backend = getBackendByName(
+					devcfg->getSubItemByName("storage")->bfsCfgItemValue());
 				found = true;
 			}
 		}
@@ -325,8 +802,18 @@ int bfsDeviceStorage::createDiskStorage(void) {
 							   "not entirely outside enclave "
 							   "(may be corrupt source ptr)");
 #else
+	// Direct storage just opens the file (then the journal, if any)
+	if (backend == BFS_STORAGE_DIRECT) {
+		return (((openDirectStorage() == 0) && (openJournal() == 0))
+					? BFS_SUCCESS
+					: BFS_FAILURE);
+	}
+
 	blockStorage =
 		__createDiskStorage(deviceID, storagePath.c_str(), numBlocks);
+	if ((blockStorage != NULL) && (openJournal() != 0)) {
+		return BFS_FAILURE;
+	}
 #endif
 
 	if (!blockStorage)
@@ -336,71 +823,171 @@ int bfsDeviceStorage::createDiskStorage(void) {
 }
 
 /**
- * @brief Initializes and creates the memory map for the disk storage.
+ * @brief Zero a range of a backing file being provisioned (the body of a
+ * pre-zeroing thread)
+ *
+ * @param arg - the range to zero (bfs_storage_zero_t)
+ * @return void * : NULL
+ */
+#ifndef __BFS_ENCLAVE_MODE
+static void *__zeroDiskRange(void *arg) {
+
+	// Local variables
+	bfs_storage_zero_t *rng = (bfs_storage_zero_t *)arg;
+	char *zeros = new char[BFS_STORAGE_ZERO_CHUNK]();
+	uint64_t off, len;
+
+	// Write the zeros a chunk at a time
+	for (off = rng->start; (rng->ret == 0) && (off < rng->end); off += len) {
+		len = ((rng->end - off) < BFS_STORAGE_ZERO_CHUNK)
+				  ? (rng->end - off)
+				  : BFS_STORAGE_ZERO_CHUNK;
+		if (pwrite(rng->fd, zeros, len, (off_t)off) != (ssize_t)len) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed zeroing storage file content [%s]",
+					   strerror(errno));
+			rng->ret = -1;
+		}
+	}
+	delete[] zeros;
+	return (NULL);
+}
+
+/**
+ * @brief Creates the backing file for the disk storage (unless it is there,
+ * at the right size, already).  The file is provisioned as configured by the
+ * device layer: "sparse" just sets its size, "allocate" reserves its blocks
+ * (fallocate, falling back to sparse where unsupported) and "zero" writes
+ * zeros over it with provision_threads threads.
  *
  * @param deviceID: the device id
  * @param storagePath: path name to the backing file
  * @param numBlocks: the number of disk blocks on the device
- * @return char*: pointer to the base address of the disk storage memory map
+ * @return int: 0 is success, -1 is failure
  */
-#ifndef __BFS_ENCLAVE_MODE
-char *__createDiskStorage(bfs_device_id_t deviceID, const char *storagePath,
-						  uint64_t numBlocks) {
-	char *blockStorage = NULL;
+
+int __createDiskFile(bfs_device_id_t deviceID, const char *storagePath,
+					 uint64_t numBlocks) {
 
 	// Local variables
-	uint64_t mapsz = numBlocks * BLK_SZ;
-	int mapprot = PROT_READ | PROT_WRITE, mapflgs = MAP_SHARED, mapfh = -1,
-		mapoffset = 0, i;
-	char zeroblk[BLK_SZ];
+	uint64_t mapsz = numBlocks * BLK_SZ, per;
+	vector<bfs_storage_zero_t> rngs;
+	int mapfh = -1, nthreads = 0, i, ret = 0;
+	string mode;
 	struct stat st;
-	bool create = false;
+	double start;
 
 	// See if the file exists
 	if (stat(storagePath, &st) == -1) {
 		// Does not exist create it
 		logMessage(DEVICE_LOG_LEVEL, "Storage file [%s] does not exist",
 				   storagePath);
-		create = true;
 	} else if (st.st_size != (off_t)mapsz) {
 		// Wrong file, remove file
 		logMessage(DEVICE_LOG_LEVEL,
 				   "Storage file [%s] incorrect size, resetting", storagePath);
 		unlink(storagePath);
-		create = true;
+	} else {
+		return (0);
 	}
 
-	// If we are creating the file
-	if (create == true) {
+	// Get the provisioning mode
+	try {
+		bfsCfgItem *config = bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG);
+		mode = config->getSubItemByName("provision")->bfsCfgItemValue();
+		if (mode == "zero") {
+			nthreads = (int)config->getSubItemByName("provision_threads")
+						   ->bfsCfgItemValueLong();
+		}
+	} catch (bfsCfgError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Failure reading system config : %s",
+				   e->getMessage().c_str());
+		delete e;
+		return (-1);
+	}
 
-		// Create the file indicated in the path config item
-		logMessage(
-			DEVICE_LOG_LEVEL,
-			"Creating memory map for device storage [did=%lu, sz=%lu bytes]",
-			deviceID, mapsz);
-		if ((mapfh = open(storagePath, O_RDWR | O_CREAT, S_IRWXU | S_IRWXG)) ==
-			-1) {
-			logMessage(
-				LOG_ERROR_LEVEL,
-				"Device memory map, file open failed, error [%s], path [%s]",
-				strerror(errno), storagePath);
-			return (NULL);
+	// Create the file indicated in the path config item
+	logMessage(DEVICE_LOG_LEVEL,
+			   "Creating backing file for device storage [did=%lu, sz=%lu "
+			   "bytes, %s]",
+			   deviceID, mapsz, mode.c_str());
+	start = storageTimeUsecs();
+	if ((mapfh = open(storagePath, O_RDWR | O_CREAT, S_IRWXU | S_IRWXG)) ==
+		-1) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device memory map, file open failed, error [%s], path [%s]",
+				   strerror(errno), storagePath);
+		return (-1);
+	}
+
+	// Size the file (reserving its blocks if allocating)
+	if ((mode != "allocate") ||
+		(fallocate(mapfh, 0, 0, (off_t)mapsz) == -1)) {
+		if (ftruncate(mapfh, (off_t)mapsz) == -1) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Failed sizing storage file [%s], error [%s]",
+					   storagePath, strerror(errno));
+			close(mapfh);
+			return (-1);
 		}
+	}
 
-		// Create the data
-		for (i = 0; i < (int)numBlocks; i++) {
-			if (write(mapfh, zeroblk, BLK_SZ) != BLK_SZ) {
-				logMessage(LOG_ERROR_LEVEL,
-						   "Failed writing memory map file content [%s]",
-						   strerror(errno));
-				return (NULL);
+	// Zero the file in parallel ranges (if pre-zeroing)
+	if (nthreads > 0) {
+		rngs.resize(nthreads);
+		per = ((numBlocks + nthreads - 1) / nthreads) * BLK_SZ;
+		for (i = 0; i < nthreads; i++) {
+			rngs[i].fd = mapfh;
+			rngs[i].start = (per * i < mapsz) ? per * i : mapsz;
+			rngs[i].end = (per * (i + 1) < mapsz) ? per * (i + 1) : mapsz;
+			rngs[i].ret = 0;
+			if (pthread_create(&rngs[i].thread, NULL, __zeroDiskRange,
+							   &rngs[i])) {
+				logMessage(LOG_ERROR_LEVEL, "Failed creating zeroing thread");
+				rngs.resize(i);
+				ret = -1;
+				break;
 			}
 		}
+		for (i = 0; i < (int)rngs.size(); i++) {
+			pthread_join(rngs[i].thread, NULL);
+			ret |= rngs[i].ret;
+		}
+	}
 
-		// Fluch and close the map file
-		fsync(mapfh);
-		close(mapfh);
-		mapfh = -1;
+	// Fluch and close the map file
+	fsync(mapfh);
+	close(mapfh);
+	if (ret == 0) {
+		logMessage(LOG_OUTPUT_LEVEL,
+				   "Provisioned device storage [did=%lu, sz=%lu bytes, %s] in "
+				   "%.3f ms",
+				   deviceID, mapsz, mode.c_str(),
+				   (storageTimeUsecs() - start) / 1000.0);
+	}
+	return (ret);
+}
+
+/**
+ * @brief Initializes and creates the memory map for the disk storage.
+ *
+ * @param deviceID: the device id
+ * @param storagePath: path name to the backing file
+ * @param numBlocks: the number of disk blocks on the device
+ * @return char*: pointer to the base address of the disk storage memory map
+ */
+char *__createDiskStorage(bfs_device_id_t deviceID, const char *storagePath,
+						  uint64_t numBlocks) {
+	char *blockStorage = NULL;
+
+	// Local variables
+	uint64_t mapsz = numBlocks * BLK_SZ;
+	int mapprot = PROT_READ | PROT_WRITE, mapflgs = MAP_SHARED, mapfh = -1,
+		mapoffset = 0;
+
+	// Create the file if needed
+	if (__createDiskFile(deviceID, storagePath, numBlocks)) {
+		return (NULL);
 	}
 
 	// Create the file indicated in the path config item
@@ -431,6 +1018,439 @@ char *__createDiskStorage(bfs_device_id_t deviceID, const char *storagePath,
 }
 #endif
 
+/**
+ * @brief Open the backing file of a direct storage, bypassing the page cache
+ * (O_DIRECT, when the file system supports it), and create the io_uring
+ * instance its batches are submitted to (falling back to preadv/pwritev2
+ * when the kernel does not support it).
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::openDirectStorage(void) {
+#ifdef __BFS_ENCLAVE_MODE
+	logMessage(LOG_ERROR_LEVEL, "Direct device storage unsupported in enclave");
+	return (-1);
+#else
+	// Local variables
+	uint64_t ncache;
+
+	// Create the file if needed
+	if (__createDiskFile(deviceID, storagePath.c_str(), numBlocks)) {
+		return (-1);
+	}
+
+	// Open it for direct I/O (e.g., tmpfs does not support it, so buffer)
+	alignedIo = true;
+	if ((storageFd = open(storagePath.c_str(), O_RDWR | O_DIRECT)) == -1) {
+		logMessage(DEVICE_LOG_LEVEL,
+				   "Direct open of [%s] failed [%s], using buffered I/O",
+				   storagePath.c_str(), strerror(errno));
+		alignedIo = false;
+		storageFd = open(storagePath.c_str(), O_RDWR);
+	}
+	if (storageFd == -1) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device storage open failed, error [%s], path [%s]",
+				   strerror(errno), storagePath.c_str());
+		return (-1);
+	}
+
+	// Create the ring
+	if ((ring = storage_ring_create(BFS_STORAGE_RING_DEPTH)) == NULL) {
+		logMessage(DEVICE_LOG_LEVEL,
+				   "No io_uring for device storage, using preadv/pwritev2");
+	}
+
+	// Create the block cache (the reads bypass the page cache)
+	try {
+		ncache = (uint64_t)bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG)
+					 ->getSubItemByName("cache_blocks")
+					 ->bfsCfgItemValueLong();
+	} catch (bfsCfgError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Failure reading system config : %s",
+				   e->getMessage().c_str());
+		delete e;
+		return (-1);
+	}
+	if (ncache > 0) {
+		cache = new bfsDeviceCache(min(ncache, numBlocks));
+	}
+
+	// Return successfully
+	logMessage(DEVICE_LOG_LEVEL,
+			   "Device storage opened [%s] (direct=%d, io_uring=%d, "
+			   "cache=%lu blocks)",
+			   storagePath.c_str(), alignedIo, (ring != NULL), ncache);
+	return (0);
+#endif
+}
+
+/**
+ * @brief Read/write a batch of blocks of a direct storage.  O_DIRECT needs
+ * aligned buffers, so the blocks go through an aligned bounce buffer.
+ *
+ * @param write - flag indicating to write the blocks (read otherwise)
+ * @param blkids - the block IDs of the blocks
+ * @param nblks - the number of blocks
+ * @param blks - the buffers of the blocks
+ * @param fua - flag indicating written blocks must be durable before returning
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::directBlocks(bool write, bfs_block_id_t *blkids,
+								   uint32_t nblks, char **blks, bool fua) {
+#ifdef __BFS_ENCLAVE_MODE
+	return (-1);
+#else
+	// Local variables
+	struct iovec *iovs;
+	off_t *offs;
+	char *bounce = NULL;
+	uint32_t i;
+	int ret;
+
+	// Check the blocks
+	for (i = 0; i < nblks; i++) {
+		if ((blkids[i] >= numBlocks) || (blks[i] == NULL)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Bad block in direct storage batch [%lu]", blkids[i]);
+			return (-1);
+		}
+	}
+	if (nblks == 0) {
+		return (0);
+	}
+
+	// Setup the I/O vectors (through the bounce buffer if aligned)
+	iovs = new struct iovec[nblks];
+	offs = new off_t[nblks];
+	if (alignedIo && posix_memalign((void **)&bounce, BFS_STORAGE_DIRECT_ALIGN,
+									(size_t)nblks * BLK_SZ)) {
+		logMessage(LOG_ERROR_LEVEL, "Direct storage bounce alloc failed");
+		delete[] iovs;
+		delete[] offs;
+		return (-1);
+	}
+	for (i = 0; i < nblks; i++) {
+		iovs[i].iov_base = alignedIo ? &bounce[(size_t)i * BLK_SZ] : blks[i];
+		iovs[i].iov_len = BLK_SZ;
+		offs[i] = (off_t)blkids[i] * BLK_SZ;
+		if (alignedIo && write) {
+			memcpy(iovs[i].iov_base, blks[i], BLK_SZ);
+		}
+	}
+
+	// Run the batch through the ring, or one block at a time without one
+	ret = storage_direct_run(ring, &ringLock, write, storageFd, iovs, offs,
+							 nblks, fua);
+	if (ret) {
+		logMessage(LOG_ERROR_LEVEL, "Direct storage %s of %u blocks failed",
+				   write ? "write" : "read", nblks);
+	}
+
+	// Copy the blocks read out, clean up
+	for (i = 0; alignedIo && (ret == 0) && (!write) && (i < nblks); i++) {
+		memcpy(blks[i], iovs[i].iov_base, BLK_SZ);
+	}
+	free(bounce);
+	delete[] iovs;
+	delete[] offs;
+	return (ret);
+#endif
+}
+
+/**
+ * @brief Read/write runs of blocks of a direct storage, one I/O per run
+ * (submitted together to the ring), through a bounce buffer if the file is
+ * O_DIRECT (the caller's buffers are not aligned)
+ *
+ * @param write - flag indicating the runs are written (else read)
+ * @param exts - the (checked) runs of blocks
+ * @param nexts - the number of runs
+ * @param bufs - the buffer holding (receiving) the blocks of each run
+ * @param fua - flag indicating written blocks must be durable before returning
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::directExtents(bool write, bfs_block_extent_t *exts,
+									uint32_t nexts, char **bufs, bool fua) {
+#ifdef __BFS_ENCLAVE_MODE
+	return (-1);
+#else
+	// Local variables
+	struct iovec *iovs;
+	off_t *offs;
+	char *bounce = NULL;
+	size_t total = 0;
+	uint32_t i;
+	int ret;
+
+	// Size the transfer
+	if (nexts == 0) {
+		return (0);
+	}
+	for (i = 0; i < nexts; i++) {
+		total += exts[i].count * BLK_SZ;
+	}
+
+	// Setup the I/O vectors (through the bounce buffer if aligned)
+	if (alignedIo &&
+		posix_memalign((void **)&bounce, BFS_STORAGE_DIRECT_ALIGN, total)) {
+		logMessage(LOG_ERROR_LEVEL, "Direct storage bounce alloc failed");
+		return (-1);
+	}
+	iovs = new struct iovec[nexts];
+	offs = new off_t[nexts];
+	for (i = 0, total = 0; i < nexts; i++) {
+		iovs[i].iov_base = alignedIo ? &bounce[total] : bufs[i];
+		iovs[i].iov_len = exts[i].count * BLK_SZ;
+		offs[i] = (off_t)exts[i].start * BLK_SZ;
+		total += iovs[i].iov_len;
+		if (alignedIo && write) {
+			memcpy(iovs[i].iov_base, bufs[i], iovs[i].iov_len);
+		}
+	}
+
+	// Run the batch, copy the blocks read out
+	ret = storage_direct_run(ring, &ringLock, write, storageFd, iovs, offs,
+							 nexts, fua);
+	if (ret) {
+		logMessage(LOG_ERROR_LEVEL, "Direct storage %s of %u extents failed",
+				   write ? "write" : "read", nexts);
+	}
+	for (i = 0; alignedIo && (ret == 0) && (!write) && (i < nexts); i++) {
+		memcpy(bufs[i], iovs[i].iov_base, iovs[i].iov_len);
+	}
+
+	// Clean up, return the status
+	free(bounce);
+	delete[] iovs;
+	delete[] offs;
+	return (ret);
+#endif
+}
+
+/**
+ * @brief Get runs of blocks of a cached direct storage.  The cached blocks
+ * are copied out, and the runs of blocks that are not are read together (one
+ * I/O per run, into their place in the buffer), then offered to the cache.
+ *
+ * @param exts - the (checked) runs of blocks
+ * @param nexts - the number of runs
+ * @param buf - the buffer receiving the blocks, in order
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::cachedExtents(bfs_block_extent_t *exts, uint32_t nexts,
+									char *buf) {
+
+	// Local variables
+	vector<bfs_block_extent_t> mexts;
+	vector<char *> mbufs;
+	vector<uint64_t> tickets;
+	bfs_block_extent_t run;
+	uint64_t ticket, j;
+	uint32_t i;
+
+	// Copy out the cached blocks, collecting the runs of those not cached
+	for (i = 0; i < nexts; i++) {
+		for (j = 0; j < exts[i].count; j++, buf += BLK_SZ) {
+			if (cache->getBlock(exts[i].start + j, buf, ticket)) {
+				continue;
+			}
+			tickets.push_back(ticket);
+			if (mexts.empty() || (mexts.back().start + mexts.back().count !=
+								  exts[i].start + j)) {
+				run.start = exts[i].start + j;
+				run.count = 0;
+				mexts.push_back(run);
+				mbufs.push_back(buf);
+			}
+			mexts.back().count++;
+		}
+	}
+	if (mexts.empty()) {
+		return (0);
+	}
+
+	// Read the runs not cached, offer their blocks to the cache
+	if (directExtents(false, mexts.data(), (uint32_t)mexts.size(),
+					  mbufs.data(), false)) {
+		return (-1);
+	}
+	for (i = 0, ticket = 0; i < mexts.size(); i++) {
+		for (j = 0; j < mexts[i].count; j++) {
+			cache->admitBlock(mexts[i].start + j, &mbufs[i][j * BLK_SZ],
+							  tickets[ticket++]);
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Open the write journal of the storage, if the config gives it a
+ * size (replaying the records a crash left)
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::openJournal(void) {
+
+	// Get the size of the journal, and of the largest batch put (a request
+	// record from a client)
+	uint64_t njnl, nbatch;
+	try {
+		njnl = (uint64_t)bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG)
+				   ->getSubItemByName("journal_blocks")
+				   ->bfsCfgItemValueLong();
+		nbatch = (uint64_t)bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG)
+					 ->getSubItemByName("max_record_size")
+					 ->bfsCfgItemValueLong() /
+				 BLK_SZ;
+	} catch (bfsCfgError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Failure reading system config : %s",
+				   e->getMessage().c_str());
+		delete e;
+		return (-1);
+	}
+
+	// Journal the puts if it has one
+	nbatch = min(nbatch, (uint64_t)UINT32_MAX);
+	return ((njnl > 0) ? enableJournal(njnl, (uint32_t)nbatch) : 0);
+}
+
+/**
+ * @brief Put a set of blocks through the journal: append the batch to the
+ * journal as one record, then write it to the data area.  Concurrent puts
+ * append (and sync) their records together, then write them to the data
+ * area in the order of the records, so the data area is what a replay of
+ * the journal makes it.
+ *
+ * @param blkids - the block IDs of the blocks to put
+ * @param nblks - the number of blocks (at most the journal's largest record)
+ * @param blks - the buffers holding the blocks
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::journalBlocks(bfs_block_id_t *blkids, uint32_t nblks,
+									char **blks) {
+#ifdef __BFS_ENCLAVE_MODE
+	return (-1);
+#else
+	// Local variables
+	uint64_t seq;
+	uint32_t i;
+	int ret;
+
+	// Check the blocks (a bad one must not reach the journal), and that the
+	// batch fits a record (splitting it would let a crash tear it)
+	for (i = 0; i < nblks; i++) {
+		if ((blkids[i] >= numBlocks) || (blks[i] == NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad block in journaled put [%lu]",
+					   blkids[i]);
+			return (-1);
+		}
+	}
+	if (nblks > journal->getMaxRecordBlocks()) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Journaled put of %u blocks larger than a record (%u)",
+				   nblks, journal->getMaxRecordBlocks());
+		return (-1);
+	}
+
+	// Append the record, then write it to the data area in its turn
+	if (journal->appendRecord(blkids, nblks, blks, seq) ||
+		journal->waitApply(seq)) {
+		logMessage(LOG_ERROR_LEVEL, "Journaled put failed [%s]",
+				   storagePath.c_str());
+		return (-1);
+	}
+	ret = writeBlocks(blkids, nblks, blks, false);
+	journal->markApplied(seq, (ret == 0));
+	if (ret) {
+		logMessage(LOG_ERROR_LEVEL, "Journaled put failed [%s]",
+				   storagePath.c_str());
+	}
+	return (ret);
+#endif
+}
+
+/**
+ * @brief Write a set of blocks to the data area (one batch to the ring of a
+ * direct storage, copies into the map otherwise)
+ *
+ * @param blkids - the block IDs of the blocks to write
+ * @param nblks - the number of blocks
+ * @param blks - the buffers holding the blocks
+ * @param fua - flag indicating the blocks must be durable before returning
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::writeBlocks(bfs_block_id_t *blkids, uint32_t nblks,
+								  char **blks, bool fua) {
+
+	// Local variables
+	char *baddr;
+	uint32_t i;
+	int ret;
+
+	// Direct storage writes them as one batch (then updates the cached
+	// copies, dropping them if the write failed)
+	if (backend == BFS_STORAGE_DIRECT) {
+		ret = directBlocks(true, blkids, nblks, blks, fua);
+		for (i = 0; (cache != NULL) && (i < nblks); i++) {
+			if (ret == 0) {
+				cache->updateBlock(blkids[i], blks[i]);
+			} else {
+				cache->invalidateBlock(blkids[i]);
+			}
+		}
+		return (ret);
+	}
+
+	// Otherwise copy them into the map
+	for (i = 0; i < nblks; i++) {
+		if (((baddr = getBlockAddress(blkids[i])) == NULL) ||
+			(blks[i] == NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "Put block failed [%lu]", blkids[i]);
+			return (-1);
+		}
+		memcpy(baddr, blks[i], BLK_SZ);
+#ifndef __BFS_ENCLAVE_MODE
+		if (fua && (msync(baddr, BLK_SZ, MS_SYNC) == -1)) {
+			logMessage(LOG_ERROR_LEVEL, "Put block sync failed [%lu] : [%s]",
+					   blkids[i], strerror(errno));
+			return (-1);
+		}
+#endif
+	}
+	return (0);
+}
+
+/**
+ * @brief Make the blocks written to the data area durable (write back the
+ * map, or flush the backing file of a direct storage)
+ *
+ * @param none
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsDeviceStorage::flushData(void) {
+#ifndef __BFS_ENCLAVE_MODE
+	if (((backend == BFS_STORAGE_DIRECT) && (fdatasync(storageFd) == -1)) ||
+		((backend == BFS_STORAGE_MMAP) && (blockStorage != NULL) &&
+		 (msync(blockStorage, numBlocks * BLK_SZ, MS_SYNC) == -1))) {
+		logMessage(LOG_ERROR_LEVEL, "Device storage flush failed : [%s]",
+				   strerror(errno));
+		return (-1);
+	}
+#endif
+	return (0);
+}
+
 /**
  * @brief De-initialze the device
  *
@@ -446,6 +1466,38 @@ int bfsDeviceStorage::bfsDeviceStorageUninitialize(void) {
 		return BFS_FAILURE;
 	}
 #else
+	// Close the journal first (checkpointing it to the data area)
+	if (journal != NULL) {
+		bfs_device_journal_stats_t jst = journal->getStats();
+		logMessage(DEVICE_LOG_LEVEL,
+				   "Device storage journal [did=%lu] : %lu records, %lu "
+				   "blocks, %lu checkpoints",
+				   deviceID, jst.records, jst.blocks, jst.checkpoints);
+		delete journal;
+		journal = NULL;
+	}
+
+	// Close the direct storage (the cache, the ring, then the file)
+	if (backend == BFS_STORAGE_DIRECT) {
+		if (cache != NULL) {
+			bfs_device_cache_stats_t st = cache->getStats();
+			logMessage(DEVICE_LOG_LEVEL,
+					   "Device storage cache [did=%lu] : %lu hits, %lu misses",
+					   deviceID, st.hits, st.misses);
+			delete cache;
+			cache = NULL;
+		}
+		if (ring != NULL) {
+			storage_ring_destroy(ring);
+			ring = NULL;
+		}
+		if (storageFd != -1) {
+			close(storageFd);
+			storageFd = -1;
+		}
+		return BFS_SUCCESS;
+	}
+
 	__deleteDiskStorage(blockStorage, numBlocks);
 #endif
 
@@ -491,3 +1543,230 @@ char *bfsDeviceStorage::getBlockAddress(uint64_t blkid) {
 	// Compute address and return it
 	return (blockStorage + (blkid * BLK_SZ));
 }
+
+//
+// Module functions
+
+#ifndef __BFS_ENCLAVE_MODE
+
+/**
+ * @brief Get the current time (usec), for timing the storage bring-up
+ *
+ * @param none
+ * @return double : the time
+ */
+
+static double storageTimeUsecs(void) {
+	return (std::chrono::duration<double, std::micro>(
+				std::chrono::high_resolution_clock::now().time_since_epoch())
+				.count());
+}
+
+/**
+ * @brief Create an io_uring instance (mapping its rings)
+ *
+ * @param depth - the number of submission queue entries
+ * @return bfs_storage_ring * : the ring, NULL if unavailable
+ */
+
+static bfs_storage_ring *storage_ring_create(unsigned depth) {
+
+	// Local variables
+	struct io_uring_params p;
+	bfs_storage_ring *r;
+	char *sq, *cq;
+
+	// Setup the instance
+	memset(&p, 0x0, sizeof(p));
+	r = new bfs_storage_ring();
+	if ((r->fd = (int)syscall(__NR_io_uring_setup, depth, &p)) == -1) {
+		delete r;
+		return (NULL);
+	}
+
+	// Map the rings (one mapping if the kernel shares them) and the entries
+	r->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->sq_map_sz = r->cq_map_sz =
+			(r->sq_map_sz > r->cq_map_sz) ? r->sq_map_sz : r->cq_map_sz;
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sq_map = mmap(NULL, r->sq_map_sz, PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP)
+					? r->sq_map
+					: mmap(NULL, r->cq_map_sz, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz,
+										  PROT_READ | PROT_WRITE,
+										  MAP_SHARED | MAP_POPULATE, r->fd,
+										  IORING_OFF_SQES);
+	if ((r->sq_map == MAP_FAILED) || (r->cq_map == MAP_FAILED) ||
+		(r->sqes == MAP_FAILED)) {
+		logMessage(LOG_ERROR_LEVEL, "Device storage ring mmap failed : [%s]",
+				   strerror(errno));
+		storage_ring_destroy(r);
+		return (NULL);
+	}
+
+	// Find the ring fields
+	sq = (char *)r->sq_map;
+	cq = (char *)r->cq_map;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (r);
+}
+
+/**
+ * @brief Destroy an io_uring instance (unmapping its rings)
+ *
+ * @param r - the ring
+ * @return none
+ */
+
+static void storage_ring_destroy(bfs_storage_ring *r) {
+	if ((r->sqes != NULL) && (r->sqes != MAP_FAILED)) {
+		munmap(r->sqes, r->sqes_sz);
+	}
+	if ((r->cq_map != NULL) && (r->cq_map != MAP_FAILED) &&
+		(r->cq_map != r->sq_map)) {
+		munmap(r->cq_map, r->cq_map_sz);
+	}
+	if ((r->sq_map != NULL) && (r->sq_map != MAP_FAILED)) {
+		munmap(r->sq_map, r->sq_map_sz);
+	}
+	close(r->fd);
+	delete r;
+	return;
+}
+
+/**
+ * @brief Run a batch of block reads/writes through an io_uring instance,
+ * submitting as many as the submission queue holds at a time and waiting for
+ * them to complete (called with the ring's lock held)
+ *
+ * @param r - the ring
+ * @param write - flag indicating to write the blocks (read otherwise)
+ * @param fd - the file to read/write
+ * @param iovs - the block buffers
+ * @param offs - the block offsets in the file
+ * @param n - the number of blocks
+ * @param fua - flag indicating writes must be durable before completing
+ * @return int : 0 is success, -1 is failure
+ */
+
+static int storage_ring_run(bfs_storage_ring *r, bool write, int fd,
+							struct iovec *iovs, off_t *offs, uint32_t n,
+							bool fua) {
+
+	// Local variables
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned tail, head, idx, batch, subd, done, mask = *r->sq_mask;
+	uint32_t next = 0;
+	int ret = 0, sub;
+
+	while (next < n) {
+
+		// Fill the submission queue with the next blocks
+		batch = (n - next < BFS_STORAGE_RING_DEPTH) ? n - next
+													: BFS_STORAGE_RING_DEPTH;
+		tail = *r->sq_tail;
+		for (idx = 0; idx < batch; idx++, tail++) {
+			sqe = &r->sqes[tail & mask];
+			memset(sqe, 0x0, sizeof(*sqe));
+			sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe->fd = fd;
+			sqe->off = (uint64_t)offs[next + idx];
+			sqe->addr = (uint64_t)&iovs[next + idx];
+			sqe->len = 1;
+			sqe->rw_flags = (write && fua) ? RWF_DSYNC : 0;
+			sqe->user_data = next + idx;
+			r->sq_array[tail & mask] = tail & mask;
+		}
+		__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+		// Submit them, waiting for them all to complete
+		for (subd = 0, done = 0; done < batch;) {
+			sub = (int)syscall(__NR_io_uring_enter, r->fd, batch - subd,
+							   batch - done, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (sub >= 0) {
+				subd += (unsigned)sub;
+			} else if (errno != EINTR) {
+				logMessage(LOG_ERROR_LEVEL, "io_uring_enter failed : [%s]",
+						   strerror(errno));
+				return (-1);
+			}
+
+			// Reap the completions
+			head = *r->cq_head;
+			while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+				cqe = &r->cqes[head & *r->cq_mask];
+				if ((cqe->res < 0) ||
+					((size_t)cqe->res != iovs[cqe->user_data].iov_len)) {
+					logMessage(LOG_ERROR_LEVEL,
+							   "Device storage ring I/O failed [%llu] : [%d]",
+							   cqe->user_data, cqe->res);
+					ret = -1;
+				}
+				head++;
+				done++;
+			}
+			__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+		}
+		next += batch;
+	}
+
+	return (ret);
+}
+
+/**
+ * @brief Run a set of direct storage I/Os, as one batch through the ring
+ * (serialized with the lock) or one at a time without one
+ *
+ * @param r - the ring (NULL if none)
+ * @param lk - the lock serializing the batches submitted to the ring
+ * @param write - flag indicating the I/Os are writes (else reads)
+ * @param fd - the backing file
+ * @param iovs - the I/O vectors (one buffer each)
+ * @param offs - the file offsets of the I/Os
+ * @param n - the number of I/Os
+ * @param fua - flag indicating writes must be durable before completing
+ * @return int : 0 is success, -1 is failure
+ */
+
+static int storage_direct_run(bfs_storage_ring *r, pthread_mutex_t *lk,
+							  bool write, int fd, struct iovec *iovs,
+							  off_t *offs, uint32_t n, bool fua) {
+
+	// Local variables
+	uint32_t i;
+	int ret = 0;
+
+	// Through the ring
+	if (r != NULL) {
+		pthread_mutex_lock(lk);
+		ret = storage_ring_run(r, write, fd, iovs, offs, n, fua);
+		pthread_mutex_unlock(lk);
+		return (ret);
+	}
+
+	// Otherwise one at a time
+	for (i = 0; (ret == 0) && (i < n); i++) {
+		if ((write ? pwritev2(fd, &iovs[i], 1, offs[i], fua ? RWF_DSYNC : 0)
+				   : preadv(fd, &iovs[i], 1, offs[i])) !=
+			(ssize_t)iovs[i].iov_len) {
+			ret = -1;
+		}
+	}
+	return (ret);
+}
+
+#endif
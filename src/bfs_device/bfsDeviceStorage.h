@@ -12,11 +12,16 @@
 //  Created : Wed 21 Jul 2021 04:00:20 PM EDT
 //
 
+// Include files
+#include <pthread.h>
+
 // STL-isms
 #include <string>
 using namespace std;
 
 // Project Includes
+#include <bfsDeviceCache.h>
+#include <bfsDeviceJournal.h>
 #include <bfsDeviceLayer.h>
 #include <bfs_common.h>
 
@@ -28,8 +33,18 @@ using namespace std;
 //
 // Class types
 
+// The ways the storage can keep the blocks in its backing file
+typedef enum {
+	BFS_STORAGE_MMAP = 0,	// Shared memory map of the file (default)
+	BFS_STORAGE_DIRECT = 1, // O_DIRECT file I/O, batched through io_uring
+} bfs_storage_backend_t;
+
+// The io_uring instance of a direct storage (opaque, see the .cpp)
+struct bfs_storage_ring;
+
 //
 // Helper function prototypes
+int __createDiskFile(bfs_device_id_t, const char *, uint64_t);
 char *__createDiskStorage(bfs_device_id_t, const char *, uint64_t);
 void __deleteDiskStorage(char *, uint64_t);
 
@@ -37,6 +52,9 @@ void __deleteDiskStorage(char *, uint64_t);
 // Class Definition
 class bfsDeviceStorage {
 
+	// The journal writes (and replays) blocks to the data area
+	friend class bfsDeviceJournal;
+
 public:
 	//
 	// Public Interfaces0
@@ -44,7 +62,11 @@ public:
 	// Constructors and destructors
 
 	bfsDeviceStorage(bfs_device_id_t did, uint64_t noblocks);
-	// Device geometry constructor
+	// Device geometry constructor (path and backend from the config)
+
+	bfsDeviceStorage(bfs_device_id_t did, uint64_t noblocks, string path,
+					 bfs_storage_backend_t bkend);
+	// Device geometry constructor (explicit path and backend)
 
 	virtual ~bfsDeviceStorage(void);
 	// Destructor
@@ -58,20 +80,60 @@ public:
 	// Return the number of blocks in the storage
 	uint64_t getNumBlocks(void) { return (numBlocks); }
 
+	// Return the backend keeping the blocks
+	bfs_storage_backend_t getBackend(void) { return (backend); }
+
+	// Return the block cache (NULL if the blocks are not cached)
+	bfsDeviceCache *getCache(void) { return (cache); }
+
+	// Return the write journal (NULL if the puts are not journaled)
+	bfsDeviceJournal *getJournal(void) { return (journal); }
+
 	//
 	// Class Methods
 
 	char *getBlock(bfs_block_id_t blkid, char *blk);
 	// Get a block from the device (at block id)
 
-	char *putBlock(bfs_block_id_t blkid, char *blk);
-	// Put a block into the device
+	char *putBlock(bfs_block_id_t blkid, char *blk, bool fua = false);
+	// Put a block into the device (fua: durable before returning)
+
+	int getBlocks(bfs_block_id_t *blkids, uint32_t nblks, char **blks);
+	// Get a set of blocks from the device (in one batch)
 
-	// Direct access into the block data (use VERY carefully)
+	int putBlocks(bfs_block_id_t *blkids, uint32_t nblks, char **blks,
+				  bool fua = false);
+	// Put a set of blocks into the device (in one batch)
+
+	int getExtents(bfs_block_extent_t *exts, uint32_t nexts, char *buf);
+	// Get runs of blocks from the device (into one buffer, in order)
+
+	int putExtents(bfs_block_extent_t *exts, uint32_t nexts, char *buf,
+				   bool fua = false);
+	// Put runs of blocks into the device (from one buffer, in order)
+
+	int flushStorage(void);
+	// Make the blocks put so far durable
+
+	int trimBlocks(bfs_block_id_t *blkids, uint32_t nblks);
+	// Discard a set of blocks (they read as zeros after)
+
+	int enableJournal(uint64_t nblks, uint32_t maxbatch);
+	// Journal the puts (a journal of nblks blocks next to the backing file,
+	// its records holding batches of up to maxbatch blocks)
+
+	// Direct access into the block data (use VERY carefully, NULL unless the
+	// storage is memory mapped)
 	char *directBlockAccess(bfs_block_id_t blkid) {
-		return (getBlockAddress(blkid));
+		return ((backend == BFS_STORAGE_MMAP) ? getBlockAddress(blkid) : NULL);
 	}
 
+	//
+	// Static methods
+
+	static bfs_storage_backend_t getBackendByName(const string &nm);
+	// Get a backend from its config name (mmap or direct)
+
 private:
 	// Private class methods
 
@@ -91,6 +153,33 @@ private:
 	char *getBlockAddress(uint64_t blkid);
 	// Get the address of a block in the device
 
+	int openDirectStorage(void);
+	// Open the backing file for direct I/O (and its io_uring instance)
+
+	int directBlocks(bool write, bfs_block_id_t *blkids, uint32_t nblks,
+					 char **blks, bool fua);
+	// Read/write a batch of blocks of a direct storage
+
+	int directExtents(bool write, bfs_block_extent_t *exts, uint32_t nexts,
+					  char **bufs, bool fua);
+	// Read/write runs of blocks of a direct storage (one I/O per run)
+
+	int cachedExtents(bfs_block_extent_t *exts, uint32_t nexts, char *buf);
+	// Get runs of blocks of a direct storage (reading only the uncached)
+
+	int openJournal(void);
+	// Open the write journal if the config gives it a size
+
+	int journalBlocks(bfs_block_id_t *blkids, uint32_t nblks, char **blks);
+	// Put a set of blocks through the journal (atomically, durable)
+
+	int writeBlocks(bfs_block_id_t *blkids, uint32_t nblks, char **blks,
+					bool fua);
+	// Write a set of blocks to the data area
+
+	int flushData(void);
+	// Make the blocks written to the data area durable
+
 	//
 	// Class Data
 
@@ -105,6 +194,27 @@ private:
 
 	char *blockStorage;
 	// A pointer to the block storage in memory
+
+	bfs_storage_backend_t backend;
+	// The backend keeping the blocks
+
+	int storageFd;
+	// The backing file (direct backend)
+
+	bool alignedIo;
+	// Flag indicating the backing file is O_DIRECT (I/O must be aligned)
+
+	bfs_storage_ring *ring;
+	// The io_uring instance (NULL falls back to preadv/pwritev2)
+
+	pthread_mutex_t ringLock;
+	// The lock serializing the batches submitted to the ring
+
+	bfsDeviceCache *cache;
+	// The cache of recently/frequently read blocks (direct backend, or NULL)
+
+	bfsDeviceJournal *journal;
+	// The write-ahead journal of the puts (or NULL)
 };
 
 #endif
@@ -9,6 +9,8 @@
 
 /* Include files  */
 #include <string.h>
+#include <algorithm>
+#include <vector>
 
 /* Project include files */
 #include <bfsLocalDevice.h>
@@ -107,14 +109,18 @@ int bfsLocalDevice::getBlocks( bfs_block_list_t & blks ) {
 
     // Local variables
     bfs_block_list_t::iterator it;
+    vector<bfs_block_id_t> pbids;
+    vector<char *> bufs;
     char bbuf[128];
     string msg;
 
-    // Walk the blocks and get them
+    // Walk the blocks, get them (as one batch)
     for ( it=blks.begin(); it!=blks.end(); it++ ) {
-        if ( storage->getBlock( it->first, it->second->getBuffer() ) == NULL ) {
-            throw new bfsDeviceError( "Failed putting block in local device" );
-        }
+        pbids.push_back( it->first );
+        bufs.push_back( it->second->getBuffer() );
+    }
+    if ( storage->getBlocks( pbids.data(), (uint32_t)pbids.size(), bufs.data() ) ) {
+        throw new bfsDeviceError( "Failed getting blocks in local device" );
     }
 
     // Log, possibly list blocks
@@ -143,13 +149,24 @@ int bfsLocalDevice::putBlocks( bfs_block_list_t & blks ) {
 
     // Local variables
     bfs_block_list_t::iterator it;
+    vector<bfs_block_id_t> pbids;
+    vector<char *> bufs;
+    uint32_t n, rec;
+    size_t i;
     char bbuf[128];
     string msg;
 
-    // Walk the blocks and get them
+    // Walk the blocks, put them (as one batch, or as batches of a journal
+    // record each if journaled, like the request records of a remote device)
     for ( it=blks.begin(); it!=blks.end(); it++ ) {
-        if ( storage->putBlock( it->first, it->second->getBuffer() ) == NULL ) {
-            throw new bfsDeviceError( "Failed putting block in local device" );
+        pbids.push_back( it->first );
+        bufs.push_back( it->second->getBuffer() );
+    }
+    rec = (storage->getJournal() != NULL) ? storage->getJournal()->getMaxRecordBlocks() : (uint32_t)pbids.size();
+    for ( i=0; i<pbids.size(); i+=n ) {
+        n = min( (uint32_t)(pbids.size()-i), rec );
+        if ( storage->putBlocks( &pbids[i], n, &bufs[i] ) ) {
+            throw new bfsDeviceError( "Failed putting blocks in local device" );
         }
     }
 
@@ -99,12 +99,7 @@ public:
 			throw new bfsDeviceError("Using NULL storage device, failed");
 		}
 
-		for (uint32_t i = 0; i < nblks; i++) {
-			if (storage->getBlock(pbids[i], blks[i]) == NULL) {
-				return -1;
-			}
-		}
-		return 0;
+		return (storage->getBlocks(pbids, nblks, blks));
 	}
 
 	virtual int getBlocks(bfs_block_list_t &blks);
@@ -130,17 +125,37 @@ public:
 			throw new bfsDeviceError("Using NULL storage device, failed");
 		}
 
-		for (uint32_t i = 0; i < nblks; i++) {
-			if (storage->putBlock(pbids[i], blks[i]) == NULL) {
-				return -1;
-			}
-		}
-		return 0;
+		return (storage->putBlocks(pbids, nblks, blks));
 	}
 
 	virtual int putBlocks(bfs_block_list_t &blks);
 	// Put the blocks associated with the following IDs
 
+	// Put a block, durable before returning
+	virtual int putBlockFua(PBfsBlock &blk) {
+		if (storage == NULL) {
+			throw new bfsDeviceError("Using NULL storage device, failed");
+		}
+		return (storage->putBlock(blk.get_pbid(), blk.getBuffer(), true) ==
+				NULL);
+	}
+
+	// Make the blocks put so far durable
+	virtual int flushDevice(void) {
+		if (storage == NULL) {
+			throw new bfsDeviceError("Using NULL storage device, failed");
+		}
+		return (storage->flushStorage());
+	}
+
+	// Discard the (freed) blocks
+	virtual int trimBlocks(bfs_block_id_t *pbids, uint32_t nblks) {
+		if (storage == NULL) {
+			throw new bfsDeviceError("Using NULL storage device, failed");
+		}
+		return (storage->trimBlocks(pbids, nblks));
+	}
+
 	//
 	// Static class methods
 
@@ -22,9 +22,14 @@
 /* For performance testing */
 static std::vector<double> d_read__lats, d_read__d_lats, d_read__net_send_lats,
 	d_write__lats, d_write__d_lats, d_write__net_send_lats;
+static pthread_mutex_t d_lats_lock = PTHREAD_MUTEX_INITIALIZER;
 static int bfs_device_listener_status = 0;
 
 static void device_signal_handler(int);
+static double device_time_us(void);
+static void record_dev_latencies(bfs_device_msg_t cmd, double d_start_time,
+								 double net_send_start_time,
+								 double net_send_end_time, double d_end_time);
 
 //
 // Class Functions
@@ -40,8 +45,14 @@ static void device_signal_handler(int);
 
 bfsNetworkDevice::bfsNetworkDevice(bfs_device_id_t did)
 	: devState(BFSDEV_UNINITIALIZED), deviceID(did), commPort(-1),
-	  blockStorage(NULL), serverConn(NULL), serverMux(NULL), secContext(NULL),
-	  storage(NULL), nd_send_seq(0), nd_recv_seq(0) {
+	  blockStorage(NULL), serverConn(NULL), shmServerConn(NULL),
+	  serverMux(NULL), secContext(NULL), storage(NULL), nd_nworkers(0), nd_stopping(false) {
+
+	// Setup the worker synchronization
+	pthread_mutex_init(&nd_lock, NULL);
+	pthread_cond_init(&nd_work, NULL);
+	pthread_cond_init(&nd_turn, NULL);
+	pthread_rwlock_init(&nd_storage_lock, NULL);
 
 	// Return, no return code
 	return;
@@ -56,7 +67,12 @@ bfsNetworkDevice::bfsNetworkDevice(bfs_device_id_t did)
 bfsNetworkDevice::~bfsNetworkDevice(void) {
 
 	// Clean up the device objects
+	stopWorkers();
 	delete secContext;
+	pthread_mutex_destroy(&nd_lock);
+	pthread_cond_destroy(&nd_work);
+	pthread_cond_destroy(&nd_turn);
+	pthread_rwlock_destroy(&nd_storage_lock);
 
 	// Return, no return code
 	return;
@@ -169,8 +185,9 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 	bfsSecAssociation *sa;
 	unsigned short did;
 	uint64_t devsz;
-	bool found;
+	bool found, shmListen = false;
 	int i;
+	double start = device_time_us(), storage_time;
 
 	// Pull the configurations
 	try {
@@ -248,6 +265,7 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 				}
 
 				sa = new bfsSecAssociation(sacfg);
+				sa->setIVContext(true);
 				setSecurityAssociation(sa);
 				found = true;
 			}
@@ -276,6 +294,7 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 					bfsCfgError("Cannot find SA configuration");
 				}
 				sa = new bfsSecAssociation(sacfg);
+				sa->setIVContext(true);
 				setSecurityAssociation(sa);
 
 				// Now get and set the port
@@ -284,6 +303,10 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 				}
 				commPort = (unsigned short)portcfg->bfsCfgItemValueLong();
 
+				// Clients on this host may connect over shared memory
+				shmListen = (devcfg->getSubItemByName("ip")->bfsCfgItemValue() ==
+							 BFS_NETCONN_SHM_ADDRESS);
+
 				// Now get and set the size (in blocks)
 				if ((szcfg = devcfg->getSubItemByName("size")) == NULL) {
 					bfsCfgError("Cannot find port configuration");
@@ -294,6 +317,11 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 				found = true;
 			}
 		}
+
+		// Get the number of worker threads processing the requests
+		nd_nworkers = (int)bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG)
+						  ->getSubItemByName("worker_threads")
+						  ->bfsCfgItemValueLong();
 #endif
 
 		// If we have not found the configuration, bail out
@@ -309,7 +337,9 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 	}
 
 	// Create the storage device
+	storage_time = device_time_us();
 	storage = new bfsDeviceStorage(deviceID, devsz);
+	storage_time = device_time_us() - storage_time;
 
 	// Now setup the server connection
 	serverConn = bfsNetworkConnection::bfsChannelFactory(commPort);
@@ -334,9 +364,32 @@ int bfsNetworkDevice::bfsNetworkDeviceInitialize(void) {
 	serverMux = new bfsConnectionMux();
 	serverMux->addConnection(serverConn);
 
-	// Return successfully
+	// Also listen over shared memory (if configured)
+	if (shmListen) {
+		shmServerConn = bfsNetworkConnection::bfsChannelFactory(commPort, true);
+		if ((shmServerConn == NULL) || shmServerConn->connect()) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Shared memory listen failed, aborting.");
+			changeDeviceState(BFSDEV_ERRORED);
+			return (-1);
+		}
+		serverMux->addConnection(shmServerConn);
+	}
+
+	// Start the workers processing the requests
+	if (startWorkers(sacfg)) {
+		logMessage(LOG_ERROR_LEVEL, "Device workers failed to start, aborting.");
+		changeDeviceState(BFSDEV_ERRORED);
+		return (-1);
+	}
+
+	// Return successfully (reporting the bring-up time)
 	logMessage(DEVICE_LOG_LEVEL,
 			   "Network device storage initialized [did=%lu].", deviceID);
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Network device [did=%lu] up in %.3f ms (storage %.3f ms)",
+			   deviceID, (device_time_us() - start) / 1000.0,
+			   storage_time / 1000.0);
 	return (0);
 }
 
@@ -355,6 +408,11 @@ int bfsNetworkDevice::bfsNetworkDeviceUninitialize(void) {
 		delete serverConn;
 		serverConn = NULL;
 	}
+	if (shmServerConn != NULL) {
+		shmServerConn->disconnect();
+		delete shmServerConn;
+		shmServerConn = NULL;
+	}
 
 	// Return successfully
 	return (0);
@@ -477,6 +535,30 @@ void bfsNetworkDevice::write_dev_latencies() {
 		"Write latencies device%d (network sends, us, %lu records):\n[%s]\n",
 		deviceID, d_write__net_send_lats.size(),
 		__d_write__net_send_lats.c_str());
+
+	// Log the block cache counters (hits, misses, hit rate, admissions,
+	// rejections, evictions), if the storage caches blocks
+	if ((storage == NULL) || (storage->getCache() == NULL)) {
+		return;
+	}
+	bfs_device_cache_stats_t cst = storage->getCache()->getStats();
+	double hit_rate = (cst.hits + cst.misses > 0)
+						  ? (double)cst.hits / (double)(cst.hits + cst.misses)
+						  : 0.0;
+	std::string __d_cache__stats_fname(getenv("BFS_HOME"));
+	__d_cache__stats_fname += "/benchmarks/micro/output/__d" +
+							  std::to_string(deviceID) + "_cache__stats.csv";
+	std::ofstream __d_cache__stats_f;
+	__d_cache__stats_f.open(__d_cache__stats_fname.c_str(), std::ios::trunc);
+	__d_cache__stats_f << cst.hits << "," << cst.misses << "," << hit_rate
+					   << "," << cst.admitted << "," << cst.rejected << ","
+					   << cst.evicted;
+	__d_cache__stats_f.close();
+	logMessage(DEVICE_LOG_LEVEL,
+			   "Cache device%d (%lu blocks): %lu hits, %lu misses (hit rate "
+			   "%.3f), %lu admitted, %lu rejected, %lu evicted\n",
+			   deviceID, storage->getCache()->getCapacity(), cst.hits,
+			   cst.misses, hit_rate, cst.admitted, cst.rejected, cst.evicted);
 }
 
 /**
@@ -490,17 +572,24 @@ int bfsNetworkDevice::processCommunications(void) {
 
 	// Local variables
 	bfsNetworkConnection *client;
+	bfs_device_conn_t *conn;
 	bfsConnectionList ready;
 	bfsConnectionList::iterator it;
 	bfsFlexibleBuffer buf;
 
+	// Receive into a block sized (pooled) buffer, so block requests neither
+	// allocate from the heap nor reallocate
+	buf.resizeAllocation(BFS_BLOCK_HEADROOM, 0, BLK_SZ + BFS_BLOCK_TAILROOM);
+
 	// Wait for incoming data
 	if (serverMux->waitConnections(ready, 0)) {
 		logMessage(LOG_ERROR_LEVEL,
 				   "Mux wait failed, aborting device processing.");
 
-		// otherwise it was a signal caught indicating to shutdown, so
-		// just log and write the perf results to a file
+		// otherwise it was a signal caught indicating to shutdown, so let the
+		// workers finish the queued requests, log and write the perf results
+		// to a file
+		stopWorkers();
 		if (bfsUtilLayer::perf_test())
 			write_dev_latencies();
 
@@ -516,6 +605,9 @@ int bfsNetworkDevice::processCommunications(void) {
 			// Accept the connection, add to the mux
 			if ((client = it->second->accept()) != NULL) {
 				serverMux->addConnection(client);
+				conn = new bfs_device_conn_t();
+				conn->client = client;
+				nd_conns[client->getSocket()] = conn;
 				logMessage(DEVICE_LOG_LEVEL,
 						   "Accepted new client connection [%d]",
 						   client->getSocket());
@@ -528,6 +620,7 @@ int bfsNetworkDevice::processCommunications(void) {
 
 			// Receive the incoming data
 			client = it->second;
+			conn = nd_conns[client->getSocket()];
 			if (client->recvPacketizedBuffer(buf) < 0) {
 				logMessage(LOG_ERROR_LEVEL,
 						   "Client request recv failed, abort.");
@@ -539,14 +632,29 @@ int bfsNetworkDevice::processCommunications(void) {
 				// Socket closed, cleanup
 				logMessage(DEVICE_LOG_LEVEL,
 						   "Connection [%d] closed, cleaning up.", it->first);
-				serverMux->removeConnection(client);
-				delete client;
+				closeClient(conn);
 				return (0);
 			}
 
-			// Process the packet (this is the actual protocol layer)
-			if (processClientRequest(client, buf) == -1) {
-				return (-1);
+			// The first packet on a connection agrees its epoch, the rest
+			// are requests (this is the actual protocol layer).  A client
+			// sending a bad (e.g., replayed) packet is dropped.
+			if (!conn->has_epoch) {
+				if (bfsDeviceLayer::acceptDeviceEpoch(client, buf,
+													  conn->epoch)) {
+					logMessage(LOG_ERROR_LEVEL,
+							   "Connection [%d] epoch failed, dropping.",
+							   it->first);
+					closeClient(conn);
+					return (0);
+				}
+				conn->has_epoch = true;
+			} else if (dispatchClientRequest(conn, buf) == -1) {
+				logMessage(LOG_ERROR_LEVEL,
+						   "Connection [%d] request failed, dropping.",
+						   it->first);
+				closeClient(conn);
+				return (0);
 			}
 		} else {
 			// Super weird case where the connection is corrupted/uninitialized
@@ -560,57 +668,232 @@ int bfsNetworkDevice::processCommunications(void) {
 	return (0);
 }
 
+/**
+ * @brief Close a client connection, forgetting it.  It is released here, or
+ * by the worker finishing its last queued request.
+ *
+ * @param conn - the client connection to close
+ * @return none
+ */
+
+void bfsNetworkDevice::closeClient(bfs_device_conn_t *conn) {
+
+	// Local variables
+	bool release;
+
+	// Remove from the mux, forget the connection
+	serverMux->removeConnection(conn->client);
+	nd_conns.erase(conn->client->getSocket());
+
+	// Release it unless the workers still have requests from it
+	pthread_mutex_lock(&nd_lock);
+	conn->closed = true;
+	release = (conn->inflight == 0);
+	pthread_mutex_unlock(&nd_lock);
+	if (release) {
+		releaseClient(conn);
+	}
+	return;
+}
+
+/**
+ * @brief Disconnect and release a closed client connection
+ *
+ * @param conn - the client connection to release
+ * @return none
+ */
+
+void bfsNetworkDevice::releaseClient(bfs_device_conn_t *conn) {
+	conn->client->disconnect();
+	delete conn->client;
+	delete conn;
+	return;
+}
+
+/**
+ * @brief Check the tag of a client request, then process it (or queue it for
+ * the workers, taking its data)
+ *
+ * @param conn - the client connection the request was received on
+ * @param buf - the received packet/buffer
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsNetworkDevice::dispatchClientRequest(bfs_device_conn_t *conn,
+											bfsFlexibleBuffer &buf) {
+
+	// Local variables
+	bfs_device_job_t job;
+	bfs_device_tag_t tag;
+	bool failed;
+
+	// Pull the request tag, it must increase on the connection (no replays)
+	if (buf.getLength() < sizeof(bfs_device_tag_t)) {
+		logMessage(LOG_ERROR_LEVEL, "Device request too short, abort.");
+		return (-1);
+	}
+	buf >> tag;
+	if (tag <= conn->last_tag) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device request tag replayed/out of order [%lu], abort.",
+				   tag);
+		return (-1);
+	}
+	conn->last_tag = tag;
+
+	// Without workers, process it here
+	if (nd_nworkers == 0) {
+		return (processClientRequest(conn, tag, buf));
+	}
+
+	// Otherwise queue it (unless an earlier request on it failed)
+	job.conn = conn;
+	job.buf = new bfsFlexibleBuffer();
+	job.buf->swapData(buf);
+	job.tag = tag;
+	job.seq = conn->next_seq++;
+	pthread_mutex_lock(&nd_lock);
+	if (!(failed = conn->failed)) {
+		conn->inflight++;
+		nd_jobs.push_back(job);
+		pthread_cond_signal(&nd_work);
+	}
+	pthread_mutex_unlock(&nd_lock);
+	if (failed) {
+		delete job.buf;
+		return (-1);
+	}
+
+	// Get the buffer ready for the next request, return successfully
+	buf.resizeAllocation(BFS_BLOCK_HEADROOM, 0, BLK_SZ + BFS_BLOCK_TAILROOM);
+	return (0);
+}
+
 /**
  * @brief Process the client request (respond as needed)
  *
- * @param client - the client we are responding to
+ * @param conn - the client connection we are responding to
+ * @param tag - the request tag
  * @param buf - the received packet/buffer
  * @return int : 0 is success, -1 is failure
  */
 
-int bfsNetworkDevice::processClientRequest(bfsNetworkConnection *client,
+int bfsNetworkDevice::processClientRequest(bfs_device_conn_t *conn,
+										   bfs_device_tag_t tag,
 										   bfsFlexibleBuffer &buf) {
 
-	// Create the request for the remote device information
-	bfs_blockid_list_t manifest;
-	bfs_blockid_list_t::iterator mit;
+	// Local variables
 	bfs_uid_t usr;
 	bfs_device_id_t did;
 	bfs_device_msg_t cmd;
-	bfs_block_id_t blkid;
-	bfsConnectionList ready;
-	bfs_device_topo_t topo;
-	string blist, msg;
-	char bbuf[128];
-	size_t i, sz;
-	bool ack;
-	double d_start_time = 0.0, d_end_time = 0.0, net_send_start_time = 0.0,
+	double d_start_time = 0.0, net_send_start_time = 0.0,
 		   net_send_end_time = 0.0;
 
 	if (bfsUtilLayer::perf_test())
-		d_start_time =
-			(double)std::chrono::time_point_cast<std::chrono::microseconds>(
-				std::chrono::high_resolution_clock::now())
-				.time_since_epoch()
-				.count();
+		d_start_time = device_time_us();
+
+	// Unmarshal the request, access the storage
+	if (unpackClientRequest(conn, secContext, tag, buf, usr, did, cmd) ||
+		executeClientRequest(cmd, did, buf)) {
+		return (-1);
+	}
+
+	if (bfsUtilLayer::perf_test())
+		net_send_start_time = device_time_us();
+
+	// Send the packet (tagged with the request tag)
+	if ((bfsDeviceLayer::marshalBfsDevicePacket(usr, did, cmd, 1, secContext,
+												conn->epoch, tag, buf) == -1) ||
+		((size_t)conn->client->sendPacketizedBuffer(buf) != buf.getLength())) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device response failed to marshal/send, abort.");
+		return (-1);
+	}
+
+	if (bfsUtilLayer::perf_test()) {
+		net_send_end_time = device_time_us();
+		record_dev_latencies(cmd, d_start_time, net_send_start_time,
+							 net_send_end_time, device_time_us());
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Unmarshal and sanity check a client request
+ *
+ * @param conn - the client connection the request was received on
+ * @param sa - the security association to decrypt it with
+ * @param tag - the request tag
+ * @param buf - the received packet/buffer (the request data after)
+ * @param usr - the requesting user
+ * @param did - the device the request is for
+ * @param cmd - the request command
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsNetworkDevice::unpackClientRequest(bfs_device_conn_t *conn,
+										  bfsSecAssociation *sa,
+										  bfs_device_tag_t tag,
+										  bfsFlexibleBuffer &buf,
+										  bfs_uid_t &usr, bfs_device_id_t &did,
+										  bfs_device_msg_t &cmd) {
+
+	// Local variables
+	bool ack;
 
 	// Unmarshal the data, sanity check it, log it
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, nd_recv_seq, buf) == -1) ||
+	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(usr, did, cmd, ack, sa,
+												  conn->epoch, tag,
+												  buf) == -1) ||
 		(usr != 1) || (ack != 0)) {
 		logMessage(LOG_ERROR_LEVEL,
 				   "Device unmarshal network data failed, abort.");
 		return (-1);
 	}
-	nd_recv_seq++;
 	logMessage(DEVICE_VRBLOG_LEVEL, "Message [%s] received from user [%lu]",
 			   bfsDeviceLayer::getDeviceMsgStr(cmd), usr);
 
-	// Sanity check the data
-	if (ack != 0) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Device request ack flag bad, aborting request.");
-		return (-1);
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Access the storage for a client request, leaving the response data
+ * in the buffer.  Puts exclude the storage accesses of other connections
+ * (gets share them), so a block is never read or written partially written.
+ *
+ * @param cmd - the request command
+ * @param did - the device the request is for (the device, for topology)
+ * @param buf - the request data (the response data after)
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsNetworkDevice::executeClientRequest(bfs_device_msg_t cmd,
+										   bfs_device_id_t &did,
+										   bfsFlexibleBuffer &buf) {
+
+	// Local variables
+	bfs_blockid_list_t manifest;
+	bfs_blockid_list_t::iterator mit;
+	vector<bfs_block_extent_t> exts;
+	vector<char *> blks;
+	bfs_block_id_t blkid;
+	bfs_device_topo_t topo;
+	string msg;
+	char bbuf[128], *rsp;
+	size_t i, sz, hdr;
+	uint64_t nblks;
+	int ret = 0;
+
+	// Lock the storage for the request (a flush only needs the puts before
+	// it to be done, so it can run alongside the reads)
+	if ((cmd == BFS_DEVICE_PUT_BLOCK) || (cmd == BFS_DEVICE_PUT_BLOCKS) ||
+		(cmd == BFS_DEVICE_PUT_BLOCK_FUA) || (cmd == BFS_DEVICE_TRIM_BLOCKS) ||
+		(cmd == BFS_DEVICE_PUT_EXTENTS)) {
+		pthread_rwlock_wrlock(&nd_storage_lock);
+	} else {
+		pthread_rwlock_rdlock(&nd_storage_lock);
 	}
 
 	// Now switch on the type of request being sent by the remote requestor
@@ -620,7 +903,8 @@ int bfsNetworkDevice::processClientRequest(bfsNetworkConnection *client,
 		if (buf.getLength() != 0) {
 			logMessage(LOG_ERROR_LEVEL, "Bad length in topology request. [%u]",
 					   buf.getLength());
-			return (-1);
+			ret = -1;
+			break;
 		}
 		memset(&topo, 0x0, sizeof(bfs_device_topo_t));
 		did = topo.did = deviceID;
@@ -632,59 +916,88 @@ int bfsNetworkDevice::processClientRequest(bfsNetworkConnection *client,
 		if (buf.getLength() != sizeof(bfs_block_id_t)) {
 			logMessage(LOG_ERROR_LEVEL, "Bad length in device get block. [%u]",
 					   buf.getLength());
-			return (-1);
+			ret = -1;
+			break;
 		}
 		if (did != deviceID) {
 			logMessage(LOG_ERROR_LEVEL,
 					   "Device ID mismatch in device get block. [%lu!=%lu]",
 					   did, deviceID);
-			return (-1);
+			ret = -1;
+			break;
 		}
 		blkid = *(bfs_block_id_t *)buf.getBuffer();
-		buf.resetWithAlloc(BLK_SZ);
+		buf.resetWithAlloc(BLK_SZ, 0x0, BFS_BLOCK_HEADROOM,
+						   BFS_BLOCK_TAILROOM);
 		getBlock(blkid, buf.getBuffer());
 		buf << blkid;
 		break;
 
-	case BFS_DEVICE_PUT_BLOCK: // Put a block into the device
+	case BFS_DEVICE_PUT_BLOCK:	  // Put a block into the device
+	case BFS_DEVICE_PUT_BLOCK_FUA: // (durable before the response)
 		if (buf.getLength() != sizeof(bfs_block_id_t) + BLK_SZ) {
 			logMessage(LOG_ERROR_LEVEL, "Bad length in device put block. [%u]",
 					   buf.getLength());
-			return (-1);
+			ret = -1;
+			break;
 		}
 		if (did != deviceID) {
 			logMessage(LOG_ERROR_LEVEL,
 					   "Device ID mismatch in device get block. [%lu!=%lu]",
 					   did, deviceID);
-			return (-1);
+			ret = -1;
+			break;
 		}
 		buf >> blkid;
-		putBlock(blkid, buf.getBuffer());
+		if (storage->putBlock(blkid, buf.getBuffer(),
+							  cmd == BFS_DEVICE_PUT_BLOCK_FUA) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "Device put block failed [%lu].",
+					   blkid);
+			ret = -1;
+			break;
+		}
 		buf.setData((char *)&blkid, sizeof(bfs_block_id_t));
 		break;
 
 	case BFS_DEVICE_GET_BLOCKS: // Get a set of blocks from the device
 		// Walk and get the block identifiers
 		buf >> sz;
+		if (buf.getLength() != sizeof(bfs_block_id_t) * sz) {
+			logMessage(LOG_ERROR_LEVEL, "Bad length in device get blocks. [%u]",
+					   buf.getLength());
+			ret = -1;
+			break;
+		}
 		for (i = 0; i < sz; i++) {
 			buf >> blkid;
 			manifest.push_back(blkid);
 		}
 
-		// Now setup the response
-		buf.burn();
-		buf << sz;
+		// Now setup the response (sized up front), and read the blocks into
+		// it as one batch
+		buf.resetWithAlloc((bfs_size_t)(sizeof(size_t) +
+										(sizeof(bfs_block_id_t) + BLK_SZ) * sz),
+						   0x0, BFS_BLOCK_HEADROOM, BFS_BLOCK_TAILROOM);
+		rsp = buf.getBuffer();
+		memcpy(rsp, &sz, sizeof(size_t));
+		rsp += sizeof(size_t);
 		for (mit = manifest.begin(); mit != manifest.end(); mit++) {
-			buf.addTrailer(*mit);
-			buf.addTrailer(storage->directBlockAccess(*mit), BLK_SZ);
+			memcpy(rsp, &(*mit), sizeof(bfs_block_id_t));
+			blks.push_back(rsp + sizeof(bfs_block_id_t));
+			rsp += sizeof(bfs_block_id_t) + BLK_SZ;
+		}
+		if (storage->getBlocks(manifest.data(), (uint32_t)sz, blks.data())) {
+			logMessage(LOG_ERROR_LEVEL, "Device get blocks failed.");
+			ret = -1;
+			break;
 		}
 
 		// Log, possibly list blocks
 		if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
 			msg = "";
-			for (mit = manifest.begin(); mit != manifest.end(); mit++) {
-				bufToString(storage->directBlockAccess(*mit), 2, bbuf, 128);
-				msg += " : " + to_string(*mit) + " (" + bbuf + ")";
+			for (i = 0; i < sz; i++) {
+				bufToString(blks[i], 2, bbuf, 128);
+				msg += " : " + to_string(manifest[i]) + " (" + bbuf + ")";
 			}
 		}
 		logMessage(DEVICE_LOG_LEVEL,
@@ -693,94 +1006,419 @@ int bfsNetworkDevice::processClientRequest(bfsNetworkConnection *client,
 		break;
 
 	case BFS_DEVICE_PUT_BLOCKS: // Put a set of blocks into the device
-		// Walk and put the blocks
+		// Walk the blocks, put them as one batch
 		buf >> sz;
+		if (buf.getLength() != (sizeof(bfs_block_id_t) + BLK_SZ) * sz) {
+			logMessage(LOG_ERROR_LEVEL, "Bad length in device put blocks. [%u]",
+					   buf.getLength());
+			ret = -1;
+			break;
+		}
+		rsp = buf.getBuffer();
 		for (i = 0; i < sz; i++) {
-			buf >> blkid;
-			buf.removeHeader(storage->directBlockAccess(blkid), BLK_SZ);
+			memcpy(&blkid, rsp, sizeof(bfs_block_id_t));
 			manifest.push_back(blkid);
+			blks.push_back(rsp + sizeof(bfs_block_id_t));
+			rsp += sizeof(bfs_block_id_t) + BLK_SZ;
 		}
-
-		// Now setup the response
-		buf.burn();
-		buf << sz;
-		for (mit = manifest.begin(); mit != manifest.end(); mit++) {
-			buf.addTrailer(*mit);
+		if (storage->putBlocks(manifest.data(), (uint32_t)sz, blks.data())) {
+			logMessage(LOG_ERROR_LEVEL, "Device put blocks failed.");
+			ret = -1;
+			break;
 		}
 
 		// Log, possibly list blocks
 		if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
 			msg = "";
-			for (mit = manifest.begin(); mit != manifest.end(); mit++) {
-				bufToString(storage->directBlockAccess(*mit), 2, bbuf, 128);
-				msg += " : " + to_string(*mit) + " (" + bbuf + ")";
+			for (i = 0; i < sz; i++) {
+				bufToString(blks[i], 2, bbuf, 128);
+				msg += " : " + to_string(manifest[i]) + " (" + bbuf + ")";
 			}
 		}
 		logMessage(DEVICE_LOG_LEVEL, "Server requesting (put blocks) %u%s", sz,
 				   msg.c_str());
+
+		// Now setup the response (dropping the blocks put)
+		buf.burn();
+		buf.resetWithAlloc(0, 0x0, BFS_BLOCK_HEADROOM, BFS_BLOCK_TAILROOM);
+		buf << sz;
+		for (mit = manifest.begin(); mit != manifest.end(); mit++) {
+			buf.addTrailer(*mit);
+		}
+		break;
+
+	case BFS_DEVICE_GET_EXTENTS: // Get a set of runs of blocks
+	case BFS_DEVICE_PUT_EXTENTS: // Put a set of runs of blocks
+		// Pull out the extents, sanity check the number of blocks
+		buf >> sz;
+		if ((did != deviceID) || (sz == 0) ||
+			(sz > buf.getLength() / sizeof(bfs_block_extent_t))) {
+			logMessage(LOG_ERROR_LEVEL, "Bad device extents request. [%u]",
+					   buf.getLength());
+			ret = -1;
+			break;
+		}
+		hdr = sizeof(bfs_block_extent_t) * sz;
+		exts.resize(sz);
+		memcpy(exts.data(), buf.getBuffer(), hdr);
+		for (i = 0, nblks = 0; (ret == 0) && (i < sz); i++) {
+			nblks += exts[i].count;
+			if ((exts[i].count > storage->getNumBlocks()) ||
+				(nblks > storage->getNumBlocks())) {
+				ret = -1;
+			}
+		}
+		if ((ret) ||
+			(buf.getLength() !=
+			 hdr + ((cmd == BFS_DEVICE_PUT_EXTENTS) ? nblks * BLK_SZ : 0))) {
+			logMessage(LOG_ERROR_LEVEL, "Bad length in device %s. [%u]",
+					   bfsDeviceLayer::getDeviceMsgStr(cmd), buf.getLength());
+			ret = -1;
+			break;
+		}
+
+		// Get the runs straight into the response (after the extents), or
+		// put them straight from the request
+		if (cmd == BFS_DEVICE_GET_EXTENTS) {
+			buf.resetWithAlloc((bfs_size_t)(sizeof(size_t) + hdr +
+											nblks * BLK_SZ),
+							   0x0, BFS_BLOCK_HEADROOM, BFS_BLOCK_TAILROOM);
+			rsp = buf.getBuffer();
+			memcpy(rsp, &sz, sizeof(size_t));
+			memcpy(rsp + sizeof(size_t), exts.data(), hdr);
+			ret = storage->getExtents(exts.data(), (uint32_t)sz,
+									  rsp + sizeof(size_t) + hdr);
+		} else {
+			ret = storage->putExtents(exts.data(), (uint32_t)sz,
+									  buf.getBuffer() + hdr);
+			buf.burn();
+			buf.resetWithAlloc(0, 0x0, BFS_BLOCK_HEADROOM, BFS_BLOCK_TAILROOM);
+			buf << sz;
+			buf.addTrailer((char *)exts.data(), (bfs_size_t)hdr);
+		}
+		if (ret) {
+			logMessage(LOG_ERROR_LEVEL, "Device %s failed.",
+					   bfsDeviceLayer::getDeviceMsgStr(cmd));
+			break;
+		}
+		logMessage(DEVICE_LOG_LEVEL,
+				   "Server requesting (%s) %u extents, %lu blocks",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd), sz, nblks);
+		break;
+
+	case BFS_DEVICE_FLUSH: // Make the blocks put so far durable
+		if ((buf.getLength() != 0) || (did != deviceID)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad device flush request. [%u, %lu]",
+					   buf.getLength(), did);
+			ret = -1;
+			break;
+		}
+		if (storage->flushStorage()) {
+			logMessage(LOG_ERROR_LEVEL, "Device flush failed.");
+			ret = -1;
+			break;
+		}
+		logMessage(DEVICE_LOG_LEVEL, "Server requesting flush of device");
+		break;
+
+	case BFS_DEVICE_TRIM_BLOCKS: // Discard a set of blocks
+		buf >> sz;
+		if ((buf.getLength() != sizeof(bfs_block_id_t) * sz) ||
+			(did != deviceID)) {
+			logMessage(LOG_ERROR_LEVEL, "Bad device trim blocks request. [%u]",
+					   buf.getLength());
+			ret = -1;
+			break;
+		}
+		if (storage->trimBlocks((bfs_block_id_t *)buf.getBuffer(),
+								(uint32_t)sz)) {
+			logMessage(LOG_ERROR_LEVEL, "Device trim blocks failed.");
+			ret = -1;
+			break;
+		}
+		logMessage(DEVICE_LOG_LEVEL, "Server requesting (trim blocks) %u", sz);
+		buf.setData((char *)&sz, sizeof(size_t));
 		break;
 
 	default: // Unknown command
 		logMessage(LOG_ERROR_LEVEL,
 				   "Unknown command received from remote user [%d], error.",
 				   cmd);
-		return (-1);
+		ret = -1;
+		break;
 	}
 
+	// Unlock the storage, return the status
+	pthread_rwlock_unlock(&nd_storage_lock);
+	return (ret);
+}
+
+/**
+ * @brief Process a queued client request (on a worker).  The request is
+ * unmarshalled and its response marshalled in parallel with the other
+ * workers, while the storage accesses and the responses take turns in the
+ * order the requests were received on the connection.  A failed request
+ * fails the rest queued on its connection, and shuts the connection down so
+ * the dispatcher drops it.
+ *
+ * @param job - the queued request
+ * @param sa - the worker's security association
+ * @return none
+ */
+
+void bfsNetworkDevice::processJob(bfs_device_job_t &job,
+								  bfsSecAssociation *sa) {
+
+	// Local variables
+	bfs_device_conn_t *conn = job.conn;
+	bfs_uid_t usr;
+	bfs_device_id_t did;
+	bfs_device_msg_t cmd;
+	bool ok, release;
+	double d_start_time = 0.0, net_send_start_time = 0.0,
+		   net_send_end_time = 0.0;
+
 	if (bfsUtilLayer::perf_test())
-		net_send_start_time =
-			(double)std::chrono::time_point_cast<std::chrono::microseconds>(
-				std::chrono::high_resolution_clock::now())
-				.time_since_epoch()
-				.count();
+		d_start_time = device_time_us();
+
+	// Unmarshal the request, access the storage in turn
+	ok = (unpackClientRequest(conn, sa, job.tag, *job.buf, usr, did, cmd) == 0);
+	ok = waitTurn(conn, conn->next_exec, job.seq) && ok &&
+		 (executeClientRequest(cmd, did, *job.buf) == 0);
+	pthread_mutex_lock(&nd_lock);
+	failConnection(conn, ok);
+	conn->next_exec++;
+	pthread_cond_broadcast(&nd_turn);
+	pthread_mutex_unlock(&nd_lock);
+
+	// Marshal the response, send it in turn
+	ok = ok && (bfsDeviceLayer::marshalBfsDevicePacket(usr, did, cmd, 1, sa,
+													   conn->epoch, job.tag,
+													   *job.buf) == 0);
+	ok = waitTurn(conn, conn->next_send, job.seq) && ok;
+	if (bfsUtilLayer::perf_test())
+		net_send_start_time = device_time_us();
+	if (ok && ((size_t)conn->client->sendPacketizedBuffer(*job.buf) !=
+			   job.buf->getLength())) {
+		logMessage(LOG_ERROR_LEVEL, "Device response failed to send, abort.");
+		ok = false;
+	}
+	if (ok && bfsUtilLayer::perf_test()) {
+		net_send_end_time = device_time_us();
+		record_dev_latencies(cmd, d_start_time, net_send_start_time,
+							 net_send_end_time, device_time_us());
+	}
 
-	// Send the packet
-	if ((bfsDeviceLayer::marshalBfsDevicePacket(usr, did, cmd, 1, secContext,
-												nd_send_seq, buf) == -1) ||
-		((size_t)client->sendPacketizedBuffer(buf) != buf.getLength())) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Device response failed to marshal/send, abort.");
-		return (-1);
+	// Finish the request
+	pthread_mutex_lock(&nd_lock);
+	failConnection(conn, ok);
+	conn->next_send++;
+	conn->inflight--;
+	release = (conn->closed && (conn->inflight == 0));
+	pthread_cond_broadcast(&nd_turn);
+	pthread_mutex_unlock(&nd_lock);
+	delete job.buf;
+
+	// Release the connection if the dispatcher closed it (and this was last)
+	if (release) {
+		releaseClient(conn);
 	}
-	nd_send_seq++;
+	return;
+}
 
-	if (bfsUtilLayer::perf_test()) {
-		net_send_end_time =
-			(double)std::chrono::time_point_cast<std::chrono::microseconds>(
-				std::chrono::high_resolution_clock::now())
-				.time_since_epoch()
-				.count();
-		d_read__net_send_lats.push_back(net_send_end_time -
-										net_send_start_time);
+/**
+ * @brief Fail a connection (once) if its request failed, shutting it down so
+ * the dispatcher drops it.  Called with the lock held.
+ *
+ * @param conn - the client connection of the request
+ * @param ok - flag indicating the request succeeded
+ * @return none
+ */
+
+void bfsNetworkDevice::failConnection(bfs_device_conn_t *conn, bool ok) {
+	if ((!ok) && (!conn->failed)) {
+		logMessage(LOG_ERROR_LEVEL, "Connection [%d] request failed, dropping.",
+				   conn->client->getSocket());
+		conn->client->shutdown();
+		conn->failed = true;
+	}
+	return;
+}
+
+/**
+ * @brief Wait for a queued request's turn on its connection
+ *
+ * @param conn - the client connection of the request
+ * @param next - the connection's next request to take the turn
+ * @param seq - the order of the request on the connection
+ * @return bool : true if the connection has not failed, false otherwise
+ */
+
+bool bfsNetworkDevice::waitTurn(bfs_device_conn_t *conn, uint64_t &next,
+								uint64_t seq) {
+
+	// Local variables
+	bool ok;
+
+	pthread_mutex_lock(&nd_lock);
+	while (next != seq) {
+		pthread_cond_wait(&nd_turn, &nd_lock);
 	}
+	ok = !conn->failed;
+	pthread_mutex_unlock(&nd_lock);
+	return (ok);
+}
 
-	if (bfsUtilLayer::perf_test()) {
-		d_end_time =
-			(double)std::chrono::time_point_cast<std::chrono::microseconds>(
-				std::chrono::high_resolution_clock::now())
-				.time_since_epoch()
-				.count();
-
-		switch (cmd) {
-		case BFS_DEVICE_GET_BLOCK:
-			d_read__net_send_lats.push_back(net_send_end_time -
-											net_send_start_time);
-			d_read__d_lats.push_back((d_end_time - d_start_time) -
-									 (net_send_end_time - net_send_start_time));
-			d_read__lats.push_back(d_end_time - d_start_time);
-			break;
-		case BFS_DEVICE_PUT_BLOCK:
-			d_write__net_send_lats.push_back(net_send_end_time -
-											 net_send_start_time);
-			d_write__d_lats.push_back(
-				(d_end_time - d_start_time) -
-				(net_send_end_time - net_send_start_time));
-			d_write__lats.push_back(d_end_time - d_start_time);
-			break;
-		default:
+/**
+ * @brief The body of a worker thread, processing the queued requests until
+ * the workers are stopped (and the queue is drained)
+ *
+ * @param arg - the worker
+ * @return void * : NULL
+ */
+
+void *bfsNetworkDevice::workerThread(void *arg) {
+
+	// Local variables
+	bfs_device_worker_t *worker = (bfs_device_worker_t *)arg;
+	bfsNetworkDevice *dev = worker->device;
+	bfs_device_job_t job;
+
+	pthread_mutex_lock(&dev->nd_lock);
+	while (true) {
+		while (dev->nd_jobs.empty() && !dev->nd_stopping) {
+			pthread_cond_wait(&dev->nd_work, &dev->nd_lock);
+		}
+		if (dev->nd_jobs.empty()) {
 			break;
 		}
+		job = dev->nd_jobs.front();
+		dev->nd_jobs.pop_front();
+		pthread_mutex_unlock(&dev->nd_lock);
+		dev->processJob(job, worker->sa);
+		pthread_mutex_lock(&dev->nd_lock);
 	}
+	pthread_mutex_unlock(&dev->nd_lock);
+	return (NULL);
+}
+
+/**
+ * @brief Start the worker threads, each with its own security association
+ * (the associations keep cipher state, so are not shared).  The workers leave
+ * the signals to the dispatcher.
+ *
+ * @param sacfg - the configuration of the device's security association
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsNetworkDevice::startWorkers(bfsCfgItem *sacfg) {
 
+	// Local variables
+	sigset_t sigs, oldsigs;
+	int i;
+
+	// Create the workers with the signals blocked
+	nd_workers.resize(nd_nworkers);
+	sigfillset(&sigs);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	for (i = 0; i < nd_nworkers; i++) {
+		nd_workers[i].device = this;
+		nd_workers[i].sa = new bfsSecAssociation(sacfg);
+		nd_workers[i].sa->setIVContext(true); // Replies on many connections
+		if (pthread_create(&nd_workers[i].thread, NULL, workerThread,
+						   &nd_workers[i])) {
+			logMessage(LOG_ERROR_LEVEL, "Failed creating device worker [%d]",
+					   i);
+			delete nd_workers[i].sa;
+			nd_workers.resize(i);
+			pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+			return (-1);
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+	// Log, return successfully
+	logMessage(DEVICE_LOG_LEVEL, "Started %d device worker threads.",
+			   nd_nworkers);
 	return (0);
 }
+
+/**
+ * @brief Stop the worker threads (once they have drained the queue)
+ *
+ * @param none
+ * @return none
+ */
+
+void bfsNetworkDevice::stopWorkers(void) {
+
+	// Local variables
+	size_t i;
+
+	// Tell the workers to stop, wait for them
+	pthread_mutex_lock(&nd_lock);
+	nd_stopping = true;
+	pthread_cond_broadcast(&nd_work);
+	pthread_mutex_unlock(&nd_lock);
+	for (i = 0; i < nd_workers.size(); i++) {
+		pthread_join(nd_workers[i].thread, NULL);
+		delete nd_workers[i].sa;
+	}
+	nd_workers.clear();
+	return;
+}
+
+//
+// Module functions
+
+/**
+ * @brief Get the current time (for the perf test latencies)
+ *
+ * @param none
+ * @return double : the time (microseconds)
+ */
+
+static double device_time_us(void) {
+	return ((double)std::chrono::time_point_cast<std::chrono::microseconds>(
+				std::chrono::high_resolution_clock::now())
+				.time_since_epoch()
+				.count());
+}
+
+/**
+ * @brief Record the perf test latencies of a block request (the workers
+ * record them concurrently)
+ *
+ * @param cmd - the request command
+ * @param d_start_time - when the request processing started
+ * @param net_send_start_time - when the response send started
+ * @param net_send_end_time - when the response send ended
+ * @param d_end_time - when the request processing ended
+ * @return none
+ */
+
+static void record_dev_latencies(bfs_device_msg_t cmd, double d_start_time,
+								 double net_send_start_time,
+								 double net_send_end_time, double d_end_time) {
+	pthread_mutex_lock(&d_lats_lock);
+	switch (cmd) {
+	case BFS_DEVICE_GET_BLOCK:
+		d_read__net_send_lats.push_back(net_send_end_time -
+										net_send_start_time);
+		d_read__d_lats.push_back((d_end_time - d_start_time) -
+								 (net_send_end_time - net_send_start_time));
+		d_read__lats.push_back(d_end_time - d_start_time);
+		break;
+	case BFS_DEVICE_PUT_BLOCK:
+	case BFS_DEVICE_PUT_BLOCK_FUA:
+		d_write__net_send_lats.push_back(net_send_end_time -
+										 net_send_start_time);
+		d_write__d_lats.push_back((d_end_time - d_start_time) -
+								  (net_send_end_time - net_send_start_time));
+		d_write__lats.push_back(d_end_time - d_start_time);
+		break;
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&d_lats_lock);
+}
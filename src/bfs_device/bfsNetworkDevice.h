@@ -12,8 +12,14 @@
 //  Created : Wed 17 Mar 2021 03:14:31 PM EDT
 //
 
+// Include files
+#include <pthread.h>
+
 // STL-isms
+#include <deque>
+#include <map>
 #include <string>
+#include <vector>
 using namespace std;
 
 // Project Includes
@@ -31,6 +37,40 @@ using namespace std;
 //
 // Class types
 
+// The state of a client connection.  The dispatcher receives the requests
+// (in order, checking their tags), the workers unmarshal them and marshal the
+// responses in parallel, but take turns (in the order received) to access the
+// storage and to send the responses.
+typedef struct {
+	bfsNetworkConnection *client; // The client connection
+	bfs_device_epoch_t epoch;	  // The epoch agreed with the client
+	bool has_epoch;				  // Flag indicating the epoch is agreed
+	bfs_device_tag_t last_tag;	  // The last request tag received
+	uint64_t next_seq;			  // The order of the next request received
+	uint64_t next_exec;			  // The next request to access the storage
+	uint64_t next_send;			  // The next request to send its response
+	size_t inflight;			  // The requests queued or being processed
+	bool failed;				  // Flag indicating a request failed
+	bool closed;				  // Flag indicating the dispatcher closed it
+} bfs_device_conn_t;
+
+// A client request queued for the workers
+typedef struct {
+	bfs_device_conn_t *conn; // The connection the request arrived on
+	bfsFlexibleBuffer *buf;	 // The request (the response once processed)
+	bfs_device_tag_t tag;	 // The request tag
+	uint64_t seq;			 // The order of the request on the connection
+} bfs_device_job_t;
+
+class bfsNetworkDevice;
+
+// A worker thread (with its own security association, they are not shareable)
+typedef struct {
+	bfsNetworkDevice *device; // The device the worker processes requests for
+	bfsSecAssociation *sa;	  // The worker's security association
+	pthread_t thread;		  // The worker thread
+} bfs_device_worker_t;
+
 //
 // Class Definition
 
@@ -111,10 +151,47 @@ private:
 	int processCommunications(void);
 	// Do the processing for the communications.
 
-	int processClientRequest(bfsNetworkConnection *client,
+	int dispatchClientRequest(bfs_device_conn_t *conn, bfsFlexibleBuffer &buf);
+	// Check a client request's tag, process it (or queue it for the workers)
+
+	int processClientRequest(bfs_device_conn_t *conn, bfs_device_tag_t tag,
 							 bfsFlexibleBuffer &buf);
 	// Process the client request (respond as needed)
 
+	int unpackClientRequest(bfs_device_conn_t *conn, bfsSecAssociation *sa,
+							bfs_device_tag_t tag, bfsFlexibleBuffer &buf,
+							bfs_uid_t &usr, bfs_device_id_t &did,
+							bfs_device_msg_t &cmd);
+	// Unmarshal and sanity check a client request
+
+	int executeClientRequest(bfs_device_msg_t cmd, bfs_device_id_t &did,
+							 bfsFlexibleBuffer &buf);
+	// Access the storage for a request, leaving the response data in buf
+
+	void processJob(bfs_device_job_t &job, bfsSecAssociation *sa);
+	// Process a queued client request (on a worker)
+
+	bool waitTurn(bfs_device_conn_t *conn, uint64_t &next, uint64_t seq);
+	// Wait for a queued request's turn on its connection (false if failed)
+
+	void failConnection(bfs_device_conn_t *conn, bool ok);
+	// Fail (and shut down) a connection if its request failed
+
+	static void *workerThread(void *arg);
+	// The body of a worker thread
+
+	int startWorkers(bfsCfgItem *sacfg);
+	// Start the worker threads (each with an association from the config)
+
+	void stopWorkers(void);
+	// Stop the worker threads (once they have drained the queue)
+
+	void closeClient(bfs_device_conn_t *conn);
+	// Close a client connection (released once its requests are processed)
+
+	void releaseClient(bfs_device_conn_t *conn);
+	// Disconnect and release a closed client connection
+
 	void write_dev_latencies();
 	// Log all the latencies to output files
 
@@ -136,6 +213,9 @@ private:
 	bfsNetworkConnection *serverConn;
 	// This is the server socket waiting for incoming connects().
 
+	bfsNetworkConnection *shmServerConn;
+	// The server for connects() over shared memory (NULL if not listening)
+
 	bfsConnectionMux *serverMux;
 	// This is the multiplexer for the server communications.
 
@@ -145,7 +225,32 @@ private:
 	bfsDeviceStorage *storage;
 	// This is the rate storage interface for the device
 
-	uint32_t nd_send_seq, nd_recv_seq;
+	map<int, bfs_device_conn_t *> nd_conns;
+	// The state of each client connection (by socket)
+
+	int nd_nworkers;
+	// The number of worker threads (0 processes requests on the dispatcher)
+
+	vector<bfs_device_worker_t> nd_workers;
+	// The worker threads
+
+	deque<bfs_device_job_t> nd_jobs;
+	// The requests queued for the workers
+
+	bool nd_stopping;
+	// Flag indicating the workers should exit (once the queue is empty)
+
+	pthread_mutex_t nd_lock;
+	// The lock protecting the queue and the connection turns
+
+	pthread_cond_t nd_work;
+	// Signalled when a request is queued (or the workers stop)
+
+	pthread_cond_t nd_turn;
+	// Signalled when a connection's storage or send turn moves on
+
+	pthread_rwlock_t nd_storage_lock;
+	// Orders the storage accesses of different connections (puts exclusive)
 };
 
 #endif
@@ -8,6 +8,7 @@
 */
 
 /* Include files  */
+#include <atomic>
 #include <string.h>
 
 /* Project include files */
@@ -15,6 +16,9 @@
 #include <bfsRemoteDevice.h>
 #include <bfs_log.h>
 #include <bfs_server.h>
+#ifndef __BFS_ENCLAVE_MODE
+#include <bfsConfigLayer.h>
+#endif
 
 #ifdef __BFS_ENCLAVE_MODE
 #include "bfs_enclave_t.h" /* For ocalls */
@@ -39,6 +43,10 @@ double f_start_time = 0.0, f_end_time = 0.0;
 
 /* Globals  */
 
+// The slot of each thread (picks the connection it sends on), 0 if unassigned
+static thread_local size_t rdThreadSlot = 0;
+static std::atomic<size_t> rdNextThreadSlot(1);
+
 //
 // Class Data
 
@@ -50,13 +58,18 @@ double f_start_time = 0.0, f_end_time = 0.0;
  *
  * @param address - the address to connect to
  * @param port - the port to bind to for incoming connections
+ * @param nconns - the number of connections (0 is the configured number)
  * @return int : 0 is success, -1 is failure
  */
 
-bfsRemoteDevice::bfsRemoteDevice(string address, unsigned short port)
+bfsRemoteDevice::bfsRemoteDevice(string address, unsigned short port,
+								 size_t nconns)
 	: devState(BFSDEV_UKNOWN), deviceID(0), numBlocks(0), commAddress(address),
-	  commPort(port), remoteConn(NULL), remoteMux(NULL), secContext(NULL),
-	  rd_send_seq(0), rd_recv_seq(0) {
+	  commPort(port), remoteMux(NULL), secContext(NULL), secConfig(NULL),
+	  rd_nconns(nconns), rd_record_blocks(BFS_REMOTE_DEV_RECORD_SIZE / BLK_SZ) {
+
+	// Setup the lock for the batch state
+	pthread_mutex_init(&rd_lock, NULL);
 
 	// Return, no return code
 	return;
@@ -70,8 +83,17 @@ bfsRemoteDevice::bfsRemoteDevice(string address, unsigned short port)
 
 bfsRemoteDevice::~bfsRemoteDevice(void) {
 
-	// Clean up the device objects
+	// Clean up the device objects (the first connection uses secContext)
+	for (size_t i = 0; i < rd_conns.size(); i++) {
+		if (rd_conns[i]->sa != secContext) {
+			delete rd_conns[i]->sa;
+		}
+		pthread_mutex_destroy(&rd_conns[i]->lock);
+		delete rd_conns[i];
+	}
+	delete remoteMux;
 	delete secContext;
+	pthread_mutex_destroy(&rd_lock);
 
 	// Return, no return code
 	return;
@@ -87,76 +109,88 @@ bfsRemoteDevice::~bfsRemoteDevice(void) {
 int bfsRemoteDevice::bfsDeviceInitialize(void) {
 
 	// Create the request for the remote device information
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = 0;
-	bfs_device_msg_t cmd;
-	bfsConnectionList ready;
 	bfs_device_topo_t *topo;
+	bfs_remote_conn_t *rc;
+	bfs_device_tag_t tag;
 	bfsFlexibleBuffer buf;
-	bool ack;
-
-	// Now setup the server connection
-	logMessage(DEVICE_LOG_LEVEL,
-			   "Attempting connection to remote device [%s/%d]",
-			   commAddress.c_str(), commPort);
-	remoteConn = bfsNetworkConnection::bfsChannelFactory(commAddress, commPort);
-	if (remoteConn == NULL) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Remote device connection create failed, aborting.");
-		changeDeviceState(BFSDEV_ERRORED);
+	size_t i;
+
+#ifndef __BFS_ENCLAVE_MODE
+	// Get the maximum size of the block data sealed into a record, and the
+	// number of connections to open
+	try {
+		rd_record_blocks = (size_t)bfsConfigLayer::getConfigItem(
+							   BFS_DEVLYR_CONFIG)
+							   ->getSubItemByName("max_record_size")
+							   ->bfsCfgItemValueLong() /
+						   BLK_SZ;
+		if (rd_nconns == 0) {
+			rd_nconns = (size_t)bfsConfigLayer::getConfigItem(BFS_DEVLYR_CONFIG)
+							->getSubItemByName("connections")
+							->bfsCfgItemValueLong();
+		}
+	} catch (bfsCfgError *e) {
+		logMessage(LOG_ERROR_LEVEL, "Failure reading system config : %s",
+				   e->getMessage().c_str());
 		return (-1);
 	}
-
-	// Connect the server for incoming connections
-	if (remoteConn->connect()) {
-		logMessage(LOG_ERROR_LEVEL, "Remote device connect failed, aborting.");
-		changeDeviceState(BFSDEV_ERRORED);
-		return (-1);
+#else
+	if (rd_nconns == 0) {
+		rd_nconns = BFS_REMOTE_DEV_CONNECTIONS;
+	}
+#endif
+	if (rd_record_blocks == 0) {
+		rd_record_blocks = 1;
 	}
 
-	// Create the mux for communication
-	remoteMux = new bfsConnectionMux();
-	remoteMux->addConnection(remoteConn);
-
-	// Marshal the packet
-	if (bfsDeviceLayer::marshalBfsDevicePacket(usr, did, BFS_DEVICE_GET_TOPO, 0,
-											   secContext, rd_send_seq,
-											   buf) == -1) {
-		return (-1);
+	// Bound the connections (each needs a security association of its own)
+	if ((rd_nconns == 0) || (secConfig == NULL)) {
+		rd_nconns = 1;
+	} else if (rd_nconns > BFS_REMOTE_DEV_MAX_CONNS) {
+		rd_nconns = BFS_REMOTE_DEV_MAX_CONNS;
 	}
-	rd_send_seq++;
 
-	// Send the packet
-	if (remoteConn->sendPacketizedBuffer(buf) != (int)buf.getLength()) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Remote device topo request send failed, abort.");
-		return (-1);
+	// Now setup the connections to the device, and the mux for them
+	logMessage(DEVICE_LOG_LEVEL,
+			   "Attempting %lu connection(s) to remote device [%s/%d]",
+			   rd_nconns, commAddress.c_str(), commPort);
+	remoteMux = new bfsConnectionMux();
+	for (i = 0; i < rd_nconns; i++) {
+		rc = new bfs_remote_conn_t;
+		rc->idx = i;
+		rc->conn = NULL;
+		rc->sa = (i == 0) ? secContext : new bfsSecAssociation(secConfig);
+		rc->next_seq = 1;
+		rc->inflight = 0;
+		pthread_mutex_init(&rc->lock, NULL);
+		rd_conns.push_back(rc);
+		if (openConnection(rc)) {
+			changeDeviceState(BFSDEV_ERRORED);
+			return (-1);
+		}
+		remoteMux->addConnection(rc->conn);
 	}
 
-	// Receive the response packet
-	if ((remoteMux->waitConnections(ready, 0)) ||
-		(ready.find(remoteConn->getSocket()) == ready.end()) ||
-		(remoteConn->recvPacketizedBuffer(buf) <= 0)) {
+	// Send the topology request, wait for the response
+	if (((tag = submitRequest(BFS_DEVICE_GET_TOPO, buf, 0)) == 0) ||
+		(waitRequest(tag) != BFS_SUCCESS)) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Remote device topo request recv failed, abort.");
+				   "Remote device topo request send/recv failed, abort.");
 		return (-1);
 	}
 
-	// Unmarshal the data, sanity check it
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, buf) == -1) ||
-		(usr != 1) || (cmd != BFS_DEVICE_GET_TOPO) || (ack != 1) ||
-		(buf.getLength() != sizeof(bfs_device_topo_t))) {
+	// Sanity check the response
+	if (buf.getLength() != sizeof(bfs_device_topo_t)) {
 		logMessage(LOG_ERROR_LEVEL,
 				   "Remote device topo request bad data response, abort.");
 		return (-1);
 	}
-	rd_recv_seq++;
 
 	// Save the data and log it
 	topo = (bfs_device_topo_t *)buf.getBuffer();
 	deviceID = topo->did;
 	numBlocks = topo->nblks;
+	changeDeviceState(BFSDEV_READY);
 	logMessage(DEVICE_LOG_LEVEL,
 			   "Remote device connected (device %lu, %lu blocks).", deviceID,
 			   numBlocks);
@@ -165,6 +199,25 @@ int bfsRemoteDevice::bfsDeviceInitialize(void) {
 	return (0);
 }
 
+/**
+ * @brief Get the number of requests awaiting a response (on all connections)
+ *
+ * @param none
+ * @return size_t : the number of requests
+ */
+
+size_t bfsRemoteDevice::getInflightRequests(void) {
+
+	// Local variables
+	size_t i, inflight = 0;
+
+	// Add up the requests of the connections
+	for (i = 0; i < rd_conns.size(); i++) {
+		inflight += rd_conns[i]->inflight;
+	}
+	return (inflight);
+}
+
 /**
  * @brief De-initialze the device
  *
@@ -174,12 +227,41 @@ int bfsRemoteDevice::bfsDeviceInitialize(void) {
 
 int bfsRemoteDevice::bfsDeviceUninitialize(void) {
 
-	// Cleanup the server socket (close connection, free memory)
-	if (remoteConn != NULL) {
-		remoteConn->disconnect();
-		delete remoteConn;
-		remoteConn = NULL;
+	// Local variables
+	bfsDeviceRequestList::iterator it;
+	bfsDeviceBatchList::iterator bit;
+	bfs_remote_conn_t *rc;
+	size_t i;
+
+	// Drain anything still outstanding, then release the requests
+	if (getInflightRequests() > 0) {
+		waitAllRequests();
+	}
+	for (i = 0; i < rd_conns.size(); i++) {
+		rc = rd_conns[i];
+		pthread_mutex_lock(&rc->lock);
+		for (it = rc->requests.begin(); it != rc->requests.end(); it++) {
+			delete it->second;
+		}
+		rc->requests.clear();
+		rc->inflight = 0;
+
+		// Cleanup the connection (close connection, free memory)
+		if (rc->conn != NULL) {
+			rc->conn->disconnect();
+			delete rc->conn;
+			rc->idx = i;
+		rc->conn = NULL;
+		}
+		pthread_mutex_unlock(&rc->lock);
 	}
+	pthread_mutex_lock(&rd_lock);
+	for (bit = rd_batches.begin(); bit != rd_batches.end(); bit++) {
+		delete bit->second.second;
+	}
+	rd_batches.clear();
+	rd_records.clear();
+	pthread_mutex_unlock(&rd_lock);
 
 	// Return successfully
 	logMessage(DEVICE_LOG_LEVEL, "Remote device disconnected (%lu).", deviceID);
@@ -187,168 +269,203 @@ int bfsRemoteDevice::bfsDeviceUninitialize(void) {
 }
 
 /**
- * @brief Submit an io request to the disk worker (implements block IO
- * transaction semantics). Single threaded for now; so the mux coordinates
- * access between file-worker and disk-worker. Allows both sync and async io
- * submission; where later async may benefit certain server-side optimizations,
- * but we will need to begin attaching request IDs to route them correctly back
- * to file I/Os (ie the related block IO fragements); and implement transaction
- * semantics at file IO level. But for now, we normally need sync io submission
- * on client file I/O requests (ie the related block IOs) to ensure
- * linearizability.
+ * @brief Send a request to the device without waiting for the response.  The
+ * request is sent on the calling thread's connection, tagged with a
+ * per-connection monotonic tag (the connection in its low bits) which is bound
+ * (with the connection epoch) into the packet as AAD and echoed back by the
+ * device, so any number of requests can be outstanding on the connection and
+ * each response is matched (and verified) against its own request. The
+ * response is received into the request buffer, so it must stay live until
+ * the request completes.  If a callback is given it is called (with the
+ * connection lock held) on completion and the request is released; otherwise
+ * call waitRequest() with the tag.
+ * Batch (get/put blocks) buffers are registered for waitBlocks() under the
+ * same lock as the send, so a waiter never sees the tag before the buffer.
  *
- * @param pblk: marshalled request packet containing either outbound request or
- * inbound response message
- * @param sync: flag indicating whether to do a sync or async request
- * @return int BFS_SUCCESS if success, BFS_FAILURE otherwise
+ * @param cmd - the device command to send
+ * @param buf - the request payload (also receives the response)
+ * @param pbid - the physical block (for single block requests)
+ * @param cb - completion callback (NULL if waited on)
+ * @param arg - argument to pass to the callback
+ * @param batch - keep the buffer (by tag) for waitBlocks
+ * @return bfs_device_tag_t : the request tag, 0 is failure
  */
-int bfsRemoteDevice::submit_io(PBfsBlock &pblk, bool sync) {
-	int resp_ready = 0; // 1 OK, 0 WAITING, -1 FAILURE
-	(void)sync;
 
-	// For single- and multi-threaded, handle the request directly in the
-	// current thread
-	bfsConnectionList ready;
+bfs_device_tag_t bfsRemoteDevice::submitRequest(bfs_device_msg_t cmd,
+												bfsFlexibleBuffer &buf,
+												bfs_block_id_t pbid,
+												bfs_device_cb_t cb, void *arg,
+												bool batch) {
 
-	if ((size_t)remoteConn->sendPacketizedBuffer(pblk) != pblk.getLength()) {
-		logMessage(LOG_ERROR_LEVEL, "Get block request send failed, error.");
-		return (-1);
+	// Local variables
+	bfs_remote_conn_t *rc;
+	bfs_device_request_t *req;
+	bfs_device_tag_t tag;
+	bfs_uid_t usr = 1;
+
+	// Refuse requests once a connection has failed (it is out of sync)
+	if ((devState == BFSDEV_ERRORED) || ((rc = getThreadConnection()) == NULL)) {
+		logMessage(DEVICE_LOG_LEVEL,
+				   "Device [%lu] errored, request [%s] refused", deviceID,
+				   bfsDeviceLayer::getDeviceMsgStr(cmd));
+		return (0);
 	}
 
-	// Receive the response packet (quasi-blocking)
-	if (remoteMux->waitConnections(ready, 0) ||
-		(ready.find(remoteConn->getSocket()) == ready.end()) ||
-		(remoteConn->recvPacketizedBuffer(pblk) <= 0)) {
-		logMessage(LOG_ERROR_LEVEL, "Error receiving disk response.");
-		resp_ready = -1; // mark bio as failed
-	} else {
-		resp_ready = 1;
+	// Keep the connection pipeline bounded, reaping responses as needed
+	pthread_mutex_lock(&rc->lock);
+	while (rc->inflight >= BFS_REMOTE_DEV_MAX_INFLIGHT) {
+		if (reapResponse(rc)) {
+			pthread_mutex_unlock(&rc->lock);
+			return (0);
+		}
+	}
+
+	// Marshal and send the packet
+	tag = (rc->next_seq++ << BFS_REMOTE_DEV_CONN_BITS) | rc->idx;
+	if ((bfsDeviceLayer::marshalBfsDevicePacket(usr, deviceID, cmd, 0, rc->sa,
+												rc->epoch, tag, buf) == -1) ||
+		((size_t)rc->conn->sendPacketizedBuffer(buf) != buf.getLength())) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device request [%s] marshal/send failed, error.",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd));
+		changeDeviceState(BFSDEV_ERRORED);
+		pthread_mutex_unlock(&rc->lock);
+		return (0);
+	}
+
+	// Record the outstanding request
+	req = new bfs_device_request_t;
+	req->tag = tag;
+	req->cmd = cmd;
+	req->pbid = pbid;
+	req->buf = &buf;
+	req->status = BFS_FAILURE;
+	req->done = false;
+	req->cb = cb;
+	req->cbarg = arg;
+	rc->requests[tag] = req;
+	rc->inflight++;
+	if (batch) {
+		pthread_mutex_lock(&rd_lock);
+		rd_batches[tag] = make_pair(cmd, &buf);
+		pthread_mutex_unlock(&rd_lock);
 	}
+	pthread_mutex_unlock(&rc->lock);
 
-	// 1 OK, 0 WAITING, -1 FAILURE
-	return (resp_ready == 1) ? BFS_SUCCESS : BFS_FAILURE;
+	// Return the tag for the request
+	logMessage(DEVICE_VRBLOG_LEVEL, "Submitted request [%s] tag [%lu]",
+			   bfsDeviceLayer::getDeviceMsgStr(cmd), tag);
+	return (tag);
 }
 
 /**
- * @brief Get a block from the device
+ * @brief Wait for a request to complete (reaping any other responses which
+ * arrive first), return its status and release it.
  *
- * @param blkid - the block ID for the block to get (at block id)
- * @param buf - buffer to copy contents into
- * @return int : 0 is success, -1 is failure
+ * @param tag - the tag of the request to wait for
+ * @return int BFS_SUCCESS if success, BFS_FAILURE otherwise
  */
 
-int bfsRemoteDevice::getBlock(PBfsBlock &pblk) {
-
-	// Create the request for the remote device information
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = 0;
-	bfs_device_msg_t cmd;
-	bfs_block_id_t rblkid, blkid;
-	char bstr[129];
-	bool ack;
-
-	blkid = pblk.get_pbid();
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_start_time) != SGX_SUCCESS) ||
-	// 			(f_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
-
-	pblk.setData((char *)&blkid, sizeof(bfs_block_id_t));
+int bfsRemoteDevice::waitRequest(bfs_device_tag_t tag) {
 
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double marshal_start_time = 0;
+	// Local variables
+	bfsDeviceRequestList::iterator it;
+	bfs_remote_conn_t *rc;
+	bfs_device_request_t *req;
+	int status;
+
+	// Find the request, make sure someone else is not going to release it
+	if ((rc = getTagConnection(tag)) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "Waiting on bad request tag [%lu]", tag);
+		return (BFS_FAILURE);
+	}
+	pthread_mutex_lock(&rc->lock);
+	if (((it = rc->requests.find(tag)) == rc->requests.end()) ||
+		(it->second->cb != NULL)) {
+		pthread_mutex_unlock(&rc->lock);
+		logMessage(LOG_ERROR_LEVEL, "Waiting on bad request tag [%lu]", tag);
+		return (BFS_FAILURE);
+	}
+	req = it->second;
 
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
+	// Process responses until ours arrives
+	while (!req->done) {
+		if (reapResponse(rc)) {
+			pthread_mutex_unlock(&rc->lock);
+			return (BFS_FAILURE);
+		}
+	}
 
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice getblock setData: %.3f us",
-	// 				   f_end_time - f_start_time);
+	// Release the request, return the status
+	status = req->status;
+	rc->requests.erase(tag);
+	delete req;
+	pthread_mutex_unlock(&rc->lock);
+	return (status);
+}
 
-	// 		marshal_start_time = f_end_time; // set the marshal start time
-	// 	}
-	// #endif
+/**
+ * @brief Wait for all of the outstanding requests to complete (requests
+ * without callbacks still need to be released with waitRequest)
+ *
+ * @param none
+ * @return int BFS_SUCCESS if success, BFS_FAILURE otherwise
+ */
 
-	logMessage(DEVICE_VRBLOG_LEVEL, "Starting getBlock [%d]", blkid);
+int bfsRemoteDevice::waitAllRequests(void) {
 
-	// Marshal the packet
-	if (bfsDeviceLayer::marshalBfsDevicePacket(
-			usr, deviceID, BFS_DEVICE_GET_BLOCK, 0, secContext, rd_send_seq,
-			pblk) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Get block request marhsal failed, error.");
-		return (-1);
+	// Local variables
+	bfs_remote_conn_t *rc;
+	size_t i;
+
+	// Reap until there is nothing in flight on any of the connections
+	for (i = 0; i < rd_conns.size(); i++) {
+		rc = rd_conns[i];
+		pthread_mutex_lock(&rc->lock);
+		while (rc->inflight > 0) {
+			if (reapResponse(rc)) {
+				pthread_mutex_unlock(&rc->lock);
+				return (BFS_FAILURE);
+			}
+		}
+		pthread_mutex_unlock(&rc->lock);
 	}
-	rd_send_seq++;
 
-	// Send the pkt
-	if (submit_io(pblk) != BFS_SUCCESS) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get block request send/recv failed, error.");
-		return (-1);
-	}
+	// Return successfully
+	return (BFS_SUCCESS);
+}
 
-	// // Send the pkt
-	// if ((size_t)remoteConn->sendPacketizedBuffer(pblk) != pblk.getLength()) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Get block request send failed, error.");
-	// 	return (-1);
-	// }
+/**
+ * @brief Get a block from the device
+ *
+ * @param blkid - the block ID for the block to get (at block id)
+ * @param buf - buffer to copy contents into
+ * @return int : 0 is success, -1 is failure
+ */
 
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double unmarshal_start_time = 0.0;
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&unmarshal_start_time) != SGX_SUCCESS) ||
-	// 			(unmarshal_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
+int bfsRemoteDevice::getBlock(PBfsBlock &pblk) {
 
-	// Unmarshal the data, sanity check it
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, pblk) == -1) ||
-		(usr != 1) || (did != deviceID) || (cmd != BFS_DEVICE_GET_BLOCK) ||
-		(ack != 1) || (pblk.getLength() != sizeof(bfs_block_id_t) + BLK_SZ)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get block request bad data response, abort [usr=%lu, "
-				   "did=%lu, cmd=%d, ack=%d, len=%d].",
-				   usr, did, cmd, ack, pblk.getLength());
-		return (-1);
-	}
-	rd_recv_seq++;
+	// Local variables
+	bfs_block_id_t blkid = pblk.get_pbid();
+	bfs_device_tag_t tag;
+	char bstr[129];
 
-	// Check the put block value
-	pblk >> rblkid;
-	if (rblkid != blkid) {
+	// Send the request, wait for the response
+	logMessage(DEVICE_VRBLOG_LEVEL, "Starting getBlock [%d]", blkid);
+	if (((tag = getBlockAsync(pblk)) == 0) ||
+		(waitRequest(tag) != BFS_SUCCESS)) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Returned block ID on get block mismatch [%lu != %lu]",
-				   blkid, rblkid);
+				   "Get block request send/recv failed, error.");
 		return (-1);
 	}
 
-	// Copy the data into the buffer, log the successful get block
-	// memcpy( pblk.getBuffer(), buf.getBuffer(), buf.getLength() ); // QB: dont
-	// need since we read directly into pblk
+	// Log the successful get block (data was received directly into pblk)
 	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
 		bufToString(pblk.getBuffer(), BLK_SZ, bstr, 128);
 		logMessage(DEVICE_VRBLOG_LEVEL,
-				   "Get block [%lu] device [%lu] data [%s].", blkid, did, bstr);
+				   "Get block [%lu] device [%lu] data [%s].", blkid, deviceID,
+				   bstr);
 	}
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
-
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice getblock unmarshal: %.3f us",
-	// 				   f_end_time - unmarshal_start_time);
-	// 	}
-	// #endif
-
 	logMessage(DEVICE_VRBLOG_LEVEL, "getBlock [%d] success", blkid);
 
 	// Return successfully
@@ -357,122 +474,37 @@ int bfsRemoteDevice::getBlock(PBfsBlock &pblk) {
 
 int bfsRemoteDevice::getBlock(bfs_block_id_t pbid, char *blk) {
 
-	// Create the request for the remote device information
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = 0;
-	bfs_device_msg_t cmd;
-	bfs_block_id_t rblkid;
-	char bstr[129];
-	bool ack;
-	PBfsBlock pblk(NULL, BLK_SZ, 0, 0, 0, 0);
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_start_time) != SGX_SUCCESS) ||
-	// 			(f_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
-
-	pblk.setData((char *)&pbid, sizeof(bfs_block_id_t));
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double marshal_start_time = 0;
-
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
-
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice getblock setData: %.3f us",
-	// 				   f_end_time - f_start_time);
-
-	// 		marshal_start_time = f_end_time; // set the marshal start time
-	// 	}
-	// #endif
-
-	logMessage(DEVICE_VRBLOG_LEVEL, "Starting getBlock [%d]", pbid);
-
-	// Marshal the packet
-	if (bfsDeviceLayer::marshalBfsDevicePacket(
-			usr, deviceID, BFS_DEVICE_GET_BLOCK, 0, secContext, rd_send_seq,
-			pblk) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Get block request marhsal failed, error.");
-		return (-1);
-	}
-	rd_send_seq++;
-
-	// Send the pkt
-	if (submit_io(pblk) != BFS_SUCCESS) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get block request send/recv failed, error.");
-		return (-1);
-	}
-
-	// // Send the pkt
-	// if ((size_t)remoteConn->sendPacketizedBuffer(pblk) != pblk.getLength()) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Get block request send failed, error.");
-	// 	return (-1);
-	// }
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double unmarshal_start_time = 0.0;
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&unmarshal_start_time) != SGX_SUCCESS) ||
-	// 			(unmarshal_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
-
-	// Unmarshal the data, sanity check it
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, pblk) == -1) ||
-		(usr != 1) || (did != deviceID) || (cmd != BFS_DEVICE_GET_BLOCK) ||
-		(ack != 1) || (pblk.getLength() != sizeof(bfs_block_id_t) + BLK_SZ)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get block request bad data response, abort [usr=%lu, "
-				   "did=%lu, cmd=%d, ack=%d, len=%d].",
-				   usr, did, cmd, ack, pblk.getLength());
-		return (-1);
-	}
-	rd_recv_seq++;
+	// Local variables
+	PBfsBlock pblk(NULL, BLK_SZ, 0, 0, pbid, this);
 
-	// Check the put block value
-	pblk >> rblkid;
-	if (rblkid != pbid) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Returned block ID on get block mismatch [%lu != %lu]", pbid,
-				   rblkid);
+	// Get the block, then copy over the data (callers that can take the
+	// block itself should use getBlock(PBfsBlock &) and avoid the copy)
+	if (getBlock(pblk)) {
 		return (-1);
 	}
+	pblk.removeHeader(blk, BLK_SZ);
 
-	// Copy the data into the buffer, log the successful get block
-	// memcpy( pblk.getBuffer(), buf.getBuffer(), buf.getLength() ); // QB: dont
-	// need since we read directly into pblk
-	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
-		bufToString(pblk.getBuffer(), BLK_SZ, bstr, 128);
-		logMessage(DEVICE_VRBLOG_LEVEL,
-				   "Get block [%lu] device [%lu] data [%s].", pbid, did, bstr);
-	}
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
+	// Return successfully
+	return (0);
+}
 
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice getblock unmarshal: %.3f us",
-	// 				   f_end_time - unmarshal_start_time);
-	// 	}
-	// #endif
+/**
+ * @brief Get a block from the device asynchronously (block data is received
+ * directly into pblk on completion)
+ *
+ * @param pblk - the block to get (uses the physical block ID)
+ * @param cb - completion callback (NULL if waited on)
+ * @param arg - argument to pass to the callback
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
 
-	// finally copy over the data
-	// TODO: deal with buffer management better to avoid unnecessary copies
-	memcpy(blk, pblk.getBuffer(), pblk.getLength()); // BLK_SZ copy
-	logMessage(DEVICE_VRBLOG_LEVEL, "getBlock [%d] success", pbid);
+bfs_device_tag_t bfsRemoteDevice::getBlockAsync(PBfsBlock &pblk,
+												bfs_device_cb_t cb, void *arg) {
 
-	// Return successfully
-	return (0);
+	// Setup the buffer with the block ID, send the request
+	bfs_block_id_t blkid = pblk.get_pbid();
+	pblk.setData((char *)&blkid, sizeof(bfs_block_id_t));
+	return (submitRequest(BFS_DEVICE_GET_BLOCK, pblk, blkid, cb, arg));
 }
 
 /**
@@ -484,229 +516,245 @@ int bfsRemoteDevice::getBlock(bfs_block_id_t pbid, char *blk) {
  */
 
 int bfsRemoteDevice::putBlock(PBfsBlock &pblk) {
+	return (putBlockWait(pblk, false));
+}
 
-	// Create the request for the remote device information
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = deviceID;
-	bfs_device_msg_t cmd;
-	bfs_block_id_t rblkid, blkid;
-	bfsConnectionList ready;
-	char bstr[129];
-	bool ack;
-
-	// Setup the buffer data block for sending
-	blkid = pblk.get_pbid();
-
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_start_time) != SGX_SUCCESS) ||
-	// 			(f_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
+/**
+ * @brief Put a block into the device, the device makes it durable before it
+ * responds (a write with forced unit access)
+ *
+ * @param pblk - the block to put (uses the physical block ID)
+ * @return int : 0 is success, -1 is failure
+ */
 
-	// buf.setData( pblk.getBuffer(), BLK_SZ );
-	pblk << blkid;
+int bfsRemoteDevice::putBlockFua(PBfsBlock &pblk) {
+	return (putBlockWait(pblk, true));
+}
 
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double marshal_start_time = 0;
+/**
+ * @brief Put a block into the device asynchronously (the block buffer is
+ * consumed by the request)
+ *
+ * @param pblk - the block to put (uses the physical block ID)
+ * @param cb - completion callback (NULL if waited on)
+ * @param arg - argument to pass to the callback
+ * @param fua - flag indicating the block must be durable before the response
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
 
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
+bfs_device_tag_t bfsRemoteDevice::putBlockAsync(PBfsBlock &pblk,
+												bfs_device_cb_t cb, void *arg,
+												bool fua) {
 
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice putblock setData: %.3f us",
-	// 				   f_end_time - f_start_time);
+	// Prepend the block ID, send the request
+	bfs_block_id_t blkid = pblk.get_pbid();
+	pblk << blkid;
+	return (submitRequest(fua ? BFS_DEVICE_PUT_BLOCK_FUA : BFS_DEVICE_PUT_BLOCK,
+						  pblk, blkid, cb, arg));
+}
 
-	// 		marshal_start_time = f_end_time; // set the marshal start time
-	// 	}
-	// #endif
+/**
+ * @brief Get the blocks associated with the IDS
+ *
+ * @param blks - the blocks to get (data copied into the blocks)
+ * @return int : 0 is success, -1 is failure
+ */
 
-	logMessage(DEVICE_VRBLOG_LEVEL, "Starting putBlock [%d]", blkid);
+int bfsRemoteDevice::getBlocks(bfs_block_list_t &blks) {
 
-	// Marshal the packet
-	if (bfsDeviceLayer::marshalBfsDevicePacket(usr, did, BFS_DEVICE_PUT_BLOCK,
-											   0, secContext, rd_send_seq,
-											   pblk) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Put block request marshal failed, error.");
-		return (-1);
-	}
-	rd_send_seq++;
+	// Local variables
+	bfs_device_tag_t tag;
 
-	// Send the pkt
-	if (submit_io(pblk) != BFS_SUCCESS) {
+	// Send the request, wait for the response
+	if (((tag = getBlocksAsync(blks)) == 0) || (waitBlocks(tag, blks))) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Put block request send/recv failed, error.");
+				   "Get blocks request send/recv failed, error.");
 		return (-1);
 	}
 
-	// // Send the pkt
-	// if (remoteConn->sendPacketizedBuffer(pblk) != (int)pblk.getLength()) {
-	// 	logMessage(LOG_ERROR_LEVEL, "Put block request send failed, error.");
-	// 	return (-1);
-	// }
+	// Return successfully
+	return (0);
+}
 
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	double unmarshal_start_time = 0.0;
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&unmarshal_start_time) != SGX_SUCCESS) ||
-	// 			(unmarshal_start_time == -1))
-	// 			return BFS_FAILURE;
-	// 	}
-	// #endif
+/**
+ * @brief Put the blocks associated with the IDS
+ *
+ * @param blks - the blocks to put
+ * @return int : 0 is success, -1 is failure
+ */
 
-	// Unmarshal the data, sanity check it
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, pblk) == -1) ||
-		(usr != 1) || (cmd != BFS_DEVICE_PUT_BLOCK) || (ack != 1) ||
-		(pblk.getLength() != sizeof(bfs_block_id_t))) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get block request bad data response, abort [usr=%lu, "
-				   "did=%lu, cmd=%d, ack=%d, len=%d].",
-				   usr, did, cmd, ack, pblk.getLength());
-		return (-1);
-	}
-	rd_recv_seq++;
+int bfsRemoteDevice::putBlocks(bfs_block_list_t &blks) {
+
+	// Local variables
+	bfs_device_tag_t tag;
 
-	// Check the put block value
-	pblk >> rblkid;
-	if (rblkid != blkid) {
+	// Send the request, wait for the response
+	if (((tag = putBlocksAsync(blks)) == 0) || (waitBlocks(tag, blks))) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Returned block ID on put block mismatch [%lu != %lu]",
-				   blkid, rblkid);
+				   "Put blocks request send/recv failed, error.");
 		return (-1);
 	}
 
-	// Log the successful get block
-	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
-		bufToString(pblk.getBuffer(), BLK_SZ, bstr, 128);
-		logMessage(DEVICE_VRBLOG_LEVEL,
-				   "Put block [%lu] device [%lu] data [%s].", blkid, did, bstr);
-	}
+	// Return successfully
+	return (0);
+}
 
-	// #ifdef __BFS_ENCLAVE_MODE
-	// 	if (bfsUtilLayer::perf_test() && collect_core_lats) {
-	// 		if ((ocall_get_time2(&f_end_time) != SGX_SUCCESS) || (f_end_time ==
-	// -1)) 			return BFS_FAILURE;
+/**
+ * @brief Send a get blocks request to the device without waiting for the
+ * response (the block data is copied out by waitBlocks)
+ *
+ * @param blks - the blocks to get
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
 
-	// 		logMessage(DEVICE_VRBLOG_LEVEL,
-	// 				   "===== Time in remoteDevice putblock unmarshal: %.3f us",
-	// 				   f_end_time - unmarshal_start_time);
-	// 	}
-	// #endif
+bfs_device_tag_t bfsRemoteDevice::getBlocksAsync(bfs_block_list_t &blks) {
+	return (submitBlocks(BFS_DEVICE_GET_BLOCKS, blks));
+}
 
-	logMessage(DEVICE_VRBLOG_LEVEL, "putBlock [%d] success", blkid);
+/**
+ * @brief Send a put blocks request to the device without waiting for the
+ * response (the block data is copied into the request on submission)
+ *
+ * @param blks - the blocks to put
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
 
-	// Return successfully
-	return (0);
+bfs_device_tag_t bfsRemoteDevice::putBlocksAsync(bfs_block_list_t &blks) {
+	return (submitBlocks(BFS_DEVICE_PUT_BLOCKS, blks));
 }
 
 /**
- * @brief Get a block from the device
+ * @brief Wait for a get/put blocks request to complete, sanity check the
+ * response against the blocks requested and (for gets) copy out the data.
  *
- * @param blkid - the block ID for the block to get (at block id)
- * @param buf - buffer to copy contents into
+ * @param tag - the tag returned by getBlocksAsync/putBlocksAsync
+ * @param blks - the blocks passed when the request was sent
  * @return int : 0 is success, -1 is failure
  */
 
-int bfsRemoteDevice::getBlocks(bfs_block_list_t &blks) {
+int bfsRemoteDevice::waitBlocks(bfs_device_tag_t tag, bfs_block_list_t &blks) {
 
-	// Create the request for the remote device information
-	bfs_block_list_t::iterator it, rit;
+	// Local variables
+	bfsDeviceRecordList::iterator rit;
+	vector<pair<bfs_device_tag_t, bfs_block_list_t>> recs;
+	size_t i;
+	int ret = 0;
+
+	// Requests sent as a single record are waited on directly
+	pthread_mutex_lock(&rd_lock);
+	if ((rit = rd_records.find(tag)) == rd_records.end()) {
+		pthread_mutex_unlock(&rd_lock);
+		return (waitRecord(tag, blks));
+	}
+	recs.swap(rit->second);
+	rd_records.erase(rit);
+	pthread_mutex_unlock(&rd_lock);
+
+	// Wait for all of the records (releasing their buffers), even on failure
+	for (i = 0; i < recs.size(); i++) {
+		if (waitRecord(recs[i].first, recs[i].second)) {
+			ret = -1;
+		}
+	}
+	return (ret);
+}
+
+/**
+ * @brief Wait for one get/put blocks record to complete, sanity check the
+ * response against the blocks in it and (for gets) copy out the data.
+ *
+ * @param tag - the tag of the record
+ * @param blks - the blocks sent in the record
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::waitRecord(bfs_device_tag_t tag, bfs_block_list_t &blks) {
+
+	// Local variables
+	bfsDeviceBatchList::iterator bit;
+	bfs_block_list_t::iterator it;
 	bfs_blockid_list_t manifest;
 	bfs_blockid_list_t::iterator mit;
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = 0;
-	bfs_device_msg_t cmd;
 	bfs_block_id_t rblkid;
-	bfsConnectionList ready;
-	bfsFlexibleBuffer buf;
-	bfs_blockid_list_t rlist;
+	bfs_device_msg_t cmd;
+	bfsFlexibleBuffer *buf;
 	size_t sz, rsz, expected_size;
 	char bbuf[128];
-	bool ack;
 	string msg;
 
-	// Send the list of elements to get
+	// Find (and take ownership of) the request buffer
+	pthread_mutex_lock(&rd_lock);
+	if ((bit = rd_batches.find(tag)) == rd_batches.end()) {
+		pthread_mutex_unlock(&rd_lock);
+		logMessage(LOG_ERROR_LEVEL, "Waiting on bad blocks request tag [%lu]",
+				   tag);
+		return (-1);
+	}
+	cmd = bit->second.first;
+	buf = bit->second.second;
+	rd_batches.erase(bit);
+	pthread_mutex_unlock(&rd_lock);
+
+	// Wait for the response
+	if (waitRequest(tag) != BFS_SUCCESS) {
+		logMessage(LOG_ERROR_LEVEL, "Blocks request [%s] failed, error.",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd));
+		delete buf;
+		return (-1);
+	}
+
+	// Extents responses echo the extents (then the data, for gets)
 	sz = blks.size();
-	buf.addTrailer(sz);
-	for (it = blks.begin(); it != blks.end(); it++) {
-		rblkid = (bfs_block_id_t)it->first;
-		buf.addTrailer(rblkid);
-		manifest.push_back(rblkid);
+	if ((cmd == BFS_DEVICE_GET_EXTENTS) || (cmd == BFS_DEVICE_PUT_EXTENTS)) {
+		return (waitExtents(cmd, buf, blks));
 	}
 
-	// Sending verbose information
-	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
-		msg = "";
-		for (it = blks.begin(); it != blks.end(); it++) {
-			msg += " : " + to_string(it->first);
-		}
-		logMessage(DEVICE_VRBLOG_LEVEL,
-				   "Get blocks sending to device=%lu, %u blocks%s", deviceID,
-				   blks.size(), msg.c_str());
-	}
-
-	// Marshal the packet
-	if ((bfsDeviceLayer::marshalBfsDevicePacket(
-			 usr, deviceID, BFS_DEVICE_GET_BLOCKS, 0, secContext, rd_send_seq,
-			 buf) == -1) ||
-		((size_t)remoteConn->sendPacketizedBuffer(buf) != buf.getLength())) {
+	// Sanity check the response size
+	expected_size =
+		sizeof(size_t) +
+		((sizeof(bfs_block_id_t) + ((cmd == BFS_DEVICE_GET_BLOCKS) ? BLK_SZ : 0)) *
+		 sz);
+	if (buf->getLength() != expected_size) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Get blocks request marshal/send failed, error.");
-		return (-1);
-	}
-	rd_send_seq++;
-
-	// Receive the response packet (quasi-blocking)
-	if ((remoteMux->waitConnections(ready, 0)) ||
-		(ready.find(remoteConn->getSocket()) == ready.end()) ||
-		(remoteConn->recvPacketizedBuffer(buf) <= 0)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get blocks request receive failed, error.");
-		return (-1);
-	}
-
-	// Unmarshal the data, sanity check it
-	expected_size = sizeof(size_t) + ((sizeof(bfs_block_id_t) + BLK_SZ) * sz);
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, buf) == -1) ||
-		(usr != 1) || (did != deviceID) || (cmd != BFS_DEVICE_GET_BLOCKS) ||
-		(ack != 1) || (buf.getLength() != expected_size)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Get blocks request bad data response, abort [usr=%lu, "
-				   "did=%lu, cmd=%d, ack=%d, len=%d].",
-				   usr, did, cmd, ack, buf.getLength());
+				   "Blocks request [%s] bad data response, abort [len=%d].",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd), buf->getLength());
+		delete buf;
 		return (-1);
 	}
-	rd_recv_seq++;
 
 	// Check the number of blocks received
-	buf >> rsz;
+	*buf >> rsz;
 	if (rsz != sz) {
 		logMessage(LOG_ERROR_LEVEL,
-				   "Incorrect number of blocks returned from get %u != %u", rsz,
-				   sz);
+				   "Incorrect number of blocks returned from [%s] %u != %u",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd), rsz, sz);
+		delete buf;
 		return (-1);
 	}
 
 	// Now walk the rest of the blocks
+	for (it = blks.begin(); it != blks.end(); it++) {
+		manifest.push_back(it->first);
+	}
 	while (!manifest.empty()) {
 		// Get the block ID and check it
-		buf >> rblkid;
+		*buf >> rblkid;
 		if ((mit = std::find(manifest.begin(), manifest.end(), rblkid)) ==
 			manifest.end()) {
 			logMessage(LOG_ERROR_LEVEL,
-					   "Incorrect block returned from get blocks [%lu]",
-					   rblkid);
+					   "Incorrect block returned from [%s] [%lu]",
+					   bfsDeviceLayer::getDeviceMsgStr(cmd), rblkid);
+			delete buf;
 			return (-1);
 		}
 
-		// Pull the data off the packet, remove from manifest
-		buf.removeHeader(blks[rblkid]->getBuffer(), BLK_SZ);
+		// Pull the data off the packet (gets), remove from manifest
+		if (cmd == BFS_DEVICE_GET_BLOCKS) {
+			buf->removeHeader(blks[rblkid]->getBuffer(), BLK_SZ);
+		}
 		manifest.erase(mit);
 	}
+	delete buf;
 
 	// Log, possibly list blocks
 	if (levelEnabled(DEVICE_LOG_LEVEL)) {
@@ -716,126 +764,126 @@ int bfsRemoteDevice::getBlocks(bfs_block_list_t &blks) {
 			msg += " : " + to_string(it->first) + " (" + bbuf + ")";
 		}
 	}
-	logMessage(DEVICE_LOG_LEVEL, "Get blocks sent to device %lu, %u blocks%s",
-			   deviceID, blks.size(), msg.c_str());
+	logMessage(DEVICE_LOG_LEVEL, "%s sent to device %lu, %u blocks%s",
+			   bfsDeviceLayer::getDeviceMsgStr(cmd), deviceID, blks.size(),
+			   msg.c_str());
 
 	// Return successfully
 	return (0);
 }
 
 /**
- * @brief Get the blocks associated with the IDS
+ * @brief Make the blocks put so far durable on the device (a barrier, so
+ * one flush replaces syncing each of the blocks).  It covers the puts
+ * completed on any connection, and those sent before it on its own.
  *
- * @param blkid - the block ID for the block to put (at block id)
- * @param buf - buffer to copy contents into (NULL no copy)
+ * @param none
  * @return int : 0 is success, -1 is failure
  */
 
-int bfsRemoteDevice::putBlocks(bfs_block_list_t &blks) {
+int bfsRemoteDevice::flushDevice(void) {
+	return (waitFlush(flushDeviceAsync()));
+}
+
+/**
+ * @brief Send a flush request to the device without waiting for the response
+ * (so the flushes of a set of devices can overlap)
+ *
+ * @param none
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
+
+bfs_device_tag_t bfsRemoteDevice::flushDeviceAsync(void) {
 
 	// Local variables
-	bfs_block_list_t::iterator it;
-	bfs_blockid_list_t manifest;
-	bfs_blockid_list_t::iterator mit;
-	bfs_uid_t usr = 1;
-	bfs_device_id_t did = deviceID;
-	bfs_device_msg_t cmd;
-	bfs_block_id_t rblkid;
-	bfsConnectionList ready;
-	bfsFlexibleBuffer buf;
-	size_t sz, rsz, expected_size;
-	char bbuf[128];
-	bool ack;
-	string msg;
+	bfsFlexibleBuffer *buf = new bfsFlexibleBuffer();
+	bfs_device_tag_t tag;
 
-	// Send the blocks of data to send
-	sz = blks.size();
-	buf.addTrailer(sz);
-	for (it = blks.begin(); it != blks.end(); it++) {
-		rblkid = (bfs_block_id_t)it->first;
-		buf.addTrailer(rblkid);
-		buf.addTrailer(blks[rblkid]->getBuffer(), BLK_SZ);
-		manifest.push_back(rblkid);
+	// Send the (empty) request, keep the buffer to receive the response
+	if ((tag = submitRequest(BFS_DEVICE_FLUSH, *buf, 0, NULL, NULL, true)) ==
+		0) {
+		delete buf;
 	}
+	return (tag);
+}
 
-	// Sending verbose information
-	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
-		for (it = blks.begin(); it != blks.end(); it++) {
-			msg += " : " + to_string(it->first);
-		}
-		logMessage(DEVICE_VRBLOG_LEVEL,
-				   "Put blocks sending to device=%lu, %u blocks%s", deviceID,
-				   blks.size(), msg.c_str());
-	}
+/**
+ * @brief Wait for a flush request to complete
+ *
+ * @param tag - the tag returned by flushDeviceAsync
+ * @return int : 0 is success, -1 is failure
+ */
 
-	// Marshal the packet
-	if ((bfsDeviceLayer::marshalBfsDevicePacket(usr, did, BFS_DEVICE_PUT_BLOCKS,
-												0, secContext, rd_send_seq,
-												buf) == -1) ||
-		(remoteConn->sendPacketizedBuffer(buf) != (int)buf.getLength())) {
-		logMessage(LOG_ERROR_LEVEL, "Put blocks request send failed, error.");
+int bfsRemoteDevice::waitFlush(bfs_device_tag_t tag) {
+
+	// Local variables
+	bfsDeviceBatchList::iterator bit;
+	bfsFlexibleBuffer *buf;
+	int ret;
+
+	// Find (and take ownership of) the request buffer
+	pthread_mutex_lock(&rd_lock);
+	if (((bit = rd_batches.find(tag)) == rd_batches.end()) ||
+		(bit->second.first != BFS_DEVICE_FLUSH)) {
+		pthread_mutex_unlock(&rd_lock);
+		logMessage(LOG_ERROR_LEVEL, "Waiting on bad flush request tag [%lu]",
+				   tag);
 		return (-1);
 	}
-	rd_send_seq++;
-
-	// Receive the response packet (quasi-blocking)
-	if ((remoteMux->waitConnections(ready, 0)) ||
-		(ready.find(remoteConn->getSocket()) == ready.end()) ||
-		(remoteConn->recvPacketizedBuffer(buf) <= 0)) {
-		logMessage(LOG_ERROR_LEVEL, "Put block request receive failed, error.");
+	buf = bit->second.second;
+	rd_batches.erase(bit);
+	pthread_mutex_unlock(&rd_lock);
+
+	// Wait for the response, release the buffer
+	ret = (waitRequest(tag) == BFS_SUCCESS) ? 0 : -1;
+	delete buf;
+	if (ret) {
+		logMessage(LOG_ERROR_LEVEL, "Flush of device [%lu] failed", deviceID);
 		return (-1);
 	}
+	logMessage(DEVICE_VRBLOG_LEVEL, "Flushed device [%lu]", deviceID);
+	return (0);
+}
 
-	// Unmarshal the data, sanity check it
-	expected_size = sizeof(size_t) + (sizeof(bfs_block_id_t) * sz);
-	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(
-			 usr, did, cmd, ack, secContext, rd_recv_seq, buf) == -1) ||
-		(usr != 1) || (cmd != BFS_DEVICE_PUT_BLOCKS) || (ack != 1) ||
-		(buf.getLength() != expected_size)) {
-		logMessage(LOG_ERROR_LEVEL,
-				   "Put blocks request bad data response [usr=%lu, did=%lu, "
-				   "cmd=%d, ack=%d, len=%d].",
-				   usr, did, cmd, ack, buf.getLength());
+/**
+ * @brief Discard a set of (freed) blocks on the device, so it can reclaim
+ * their space
+ *
+ * @param pbids - the blocks to discard
+ * @param nblks - the number of blocks
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::trimBlocks(bfs_block_id_t *pbids, uint32_t nblks) {
+
+	// Local variables
+	bfsFlexibleBuffer buf;
+	bfs_device_tag_t tag;
+	size_t sz = nblks, rsz;
+
+	// Send the list of blocks, wait for the response (the count trimmed)
+	buf.resizeAllocation(BFS_BLOCK_HEADROOM, 0,
+						 (bfs_size_t)(sizeof(size_t) +
+									  sizeof(bfs_block_id_t) * sz +
+									  BFS_BLOCK_TAILROOM));
+	buf.addTrailer(sz);
+	buf.addTrailer((char *)pbids, (bfs_size_t)(sizeof(bfs_block_id_t) * sz));
+	if (((tag = submitRequest(BFS_DEVICE_TRIM_BLOCKS, buf, 0)) == 0) ||
+		(waitRequest(tag) != BFS_SUCCESS) ||
+		(buf.getLength() != sizeof(size_t))) {
+		logMessage(LOG_ERROR_LEVEL, "Trim blocks request send/recv failed.");
 		return (-1);
 	}
-	rd_recv_seq++;
-
-	// Check the number of blocks received
 	buf >> rsz;
 	if (rsz != sz) {
-		logMessage(
-			LOG_ERROR_LEVEL,
-			"Incorrect number of blocks returned from put blocks %u != %u", rsz,
-			sz);
+		logMessage(LOG_ERROR_LEVEL, "Incorrect number of blocks trimmed %u != %u",
+				   rsz, sz);
 		return (-1);
 	}
 
-	// Now walk the rest of the blocks
-	while (!manifest.empty()) {
-		// Get the block ID and check it
-		buf >> rblkid;
-		if ((mit = std::find(manifest.begin(), manifest.end(), rblkid)) ==
-			manifest.end()) {
-			logMessage(LOG_ERROR_LEVEL,
-					   "Incorrect block returned from get blocks [%lu]",
-					   rblkid);
-			return (-1);
-		}
-		manifest.erase(mit);
-	}
-
-	// Log, possibly list blocks
-	if (levelEnabled(DEVICE_LOG_LEVEL)) {
-		msg = "";
-		for (it = blks.begin(); it != blks.end(); it++) {
-			bufToString(it->second->getBuffer(), 2, bbuf, 128);
-			msg += " : " + to_string(it->first) + " (" + bbuf + ")";
-		}
-	}
-	logMessage(DEVICE_LOG_LEVEL, "Put blocks sent to device %lu, %u blocks%s",
-			   deviceID, blks.size(), msg.c_str());
-
-	// Return successfully
+	// Log, return successfully
+	logMessage(DEVICE_VRBLOG_LEVEL, "Trimmed %u blocks of device [%lu]", nblks,
+			   deviceID);
 	return (0);
 }
 
@@ -883,3 +931,442 @@ int bfsRemoteDevice::changeDeviceState(bfs_device_state_t st) {
 	// Return successfully
 	return (0);
 }
+
+/**
+ * @brief Connect a connection of the pool to the device and agree its epoch
+ *
+ * @param rc - the connection
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::openConnection(bfs_remote_conn_t *rc) {
+
+	// Create the connection, connect it
+	rc->conn = bfsNetworkConnection::bfsChannelFactory(commAddress, commPort);
+	if (rc->conn == NULL) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Remote device connection create failed, aborting.");
+		return (-1);
+	}
+	if (rc->conn->connect()) {
+		logMessage(LOG_ERROR_LEVEL, "Remote device connect failed, aborting.");
+		return (-1);
+	}
+
+	// Agree the epoch of the connection (binds its packets to it)
+	if (bfsDeviceLayer::openDeviceEpoch(rc->conn, rc->epoch)) {
+		logMessage(LOG_ERROR_LEVEL, "Remote device epoch failed, aborting.");
+		return (-1);
+	}
+
+	// Our IVs on the connection are the initiator's, under its epoch
+	rc->sa->setIVContext(false, rc->epoch.client);
+
+	// Return successfully
+	logMessage(DEVICE_VRBLOG_LEVEL, "Remote device connection [%lu] open",
+			   rc->idx);
+	return (0);
+}
+
+/**
+ * @brief Get the connection the calling thread sends its requests on.  Each
+ * thread is given a slot the first time it sends, so the threads are spread
+ * evenly over the connections (and each keeps its requests in order).
+ *
+ * @param none
+ * @return bfs_remote_conn_t * : the connection, NULL if there are none
+ */
+
+bfs_remote_conn_t *bfsRemoteDevice::getThreadConnection(void) {
+
+	// Assign the thread a slot, if it does not have one
+	if (rd_conns.empty()) {
+		return (NULL);
+	}
+	if (rdThreadSlot == 0) {
+		rdThreadSlot = rdNextThreadSlot++;
+	}
+	return (rd_conns[rdThreadSlot % rd_conns.size()]);
+}
+
+/**
+ * @brief Receive the next response on a connection and complete the request
+ * it is tagged with (must be called with the connection lock held).
+ * Responses for tags which are not outstanding (unknown or replayed) are
+ * rejected.
+ *
+ * @param rc - the connection to receive on
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::reapResponse(bfs_remote_conn_t *rc) {
+
+	// Local variables
+	bfsDeviceRequestList::iterator it;
+	bfs_device_request_t *req;
+	bfs_device_tag_t tag;
+	bfs_size_t len;
+
+	// Receive the packet length and the (clear) tag at the front of it
+	if ((rc->conn->recvPacketizedLength(len) != (int)sizeof(bfs_size_t)) ||
+		(len < sizeof(bfs_device_tag_t)) ||
+		(rc->conn->recvDataL(sizeof(bfs_device_tag_t), (char *)&tag) !=
+		 (int)sizeof(bfs_device_tag_t))) {
+		logMessage(LOG_ERROR_LEVEL, "Error receiving disk response.");
+		changeDeviceState(BFSDEV_ERRORED);
+		return (-1);
+	}
+
+	// Find the request, only accept a single response for an outstanding tag
+	if (((it = rc->requests.find(tag)) == rc->requests.end()) ||
+		(it->second->done)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Disk response for unknown request tag [%lu], error.", tag);
+		changeDeviceState(BFSDEV_ERRORED);
+		return (-1);
+	}
+	req = it->second;
+
+	// Receive the rest of the packet directly into the request buffer
+	if (rc->conn->recvBuffer(*req->buf, len - (bfs_size_t)sizeof(tag)) <=
+		0) {
+		logMessage(LOG_ERROR_LEVEL, "Error receiving disk response.");
+		changeDeviceState(BFSDEV_ERRORED);
+		return (-1);
+	}
+
+	// Complete the request, release it if there is a callback
+	req->status = completeRequest(rc, req);
+	req->done = true;
+	rc->inflight--;
+	if (req->cb != NULL) {
+		req->cb(req, req->cbarg);
+		rc->requests.erase(it);
+		delete req;
+	}
+
+	// Return successfully
+	return (0);
+}
+
+/**
+ * @brief Unmarshal and sanity check the response for a request (single block
+ * responses are fully checked here, the others by the caller)
+ *
+ * @param rc - the connection the response was received on
+ * @param req - the request whose response was received
+ * @return int BFS_SUCCESS if success, BFS_FAILURE otherwise
+ */
+
+int bfsRemoteDevice::completeRequest(bfs_remote_conn_t *rc,
+									 bfs_device_request_t *req) {
+
+	// Local variables
+	bfs_uid_t usr;
+	bfs_device_id_t did;
+	bfs_device_msg_t cmd;
+	bfs_block_id_t rblkid;
+	bool ack;
+
+	// Unmarshal the data, sanity check it
+	if ((bfsDeviceLayer::unmarshalBfsDevicePacket(usr, did, cmd, ack, rc->sa,
+												  rc->epoch, req->tag,
+												  *req->buf) == -1) ||
+		(usr != 1) || (cmd != req->cmd) || (ack != 1) ||
+		((cmd != BFS_DEVICE_GET_TOPO) && (did != deviceID))) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Device request bad data response, abort [usr=%lu, "
+				   "did=%lu, cmd=%d, ack=%d, len=%d].",
+				   usr, did, cmd, ack, req->buf->getLength());
+		return (BFS_FAILURE);
+	}
+
+	// Check the single block responses
+	switch (cmd) {
+	case BFS_DEVICE_GET_BLOCK:
+	case BFS_DEVICE_PUT_BLOCK:
+	case BFS_DEVICE_PUT_BLOCK_FUA:
+		if (req->buf->getLength() !=
+			sizeof(bfs_block_id_t) +
+				((cmd == BFS_DEVICE_GET_BLOCK) ? BLK_SZ : 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Block request [%s] bad response length [%d].",
+					   bfsDeviceLayer::getDeviceMsgStr(cmd),
+					   req->buf->getLength());
+			return (BFS_FAILURE);
+		}
+		*req->buf >> rblkid;
+		if (rblkid != req->pbid) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Returned block ID on [%s] mismatch [%lu != %lu]",
+					   bfsDeviceLayer::getDeviceMsgStr(cmd), req->pbid, rblkid);
+			return (BFS_FAILURE);
+		}
+		break;
+
+	case BFS_DEVICE_FLUSH:
+		if (req->buf->getLength() != 0) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Flush request bad response length [%d].",
+					   req->buf->getLength());
+			return (BFS_FAILURE);
+		}
+		break;
+
+	default: // Multi-block and topology responses are checked by the caller
+		break;
+	}
+
+	// Return successfully
+	return (BFS_SUCCESS);
+}
+
+/**
+ * @brief Marshal and send a get/put blocks request.  Batches larger than the
+ * maximum record size are split into several records (each sealed on its own,
+ * so the device can open them in parallel), which waitBlocks waits on as one.
+ *
+ * @param cmd - the command (BFS_DEVICE_GET_BLOCKS or BFS_DEVICE_PUT_BLOCKS)
+ * @param blks - the blocks to get/put
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
+
+bfs_device_tag_t bfsRemoteDevice::submitBlocks(bfs_device_msg_t cmd,
+											   bfs_block_list_t &blks) {
+
+	// Local variables
+	vector<pair<bfs_device_tag_t, bfs_block_list_t>> recs;
+	bfs_block_list_t::iterator it;
+	bfs_device_tag_t tag;
+	size_t i;
+
+	// Send the batch as a single record, if it fits in one
+	if (blks.size() <= rd_record_blocks) {
+		return (submitRecord(cmd, blks));
+	}
+
+	// Split the blocks into records, send each of them
+	for (it = blks.begin(); it != blks.end(); it++) {
+		if ((recs.empty()) || (recs.back().second.size() == rd_record_blocks)) {
+			recs.push_back(make_pair(0, bfs_block_list_t()));
+		}
+		recs.back().second.insert(*it);
+	}
+	for (i = 0; i < recs.size(); i++) {
+		if ((recs[i].first = submitRecord(cmd, recs[i].second)) == 0) {
+			// Release the records already sent, then fail
+			while (i-- > 0) {
+				waitRecord(recs[i].first, recs[i].second);
+			}
+			return (0);
+		}
+	}
+
+	// Keep the records (by the first tag) for waitBlocks
+	logMessage(DEVICE_VRBLOG_LEVEL, "%s split into %u records (device=%lu)",
+			   bfsDeviceLayer::getDeviceMsgStr(cmd), recs.size(), deviceID);
+	tag = recs.front().first;
+	pthread_mutex_lock(&rd_lock);
+	rd_records[tag].swap(recs);
+	pthread_mutex_unlock(&rd_lock);
+
+	// Return the tag for the request
+	return (tag);
+}
+
+/**
+ * @brief Marshal and send one get/put blocks record.  The request buffer is
+ * kept (by tag) until the response is waited on with waitRecord.
+ *
+ * @param cmd - the command (BFS_DEVICE_GET_BLOCKS or BFS_DEVICE_PUT_BLOCKS)
+ * @param blks - the blocks to get/put
+ * @return bfs_device_tag_t : the request tag, 0 is failure
+ */
+
+bfs_device_tag_t bfsRemoteDevice::submitRecord(bfs_device_msg_t cmd,
+											   bfs_block_list_t &blks) {
+
+	// Local variables
+	bfs_block_list_t::iterator it;
+	vector<bfs_block_extent_t> exts;
+	bfs_block_id_t rblkid;
+	bfs_device_tag_t tag;
+	bfsFlexibleBuffer *buf;
+	size_t sz, nexts;
+	string msg;
+
+	// Send runs of adjacent blocks as extents, if there are any
+	sz = blks.size();
+	nexts = getBlockExtents(blks, exts);
+	if (nexts < sz) {
+		cmd = (cmd == BFS_DEVICE_GET_BLOCKS) ? BFS_DEVICE_GET_EXTENTS
+											 : BFS_DEVICE_PUT_EXTENTS;
+	}
+
+	// Send the list of blocks or extents (and data for puts), sizing the
+	// buffer up front for the blocks going either way, so it is not
+	// reallocated (and copied) as each block is appended or when the response
+	// is received into it
+	buf = new bfsFlexibleBuffer();
+	if (nexts < sz) {
+		buf->resizeAllocation(BFS_BLOCK_HEADROOM, 0,
+							  (bfs_size_t)(sizeof(size_t) +
+										   sizeof(bfs_block_extent_t) * nexts +
+										   BLK_SZ * sz + BFS_BLOCK_TAILROOM));
+		buf->addTrailer(nexts);
+		buf->addTrailer((char *)exts.data(),
+						(bfs_size_t)(sizeof(bfs_block_extent_t) * nexts));
+	} else {
+		buf->resizeAllocation(BFS_BLOCK_HEADROOM, 0,
+							  (bfs_size_t)(sizeof(size_t) +
+										   (sizeof(bfs_block_id_t) + BLK_SZ) *
+											   sz +
+										   BFS_BLOCK_TAILROOM));
+		buf->addTrailer(sz);
+	}
+	for (it = blks.begin(); it != blks.end(); it++) {
+		rblkid = (bfs_block_id_t)it->first;
+		if (nexts == sz) {
+			buf->addTrailer(rblkid);
+		}
+		if ((cmd == BFS_DEVICE_PUT_BLOCKS) || (cmd == BFS_DEVICE_PUT_EXTENTS)) {
+			buf->addTrailer(it->second->getBuffer(), BLK_SZ);
+		}
+	}
+
+	// Sending verbose information
+	if (levelEnabled(DEVICE_VRBLOG_LEVEL)) {
+		for (it = blks.begin(); it != blks.end(); it++) {
+			msg += " : " + to_string(it->first);
+		}
+		logMessage(DEVICE_VRBLOG_LEVEL, "%s sending to device=%lu, %u blocks%s",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd), deviceID, blks.size(),
+				   msg.c_str());
+	}
+
+	// Send the request, keep the buffer to receive the response
+	if ((tag = submitRequest(cmd, *buf, 0, NULL, NULL, true)) == 0) {
+		delete buf;
+		return (0);
+	}
+
+	// Return the tag for the request
+	return (tag);
+}
+
+/**
+ * @brief Check the response to a get/put extents request against the blocks
+ * requested and (for gets) copy the data out of it into the blocks.  Releases
+ * the request buffer.
+ *
+ * @param cmd - the command (BFS_DEVICE_GET_EXTENTS or BFS_DEVICE_PUT_EXTENTS)
+ * @param buf - the request buffer (holding the response)
+ * @param blks - the blocks passed when the request was sent
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::waitExtents(bfs_device_msg_t cmd, bfsFlexibleBuffer *buf,
+								 bfs_block_list_t &blks) {
+
+	// Local variables
+	bfs_block_list_t::iterator it;
+	vector<bfs_block_extent_t> exts;
+	size_t nexts, rnexts, hdr;
+	char *data;
+
+	// Sanity check the response size
+	nexts = getBlockExtents(blks, exts);
+	hdr = sizeof(bfs_block_extent_t) * nexts;
+	if (buf->getLength() !=
+		sizeof(size_t) + hdr +
+			((cmd == BFS_DEVICE_GET_EXTENTS) ? BLK_SZ * blks.size() : 0)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Extents request [%s] bad data response, abort [len=%d].",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd), buf->getLength());
+		delete buf;
+		return (-1);
+	}
+
+	// Check the extents echoed are the ones requested
+	*buf >> rnexts;
+	if ((rnexts != nexts) || (memcmp(buf->getBuffer(), exts.data(), hdr))) {
+		logMessage(LOG_ERROR_LEVEL, "Incorrect extents returned from [%s]",
+				   bfsDeviceLayer::getDeviceMsgStr(cmd));
+		delete buf;
+		return (-1);
+	}
+
+	// Copy out the data (in block order, as the extents are)
+	if (cmd == BFS_DEVICE_GET_EXTENTS) {
+		data = buf->getBuffer() + hdr;
+		for (it = blks.begin(); it != blks.end(); it++, data += BLK_SZ) {
+			memcpy(it->second->getBuffer(), data, BLK_SZ);
+		}
+	}
+	delete buf;
+
+	// Log, return successfully
+	logMessage(DEVICE_LOG_LEVEL, "%s sent to device %lu, %u blocks (%u runs)",
+			   bfsDeviceLayer::getDeviceMsgStr(cmd), deviceID, blks.size(),
+			   nexts);
+	return (0);
+}
+
+/**
+ * @brief Find the runs of adjacent blocks in a block list
+ *
+ * @param blks - the blocks (in block order)
+ * @param exts - the runs of blocks (returned)
+ * @return size_t : the number of runs
+ */
+
+size_t bfsRemoteDevice::getBlockExtents(bfs_block_list_t &blks,
+										vector<bfs_block_extent_t> &exts) {
+
+	// Local variables
+	bfs_block_list_t::iterator it;
+	bfs_block_extent_t ext;
+
+	// Walk the blocks, extending the last run while they are adjacent
+	exts.clear();
+	for (it = blks.begin(); it != blks.end(); it++) {
+		if ((!exts.empty()) &&
+			(exts.back().start + exts.back().count == it->first)) {
+			exts.back().count++;
+		} else {
+			ext.start = it->first;
+			ext.count = 1;
+			exts.push_back(ext);
+		}
+	}
+	return (exts.size());
+}
+
+/**
+ * @brief Put a block into the device, waiting for the response
+ *
+ * @param pblk - the block to put (uses the physical block ID)
+ * @param fua - flag indicating the block must be durable before the response
+ * @return int : 0 is success, -1 is failure
+ */
+
+int bfsRemoteDevice::putBlockWait(PBfsBlock &pblk, bool fua) {
+
+	// Local variables
+	bfs_block_id_t blkid = pblk.get_pbid();
+	bfs_device_tag_t tag;
+
+	// Send the request, wait for the response
+	logMessage(DEVICE_VRBLOG_LEVEL, "Starting putBlock [%d]%s", blkid,
+			   fua ? " (fua)" : "");
+	if (((tag = putBlockAsync(pblk, NULL, NULL, fua)) == 0) ||
+		(waitRequest(tag) != BFS_SUCCESS)) {
+		logMessage(LOG_ERROR_LEVEL,
+				   "Put block request send/recv failed, error.");
+		return (-1);
+	}
+	logMessage(DEVICE_VRBLOG_LEVEL, "putBlock [%d] success", blkid);
+
+	// Return successfully
+	return (0);
+}
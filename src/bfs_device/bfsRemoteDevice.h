@@ -12,10 +12,14 @@
 //  Created : Wed 17 Mar 2021 03:14:31 PM EDT
 //
 
+// Include files
+#include <pthread.h>
+
 // STL-isms
 #include <algorithm>
 #include <map>
 #include <string>
+#include <vector>
 using namespace std;
 
 // Project Includes
@@ -28,10 +32,46 @@ using namespace std;
 //
 // Class definitions
 
+// The maximum number of requests outstanding on a device connection (bounds
+// the data queued in the socket buffers in both directions)
+#define BFS_REMOTE_DEV_MAX_INFLIGHT 32
+
+// The default maximum size of the block data sealed into one request record
+// (larger get/put blocks batches are sent as several records)
+#define BFS_REMOTE_DEV_RECORD_SIZE 262144
+
+// The default number of connections to a device (each thread sends on one of
+// them, so the threads do not all wait on the same connection), a pool is
+// opt-in through the config
+#define BFS_REMOTE_DEV_CONNECTIONS 1
+
+// The low bits of a request tag hold the connection it is sent on
+#define BFS_REMOTE_DEV_CONN_BITS 8
+#define BFS_REMOTE_DEV_MAX_CONNS (1 << BFS_REMOTE_DEV_CONN_BITS)
+
 //
 // Class types
 class bfsRemoteDevice;
 typedef map<bfs_device_id_t, bfsRemoteDevice *> bfsRemoteDeviceList;
+typedef map<bfs_device_tag_t, bfs_device_request_t *> bfsDeviceRequestList;
+typedef map<bfs_device_tag_t, pair<bfs_device_msg_t, bfsFlexibleBuffer *>>
+	bfsDeviceBatchList;
+typedef map<bfs_device_tag_t, vector<pair<bfs_device_tag_t, bfs_block_list_t>>>
+	bfsDeviceRecordList;
+
+// A connection to a remote device.  Each has its own epoch, security
+// association (the cipher state is not shareable) and requests, and is
+// locked on its own, so the connections are driven independently.
+typedef struct {
+	size_t idx;					   // The index (the low bits of its tags)
+	bfsNetworkConnection *conn;	   // The connection to the device
+	bfsSecAssociation *sa;		   // The security association of the connection
+	bfs_device_epoch_t epoch;	   // The epoch (bound into each packet)
+	bfs_device_tag_t next_seq;	   // The sequence of the next request tag
+	bfsDeviceRequestList requests; // The requests sent (not yet released)
+	size_t inflight;			   // The requests awaiting a response
+	pthread_mutex_t lock;		   // Serializes the connection and requests
+} bfs_remote_conn_t;
 
 // Device states
 
@@ -46,8 +86,8 @@ public:
 
 	// Constructors and destructors
 
-	bfsRemoteDevice(string address, unsigned short port);
-	// Device address constructor
+	bfsRemoteDevice(string address, unsigned short port, size_t nconns = 0);
+	// Device address constructor (0 connections is the configured number)
 
 	virtual ~bfsRemoteDevice(void);
 	// Destructor
@@ -61,11 +101,37 @@ public:
 	// Return the number of blocks in the storage
 	virtual uint64_t getNumBlocks(void) { return (numBlocks); }
 
+	// Return the state of the device
+	virtual bfs_device_state_t getDeviceState(void) { return (devState); }
+
 	// Set the security association
 	virtual void setSecurityAssociation(bfsSecAssociation *sa) {
 		secContext = sa;
 	}
 
+	// Get the security association
+	bfsSecAssociation *getSecurityAssociation(void) { return (secContext); }
+
+	// Get the address of the device
+	string getCommAddress(void) { return (commAddress); }
+
+	// Get the port of the device
+	unsigned short getCommPort(void) { return (commPort); }
+
+	// Set the security configuration (the associations of the connections)
+	void setSecurityConfig(bfsCfgItem *cfg) { secConfig = cfg; }
+
+	// Get the (first) connection to the device
+	bfsNetworkConnection *getConnection(void) { return (getConnection(0)); }
+
+	// Get a connection to the device
+	bfsNetworkConnection *getConnection(size_t idx) {
+		return ((idx < rd_conns.size()) ? rd_conns[idx]->conn : NULL);
+	}
+
+	// Get the number of connections to the device
+	size_t getNumConnections(void) { return (rd_conns.size()); }
+
 	//
 	// Class Methods
 
@@ -75,8 +141,28 @@ public:
 	virtual int bfsDeviceUninitialize(void);
 	// De-initialze the device
 
-	int submit_io(PBfsBlock &, bool = true);
-	// Submit an io request to the disk worker
+	bfs_device_tag_t submitRequest(bfs_device_msg_t cmd, bfsFlexibleBuffer &buf,
+								   bfs_block_id_t pbid,
+								   bfs_device_cb_t cb = NULL,
+								   void *arg = NULL, bool batch = false);
+	// Send a request without waiting for the response (returns tag, 0 fail)
+
+	int waitRequest(bfs_device_tag_t tag);
+	// Wait for a request to complete, return its status (and release it)
+
+	int waitAllRequests(void);
+	// Wait for all of the outstanding requests to complete
+
+	size_t getInflightRequests(void);
+	// Return the number of requests awaiting a response
+
+	bfs_device_tag_t getBlockAsync(PBfsBlock &pblk, bfs_device_cb_t cb = NULL,
+								   void *arg = NULL);
+	// Get a block from the device (asynchronously, returns the tag)
+
+	bfs_device_tag_t putBlockAsync(PBfsBlock &pblk, bfs_device_cb_t cb = NULL,
+								   void *arg = NULL, bool fua = false);
+	// Put a block into the device (asynchronously, returns the tag)
 
 	virtual int getBlock(PBfsBlock &);
 	virtual int getBlock(bfs_block_id_t, char *);
@@ -91,6 +177,30 @@ public:
 	virtual int putBlocks(bfs_block_list_t &blks);
 	// Put the blocks associated with the following IDs
 
+	virtual bfs_device_tag_t getBlocksAsync(bfs_block_list_t &blks);
+	// Send a get blocks request without waiting (returns tag, 0 fail)
+
+	virtual bfs_device_tag_t putBlocksAsync(bfs_block_list_t &blks);
+	// Send a put blocks request without waiting (returns tag, 0 fail)
+
+	virtual int waitBlocks(bfs_device_tag_t tag, bfs_block_list_t &blks);
+	// Wait for a get/put blocks request, check (and copy out) the response
+
+	virtual int putBlockFua(PBfsBlock &pblk);
+	// Put a block into the device, durable before the response
+
+	virtual int flushDevice(void);
+	// Make the blocks put so far durable on the device
+
+	virtual bfs_device_tag_t flushDeviceAsync(void);
+	// Send a flush request without waiting (returns tag, 0 fail)
+
+	virtual int waitFlush(bfs_device_tag_t tag);
+	// Wait for a flush request to complete
+
+	virtual int trimBlocks(bfs_block_id_t *pbids, uint32_t nblks);
+	// Discard a set of (freed) blocks on the device
+
 	//
 	// Static class methods
 
@@ -103,6 +213,46 @@ private:
 	int changeDeviceState(bfs_device_state_t st);
 	// Change the state of the device
 
+	int openConnection(bfs_remote_conn_t *rc);
+	// Connect a connection of the pool, agree its epoch
+
+	bfs_remote_conn_t *getThreadConnection(void);
+	// Get the connection the calling thread sends its requests on
+
+	// Get the connection a request (tag) was sent on
+	bfs_remote_conn_t *getTagConnection(bfs_device_tag_t tag) {
+		size_t idx = (size_t)(tag & (BFS_REMOTE_DEV_MAX_CONNS - 1));
+		return ((idx < rd_conns.size()) ? rd_conns[idx] : NULL);
+	}
+
+	int reapResponse(bfs_remote_conn_t *rc);
+	// Receive the next response on a connection, complete its request
+
+	int completeRequest(bfs_remote_conn_t *rc, bfs_device_request_t *req);
+	// Unmarshal and check the response for a request
+
+	bfs_device_tag_t submitBlocks(bfs_device_msg_t cmd,
+								  bfs_block_list_t &blks);
+	// Marshal and send a get/put blocks request (split into records)
+
+	bfs_device_tag_t submitRecord(bfs_device_msg_t cmd,
+								  bfs_block_list_t &blks);
+	// Marshal and send one get/put blocks record (buffer kept until waited)
+
+	int waitRecord(bfs_device_tag_t tag, bfs_block_list_t &blks);
+	// Wait for one get/put blocks record, check (and copy out) the blocks
+
+	int putBlockWait(PBfsBlock &pblk, bool fua);
+	// Put a block into the device and wait for the response
+
+	int waitExtents(bfs_device_msg_t cmd, bfsFlexibleBuffer *buf,
+					bfs_block_list_t &blks);
+	// Check a get/put extents response (and copy out the blocks got)
+
+	static size_t getBlockExtents(bfs_block_list_t &blks,
+								  vector<bfs_block_extent_t> &exts);
+	// Find the runs of adjacent blocks in a block list
+
 	//
 	// Class Data
 
@@ -121,16 +271,32 @@ private:
 	unsigned short commPort;
 	// This is the port number on which it is bound.
 
-	bfsNetworkConnection *remoteConn;
-	// This is the server socket waiting for incoming connects().
-
 	bfsConnectionMux *remoteMux;
 	// This is a multiplexer for the communications
 
 	bfsSecAssociation *secContext;
-	// This is the security association (keys/config)
+	// This is the security association (keys/config) of the first connection
+
+	bfsCfgItem *secConfig;
+	// The security configuration (the associations of the other connections)
+
+	size_t rd_nconns;
+	// The number of connections to open to the device
+
+	vector<bfs_remote_conn_t *> rd_conns;
+	// The connections to the device (the tags of each in its low bits)
+
+	bfsDeviceBatchList rd_batches;
+	// The request buffers of the get/put blocks requests not yet waited on
+
+	bfsDeviceRecordList rd_records;
+	// The records (tag, blocks) of the batches split, by the first tag
+
+	size_t rd_record_blocks;
+	// The maximum number of blocks sealed into one record
 
-	uint32_t rd_send_seq, rd_recv_seq;
+	pthread_mutex_t rd_lock;
+	// Protects the batches and records (nests inside a connection's lock)
 };
 
 #endif
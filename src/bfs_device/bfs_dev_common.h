@@ -49,20 +49,50 @@ typedef enum {
 	BFS_DEVICE_PUT_BLOCKS,	 // Put a set of blocks
 	BFS_DEVICE_PUT_BLOCK_TAGGED,
 	BFS_DEVICE_GET_BLOCK_TAGGED,
+	BFS_DEVICE_FLUSH,		  // Make the blocks put so far durable (barrier)
+	BFS_DEVICE_PUT_BLOCK_FUA, // Put a block, durable before the response
+	BFS_DEVICE_TRIM_BLOCKS,	  // Discard a set of (freed) blocks
+	BFS_DEVICE_GET_EXTENTS,	  // Get a set of runs of blocks
+	BFS_DEVICE_PUT_EXTENTS,	  // Put a set of runs of blocks
 	BFS_DEVICE_MAX_MSG // Guard value
 } bfs_device_msg_t;
 
-// A device packet for the disk-worker job queue (note: data also contains some
-// of the params for the device to unpack as well)
+// The request tag carried (in the clear, bound as AAD) on each device packet
+typedef uint64_t bfs_device_tag_t;
+
+// The epoch of a device connection, a nonce chosen by each end when the
+// connection opens and bound (with the tag) as AAD on each packet, so that
+// packets recorded on one connection are rejected on any other
+typedef struct {
+	uint64_t client; // The nonce chosen by the client (remote device)
+	uint64_t device; // The nonce chosen by the (network) device
+} bfs_device_epoch_t;
+
+// A run of contiguous blocks on a device (as sent in the extent commands,
+// the blocks' data follows the list of extents, in order)
 typedef struct {
-	char *req_data;
-	bfs_block_id_t pbid;
-	size_t len;
-	void *remoteMux;
-	void *remoteConn;
-    int ready; // flag indicating if job is done
-    int sync;
-} device_req_packet_t;
+	bfs_block_id_t start; // The first block of the run
+	uint64_t count;		  // The number of blocks in the run
+} bfs_block_extent_t;
+
+// Tag returned for batched requests a device completed on submission
+#define BFS_DEVICE_TAG_DONE ((bfs_device_tag_t)-1)
+
+// An outstanding (pipelined) request on a remote device connection, the
+// response is matched to the request by its tag
+struct bfs_device_request;
+typedef void (*bfs_device_cb_t)(struct bfs_device_request *req, void *arg);
+class bfsFlexibleBuffer;
+typedef struct bfs_device_request {
+	bfs_device_tag_t tag;	// The request tag (and AAD of the packets)
+	bfs_device_msg_t cmd;	// The command sent in the request
+	bfs_block_id_t pbid;	// The physical block (single block requests)
+	bfsFlexibleBuffer *buf; // The buffer the response is received into
+	int status;				// BFS_SUCCESS/BFS_FAILURE once done
+	bool done;				// Flag indicating the response was processed
+	bfs_device_cb_t cb;		// Completion callback (NULL if none)
+	void *cbarg;			// The argument passed to the callback
+} bfs_device_request_t;
 
 // The topo information for the device
 typedef struct {
@@ -13,9 +13,16 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 // STL Includes
 #include <algorithm>
+#include <fstream>
+#include <iterator>
 using namespace std;
 
 // Project Include Files
@@ -24,26 +31,91 @@ using namespace std;
 #include <bfsDeviceLayer.h>
 #include <bfsDeviceError.h>
 #include <bfsConfigLayer.h>
+#include <bfsRemoteDevice.h>
+#include <bfsDeviceStorage.h>
+#include <bfsDeviceCache.h>
 
 // Defines
-#define BFSDEVICEUT_ARGUMENTS "vhl:p:d:b:"
+#define BFSDEVICEUT_ARGUMENTS "vhl:p:d:b:s:q:x:e:"
 #define USAGE \
-	"USAGE: bfs_device [-h] [-v] [-l <logfile>]\n" \
+	"USAGE: bfs_device [-h] [-v] [-l <logfile>] [-s <ops>] [-q <ops>] [-x <ops>] [-e <ops>]\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -s - benchmark device ops/sec over pools of 1, 2 and 4 connections\n" \
+	"    -q - benchmark mmap and direct storage at queue depths 1-128\n" \
+	"    -x - benchmark batches of scattered blocks against runs (extents)\n" \
+	"    -e - benchmark sealing/opening 4 KB and 64 KB packets (cycles/byte)\n" \
 	"\n" 
 #define BFS_DEV_UNIT_TEST_SLOTS 256
 #define BFS_DEV_UNIT_TEST_ITERATIONS 1024
+#define BFS_DEV_UNIT_TEST_DURABLE 5
 #define BFS_DEV_UTEST_SLOTS 10
+#undef BFS_UTEST_UNUSED // (block layer version is 64 bit)
 #define BFS_UTEST_UNUSED (uint16_t)-1
+#define BFS_DEV_BENCH_MAX_CONNS 4
+#define BFS_DEV_BENCH_MAX_QDEPTH 128
+#define BFS_DEV_BENCH_RUN 64
+#define BFS_DEV_CACHE_BLOCKS 100
+#define BFS_DEV_CACHE_HOT 50
+#define BFS_DEV_CACHE_SCAN 1000
+#define BFS_DEV_JOURNAL_BLOCKS 512
+#define BFS_DEV_JOURNAL_STORAGE 2048
+#define BFS_DEV_JOURNAL_BATCH 16
+#define BFS_DEV_JOURNAL_PUTS 3
+#define BFS_DEV_JOURNAL_LARGE 200
+#define BFS_DEV_JOURNAL_ROUNDS 8
+#define BFS_DEV_JOURNAL_THREADS 4
+#define BFS_DEV_JOURNAL_TPUTS 32
+
+// A benchmark connection (and the thread driving it)
+typedef struct {
+    bfsRemoteDevice *rdev; // The connection to the device
+    int              ops;  // The number of puts (then gets) to run
+    int              ret;  // 0 if successful, -1 if failure
+    pthread_t        thr;  // The thread driving the connection
+} bfs_dev_bench_conn_t;
+
+// A thread putting batches through a storage journal (concurrently)
+typedef struct {
+    bfsDeviceStorage *storage; // The journaled storage
+    char             *data;    // The blocks to put (indexed by block ID)
+    int               first;   // The first block of the thread's batches
+    int               ret;     // 0 if successful, -1 if failure
+    pthread_t         thr;     // The thread putting the batches
+} bfs_dev_journal_putter_t;
 
 // Global data
 
+// The benchmark clock (cycles where there is a counter, else nanoseconds)
+#if defined(__x86_64__) || defined(__i386__)
+#define BFS_DEV_BENCH_CLOCK_UNIT "cycles"
+static inline uint64_t bfsDeviceBenchClock( void ) { return( __rdtsc() ); }
+#else
+#define BFS_DEV_BENCH_CLOCK_UNIT "ns"
+static inline uint64_t bfsDeviceBenchClock( void ) {
+    return( (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count() );
+}
+#endif
+
 // Functional Prototypes
 int bfsDeviceLayerUnitTest( void );
+int bfsDevicePipelineUnitTest( bfs_device_list_t & devList );
+int bfsDeviceReplayUnitTest( bfs_device_list_t & devList );
+int bfsDeviceDurabilityUnitTest( bfs_device_list_t & devList );
+int bfsDeviceCacheUnitTest( void );
+int bfsDeviceJournalUnitTest( void );
+bfsDeviceStorage *bfsDeviceJournalOpen( string path );
+int bfsDeviceJournalCrash( string path, string & jnl, int torn );
+void *bfsDeviceJournalPutThread( void *arg );
+int bfsDeviceScalingBench( int ops );
+void *bfsDeviceBenchThread( void *arg );
+int bfsDeviceStorageBench( int ops );
+int bfsDeviceExtentBench( int ops );
+int bfsDeviceSealBench( int ops );
 
 // 
 // Functions
@@ -60,7 +132,8 @@ int bfsDeviceLayerUnitTest( void );
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, bench_ops = 0, qbench_ops = 0,
+	    xbench_ops = 0, ebench_ops = 0;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, BFSDEVICEUT_ARGUMENTS)) != -1) {
@@ -79,6 +152,22 @@ int main( int argc, char *argv[] ) {
 			log_initialized = 1;
 			break;
 
+		case 's': // Benchmark the device ops/sec
+			bench_ops = atoi( optarg );
+			break;
+
+		case 'q': // Benchmark the storage backends
+			qbench_ops = atoi( optarg );
+			break;
+
+		case 'x': // Benchmark the extents
+			xbench_ops = atoi( optarg );
+			break;
+
+		case 'e': // Benchmark the packet sealing
+			ebench_ops = atoi( optarg );
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option, aborting.\n" );
 			return( -1 );
@@ -103,6 +192,36 @@ int main( int argc, char *argv[] ) {
         }
         // TODO: MUCH OF THIS BLOCK NEED TO BE MOVED TO A GLOBAL INIT FUNCTION
         
+        // Run the benchmark instead of the unit test, if asked
+        if ( bench_ops > 0 ) {
+            if ( bfsDeviceScalingBench(bench_ops) ) {
+                logMessage( LOG_ERROR_LEVEL, "BFS device benchmark failed, aborting." );
+                return( -1 );
+            }
+            return( 0 );
+        }
+        if ( qbench_ops > 0 ) {
+            if ( bfsDeviceStorageBench(qbench_ops) ) {
+                logMessage( LOG_ERROR_LEVEL, "BFS storage benchmark failed, aborting." );
+                return( -1 );
+            }
+            return( 0 );
+        }
+        if ( xbench_ops > 0 ) {
+            if ( bfsDeviceExtentBench(xbench_ops) ) {
+                logMessage( LOG_ERROR_LEVEL, "BFS extent benchmark failed, aborting." );
+                return( -1 );
+            }
+            return( 0 );
+        }
+        if ( ebench_ops > 0 ) {
+            if ( bfsDeviceSealBench(ebench_ops) ) {
+                logMessage( LOG_ERROR_LEVEL, "BFS seal benchmark failed, aborting." );
+                return( -1 );
+            }
+            return( 0 );
+        }
+
         // Call the UNIT test code, check for error
         if ( bfsDeviceLayerUnitTest() ) {
             logMessage( LOG_ERROR_LEVEL, "BFS device layer failed, aborting." );
@@ -138,7 +257,7 @@ int bfsDeviceLayerUnitTest( void ) {
     bfs_block_id_t tblk, blkid;
     int slot, devat, idx, start;
     char utstr[129];
-    size_t blocks, i;
+    size_t blocks, i, j;
     vector<int> slots;  
     vector<int>::iterator sit;
 
@@ -278,8 +397,8 @@ int bfsDeviceLayerUnitTest( void ) {
             if ( blocks > 0 ) {
 
 				// Set up the block list (and location to stick data)
-				for (i = 0; i < slots.size(); i++) {
-					blkid = utblks[slots.at(i)].blk;
+				for (j = 0; j < slots.size(); j++) {
+					blkid = utblks[slots.at(j)].blk;
 					blist[blkid] = new PBfsBlock(NULL, BLK_SZ, 0, 0, blkid, device);
 				}
 
@@ -300,15 +419,15 @@ int bfsDeviceLayerUnitTest( void ) {
                 }
 
                 // Validate the blocks we submitted were the same as returned
-                for ( i=0; i<slots.size(); i++ ) {
-                    slot = slots[i];
-					if (memcmp( utblks[slots[i]].block, blist[utblks[slots[i]].blk]->
+                for ( j=0; j<slots.size(); j++ ) {
+                    slot = slots[j];
+					if (memcmp( utblks[slots[j]].block, blist[utblks[slots[j]].blk]->
                         getBuffer(), BLK_SZ) != 0) {
 						logMessage( LOG_ERROR_LEVEL, "Retrieved block [%lu] (from device [%lu]) failed match validation.",
                             utblks[slot].blk, utblks[slot].dev );
                         bufToString( utblks[slot].block, BLK_SZ, utstr, 128 );
                         logMessage( LOG_ERROR_LEVEL, "Failed stored  : [%s]", utstr );
-                        bufToString( blist[utblks[slots[i]].blk]->getBuffer(), BLK_SZ, utstr, 128 );
+                        bufToString( blist[utblks[slots[j]].blk]->getBuffer(), BLK_SZ, utstr, 128 );
                         logMessage( LOG_ERROR_LEVEL, "Failed recevied: [%s]", utstr );
                         return( -1);
 					}
@@ -322,10 +441,960 @@ int bfsDeviceLayerUnitTest( void ) {
         }
     }
 
+    // Now test the pipelined (asynchronous) requests on the remote devices
+    if ( bfsDevicePipelineUnitTest(devList) ) {
+        return( -1 );
+    }
+
+    // Make sure packets cannot be replayed onto a new connection
+    if ( bfsDeviceReplayUnitTest(devList) ) {
+        return( -1 );
+    }
+
+    // Test the flush, write-through (FUA) and trim commands
+    if ( bfsDeviceDurabilityUnitTest(devList) ) {
+        return( -1 );
+    }
+
+    // Test the admission/eviction of the storage block cache
+    if ( bfsDeviceCacheUnitTest() ) {
+        return( -1 );
+    }
+
+    // Test the replay of the storage write journal after a crash
+    if ( bfsDeviceJournalUnitTest() ) {
+        return( -1 );
+    }
+
     // When we have a shutdown method, we will add it here
     // TODO: add layer shutdowm method
 
     // Log saluation, return succesfully
     logMessage( LOG_INFO_LEVEL, "Completed bfs device unit test successfull, exiting." );
     return( 0 );
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDevicePipelineUnitTest
+// Description  : Test many outstanding (tagged) requests per connection on
+//                each of the remote devices.
+//
+// Inputs       : devList - the list of devices to test
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDevicePipelineUnitTest( bfs_device_list_t & devList ) {
+
+    // Local variables
+    bfs_device_list_t::iterator it;
+    bfsRemoteDevice *rdev;
+    PBfsBlock *pblks[BFS_DEV_UNIT_TEST_SLOTS];
+    bfs_device_tag_t tags[BFS_DEV_UNIT_TEST_SLOTS];
+    char data[BFS_DEV_UNIT_TEST_SLOTS][BLK_SZ];
+    bfs_block_id_t base;
+    int i, slots;
+
+    // Walk the remote devices, putting then getting a window of blocks
+    slots = ( BFS_REMOTE_DEV_MAX_INFLIGHT*2 < BFS_DEV_UNIT_TEST_SLOTS ) ?
+        BFS_REMOTE_DEV_MAX_INFLIGHT*2 : BFS_DEV_UNIT_TEST_SLOTS;
+    for ( it=devList.begin(); it!=devList.end(); it++ ) {
+        if ( (rdev = dynamic_cast<bfsRemoteDevice *>(it->second)) == NULL ) {
+            continue;
+        }
+        base = get_random_value( 0, (uint32_t)(rdev->getNumBlocks()-slots-1) );
+
+        // Submit all of the puts before waiting on any of them
+        for ( i=0; i<slots; i++ ) {
+            get_random_data( data[i], BLK_SZ );
+            pblks[i] = new PBfsBlock( data[i], BLK_SZ, 0, 0, base+i, rdev );
+            if ( (tags[i] = rdev->putBlockAsync(*pblks[i])) == 0 ) {
+                logMessage( LOG_ERROR_LEVEL, "Pipelined put submit failed [%lu]", base+i );
+                return( -1 );
+            }
+        }
+        for ( i=0; i<slots; i++ ) {
+            if ( rdev->waitRequest(tags[i]) != BFS_SUCCESS ) {
+                logMessage( LOG_ERROR_LEVEL, "Pipelined put failed [%lu]", base+i );
+                return( -1 );
+            }
+            delete pblks[i];
+        }
+
+        // Now the gets, waiting on them in reverse order
+        for ( i=0; i<slots; i++ ) {
+            pblks[i] = new PBfsBlock( NULL, BLK_SZ, 0, 0, base+i, rdev );
+            if ( (tags[i] = rdev->getBlockAsync(*pblks[i])) == 0 ) {
+                logMessage( LOG_ERROR_LEVEL, "Pipelined get submit failed [%lu]", base+i );
+                return( -1 );
+            }
+        }
+        for ( i=slots-1; i>=0; i-- ) {
+            if ( (rdev->waitRequest(tags[i]) != BFS_SUCCESS) ||
+                 (memcmp(data[i], pblks[i]->getBuffer(), BLK_SZ) != 0) ) {
+                logMessage( LOG_ERROR_LEVEL, "Pipelined get failed validation [%lu]", base+i );
+                return( -1 );
+            }
+            delete pblks[i];
+        }
+
+        // Log the unit test thing
+        logMessage( LOG_INFO_LEVEL, "Successful pipelined put/get of %d blocks on device [%lu]",
+            slots, rdev->getDeviceIdenfier() );
+    }
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceDurabilityUnitTest
+// Description  : Put a block with FUA and a set of blocks followed by a flush
+//                on each device, then trim some of the blocks and make sure
+//                they read back as zeros (and the others are intact).
+//
+// Inputs       : devList - the list of devices to test
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceDurabilityUnitTest( bfs_device_list_t & devList ) {
+
+    // Local variables
+    bfs_device_list_t::iterator it;
+    bfs_block_list_t blist;
+    bfs_block_id_t base, trims[2];
+    bfsDevice *device;
+    char data[BFS_DEV_UNIT_TEST_DURABLE][BLK_SZ], zeros[BLK_SZ];
+    PBfsBlock *pblk;
+    int i;
+
+    // Walk the devices, putting then trimming a run of blocks
+    memset( zeros, 0x0, BLK_SZ );
+    for ( it=devList.begin(); it!=devList.end(); it++ ) {
+        device = it->second;
+        base = get_random_value( 0, (uint32_t)(device->getNumBlocks()-BFS_DEV_UNIT_TEST_DURABLE-1) );
+
+        // Put the first block with FUA, the rest as a batch then flush
+        for ( i=0; i<BFS_DEV_UNIT_TEST_DURABLE; i++ ) {
+            get_random_data( data[i], BLK_SZ );
+        }
+        pblk = new PBfsBlock( data[0], BLK_SZ, 0, 0, base, device );
+        if ( device->putBlockFua(*pblk) ) {
+            logMessage( LOG_ERROR_LEVEL, "Put block (FUA) failed [%lu]", base );
+            return( -1 );
+        }
+        delete pblk;
+        for ( i=1; i<BFS_DEV_UNIT_TEST_DURABLE; i++ ) {
+            blist[base+i] = new PBfsBlock( data[i], BLK_SZ, 0, 0, base+i, device );
+        }
+        if ( device->putBlocks(blist) || device->flushDevice() ) {
+            logMessage( LOG_ERROR_LEVEL, "Put blocks/flush failed on device [%lu]", it->first );
+            return( -1 );
+        }
+        for ( auto bit=blist.begin(); bit!=blist.end(); bit++ ) {
+            delete bit->second;
+        }
+        blist.clear();
+
+        // Trim two of the blocks (not adjacent), then read them all back
+        trims[0] = base+1;
+        trims[1] = base+3;
+        if ( device->trimBlocks(trims, 2) ) {
+            logMessage( LOG_ERROR_LEVEL, "Trim blocks failed on device [%lu]", it->first );
+            return( -1 );
+        }
+        for ( i=0; i<BFS_DEV_UNIT_TEST_DURABLE; i++ ) {
+            blist[base+i] = new PBfsBlock( NULL, BLK_SZ, 0, 0, base+i, device );
+        }
+        if ( device->getBlocks(blist) ) {
+            logMessage( LOG_ERROR_LEVEL, "Get blocks after trim failed on device [%lu]", it->first );
+            return( -1 );
+        }
+        for ( i=0; i<BFS_DEV_UNIT_TEST_DURABLE; i++ ) {
+            if ( memcmp(((i == 1) || (i == 3)) ? zeros : data[i],
+                        blist[base+i]->getBuffer(), BLK_SZ) != 0 ) {
+                logMessage( LOG_ERROR_LEVEL, "Block [%lu] failed validation after trim", base+i );
+                return( -1 );
+            }
+            delete blist[base+i];
+        }
+        blist.clear();
+
+        // Log the unit test thing
+        logMessage( LOG_INFO_LEVEL, "Successful flush/FUA/trim on device [%lu]", it->first );
+    }
+
+    // Return successfully
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceCacheUnitTest
+// Description  : Make a set of hot blocks frequently used in a storage block
+//                cache, then scan many more cold blocks through it: the hot
+//                blocks must survive the scan (intact).  Also make sure the
+//                reads racing a put are not admitted, and that invalidated
+//                blocks are dropped.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceCacheUnitTest( void ) {
+
+    // Local variables
+    bfsDeviceCache *cache = new bfsDeviceCache( BFS_DEV_CACHE_BLOCKS );
+    char data[BFS_DEV_CACHE_HOT][BLK_SZ], blk[BLK_SZ];
+    bfs_device_cache_stats_t st;
+    uint64_t ticket, stale;
+    bfs_block_id_t cold;
+    int i, j, ret = 0;
+
+    // Read the hot blocks a few times each (admitting them on the misses)
+    for ( i=0; i<BFS_DEV_CACHE_HOT; i++ ) {
+        get_random_data( data[i], BLK_SZ );
+        for ( j=0; j<5; j++ ) {
+            if ( ! cache->getBlock(i, blk, ticket) ) {
+                cache->admitBlock( i, data[i], ticket );
+            }
+        }
+    }
+
+    // Scan the cold blocks through, then make sure the hot ones survived
+    for ( i=0; i<BFS_DEV_CACHE_SCAN; i++ ) {
+        if ( ! cache->getBlock(BFS_DEV_CACHE_HOT+i, blk, ticket) ) {
+            cache->admitBlock( BFS_DEV_CACHE_HOT+i, data[0], ticket );
+        }
+    }
+    for ( i=0; (ret == 0) && (i<BFS_DEV_CACHE_HOT); i++ ) {
+        if ( (! cache->getBlock(i, blk, ticket)) || (memcmp(blk, data[i], BLK_SZ) != 0) ) {
+            logMessage( LOG_ERROR_LEVEL, "Hot block [%d] not cached (intact) after scan", i );
+            ret = -1;
+        }
+    }
+
+    // A read missing before a put must not be admitted after it
+    cold = BFS_DEV_CACHE_HOT + BFS_DEV_CACHE_SCAN;
+    if ( (ret == 0) && cache->getBlock(cold, blk, stale) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device cache hit a block never admitted" );
+        ret = -1;
+    }
+    cache->updateBlock( 0, data[1] );
+    cache->admitBlock( cold, data[0], stale );
+    if ( (ret == 0) && cache->getBlock(cold, blk, ticket) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device cache admitted a block read before a put" );
+        ret = -1;
+    }
+
+    // The put updated the cached copy, and invalidated blocks are dropped
+    if ( (ret == 0) && ((! cache->getBlock(0, blk, ticket)) || (memcmp(blk, data[1], BLK_SZ) != 0)) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device cache did not update a block put" );
+        ret = -1;
+    }
+    cache->invalidateBlock( 0 );
+    if ( (ret == 0) && cache->getBlock(0, blk, ticket) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device cache kept an invalidated block" );
+        ret = -1;
+    }
+
+    // Log the unit test thing, clean up
+    st = cache->getStats();
+    if ( ret == 0 ) {
+        logMessage( LOG_INFO_LEVEL, "Successful device cache test (%lu hits, %lu misses, %lu admitted, %lu rejected)",
+            st.hits, st.misses, st.admitted, st.rejected );
+    }
+    delete cache;
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceJournalUnitTest
+// Description  : Put a few batches to a journaled storage, then "crash" it
+//                (the blocks never reach the data area): reopening must
+//                replay the batches, except one whose record was torn (none
+//                of its blocks may be applied).  Then put large batches
+//                (a record each) through the journal until it wraps, put
+//                batches from several threads at once (their records share
+//                syncs), and check a journal too small for them is refused.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceJournalUnitTest( void ) {
+
+    // Local variables
+    const int nput = BFS_DEV_JOURNAL_PUTS*BFS_DEV_JOURNAL_BATCH;
+    const int nlarge = BFS_DEV_JOURNAL_ROUNDS*BFS_DEV_JOURNAL_LARGE;
+    char *data = new char[nlarge*BLK_SZ], *blks[BFS_DEV_JOURNAL_LARGE], blk[BLK_SZ], zeros[BLK_SZ];
+    bfs_block_id_t blkids[BFS_DEV_JOURNAL_LARGE];
+    bfs_dev_journal_putter_t putters[BFS_DEV_JOURNAL_THREADS];
+    bfs_device_journal_stats_t st;
+    bfsDeviceStorage *storage, *small;
+    uint64_t records, syncs;
+    string path, jnl;
+    int i, j, torn, nbatch, nstarted, ret = 0;
+
+    // Start a new storage next to the first device's
+    path = bfsConfigLayer::getConfigItem( BFS_DEVLYR_DEVICES_CONFIG )->getSubItemByIndex(0)
+               ->getSubItemByName("path")->bfsCfgItemValue() + ".jtest";
+    unlink( path.c_str() );
+    unlink( (path+".journal").c_str() );
+    memset( zeros, 0x0, BLK_SZ );
+    get_random_data( data, nlarge*BLK_SZ );
+    if ( (storage = bfsDeviceJournalOpen(path)) == NULL ) {
+        delete [] data;
+        return( -1 );
+    }
+    if ( storage->getJournal()->getCapacity() <= 2*BFS_DEV_JOURNAL_PUTS*(BFS_DEV_JOURNAL_BATCH+1) ) {
+        logMessage( LOG_INFO_LEVEL, "Device journal too small to test a crash, skipping" );
+        delete storage;
+        delete [] data;
+        return( 0 );
+    }
+
+    // Put the batches (too few to checkpoint), keep the journal as it was
+    for ( i=0; (ret == 0) && (i<BFS_DEV_JOURNAL_PUTS); i++ ) {
+        for ( j=0; j<BFS_DEV_JOURNAL_BATCH; j++ ) {
+            blkids[j] = i*BFS_DEV_JOURNAL_BATCH + j;
+            blks[j] = &data[blkids[j]*BLK_SZ];
+        }
+        ret = storage->putBlocks( blkids, BFS_DEV_JOURNAL_BATCH, blks );
+    }
+    std::ifstream jin( path+".journal", std::ios::binary );
+    jnl.assign( std::istreambuf_iterator<char>(jin), std::istreambuf_iterator<char>() );
+    jin.close();
+    delete storage;
+    storage = NULL;
+
+    // Crash it, then with the last record torn (its blocks stay zeros)
+    for ( torn=0; (ret == 0) && (torn<2); torn++ ) {
+        if ( bfsDeviceJournalCrash(path, jnl, torn) || ((storage = bfsDeviceJournalOpen(path)) == NULL) ) {
+            ret = -1;
+            break;
+        }
+        for ( i=0; (ret == 0) && (i<nput); i++ ) {
+            if ( (storage->getBlock(i, blk) == NULL) ||
+                 (memcmp(blk, (torn && (i >= nput-BFS_DEV_JOURNAL_BATCH)) ? zeros : &data[i*BLK_SZ], BLK_SZ) != 0) ) {
+                logMessage( LOG_ERROR_LEVEL, "Block [%d] not replayed from device journal (torn=%d)", i, torn );
+                ret = -1;
+            }
+        }
+        st = storage->getJournal()->getStats();
+        if ( (ret == 0) && (st.replayed != (uint64_t)(BFS_DEV_JOURNAL_PUTS-torn)) ) {
+            logMessage( LOG_ERROR_LEVEL, "Device journal replayed %lu records, expected %d",
+                st.replayed, BFS_DEV_JOURNAL_PUTS-torn );
+            ret = -1;
+        }
+        if ( torn == 0 ) {
+            delete storage;
+            storage = NULL;
+        }
+    }
+
+    // Put large batches through the journal (wrapping), read them back
+    nbatch = (ret == 0) ? (int)min( (uint32_t)BFS_DEV_JOURNAL_LARGE, storage->getJournal()->getMaxRecordBlocks() ) : 0;
+    for ( i=0; (ret == 0) && (i<BFS_DEV_JOURNAL_ROUNDS); i++ ) {
+        for ( j=0; j<nbatch; j++ ) {
+            blkids[j] = (i*nbatch + j) % BFS_DEV_JOURNAL_STORAGE;
+            blks[j] = &data[(i*nbatch + j)*BLK_SZ];
+        }
+        ret = storage->putBlocks( blkids, nbatch, blks );
+    }
+    for ( i=0; (ret == 0) && (i<BFS_DEV_JOURNAL_ROUNDS*nbatch); i++ ) {
+        if ( (storage->getBlock(i % BFS_DEV_JOURNAL_STORAGE, blk) == NULL) ||
+             (memcmp(blk, &data[i*BLK_SZ], BLK_SZ) != 0) ) {
+            logMessage( LOG_ERROR_LEVEL, "Block [%d] failed validation after journaled put", i );
+            ret = -1;
+        }
+    }
+
+    // Put batches from several threads at once, read them back
+    st = (ret == 0) ? storage->getJournal()->getStats() : st;
+    records = st.records;
+    syncs = st.syncs;
+    for ( nstarted=0; (ret == 0) && (nstarted<BFS_DEV_JOURNAL_THREADS); nstarted++ ) {
+        putters[nstarted].storage = storage;
+        putters[nstarted].data = data;
+        putters[nstarted].first = nstarted*BFS_DEV_JOURNAL_TPUTS*BFS_DEV_JOURNAL_BATCH;
+        putters[nstarted].ret = 0;
+        if ( pthread_create(&putters[nstarted].thr, NULL, bfsDeviceJournalPutThread, &putters[nstarted]) ) {
+            logMessage( LOG_ERROR_LEVEL, "Failed creating device journal put thread" );
+            ret = -1;
+            break;
+        }
+    }
+    for ( i=0; i<nstarted; i++ ) {
+        pthread_join( putters[i].thr, NULL );
+        ret = (putters[i].ret != 0) ? -1 : ret;
+    }
+    for ( i=0; (ret == 0) && (i<BFS_DEV_JOURNAL_THREADS*BFS_DEV_JOURNAL_TPUTS*BFS_DEV_JOURNAL_BATCH); i++ ) {
+        if ( (storage->getBlock(i % BFS_DEV_JOURNAL_STORAGE, blk) == NULL) ||
+             (memcmp(blk, &data[(i % nlarge)*BLK_SZ], BLK_SZ) != 0) ) {
+            logMessage( LOG_ERROR_LEVEL, "Block [%d] failed validation after concurrent journaled put", i );
+            ret = -1;
+        }
+    }
+    if ( ret == 0 ) {
+        st = storage->getJournal()->getStats();
+        if ( (st.records-records != BFS_DEV_JOURNAL_THREADS*BFS_DEV_JOURNAL_TPUTS) || (st.syncs-syncs > st.records-records) ) {
+            logMessage( LOG_ERROR_LEVEL, "Device journal synced %lu times for %lu concurrent records",
+                st.syncs-syncs, st.records-records );
+            ret = -1;
+        } else {
+            logMessage( LOG_INFO_LEVEL, "Device journal synced %lu times for %lu concurrent records",
+                st.syncs-syncs, st.records-records );
+        }
+    }
+
+    // A batch larger than a record is refused (rather than split), as is a
+    // journal whose records cannot hold the largest batch
+    if ( ret == 0 ) {
+        vector<bfs_block_id_t> oids( min(storage->getJournal()->getMaxRecordBlocks()+1, (uint32_t)nlarge) );
+        vector<char *> oblks( oids.size() );
+        for ( j=0; j<(int)oids.size(); j++ ) {
+            oids[j] = j % BFS_DEV_JOURNAL_STORAGE;
+            oblks[j] = &data[j*BLK_SZ];
+        }
+        if ( (oids.size() > storage->getJournal()->getMaxRecordBlocks()) &&
+             (storage->putBlocks(oids.data(), (uint32_t)oids.size(), oblks.data()) == 0) ) {
+            logMessage( LOG_ERROR_LEVEL, "Device journal accepted a batch larger than a record" );
+            ret = -1;
+        }
+    }
+    if ( ret == 0 ) {
+        small = new bfsDeviceStorage( 0, BFS_DEV_JOURNAL_STORAGE, path+".small", BFS_STORAGE_MMAP );
+        if ( (small->getJournal() == NULL) && (small->enableJournal(BFS_DEV_JOURNAL_BLOCKS/4, BFS_DEV_JOURNAL_LARGE) == 0) ) {
+            logMessage( LOG_ERROR_LEVEL, "Device journal too small for its batches was not refused" );
+            ret = -1;
+        }
+        delete small;
+        unlink( (path+".small").c_str() );
+        unlink( (path+".small.journal").c_str() );
+    }
+
+    // Log the unit test thing, clean up
+    if ( ret == 0 ) {
+        st = storage->getJournal()->getStats();
+        logMessage( LOG_INFO_LEVEL, "Successful device journal test (%lu records, %lu blocks, %lu checkpoints)",
+            st.records, st.blocks, st.checkpoints );
+    }
+    if ( storage != NULL ) {
+        delete storage;
+    }
+    unlink( path.c_str() );
+    unlink( (path+".journal").c_str() );
+    delete [] data;
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceJournalPutThread
+// Description  : Put the batches of a journal test thread (each batch the
+//                next BFS_DEV_JOURNAL_BATCH blocks from its first).
+//
+// Inputs       : arg - the thread (bfs_dev_journal_putter_t)
+// Outputs      : NULL
+
+void *bfsDeviceJournalPutThread( void *arg ) {
+
+    // Local variables
+    bfs_dev_journal_putter_t *putter = (bfs_dev_journal_putter_t *)arg;
+    const int nlarge = BFS_DEV_JOURNAL_ROUNDS*BFS_DEV_JOURNAL_LARGE;
+    bfs_block_id_t blkids[BFS_DEV_JOURNAL_BATCH];
+    char *blks[BFS_DEV_JOURNAL_BATCH];
+    int i, j, blk;
+
+    // Put the batches
+    for ( i=0; (putter->ret == 0) && (i<BFS_DEV_JOURNAL_TPUTS); i++ ) {
+        for ( j=0; j<BFS_DEV_JOURNAL_BATCH; j++ ) {
+            blk = putter->first + i*BFS_DEV_JOURNAL_BATCH + j;
+            blkids[j] = blk % BFS_DEV_JOURNAL_STORAGE;
+            blks[j] = &putter->data[(blk % nlarge)*BLK_SZ];
+        }
+        putter->ret = putter->storage->putBlocks( blkids, BFS_DEV_JOURNAL_BATCH, blks );
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceJournalOpen
+// Description  : Open (replay) the journaled storage of the journal test
+//                (journaled as configured, else with a test journal).
+//
+// Inputs       : path - the path to the backing file
+// Outputs      : the storage, or NULL if failure
+
+bfsDeviceStorage *bfsDeviceJournalOpen( string path ) {
+
+    // Create the storage, journal it
+    bfsDeviceStorage *storage = new bfsDeviceStorage( 0, BFS_DEV_JOURNAL_STORAGE, path, BFS_STORAGE_MMAP );
+    if ( (storage->getJournal() == NULL) && storage->enableJournal(BFS_DEV_JOURNAL_BLOCKS, BFS_DEV_JOURNAL_LARGE) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device journal open failed [%s]", path.c_str() );
+        delete storage;
+        return( NULL );
+    }
+    return( storage );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceJournalCrash
+// Description  : Make the journal test storage look crashed: its blocks
+//                never reached the data area, and the journal is as kept
+//                (with a byte of the last record flipped if torn).
+//
+// Inputs       : path - the path to the backing file
+//                jnl - the journal as kept
+//                torn - flag indicating the last record is torn
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceJournalCrash( string path, string & jnl, int torn ) {
+
+    // Zero the data area, write back the journal
+    string crashed = jnl;
+    if ( torn ) {
+        crashed[BLK_SZ + (BFS_DEV_JOURNAL_PUTS*(BFS_DEV_JOURNAL_BATCH+1)-1)*BLK_SZ] ^= 0x1;
+    }
+    std::ofstream jout( path+".journal", std::ios::binary | std::ios::trunc );
+    jout.write( crashed.data(), crashed.size() );
+    jout.close();
+    if ( (truncate(path.c_str(), 0) != 0) || (truncate(path.c_str(), BFS_DEV_JOURNAL_STORAGE*BLK_SZ) != 0) || (! jout) ) {
+        logMessage( LOG_ERROR_LEVEL, "Failed crashing journal test storage [%s]", path.c_str() );
+        return( -1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceReplayUnitTest
+// Description  : Record a request on one connection to a remote device and
+//                replay it on a new connection (where the tags start over),
+//                the device must reject it (and drop that connection).
+//
+// Inputs       : devList - the list of devices to test
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceReplayUnitTest( bfs_device_list_t & devList ) {
+
+    // Local variables
+    bfs_device_list_t::iterator it;
+    bfsRemoteDevice *rdev = NULL;
+    bfsNetworkConnection *conn;
+    bfs_device_epoch_t epoch;
+    bfsFlexibleBuffer buf, replay;
+    bfs_device_tag_t tag = 1;
+    bfs_device_msg_t cmd;
+    bfs_device_id_t did;
+    bfs_uid_t usr;
+    char blk[BLK_SZ];
+    bool ack;
+    int ret;
+
+    // Find a remote device to replay against
+    for ( it=devList.begin(); (rdev == NULL) && (it!=devList.end()); it++ ) {
+        rdev = dynamic_cast<bfsRemoteDevice *>(it->second);
+    }
+    if ( rdev == NULL ) {
+        return( 0 );
+    }
+
+    // Send a (good) request on a new connection, recording the packet
+    conn = bfsNetworkConnection::bfsChannelFactory( rdev->getCommAddress(), rdev->getCommPort() );
+    if ( (conn == NULL) || conn->connect() ||
+         bfsDeviceLayer::openDeviceEpoch(conn, epoch) ||
+         bfsDeviceLayer::marshalBfsDevicePacket(1, rdev->getDeviceIdenfier(), BFS_DEVICE_GET_TOPO,
+            0, rdev->getSecurityAssociation(), epoch, tag, buf) ) {
+        logMessage( LOG_ERROR_LEVEL, "Replay test connection/request setup failed" );
+        return( -1 );
+    }
+    replay.setData( buf.getBuffer(), buf.getLength() );
+    if ( ((size_t)conn->sendPacketizedBuffer(buf) != buf.getLength()) ||
+         (conn->recvPacketizedBuffer(buf) <= (int)sizeof(bfs_device_tag_t)) ) {
+        logMessage( LOG_ERROR_LEVEL, "Replay test request send/recv failed" );
+        return( -1 );
+    }
+    buf >> tag;
+    if ( (tag != 1) ||
+         bfsDeviceLayer::unmarshalBfsDevicePacket(usr, did, cmd, ack,
+            rdev->getSecurityAssociation(), epoch, tag, buf) ||
+         (cmd != BFS_DEVICE_GET_TOPO) || (ack != 1) ) {
+        logMessage( LOG_ERROR_LEVEL, "Replay test request got a bad response" );
+        return( -1 );
+    }
+    conn->disconnect();
+    delete conn;
+
+    // Now replay the recorded packet on a new connection, it must not answer
+    conn = bfsNetworkConnection::bfsChannelFactory( rdev->getCommAddress(), rdev->getCommPort() );
+    if ( (conn == NULL) || conn->connect() ||
+         bfsDeviceLayer::openDeviceEpoch(conn, epoch) ||
+         ((size_t)conn->sendPacketizedBuffer(replay) != replay.getLength()) ) {
+        logMessage( LOG_ERROR_LEVEL, "Replay test reconnect/replay send failed" );
+        return( -1 );
+    }
+    disableLogLevels( LOG_ERROR_LEVEL );
+    ret = conn->recvPacketizedBuffer( buf );
+    enableLogLevels( LOG_ERROR_LEVEL );
+    conn->disconnect();
+    delete conn;
+    if ( ret > 0 ) {
+        logMessage( LOG_ERROR_LEVEL, "Device answered a request replayed on a new connection" );
+        return( -1 );
+    }
+
+    // The device must still serve its other connections
+    if ( rdev->getBlock(0, blk) ) {
+        logMessage( LOG_ERROR_LEVEL, "Device failed after rejecting a replay" );
+        return( -1 );
+    }
+
+    // Log the unit test thing, return successfully
+    logMessage( LOG_INFO_LEVEL, "Successfully rejected replay on device [%lu]",
+        rdev->getDeviceIdenfier() );
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceScalingBench
+// Description  : Benchmark the requests a network device processes per
+//                second, over a pool of 1, 2 and 4 connections to the first
+//                remote device (each driven by its own thread, pipelining
+//                puts then gets of random blocks).  Run it with the devices'
+//                worker threads (and the cores they may use) varied to see
+//                how the device scales.
+//
+// Inputs       : ops - the number of puts (and gets) on each connection
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceScalingBench( int ops ) {
+
+    // Local variables
+    bfs_dev_bench_conn_t conns[BFS_DEV_BENCH_MAX_CONNS];
+    bfs_device_list_t devList;
+    bfs_device_list_t::iterator it;
+    bfsRemoteDevice *rdev = NULL;
+    bfsCfgItem *config, *devcfg = NULL;
+    int nconns, i, ret = 0;
+    double secs;
+
+    // Find the first remote device, and its configuration
+    if ( bfsDeviceLayer::getDeviceManifest(devList) ) {
+        logMessage( LOG_ERROR_LEVEL, "Unable to get device manifest data, aborting" );
+        return( -1 );
+    }
+    for ( it=devList.begin(); (rdev == NULL) && (it!=devList.end()); it++ ) {
+        rdev = dynamic_cast<bfsRemoteDevice *>(it->second);
+    }
+    config = bfsConfigLayer::getConfigItem( BFS_DEVLYR_DEVICES_CONFIG );
+    for ( i=0; (rdev != NULL) && (i<config->bfsCfgItemNumSubItems()); i++ ) {
+        if ( (bfs_device_id_t)config->getSubItemByIndex(i)->getSubItemByName("did")->bfsCfgItemValueLong() ==
+                rdev->getDeviceIdenfier() ) {
+            devcfg = config->getSubItemByIndex(i);
+        }
+    }
+    if ( devcfg == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "No remote device to benchmark, aborting" );
+        return( -1 );
+    }
+
+    // Run over each number of connections
+    logMessage( LOG_OUTPUT_LEVEL, "Device [%lu] requests (%d puts then %d gets per connection)",
+        rdev->getDeviceIdenfier(), ops, ops );
+    for ( nconns=1; (ret == 0) && (nconns<=BFS_DEV_BENCH_MAX_CONNS); nconns*=2 ) {
+
+        // Open the pool of connections (each thread sends on its own)
+        conns[0].rdev = new bfsRemoteDevice( rdev->getCommAddress(), rdev->getCommPort(), nconns );
+        conns[0].rdev->setSecurityAssociation( new bfsSecAssociation(devcfg->getSubItemByName("sa")) );
+        conns[0].rdev->setSecurityConfig( devcfg->getSubItemByName("sa") );
+        if ( (conns[0].rdev->bfsDeviceInitialize() != BFS_SUCCESS) ||
+             (conns[0].rdev->getNumConnections() != (size_t)nconns) ) {
+            logMessage( LOG_ERROR_LEVEL, "Benchmark connections failed, aborting" );
+            return( -1 );
+        }
+        for ( i=0; i<nconns; i++ ) {
+            conns[i].rdev = conns[0].rdev;
+            conns[i].ops = ops;
+            conns[i].ret = 0;
+        }
+
+        // Drive them all at once, timing them
+        auto start = chrono::high_resolution_clock::now();
+        for ( i=0; i<nconns; i++ ) {
+            if ( pthread_create(&conns[i].thr, NULL, bfsDeviceBenchThread, &conns[i]) ) {
+                logMessage( LOG_ERROR_LEVEL, "Benchmark thread create failed, aborting" );
+                return( -1 );
+            }
+        }
+        for ( i=0; i<nconns; i++ ) {
+            pthread_join( conns[i].thr, NULL );
+            ret |= conns[i].ret;
+        }
+        secs = chrono::duration<double>( chrono::high_resolution_clock::now()-start ).count();
+
+        // Report, close the connections
+        logMessage( LOG_OUTPUT_LEVEL, "%d connection(s) : %9.0f ops/sec", nconns,
+            (double)ops*2*nconns/secs );
+        conns[0].rdev->bfsDeviceUninitialize();
+        delete conns[0].rdev;
+    }
+
+    // Return the status
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceBenchThread
+// Description  : Drive a benchmark connection, pipelining the puts of random
+//                blocks (keeping a window of them in flight), then the gets.
+//
+// Inputs       : arg - the benchmark connection
+// Outputs      : NULL
+
+void *bfsDeviceBenchThread( void *arg ) {
+
+    // Local variables
+    bfs_dev_bench_conn_t *conn = (bfs_dev_bench_conn_t *)arg;
+    PBfsBlock *pblks[BFS_REMOTE_DEV_MAX_INFLIGHT];
+    bfs_device_tag_t tags[BFS_REMOTE_DEV_MAX_INFLIGHT];
+    char data[BLK_SZ];
+    int phase, i, slot;
+
+    // Setup the window of blocks
+    get_random_data( data, BLK_SZ );
+    for ( slot=0; slot<BFS_REMOTE_DEV_MAX_INFLIGHT; slot++ ) {
+        pblks[slot] = new PBfsBlock( NULL, BLK_SZ, 0, 0, 0, conn->rdev );
+    }
+
+    // Run the puts, then the gets, waiting on a slot before reusing it
+    for ( phase=0; (conn->ret == 0) && (phase<2); phase++ ) {
+        for ( i=0; (conn->ret == 0) && (i<conn->ops+BFS_REMOTE_DEV_MAX_INFLIGHT); i++ ) {
+            slot = i % BFS_REMOTE_DEV_MAX_INFLIGHT;
+            if ( (i >= BFS_REMOTE_DEV_MAX_INFLIGHT) &&
+                 (conn->rdev->waitRequest(tags[slot]) != BFS_SUCCESS) ) {
+                logMessage( LOG_ERROR_LEVEL, "Benchmark request failed" );
+                conn->ret = -1;
+            }
+            if ( (conn->ret == 0) && (i < conn->ops) ) {
+                // (a request leaves the response in the block, so put its data back)
+                if ( phase == 0 ) {
+                    pblks[slot]->setData( data, BLK_SZ );
+                }
+                pblks[slot]->set_pbid( get_random_value(0, (uint32_t)(conn->rdev->getNumBlocks()-1)) );
+                tags[slot] = (phase == 0) ? conn->rdev->putBlockAsync( *pblks[slot] ) :
+                                            conn->rdev->getBlockAsync( *pblks[slot] );
+                if ( tags[slot] == 0 ) {
+                    logMessage( LOG_ERROR_LEVEL, "Benchmark request submit failed" );
+                    conn->ret = -1;
+                }
+            }
+        }
+    }
+
+    // Release the blocks, return
+    for ( slot=0; slot<BFS_REMOTE_DEV_MAX_INFLIGHT; slot++ ) {
+        delete pblks[slot];
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceStorageBench
+// Description  : Benchmark the storage backends, putting then getting random
+//                blocks in batches of 1 to 128 (the queue depth) through a
+//                memory mapped and a direct storage of the first device's
+//                size (backed by a file next to its own).
+//
+// Inputs       : ops - the number of puts (and gets) at each queue depth
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceStorageBench( int ops ) {
+
+    // Local variables
+    const char *names[] = { "mmap", "direct" };
+    bfs_storage_backend_t bkends[] = { BFS_STORAGE_MMAP, BFS_STORAGE_DIRECT };
+    bfs_block_id_t blkids[BFS_DEV_BENCH_MAX_QDEPTH];
+    char *blks[BFS_DEV_BENCH_MAX_QDEPTH];
+    bfsDeviceStorage *storage;
+    bfsCfgItem *devcfg;
+    string path;
+    uint64_t nblks;
+    int b, qd, i, j, phase, ret = 0;
+    double secs[2];
+
+    // Use the first device's geometry
+    devcfg = bfsConfigLayer::getConfigItem( BFS_DEVLYR_DEVICES_CONFIG )->getSubItemByIndex(0);
+    path = devcfg->getSubItemByName("path")->bfsCfgItemValue() + ".bench";
+    nblks = (uint64_t)devcfg->getSubItemByName("size")->bfsCfgItemValueLong();
+    for ( i=0; i<BFS_DEV_BENCH_MAX_QDEPTH; i++ ) {
+        blks[i] = new char[BLK_SZ];
+        get_random_data( blks[i], BLK_SZ );
+    }
+
+    // Run each backend over each queue depth
+    logMessage( LOG_OUTPUT_LEVEL, "Storage [%s] (%lu blocks, %d puts then %d gets per depth)",
+        path.c_str(), nblks, ops, ops );
+    for ( b=0; (ret == 0) && (b<2); b++ ) {
+        storage = new bfsDeviceStorage( 0, nblks, path, bkends[b] );
+        for ( qd=1; (ret == 0) && (qd<=BFS_DEV_BENCH_MAX_QDEPTH); qd*=2 ) {
+            for ( phase=0; (ret == 0) && (phase<2); phase++ ) {
+                auto start = chrono::high_resolution_clock::now();
+                for ( i=0; (ret == 0) && (i<ops); i+=qd ) {
+                    for ( j=0; j<qd; j++ ) {
+                        blkids[j] = get_random_value( 0, (uint32_t)(nblks-1) );
+                    }
+                    ret = (phase == 0) ? storage->putBlocks( blkids, qd, blks ) :
+                                         storage->getBlocks( blkids, qd, blks );
+                }
+                secs[phase] = chrono::duration<double>( chrono::high_resolution_clock::now()-start ).count();
+            }
+            if ( ret == 0 ) {
+                logMessage( LOG_OUTPUT_LEVEL, "%6s qd %3d : %9.0f puts/sec %9.0f gets/sec",
+                    names[b], qd, ops/secs[0], ops/secs[1] );
+            }
+        }
+        delete storage;
+    }
+
+    // Clean up, return the status
+    for ( i=0; i<BFS_DEV_BENCH_MAX_QDEPTH; i++ ) {
+        delete [] blks[i];
+    }
+    unlink( path.c_str() );
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceExtentBench
+// Description  : Time batches of BFS_DEV_BENCH_RUN scattered blocks (sent
+//                block by block) against runs of as many adjacent blocks
+//                (sent as one extent) on each of the devices.
+//
+// Inputs       : ops - the number of batches to put/get per layout
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceExtentBench( int ops ) {
+
+    // Local variables
+    const char *names[] = { "scattered", "runs" };
+    bfs_device_list_t devList;
+    bfs_device_list_t::iterator it;
+    bfs_block_list_t blist;
+    bfs_block_id_t base;
+    char data[BFS_DEV_BENCH_RUN][BLK_SZ];
+    int layout, phase, i, j, ret = 0;
+    double secs[2];
+
+    // Get the devices, some data to put
+    if ( bfsDeviceLayer::getDeviceManifest(devList) ) {
+        logMessage( LOG_ERROR_LEVEL, "Unable to get device manifest data, aborting" );
+        return( -1 );
+    }
+    for ( i=0; i<BFS_DEV_BENCH_RUN; i++ ) {
+        get_random_data( data[i], BLK_SZ );
+    }
+
+    // Put then get the batches on each device, in each layout
+    logMessage( LOG_OUTPUT_LEVEL, "Batches of %d blocks, %d puts then %d gets per layout",
+        BFS_DEV_BENCH_RUN, ops, ops );
+    for ( it=devList.begin(); (ret == 0) && (it!=devList.end()); it++ ) {
+        for ( layout=0; (ret == 0) && (layout<2); layout++ ) {
+            for ( phase=0; (ret == 0) && (phase<2); phase++ ) {
+                auto start = chrono::high_resolution_clock::now();
+                for ( i=0; (ret == 0) && (i<ops); i++ ) {
+                    base = get_random_value( 0, (uint32_t)(it->second->getNumBlocks()-BFS_DEV_BENCH_RUN*2-1) );
+                    for ( j=0; j<BFS_DEV_BENCH_RUN; j++ ) {
+                        blist[base+j*(2-layout)] = new PBfsBlock( data[j], BLK_SZ, 0, 0,
+                            base+j*(2-layout), it->second );
+                    }
+                    ret = (phase == 0) ? it->second->putBlocks( blist ) : it->second->getBlocks( blist );
+                    for ( auto bit=blist.begin(); bit!=blist.end(); bit++ ) {
+                        delete bit->second;
+                    }
+                    blist.clear();
+                }
+                secs[phase] = chrono::duration<double>( chrono::high_resolution_clock::now()-start ).count();
+            }
+            if ( ret == 0 ) {
+                logMessage( LOG_OUTPUT_LEVEL, "Device [%lu] %9s : %8.1f MB/s put %8.1f MB/s get",
+                    it->first, names[layout], (double)ops*BFS_DEV_BENCH_RUN*BLK_SZ/secs[0]/1e6,
+                    (double)ops*BFS_DEV_BENCH_RUN*BLK_SZ/secs[1]/1e6 );
+            }
+        }
+    }
+
+    // Return the status
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsDeviceSealBench
+// Description  : Time marshaling (sealing) then unmarshaling (opening) device
+//                packets of 1 and 16 blocks (4 KB and 64 KB) with the first
+//                device's security association, in cycles per byte (ns per
+//                byte where there is no cycle counter).
+//
+// Inputs       : ops - the number of packets sealed/opened at each size
+// Outputs      : 0 if successful, -1 if failure
+
+int bfsDeviceSealBench( int ops ) {
+
+    // Local variables
+    int sizes[] = { 1, 16 };
+    bfsSecAssociation *sa;
+    bfsFlexibleBuffer buf;
+    bfs_device_epoch_t epoch;
+    bfs_device_tag_t tag;
+    bfs_device_msg_t cmd;
+    bfs_device_id_t did;
+    bfs_uid_t usr;
+    uint64_t start, cycles[2];
+    bool ack;
+    char *data;
+    int s, i;
+
+    // Use the first device's association (it seals and opens alike)
+    sa = new bfsSecAssociation( bfsConfigLayer::getConfigItem(BFS_DEVLYR_DEVICES_CONFIG)
+        ->getSubItemByIndex(0)->getSubItemByName("sa") );
+    memset( &epoch, 0x0, sizeof(epoch) );
+    data = new char[BLK_SZ*16];
+    get_random_data( data, BLK_SZ*16 );
+
+    // Seal and open the packets of each size
+    for ( s=0; s<2; s++ ) {
+        cycles[0] = cycles[1] = 0;
+        for ( i=0; i<ops; i++ ) {
+            buf.resetWithAlloc( 0, 0x0, BFS_BLOCK_HEADROOM, BLK_SZ*sizes[s]+BFS_BLOCK_TAILROOM );
+            buf.addTrailer( data, BLK_SZ*sizes[s] );
+            tag = (bfs_device_tag_t)i+1;
+            start = bfsDeviceBenchClock();
+            if ( bfsDeviceLayer::marshalBfsDevicePacket(1, 1, BFS_DEVICE_PUT_BLOCKS, 0, sa, epoch, tag, buf) ) {
+                return( -1 );
+            }
+            cycles[0] += bfsDeviceBenchClock() - start;
+            buf >> tag;
+            start = bfsDeviceBenchClock();
+            if ( bfsDeviceLayer::unmarshalBfsDevicePacket(usr, did, cmd, ack, sa, epoch, tag, buf) ||
+                 (buf.getLength() != (bfs_size_t)BLK_SZ*sizes[s]) ) {
+                logMessage( LOG_ERROR_LEVEL, "Sealed packet failed to open" );
+                return( -1 );
+            }
+            cycles[1] += bfsDeviceBenchClock() - start;
+        }
+        logMessage( LOG_OUTPUT_LEVEL, "%6d byte packets : seal %6.2f, open %6.2f %s/byte",
+            BLK_SZ*sizes[s], (double)cycles[0]/ops/(BLK_SZ*sizes[s]),
+            (double)cycles[1]/ops/(BLK_SZ*sizes[s]), BFS_DEV_BENCH_CLOCK_UNIT );
+    }
+
+    // Clean up, return successfully
+    delete [] data;
+    delete sa;
+    return( 0 );
+}
@@ -67,6 +67,7 @@ bool BfsACLayer::initialized() { return ACLayerInitialized; }
  */
 BfsUserContext *BfsACLayer::add_user_context(void *conn_ptr) {
 	bfsCfgItem *config, *sacfg;
+	bfsSecAssociation *sa;
 
 	if (!ACLayerInitialized)
 		return NULL;
@@ -118,9 +119,11 @@ BfsUserContext *BfsACLayer::add_user_context(void *conn_ptr) {
 	sacfg = config->getSubItemByName("cl_serv_sa");
 #endif
 
-	auto u = user_contexts.insert(std::make_pair(
-		conn_ptr,
-		new BfsUserContext(alloc_uid(), new bfsSecAssociation(sacfg))));
+	// The server replies to the client, so its IVs are the responder's
+	sa = new bfsSecAssociation(sacfg);
+	sa->setIVContext(true);
+	auto u = user_contexts.insert(
+		std::make_pair(conn_ptr, new BfsUserContext(alloc_uid(), sa)));
 
 	return u.first->second;
 }
@@ -3831,7 +3831,10 @@ int32_t BfsHandle::bfs_fsync(BfsUserContext *usr, bfs_fh_t fh,
 		throw BfsServerError("Error during write inode in bfs_fsync\n", NULL,
 							 path_ino_ptr);
 
-	// TODO: then flush the data buffers (similar code to read/write)
+	// then flush the (write-back cached) data blocks out to the devices
+	if (bfsBlockLayer::flushBlocks() != BFS_SUCCESS)
+		throw BfsServerError("Error during flush blocks in bfs_fsync\n", NULL,
+							 path_ino_ptr);
 
 	if (!path_ino_ptr->unlock())
 		throw BfsServerError("Failed releasing inode\n", NULL, NULL);
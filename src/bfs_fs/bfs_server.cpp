@@ -39,6 +39,7 @@ static int bfs_server_listener_status = 0;
 uint64_t bfs_server_log_level = 0, bfs_server_vrb_log_level = 0;
 static std::list<pthread_t *> client_worker_threads;
 static unsigned short bfs_server_port = -1;
+static bool bfs_server_shm_listener = false;
 
 /* For performance testing */
 static std::vector<long> s_read__lats, s_read__s_lats, s_read__net_c_send_lats,
@@ -218,6 +219,9 @@ int server_init() {
 		bfs_server_port =
 			(unsigned short)config->getSubItemByName("bfs_server_port")
 				->bfsCfgItemValueLong();
+		bfs_server_shm_listener =
+			(config->getSubItemByName("shm_listener")->bfsCfgItemValue() ==
+			 "true");
 
 		num_file_worker_threads =
 			config->getSubItemByName("num_file_worker_threads")
@@ -316,7 +320,7 @@ void *client_worker_entry(void *arg) {
  * @return int BFS_SUCCESS if success, BFS_FAILURE if failure
  */
 static int start_dispatcher() {
-	bfsNetworkConnection *server, *client;
+	bfsNetworkConnection *server, *shm_server = NULL, *client;
 	pthread_t *client_thread;
 	bfsConnectionMux *mux;
 	bfsConnectionList ready;
@@ -341,6 +345,20 @@ static int start_dispatcher() {
 	mux->addConnection(server);
 	logMessage(SERVER_LOG_LEVEL, "Server listening on [%d]\n", bfs_server_port);
 
+	// Also listen for clients on this host over shared memory (if configured)
+	if (bfs_server_shm_listener) {
+		shm_server =
+			bfsNetworkConnection::bfsChannelFactory(bfs_server_port, true);
+		if (shm_server->connect()) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Server shared memory connection failed, aborting.");
+			return BFS_FAILURE;
+		}
+		mux->addConnection(shm_server);
+		logMessage(SERVER_LOG_LEVEL, "Server listening on [%d] (shared memory)\n",
+				   bfs_server_port);
+	}
+
 	// Now keep listening to sockets until you are done
 	done = false;
 	while (!done) {
@@ -510,6 +528,10 @@ static int start_dispatcher() {
 	// Remove the server from the connection list, cleanup
 	mux->removeConnection(server);
 	delete server;
+	if (shm_server != NULL) {
+		mux->removeConnection(shm_server);
+		delete shm_server;
+	}
 	mux->cleanup();
 	delete mux;
 
@@ -127,6 +127,29 @@ static int enclave_init() {
 	return BFS_SUCCESS;
 }
 
+/**
+ * @brief Seals a response to the request being handled for the user. The
+ * response is bound (as AAD) to the tag of the request and its sequence within
+ * the request (e.g., readdir sends two), then the tag is prepended in clear so
+ * the client can hand the response to the waiting caller before opening it.
+ *
+ * @param usr: the user context that sent the request
+ * @param spkt: the response to seal
+ * @param spkt_enc: the buffer to place the sealed (tagged) response in
+ * @return none, throws bfsCryptoError on failure
+ */
+static void seal_response(BfsUserContext *usr, bfsSecureFlexibleBuffer &spkt,
+						  bfsSecureFlexibleBuffer &spkt_enc) {
+	uint32_t _client_req_id = usr->get_req_id();
+	uint32_t _client_resp_aad[2] = {_client_req_id, usr->get_resp_seq()};
+	bfsSecureFlexibleBuffer aad((char *)_client_resp_aad,
+								sizeof(_client_resp_aad));
+
+	usr->get_SA()->encryptData(spkt, spkt_enc, &aad, true);
+	usr->inc_resp_seq();
+	spkt_enc << _client_req_id;
+}
+
 /**
  * @brief Deserializes the rpc message and executes the operation based on the
  * type (e.g., client open, read, etc.). Expects the first two fields to be the
@@ -135,7 +158,10 @@ static int enclave_init() {
  * Note that the non-enclave code can tamper with args here (e.g., the client
  * conn ptr), and we rely on the security associations to ensure integrity and
  * secrecy of messages (i.e., message decryption will only succeed with if the
- * socket/conn ptr is correctly mapped).
+ * socket/conn ptr is correctly mapped). Each request carries its tag in clear
+ * in front of the sealed message; the tag must be the next one expected from
+ * the user (bound as AAD, so requests cannot be replayed or reordered), and the
+ * responses are tagged with it so the client can match them to the callers.
  *
  * @param in_conn_ptr: pointer to client connection object (non-enclave memory)
  * @param rbuf: incoming buffer
@@ -193,14 +219,26 @@ int64_t ecall_bfs_handle_in_msg(void *in_conn_ptr, void *rpkt_enc_ptr) {
 
 	logMessage(FS_VRB_LOG_LEVEL, "Got user context.\n");
 
-	// decrypt then get message and operation types
+	// check the request tag, decrypt then get message and operation types
 	try {
-		uint32_t _client_recv_seq = usr->get_recv_seq();
+		uint32_t _client_req_id = 0;
+		if (rpkt_enc->getLength() < sizeof(uint32_t)) {
+			logMessage(LOG_ERROR_LEVEL, "Server recv message untagged\n");
+			return BFS_FAILURE;
+		}
+		*rpkt_enc >> _client_req_id;
+		if (_client_req_id != usr->get_recv_seq()) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "Server recv request [%u] out of sequence (want %u)\n",
+					   _client_req_id, usr->get_recv_seq());
+			return BFS_FAILURE;
+		}
 		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_recv_seq,
+			(char *)&_client_req_id,
 			sizeof(uint32_t)); // must be secure buffer
 		usr->get_SA()->decryptData(*rpkt_enc, rpkt, aad, true);
 		usr->inc_recv_seq();
+		usr->set_req_id(_client_req_id);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from crypto: %s\n",
 				   err->getMessage().c_str());
@@ -403,11 +441,7 @@ static int32_t handle_getattr(void *in_conn_ptr, BfsUserContext *usr,
 		 << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -497,11 +531,7 @@ static int32_t handle_mkdir(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -590,11 +620,7 @@ static int32_t handle_unlink(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -683,11 +709,7 @@ static int32_t handle_rmdir(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -779,11 +801,7 @@ static int32_t handle_rename(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -872,11 +890,7 @@ static int32_t handle_open(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -980,11 +994,7 @@ static int32_t handle_read(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1115,11 +1125,7 @@ static int32_t handle_write(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1237,11 +1243,7 @@ static int32_t handle_release(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1329,11 +1331,7 @@ static int32_t handle_fsync(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1422,11 +1420,7 @@ static int32_t handle_opendir(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1531,11 +1525,7 @@ static int32_t handle_readdir(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << num_ents << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1599,11 +1589,7 @@ static int32_t handle_readdir(void *in_conn_ptr, BfsUserContext *usr,
 	}
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1703,11 +1689,7 @@ static int32_t handle_init(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1786,11 +1768,7 @@ static int32_t handle_destroy(void *in_conn_ptr, BfsUserContext *usr) {
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1882,11 +1860,7 @@ static int32_t handle_create(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -1967,11 +1941,7 @@ static int32_t handle_ftruncate(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
@@ -2058,11 +2028,7 @@ static int32_t handle_chmod(void *in_conn_ptr, BfsUserContext *usr,
 	spkt << ret << otype << mtype;
 
 	try {
-		uint32_t _client_send_seq = usr->get_send_seq();
-		bfsSecureFlexibleBuffer *aad = new bfsSecureFlexibleBuffer(
-			(char *)&_client_send_seq, sizeof(uint32_t));
-		usr->get_SA()->encryptData(spkt, spkt_enc, aad, true);
-		usr->inc_send_seq();
+		seal_response(usr, spkt, spkt_enc);
 	} catch (bfsCryptoError *err) {
 		logMessage(LOG_ERROR_LEVEL, "Exception caught from encrypt: %s\n",
 				   err->getMessage().c_str());
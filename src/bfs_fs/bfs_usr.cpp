@@ -16,8 +16,9 @@
 BfsUserContext::BfsUserContext(bfs_uid_t u, bfsSecAssociation *s) {
 	uid = u;
 	sa = s;
-	user_send_seq = 0;
 	user_recv_seq = 0;
+	user_req_id = 0;
+	user_resp_seq = 0;
 }
 
 /**
@@ -27,13 +28,26 @@ BfsUserContext::BfsUserContext(bfs_uid_t u, bfsSecAssociation *s) {
  */
 bfs_uid_t BfsUserContext::get_uid() { return uid; }
 
-bfs_uid_t BfsUserContext::get_send_seq() { return user_send_seq; }
+uint32_t BfsUserContext::get_recv_seq() { return user_recv_seq; }
 
-bfs_uid_t BfsUserContext::get_recv_seq() { return user_recv_seq; }
+void BfsUserContext::inc_recv_seq() { user_recv_seq++; }
+
+/**
+ * @brief Sets the request being handled (by its tag), so the responses to it
+ * are tagged and sealed for that request.
+ *
+ * @param id: the tag of the request
+ */
+void BfsUserContext::set_req_id(uint32_t id) {
+	user_req_id = id;
+	user_resp_seq = 0;
+}
 
-void BfsUserContext::inc_send_seq() { user_send_seq++; }
+uint32_t BfsUserContext::get_req_id() { return user_req_id; }
 
-void BfsUserContext::inc_recv_seq() { user_recv_seq++; }
+uint32_t BfsUserContext::get_resp_seq() { return user_resp_seq; }
+
+void BfsUserContext::inc_resp_seq() { user_resp_seq++; }
 
 /**
  * @brief Returns the security association.
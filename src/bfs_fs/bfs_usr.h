@@ -22,18 +22,24 @@ public:
 	/* Get the user id */
 	bfs_uid_t get_uid();
 
-	bfs_uid_t get_send_seq();
-	bfs_uid_t get_recv_seq();
-	void inc_send_seq();
+	/* Sequence of the next request expected (its tag) */
+	uint32_t get_recv_seq();
 	void inc_recv_seq();
 
+	/* The request being handled, and the sequence of its next response */
+	void set_req_id(uint32_t);
+	uint32_t get_req_id();
+	uint32_t get_resp_seq();
+	void inc_resp_seq();
+
 	/* Get the security association between the user/server */
 	bfsSecAssociation *get_SA();
 
 private:
 	bfs_uid_t uid;		   /* User id */
 	bfsSecAssociation *sa; /* Security assoc between the user and server */
-	uint32_t user_send_seq, user_recv_seq;
+	uint32_t user_recv_seq; /* Tag of the next request expected */
+	uint32_t user_req_id, user_resp_seq; /* Current request, its responses */
 	// ... other attributes (e.g., groups, shared files to/from other users)
 };
 
@@ -311,13 +311,8 @@ bool bfsCryptoKey::encryptData(char *iv, char *out, bfs_size_t olen, char *in,
 	(void)mtag;
 	gcry_error_t err;
 
-	// Set the passed IV for the encryption algorithm
-	if ((err = gcry_cipher_setkey(cipher, keydat, 16)) != GPG_ERR_NO_ERROR) {
-		message =
-			(string) "gcrypt failure setting cipher key: " + gcry_strerror(err);
-		throw new bfsCryptoError(message);
-	}
-
+	// Set the passed IV for the encryption algorithm (the cipher was keyed
+	// once in setKeyData, setting the IV restarts GCM for this message)
 	if ((err = gcry_cipher_setiv(cipher, iv, getIVlen())) != GPG_ERR_NO_ERROR) {
 		message =
 			(string) "gcrypt failure setting cipher IV: " + gcry_strerror(err);
@@ -385,13 +380,7 @@ bool bfsCryptoKey::decryptData(char *iv, char *out, bfs_size_t olen, char *in,
 	(void)mtag;
 	gcry_error_t err;
 
-	if ((err = gcry_cipher_setkey(cipher, keydat, 16)) != GPG_ERR_NO_ERROR) {
-		message =
-			(string) "gcrypt failure setting cipher key: " + gcry_strerror(err);
-		throw new bfsCryptoError(message);
-	}
-
-	// Set the passed IV for the decryption algorithm
+	// Set the passed IV for the decryption algorithm (keyed in setKeyData)
 	if ((err = gcry_cipher_setiv(cipher, iv, getIVlen())) != GPG_ERR_NO_ERROR) {
 		message =
 			(string) "gcrypt failure setting cipher IV: " + gcry_strerror(err);
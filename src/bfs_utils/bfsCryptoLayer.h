@@ -42,6 +42,7 @@
 
 #define CRYPTO_UTEST_NUMBER_SAS 10
 #define CRYPTO_ENCDEC_UTEST_ITERATIONS 10
+#define CRYPTO_IV_UTEST_ITERATIONS 200
 
 //
 // Class Definition
@@ -60,6 +61,9 @@ public:
     static int bfsCryptoLayerUtest__enclave( void );
 	  // Perform a unit test on the crypto implementation
 
+	static int bfsCryptoLayerBench( int ops );
+	  // Benchmark small message encryption through a security association
+
 	//
 	// Static Class Variables
 
@@ -13,6 +13,7 @@
 
 // Includes
 #include <string.h>
+#include <utility>
 
 // Project Includes
 #ifdef __BFS_ENCLAVE_MODE
@@ -23,6 +24,7 @@
 #endif
 #include <bfsFlexibleBuffer.h>
 #include <bfsUtilError.h>
+#include <bfs_block_pool.h>
 #include <bfs_log.h>
 #include <bfs_util.h>
 
@@ -42,6 +44,9 @@ const char *bfsFlexibleBuffer::bfs_flexbuf_dtypes_strings[] = {
 	"BFS_FLEXBUF_I16",	"BFS_FLEXBUF_UI32", "BFS_FLEXBUF_I32",
 	"BFS_FLEXBUF_UI64", "BFS_FLEXBUF_I64",	"BFS_FLEXBUF_DATA"};
 
+// The bytes of data copied by the buffers
+std::atomic<uint64_t> bfsFlexibleBuffer::copiedBytes(0);
+
 //
 // Class Methods
 
@@ -111,10 +116,11 @@ bfsFlexibleBuffer::bfsFlexibleBuffer(const bfsFlexibleBuffer &cpy)
 			"not entirely outside enclave "
 			"(may be corrupt source ptr)");
 #else
-	buffer = new char[allocation];
+	buffer = BfsBlockPool::allocBuffer(allocation);
 #endif
 
 	memcpy(buffer, cpy.buffer, allocation);
+	copiedBytes += allocation;
 
 	// Return, no return code
 	return;
@@ -132,16 +138,10 @@ bfsSecureFlexibleBuffer::bfsSecureFlexibleBuffer(const bfsFlexibleBuffer &cpy) {
 	// memory (for sgx-based builds), so if we are doing sgx-based builds (with
 	// __BFS_ENCLAVE_MODE flag) then always check that the allocation is in
 	// enclave memory.
-	buffer = new char[allocation];
-
-#ifdef __BFS_ENCLAVE_MODE
-	if (sgx_is_within_enclave(buffer, allocation) != 1)
-		throw new bfsUtilError(
-			"Failed bfsSecureFlexibleBuffer alloc: addr range is "
-			"not entirely inside enclave");
-#endif
+	buffer = do_alloc(allocation);
 
 	memcpy(buffer, cpy.getFullBuffer(), allocation);
+	copiedBytes += allocation;
 
 	// Return, no return code
 	return;
@@ -199,7 +199,7 @@ bfsFlexibleBuffer::~bfsFlexibleBuffer(void) {
 		if ((ocall_delete_allocation((long)buffer) != SGX_SUCCESS))
 			throw new bfsUtilError("Failed ocall_delete_allocation");
 #else
-		delete[] buffer;
+		BfsBlockPool::releaseBuffer(buffer, allocation);
 #endif
 		buffer = NULL;
 	}
@@ -230,12 +230,7 @@ bfsSecureFlexibleBuffer::~bfsSecureFlexibleBuffer(void) {
 
 	// Cleanup the data
 	if (buffer != NULL) {
-#ifdef __BFS_ENCLAVE_MODE
-		if (sgx_is_within_enclave(buffer, allocation) != 1)
-			throw new bfsUtilError(
-				"Failed destructor: addr range is not entirely inside enclave");
-#endif
-		delete[] buffer;
+		do_del_alloc();
 		buffer = NULL;
 	}
 
@@ -264,13 +259,21 @@ bfs_size_t bfsFlexibleBuffer::setData(const char *dat, bfs_size_t len) {
 	// method fixed; otherwise when later trying to add headers, (len > hlength)
 	// will evaluate true and trigger a resize, which will force a re-center and
 	// thus we will lose the data (ie it will be stuck in the header portion)
+	// Edit: the old data is discarded, so don't move it, and only keep the
+	// block pads around it (a buffer left holding a short response has most of
+	// its allocation in the header/trailer, and keeping those grew a reused
+	// block buffer on every set)
 	if (len != length) {
 		// if ( len > length ) {
-		resizeAllocation(hlength, len, tlength);
+		length = 0;
+		resizeAllocation(
+			(hlength < BFS_BLOCK_HEADROOM) ? hlength : BFS_BLOCK_HEADROOM, len,
+			(tlength < BFS_BLOCK_TAILROOM) ? tlength : BFS_BLOCK_TAILROOM);
 	}
 
 	// Copy over the data
 	memcpy(&buffer[hlength], dat, len);
+	copiedBytes += len;
 	length = len;
 	logMessage(UTIL_VRBLOG_LEVEL,
 			   "Setting flex buffer base data, size %d (%d/%d/%d, alloc %d)",
@@ -302,6 +305,10 @@ bfs_size_t bfsFlexibleBuffer::resetWithAlloc(bfs_size_t sz, char fill,
 	if (burn_on_reset)
 		burn();
 
+	// The old contents are overwritten by the fill, so drop them first (saves
+	// moving/copying them over when resizing)
+	length = 0;
+
 	// resize if the header/trailer are shorter than requested, or the length is
 	// not exactly as requested
 	if ((length != sz) || (hlength < hpadsz) || (tlength < tpadsz)) {
@@ -332,6 +339,29 @@ bfs_size_t bfsFlexibleBuffer::resetWithAlloc(bfs_size_t sz, char fill,
 	return (sz);
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsFlexibleBuffer::swapData
+// Description  : Exchange the contents (and allocations) of two buffers, so
+//                data can be handed between them without copying it.  Only
+//                valid when both are allocated from the same memory (e.g., not
+//                a secure and a normal buffer in an enclave).
+//
+// Inputs       : buf - the buffer to exchange contents with
+// Outputs      : none
+
+void bfsFlexibleBuffer::swapData(bfsFlexibleBuffer &buf) {
+
+	// Just exchange the allocations and their layouts
+	std::swap(buffer, buf.buffer);
+	std::swap(allocation, buf.allocation);
+	std::swap(hlength, buf.hlength);
+	std::swap(length, buf.length);
+	std::swap(tlength, buf.tlength);
+	logMessage(UTIL_VRBLOG_LEVEL, "Swapped flex buffer data, size %d/%d",
+			   length, buf.length);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : bfsFlexibleBuffer::addHeader
@@ -351,6 +381,7 @@ bfs_size_t bfsFlexibleBuffer::addHeader(char *dat, bfs_size_t len) {
 	// Now add the header
 	logMessage(UTIL_VRBLOG_LEVEL, "Adding flex buffer header, size %d", len);
 	memcpy(&buffer[hlength - len], dat, len);
+	copiedBytes += len;
 	hlength -= len;
 	length += len;
 
@@ -383,6 +414,7 @@ bfs_size_t bfsFlexibleBuffer::removeHeader(char *dat, bfs_size_t len) {
 	logMessage(UTIL_VRBLOG_LEVEL, "Removing flex buffer header, size %d", len);
 	if (dat != NULL) {
 		memcpy(dat, &buffer[hlength], len);
+		copiedBytes += len;
 	}
 
 	// Just skip the header part, return
@@ -410,6 +442,7 @@ bfs_size_t bfsFlexibleBuffer::addTrailer(char *dat, bfs_size_t len) {
 	// Now add the header
 	logMessage(UTIL_VRBLOG_LEVEL, "Adding flex buffer trailer, size %d", len);
 	memcpy(&buffer[hlength + length], dat, len);
+	copiedBytes += len;
 	tlength -= len;
 	length += len;
 
@@ -442,6 +475,7 @@ bfs_size_t bfsFlexibleBuffer::removeTrailer(char *const dat, bfs_size_t len) {
 	logMessage(UTIL_VRBLOG_LEVEL, "Removing flex buffer trailer, size %d", len);
 	if (dat != NULL) {
 		memcpy(dat, &buffer[(hlength + length) - len], len);
+		copiedBytes += len;
 	}
 
 	// Just skip the header part, return
@@ -532,7 +566,7 @@ int bfsFlexibleBuffer::flexBufferUTest(void) {
 	int i, j, iter, hstkPtr = 0, tstkPtr = 0;
 	char newblk[BFS_FLEX_UTEST_BASESZ], byteT, *blkptr;
 	bool doheader, adddat, match, boolT, completed;
-	bfsFlexibleBuffer *buffer;
+	bfsFlexibleBuffer *buffer, swapbuf;
 	bfs_flexbuf_dtypes_t ntype;
 	uint32_t sz, *szptr, uint32T;
 	uint16_t uint16T;
@@ -1078,8 +1112,27 @@ int bfsFlexibleBuffer::flexBufferUTest(void) {
 		}
 	}
 
-	// Log, return successfully
+	// Check that swapping buffers exchanges their data without copying it
 	logMessage(LOG_INFO_LEVEL, "Successfully completed header/trailer test.");
+	buffer = new bfsFlexibleBuffer();
+	get_random_data(newblk, BFS_FLEX_UTEST_BASESZ);
+	buffer->setData(newblk, BFS_FLEX_UTEST_BASESZ);
+	swapbuf.resetWithAlloc(BFS_FLEX_UTEST_APPNDSZ, 0x5a);
+	uint64T = getCopiedBytes();
+	buffer->swapData(swapbuf);
+	if ((getCopiedBytes() != uint64T) ||
+		(buffer->getLength() != BFS_FLEX_UTEST_APPNDSZ) ||
+		(buffer->getBuffer()[0] != 0x5a) ||
+		(swapbuf.getLength() != BFS_FLEX_UTEST_BASESZ) ||
+		(memcmp(swapbuf.getBuffer(), newblk, BFS_FLEX_UTEST_BASESZ) != 0)) {
+		logMessage(LOG_ERROR_LEVEL, "Flexible buffer swap failed, aborting");
+		delete buffer;
+		return (-1);
+	}
+	delete buffer;
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "Successfully completed swap test.");
 	return (0);
 }
 #endif
@@ -1121,12 +1174,16 @@ bfs_size_t bfsFlexibleBuffer::resizeAllocation(bfs_size_t minhd,
 		new_tlength = mintl + left / 2;
 
 		// Re-center, log and return
-		// Update the length first so the memmove reflects the allowable size to
-		// copy over (otherwise we overflow the stack). Might truncate the
-		// original buffer, however, if all data was to be kept, then the
-		// arguments to the original resize call were incorrect.
+		// Only move the data that survives the resize (the smaller of the old
+		// and new lengths), otherwise we would read past the allocation. Might
+		// truncate the original buffer, however, if all data was to be kept,
+		// then the arguments to the original resize call were incorrect.
+		if ((length > 0) && (new_hlength != hlength)) {
+			memmove(&buffer[new_hlength], &buffer[hlength],
+					(length < newlen) ? length : newlen);
+			copiedBytes += (length < newlen) ? length : newlen;
+		}
 		length = newlen;
-		// memmove( &buffer[new_hlength], &buffer[hlength], length );
 		hlength = new_hlength;
 		tlength = new_tlength;
 		logMessage(UTIL_VRBLOG_LEVEL,
@@ -1164,6 +1221,7 @@ bfs_size_t bfsFlexibleBuffer::resizeAllocation(bfs_size_t minhd,
 			throw new bfsUtilError("Flex buffer length>0, NULL buffer");
 		}
 		memcpy(&newbuf[minhd], &buffer[hlength], length);
+		copiedBytes += length;
 	}
 
 	// Now cleanup the existing buffer
@@ -1207,7 +1265,7 @@ char *bfsFlexibleBuffer::do_alloc(bfs_size_t sz) {
 			"not entirely outside enclave "
 			"(may be corrupt source ptr)");
 #else
-	_newbuf = new char[sz];
+	_newbuf = BfsBlockPool::allocBuffer(sz);
 #endif
 
 	return _newbuf;
@@ -1228,7 +1286,7 @@ void bfsFlexibleBuffer::do_del_alloc() {
 	if ((ocall_delete_allocation((long)buffer) != SGX_SUCCESS))
 		throw new bfsUtilError("Failed ocall_delete_allocation");
 #else
-	delete[] buffer;
+	BfsBlockPool::releaseBuffer(buffer, allocation);
 #endif
 }
 
@@ -1239,11 +1297,13 @@ void bfsFlexibleBuffer::do_del_alloc() {
  * @return char*: pointer to the new buffer
  */
 char *bfsSecureFlexibleBuffer::do_alloc(bfs_size_t sz) {
+#ifdef __BFS_ENCLAVE_MODE
 	char *b = new char[sz];
 
-#ifdef __BFS_ENCLAVE_MODE
 	if (sgx_is_within_enclave(b, sz) != 1)
 		throw new bfsUtilError("Failed do_alloc: addr is not inside enclave");
+#else
+	char *b = BfsBlockPool::allocBuffer(sz);
 #endif
 
 	return b;
@@ -1256,5 +1316,7 @@ void bfsSecureFlexibleBuffer::do_del_alloc() {
 			"Failed do_del_alloc: addr is not inside enclave");
 
 	delete[] buffer;
+#else
+	BfsBlockPool::releaseBuffer(buffer, allocation);
 #endif
 }
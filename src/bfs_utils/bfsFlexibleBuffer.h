@@ -24,6 +24,7 @@
 #include <bfs_common.h>
 
 // C++/STL Isms
+#include <atomic>
 #include <string>
 using namespace std;
 
@@ -120,6 +121,10 @@ public:
 	// Reset the buffer, preallocating buffer with data of specific length and
 	// fill
 
+	void swapData(bfsFlexibleBuffer &buf);
+	// Exchange the contents (and allocations) of two buffers without copying
+	// (both must be allocated from the same memory, see do_alloc)
+
 	string toString(int maxdigits = -1);
 	// Create a human readable string describing the buffer
 
@@ -410,6 +415,9 @@ public:
 	static int flexBufferUTest(void);
 	// Test the flexible buffer implementation
 
+	static uint64_t getCopiedBytes(void) { return (copiedBytes); }
+	// Get the bytes of data copied into, out of and within the buffers
+
 	static const char *getDataTypeString(bfs_flexbuf_dtypes_t ty) {
 		if ((ty < 0) || (ty > BFS_FLEXBUF_DATA)) {
 			return ("BAD DATA TYPE");
@@ -450,6 +458,9 @@ protected:
 
 	static const char *bfs_flexbuf_dtypes_strings[];
 	// Descriptive strings for the flexible buffer data types
+
+	static std::atomic<uint64_t> copiedBytes;
+	// The bytes of data copied by the buffers (see getCopiedBytes)
 };
 
 class bfsSecureFlexibleBuffer : public bfsFlexibleBuffer {
@@ -26,6 +26,22 @@
 //
 // Class Methods
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::bfsSecAssociation
+// Description  : Default constructor
+//
+// Inputs       : none
+// Outputs      : none
+
+bfsSecAssociation::bfsSecAssociation(void)
+	: saKey(NULL), ivFixed(0), ivSequence(0), ivRandom(true) {
+
+	// The IVs start out as the initiator's, under a random context
+	pthread_mutex_init(&ivLock, NULL);
+	setIVContext(false);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : bfsSecAssociation::bfsSecAssociation
@@ -37,7 +53,11 @@
 // Outputs      : none
 
 bfsSecAssociation::bfsSecAssociation(string in, string resp, bfsCryptoKey *key)
-	: initiator(in), responder(resp), saKey(NULL) {
+	: bfsSecAssociation() {
+
+	// Set the identities
+	initiator = in;
+	responder = resp;
 
 	// Set the key as necessary
 	if (key != NULL) {
@@ -181,6 +201,7 @@ bfsSecAssociation::~bfsSecAssociation(void) {
 	// Return, no return code
 	logMessage(CRYPTO_LOG_LEVEL, "Destroyed security association [%s/%s]",
 			   initiator.c_str(), responder.c_str());
+	pthread_mutex_destroy(&ivLock);
 	return;
 }
 
@@ -200,7 +221,16 @@ int bfsSecAssociation::setKey(bfsCryptoKey *key) {
 	// Log and set the key
 	logMessage(CRYPTO_LOG_LEVEL, "Setting key for security association [%s/%s]",
 			   initiator.c_str(), responder.c_str());
-	saKey = key;
+
+	// The IVs restart under a new key, a key set again carries on with its
+	// sequence (so the IVs already used with it are not replayed).  The key
+	// itself is used unlocked, so it is only changed while the SA is idle.
+	pthread_mutex_lock(&ivLock);
+	if (key != saKey) {
+		saKey = key;
+		ivSequence = 0;
+	}
+	pthread_mutex_unlock(&ivLock);
 
 	// Return successfully
 	return (0);
@@ -216,6 +246,24 @@ int bfsSecAssociation::setKey(bfsCryptoKey *key) {
 
 int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 								   bfsFlexibleBuffer *aad, bool mac) {
+	return (encryptData(buf, aad ? aad->getBuffer() : NULL,
+						aad ? aad->getLength() : 0, mac));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::encryptData
+// Description  : In-place encryption of data, with the AAD passed in place
+//                (so callers need not allocate a buffer for it)
+//
+// Inputs       : buf - buffer to encrypt (in place)
+//                aad - the additional authenticated data (NULL if none)
+//                aadlen - the length of the AAD
+//                mac - flag indicating to add the MAC as a trailer
+// Outputs      : 0 or throws exception on error
+
+int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf, char *aad,
+								   bfs_size_t aadlen, bool mac) {
 
 	// Check the state of the association
 	if (saKey == NULL) {
@@ -229,19 +277,17 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 	// Add the padding, setup output to padded size
 	addPKCS7Padding(buf);
 
-	// Setup a random IV, do the encryption
-	iv.resetWithAlloc((bfs_size_t)saKey->getIVlen());
+	// Setup the next IV, do the encryption
+	char ivdat[saKey->getIVlen()];
+	nextIV(ivdat);
 
 #ifndef __BFS_ENCLAVE_MODE
-	// TODO: use counter (seq perhaps) as IV for GCM
-	get_random_data(iv.getBuffer(), (bfs_size_t)saKey->getIVlen());
 	// memset(iv.getBuffer(), 0x0, 12);
 	// saKey->encryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength());
-	saKey->encryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength(),
-					   aad ? aad->getBuffer() : NULL,
-					   aad ? aad->getLength() : 0, NULL);
+	saKey->encryptData(ivdat, buf.getBuffer(), buf.getLength(), aad,
+					   (int)aadlen, NULL);
 
-	buf.addHeader(iv.getBuffer(), iv.getLength());
+	buf.addHeader(ivdat, (bfs_size_t)saKey->getIVlen());
 
 	// MAC as necessary, adding as trailer
 	if (mac)
@@ -253,13 +299,6 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 	// buffer\n"); 	throw new bfsCryptoError(message);
 	// }
 
-	if (sgx_read_rand((unsigned char *)iv.getBuffer(),
-					  (bfs_size_t)saKey->getIVlen()) != SGX_SUCCESS) {
-		std::string message =
-			std::string("Failed generating random iv in encryptData");
-		throw new bfsCryptoError(message);
-	}
-
 	// Mimic in-place encryption for now so other enclave code doesn't break; eg
 	// device code (in-place not natively supported by sgx crypto)
 	sgx_aes_gcm_128bit_tag_t mtag = {0};
@@ -270,10 +309,10 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 	char *buf_cpy = (char *)calloc(buf.getLength(),
 								   1); // avoid destructor calls with buf_cpy
 	memcpy(buf_cpy, buf.getBuffer(), buf.getLength());
-	saKey->encryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength(),
-					   buf_cpy, buf.getLength(), aad ? aad->getBuffer() : NULL,
-					   aad ? aad->getLength() : 0, (unsigned char **)&mtag);
-	buf.addHeader(iv.getBuffer(), iv.getLength());
+	saKey->encryptData(ivdat, buf.getBuffer(), buf.getLength(), buf_cpy,
+					   buf.getLength(), aad, (int)aadlen,
+					   (unsigned char **)&mtag);
+	buf.addHeader(ivdat, (bfs_size_t)saKey->getIVlen());
 	free(buf_cpy);
 
 	// Just append the computed mac as a trailer (adapted from macData)
@@ -318,16 +357,15 @@ int bfsSecAssociation::encryptData2(bfsFlexibleBuffer &buf,
 	// Add the padding, setup output to padded size
 	// addPKCS7Padding(buf);
 
-	// Setup a random IV, do the encryption
+	// Setup the next IV, do the encryption
 	// iv.resetWithAlloc((bfs_size_t)saKey->getIVlen());
 	if (!(*iv || *mac)) {
 		std::string message = std::string("NULL iv or mac in encryptData2");
 		throw new bfsCryptoError(message);
 	}
+	nextIV((char *)*iv);
 
 #ifndef __BFS_ENCLAVE_MODE
-	// TODO: use counter (seq perhaps) as IV for GCM
-	get_random_data((char *)*iv, (bfs_size_t)saKey->getIVlen());
 	// memset(iv.getBuffer(), 0x0, 12);
 	// saKey->encryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength());
 	saKey->encryptData((char *)*iv, buf.getBuffer(), buf.getLength(),
@@ -347,13 +385,6 @@ int bfsSecAssociation::encryptData2(bfsFlexibleBuffer &buf,
 	// buffer\n"); 	throw new bfsCryptoError(message);
 	// }
 
-	if (sgx_read_rand((unsigned char *)*iv, (bfs_size_t)saKey->getIVlen()) !=
-		SGX_SUCCESS) {
-		std::string message =
-			std::string("Failed generating random iv in encryptData");
-		throw new bfsCryptoError(message);
-	}
-
 	// Mimic in-place encryption for now so other enclave code doesn't break; eg
 	// device code (in-place not natively supported by sgx crypto)
 	sgx_aes_gcm_128bit_tag_t mtag = {0};
@@ -422,8 +453,9 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 
 	out.resetWithAlloc(buf.getLength());
 
-	// Setup a random IV, do the encryption
+	// Setup the next IV, do the encryption
 	iv.resetWithAlloc((bfs_size_t)saKey->getIVlen());
+	nextIV(iv.getBuffer());
 
 #ifndef __BFS_ENCLAVE_MODE
 	// if (saKey->add_add(aad) != BFS_SUCCESS) {
@@ -431,7 +463,6 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 	// 	throw new bfsCryptoError(message);
 	// }
 
-	get_random_data(iv.getBuffer(), (bfs_size_t)saKey->getIVlen());
 	// memset(iv.getBuffer(), 0x0, 12);
 	saKey->encryptData(iv.getBuffer(), out.getBuffer(), out.getLength(),
 					   buf.getBuffer(), buf.getLength(),
@@ -450,13 +481,6 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 	// buffer\n"); 	throw new bfsCryptoError(message);
 	// }
 
-	if (sgx_read_rand((unsigned char *)iv.getBuffer(),
-					  (bfs_size_t)saKey->getIVlen()) != SGX_SUCCESS) {
-		std::string message =
-			std::string("Failed generating random iv in encryptData");
-		throw new bfsCryptoError(message);
-	}
-
 	sgx_aes_gcm_128bit_tag_t mtag = {0};
 	saKey->encryptData(iv.getBuffer(), out.getBuffer(), out.getLength(),
 					   buf.getBuffer(), buf.getLength(),
@@ -502,6 +526,26 @@ int bfsSecAssociation::encryptData(bfsFlexibleBuffer &buf,
 int bfsSecAssociation::decryptData(bfsFlexibleBuffer &buf,
 								   bfsFlexibleBuffer *aad, bool mac,
 								   uint8_t *const mac_out) {
+	return (decryptData(buf, aad ? aad->getBuffer() : NULL,
+						aad ? aad->getLength() : 0, mac, mac_out));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::decryptData
+// Description  : In-place decryption of data, with the AAD passed in place
+//                (so callers need not allocate a buffer for it)
+//
+// Inputs       : buf - buffer to decrypt
+//                aad - the additional authenticated data (NULL if none)
+//                aadlen - the length of the AAD
+//                mac - flag indicating to verify (remove) the MAC trailer
+//                mac_out - place to copy the MAC out to (NULL if not needed)
+// Outputs      : 0 or throws exception on error
+
+int bfsSecAssociation::decryptData(bfsFlexibleBuffer &buf, char *aad,
+								   bfs_size_t aadlen, bool mac,
+								   uint8_t *const mac_out) {
 
 	// Check the state of the association
 	if (saKey == NULL) {
@@ -524,16 +568,15 @@ int bfsSecAssociation::decryptData(bfsFlexibleBuffer &buf,
 						  (bfs_size_t)saKey->getMACsize());
 
 	// Remove the IV from the buffer
-	iv.resetWithAlloc((bfs_size_t)saKey->getIVlen());
-	buf.removeHeader(iv.getBuffer(), (bfs_size_t)saKey->getIVlen());
+	char ivdat[saKey->getIVlen()];
+	buf.removeHeader(ivdat, (bfs_size_t)saKey->getIVlen());
 
 #ifndef __BFS_ENCLAVE_MODE
 	// saKey->decryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength());
 	// Note: need to pass aad to decrypt call so it adds the aad before calling
 	// decrypt routine (aad buffer not needed anymore in verify)
-	saKey->decryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength(),
-					   aad ? aad->getBuffer() : NULL,
-					   aad ? aad->getLength() : 0, NULL);
+	saKey->decryptData(ivdat, buf.getBuffer(), buf.getLength(), aad,
+					   (int)aadlen, NULL);
 
 	// if (mac && !verifyMac(buf, aad)) {
 	// 	string message = "Sec assoc: MAC failed on decryption";
@@ -556,9 +599,8 @@ int bfsSecAssociation::decryptData(bfsFlexibleBuffer &buf,
 	char *buf_cpy = (char *)calloc(buf.getLength(),
 								   1); // avoid destructor calls with buf_cpy
 	memcpy(buf_cpy, buf.getBuffer(), buf.getLength());
-	saKey->decryptData(iv.getBuffer(), buf.getBuffer(), buf.getLength(),
-					   buf_cpy, buf.getLength(), aad ? aad->getBuffer() : NULL,
-					   aad ? aad->getLength() : 0,
+	saKey->decryptData(ivdat, buf.getBuffer(), buf.getLength(), buf_cpy,
+					   buf.getLength(), aad, (int)aadlen,
 					   mac ? (mac_out ? (char *)mac_out : (char *)mac_copy)
 						   : NULL);
 	free(buf_cpy);
@@ -833,3 +875,135 @@ size_t bfsSecAssociation::removePKCS7Padding(bfsFlexibleBuffer &buf) {
 	buf.removeTrailer(padding, (bfs_size_t)padsz);
 	return (padsz);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : randomIVContext
+// Description  : Draw a random IV context
+//
+// Inputs       : context - the place to put the context
+// Outputs      : 0 if successful, -1 if failure
+
+static int randomIVContext(uint64_t &context) {
+#ifndef __BFS_ENCLAVE_MODE
+	get_random_data((char *)&context, sizeof(context));
+#else
+	if (sgx_read_rand((unsigned char *)&context, sizeof(context)) !=
+		SGX_SUCCESS) {
+		return (-1);
+	}
+#endif
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::setIVContext
+// Description  : Fix the IVs to a direction and context, restarting their
+//                sequence.  The endpoints sharing a key each need a
+//                (direction, context) pair of their own, e.g., the
+//                initiator of a connection under the connection's epoch.
+//
+// Inputs       : resp - flag indicating the IVs are the responder's
+//                context - the context of the IVs (the low 63 bits are used)
+// Outputs      : none
+
+void bfsSecAssociation::setIVContext(bool resp, uint64_t context) {
+
+	// Change the fields and restart the sequence together
+	pthread_mutex_lock(&ivLock);
+	ivFixed = (context & ~BFS_SA_IV_RESPONDER) |
+			  (resp ? BFS_SA_IV_RESPONDER : 0);
+	ivSequence = 0;
+	ivRandom = false;
+	pthread_mutex_unlock(&ivLock);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::setIVContext
+// Description  : Fix the IVs to a direction under a random context, for SAs
+//                with no context to bind them to (e.g., one replying on many
+//                connections).  The context is redrawn whenever its sequence
+//                is used up.
+//
+// Inputs       : resp - flag indicating the IVs are the responder's
+// Outputs      : none (throws exception on error)
+
+void bfsSecAssociation::setIVContext(bool resp) {
+
+	// Local variables
+	uint64_t context;
+
+	// Draw the context, then fix the IVs to it
+	if (randomIVContext(context)) {
+		string message = "Failed generating random IV context";
+		throw new bfsCryptoError(message);
+	}
+	pthread_mutex_lock(&ivLock);
+	ivFixed = (context & ~BFS_SA_IV_RESPONDER) |
+			  (resp ? BFS_SA_IV_RESPONDER : 0);
+	ivSequence = 0;
+	ivRandom = true;
+	pthread_mutex_unlock(&ivLock);
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bfsSecAssociation::nextIV
+// Description  : Build the next IV for an encryption under the key.  The
+//                (big-endian) IV is the fixed field (the direction bit, then
+//                63 bits of context) followed by the 32-bit sequence number,
+//                so no two encryptions through the SA share an IV.  The
+//                sequence never carries into the fixed field: once 2^32 IVs
+//                are used a random context is redrawn, and a bound one
+//                fails until the SA is rekeyed (a new key or context).
+//
+// Inputs       : ivdat - the place to put the IV (getIVlen() bytes)
+// Outputs      : none (throws exception on error)
+
+void bfsSecAssociation::nextIV(char *ivdat) {
+
+	// Local variables
+	uint64_t fixed, seq, context;
+	int i;
+
+	// Sanity check the IV length
+	if (saKey->getIVlen() != BFS_CRYPTO_DEFAULT_IV_LEN) {
+		string message = (string) "Sec association bad IV length " +
+						 to_string(saKey->getIVlen());
+		throw new bfsCryptoError(message);
+	}
+
+	// Take the next sequence number with the fields it goes with (workers
+	// may share the SA)
+	pthread_mutex_lock(&ivLock);
+	if ((ivSequence == BFS_SA_IV_MAX_SEQUENCE) && (ivRandom) &&
+		(randomIVContext(context) == 0)) {
+		ivFixed = (ivFixed & BFS_SA_IV_RESPONDER) |
+				  (context & ~BFS_SA_IV_RESPONDER);
+		ivSequence = 0;
+	}
+	fixed = ivFixed;
+	seq = ivSequence;
+	if (seq < BFS_SA_IV_MAX_SEQUENCE) {
+		ivSequence++;
+	}
+	pthread_mutex_unlock(&ivLock);
+	if (seq == BFS_SA_IV_MAX_SEQUENCE) {
+		string message = (string) "Sec association IVs exhausted [" +
+						 initiator + "/" + responder + "], must rekey";
+		throw new bfsCryptoError(message);
+	}
+
+	// Lay out the fixed field, then the sequence number
+	for (i = 0; i < 8; i++) {
+		ivdat[i] = (char)(fixed >> (56 - 8 * i));
+	}
+	for (i = 0; i < 4; i++) {
+		ivdat[8 + i] = (char)(seq >> (24 - 8 * i));
+	}
+	return;
+}
@@ -23,10 +23,13 @@
 #include <bfsFlexibleBuffer.h>
 
 // C++/STL Isms
+#include <pthread.h>
 #include <string>
 using namespace std;
 
 // Definitions
+#define BFS_SA_IV_RESPONDER (1ULL << 63) // The IV direction bit (responder)
+#define BFS_SA_IV_MAX_SEQUENCE (1ULL << 32) // The IVs per key and context
 
 // Types
 
@@ -39,8 +42,8 @@ public:
 	//
 	// Constructors and destructors
 
+	bfsSecAssociation(void);
 	// Default constructor
-	bfsSecAssociation(void) : saKey(NULL) {}
 
 	bfsSecAssociation(string in, string resp, bfsCryptoKey *key = NULL);
 	// Attribute constructor
@@ -51,6 +54,10 @@ public:
 	~bfsSecAssociation();
 	// Destructor
 
+	bfsSecAssociation(const bfsSecAssociation &) = delete;
+	bfsSecAssociation &operator=(const bfsSecAssociation &) = delete;
+	// No copies (a copy would reuse the IVs of the original)
+
 	//
 	// Access Methods
 
@@ -69,10 +76,20 @@ public:
 	int setKey(bfsCryptoKey *key);
 	// Set the key for the security association
 
+	void setIVContext(bool resp, uint64_t context);
+	// Fix the IVs to a direction and context (e.g., a connection epoch)
+
+	void setIVContext(bool resp);
+	// Fix the IVs to a direction (under a fresh random context)
+
 	int encryptData(bfsFlexibleBuffer &buf, bfsFlexibleBuffer *aad = NULL,
 					bool mac = false);
 	// In-place encryption of data
 
+	int encryptData(bfsFlexibleBuffer &buf, char *aad, bfs_size_t aadlen,
+					bool mac);
+	// In-place encryption of data (AAD passed in place)
+
 	int encryptData2(bfsFlexibleBuffer &buf, bfsFlexibleBuffer *aad,
 					 uint8_t **iv = NULL, uint8_t **mac = NULL);
 
@@ -84,6 +101,10 @@ public:
 					bool mac = false, uint8_t *const mac_out = NULL);
 	// In-place decryption of data
 
+	int decryptData(bfsFlexibleBuffer &buf, char *aad, bfs_size_t aadlen,
+					bool mac, uint8_t *const mac_out = NULL);
+	// In-place decryption of data (AAD passed in place)
+
 	int decryptData2(bfsFlexibleBuffer &buf, bfsFlexibleBuffer *aad,
 					 uint8_t *iv = NULL, uint8_t *mac = NULL);
 
@@ -113,6 +134,9 @@ private:
 	size_t removePKCS7Padding(bfsFlexibleBuffer &buf);
 	// Remove the PKCS padding (returns bytes padded)
 
+	void nextIV(char *ivdat);
+	// Build the next IV for an encryption under the key
+
 	friend int bfsCryptoLayer::bfsCryptoLayerUtest(void);
 	// A friend function (allows private access in unit test)
 
@@ -131,6 +155,18 @@ private:
 	bfsFlexibleBuffer iv;
 	// The IV for each encrypted block
 
+	uint64_t ivFixed;
+	// The fixed field of the IVs (direction bit and context)
+
+	uint64_t ivSequence;
+	// The number of IVs used with the key and context
+
+	bool ivRandom;
+	// Flag indicating the IV context is random (redrawn when used up)
+
+	pthread_mutex_t ivLock;
+	// The lock keeping the IV fields and sequence together
+
 	//
 	// Static class data
 };
@@ -15,6 +15,7 @@
 #include <bfsConfigLayer.h>
 #include <bfsCryptoLayer.h>
 #include <bfsUtilLayer.h>
+#include <bfs_block_pool.h>
 #include <bfs_log.h>
 #include <bfs_util.h>
 
@@ -258,6 +259,10 @@ int bfsUtilLayer::bfsUtilLayerInit(void) {
 		(config->getSubItemByName("cache_enabled")->bfsCfgItemValue() ==
 		 "true");
 
+	// Pool the block buffers (before any are allocated)
+	BfsBlockPool::setEnabled(
+		config->getSubItemByName("block_pool")->bfsCfgItemValue() == "true");
+
 	// Get common configs
 	config = bfsConfigLayer::getConfigItem(BFS_COMMON_CONFIG);
 	if (config->bfsCfgItemType() != bfsCfgItem_STRUCT) {
@@ -31,6 +31,12 @@ VBfsBlock::VBfsBlock(char *dat, bfs_size_t len, bfs_size_t hsz, bfs_size_t tsz,
 
 	vbid = v;
 
+	// Always leave room for encrypting the block in place (and sending it)
+	if (hsz < BFS_BLOCK_HEADROOM)
+		hsz = BFS_BLOCK_HEADROOM;
+	if (tsz < BFS_BLOCK_TAILROOM)
+		tsz = BFS_BLOCK_TAILROOM;
+
 	if (!dat && (len + hsz + tsz > 0)) {
 		resetWithAlloc(len, 0x0, hsz, tsz);
 	} else if (dat) {
@@ -71,6 +77,13 @@ PBfsBlock::PBfsBlock(char *dat, bfs_size_t len, bfs_size_t hsz, bfs_size_t tsz,
 
 	pbid = p;
 	rd = r;
+	vbid = 0;
+
+	// Always leave room for the device packet framing
+	if (hsz < BFS_BLOCK_HEADROOM)
+		hsz = BFS_BLOCK_HEADROOM;
+	if (tsz < BFS_BLOCK_TAILROOM)
+		tsz = BFS_BLOCK_TAILROOM;
 
 	if (!dat && (len + hsz + tsz > 0)) {
 		resetWithAlloc(len, 0x0, hsz, tsz);
@@ -103,3 +116,18 @@ void PBfsBlock::set_pbid(bfs_block_id_t p) { pbid = p; }
 void *PBfsBlock::get_rd() const { return rd; }
 
 void PBfsBlock::set_rd(void *_rd) { rd = _rd; }
+
+/**
+ * @brief Gets the virtual block id the physical block holds (set by the
+ * cluster for blocks in its cache, so they can be flushed when evicted).
+ *
+ * @return bfs_vbid_t: the virtual block id
+ */
+bfs_vbid_t PBfsBlock::get_vbid() const { return vbid; }
+
+/**
+ * @brief Set the virtual block id the physical block holds.
+ *
+ * @param v: new id
+ */
+void PBfsBlock::set_vbid(bfs_vbid_t v) { vbid = v; }
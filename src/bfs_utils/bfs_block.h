@@ -10,6 +10,7 @@
 #include <vector>
 
 #include <bfsFlexibleBuffer.h>
+#include <bfs_block_pool.h>
 #include <bfs_cache.h>
 #include <bfs_common.h>
 
@@ -67,9 +68,16 @@ public:
 
 	void set_rd(void *);
 
+	/* get the virtual block id (of the cached block) */
+	bfs_vbid_t get_vbid() const;
+
+	/* set the virtual block id */
+	void set_vbid(bfs_vbid_t);
+
 private:
 	bfs_block_id_t pbid; /* the physical block id */
 	void *rd;			 /* back-ptr to remote dev where the blk is located */
+	bfs_vbid_t vbid;	 /* the virtual block held (for flushing from cache) */
 };
 
 // Block conmtainer types
@@ -0,0 +1,314 @@
+/**
+ * @file bfs_block_pool.cpp
+ * @brief Definitions for the pool of block sized buffers.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bfsUtilError.h"
+#include "bfs_block.h"
+#include "bfs_block_pool.h"
+#include "bfs_log.h"
+
+//
+// Module data
+
+// The free buffers held by a thread (and its count of heap allocations, kept
+// per thread so counting them doesn't contend, padded off its neighbours)
+typedef struct {
+	std::vector<char *> free;		  /* buffers ready for reuse */
+	std::atomic<uint64_t> heapAllocs; /* buffers allocated from the heap */
+	char pad[64];
+} bfs_block_pool_cache_t;
+
+// The thread's own free buffers (and the key that returns them on exit)
+static thread_local bfs_block_pool_cache_t *poolCache = NULL;
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+// The free buffers shared between the threads and the thread caches (never
+// destroyed, as buffers may be released during process exit)
+static std::vector<char *> *poolDepot = NULL;
+static std::vector<bfs_block_pool_cache_t *> *poolCaches = NULL;
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Heap allocations of exited threads, slabs carved into pooled buffers
+static uint64_t poolExitedHeapAllocs = 0;
+static std::atomic<uint64_t> poolSlabs(0);
+
+//
+// Class data
+
+bool BfsBlockPool::poolEnabled = false;
+
+//
+// Module functions
+
+/**
+ * @brief Return the free buffers of an exiting thread to the depot.
+ *
+ * @param arg - the thread's cache
+ */
+static void releasePoolCache(void *arg) {
+	bfs_block_pool_cache_t *cache = (bfs_block_pool_cache_t *)arg;
+
+	pthread_mutex_lock(&poolLock);
+	poolDepot->insert(poolDepot->end(), cache->free.begin(),
+					  cache->free.end());
+	poolExitedHeapAllocs += cache->heapAllocs;
+	poolCaches->erase(
+		std::find(poolCaches->begin(), poolCaches->end(), cache));
+	pthread_mutex_unlock(&poolLock);
+	poolCache = NULL;
+	delete cache;
+}
+
+/**
+ * @brief Create the key that releases thread caches (once).
+ */
+static void makePoolKey(void) {
+	pthread_key_create(&poolKey, releasePoolCache);
+	poolDepot = new std::vector<char *>();
+	poolCaches = new std::vector<bfs_block_pool_cache_t *>();
+}
+
+/**
+ * @brief Get the calling thread's cache of free buffers, creating it on first
+ * use.
+ *
+ * @return bfs_block_pool_cache_t *: the cache
+ */
+static bfs_block_pool_cache_t *getPoolCache(void) {
+	if (poolCache == NULL) {
+		pthread_once(&poolKeyOnce, makePoolKey);
+		poolCache = new bfs_block_pool_cache_t();
+		poolCache->free.reserve(BFS_BLOCK_POOL_CACHE + BFS_BLOCK_POOL_BATCH);
+		poolCache->heapAllocs = 0;
+		pthread_mutex_lock(&poolLock);
+		poolCaches->push_back(poolCache);
+		pthread_mutex_unlock(&poolLock);
+		pthread_setspecific(poolKey, poolCache);
+	}
+	return (poolCache);
+}
+
+/**
+ * @brief Refill a thread's cache with a batch of buffers from the depot, or
+ * from a new slab if the depot is empty.
+ *
+ * @param cache - the cache to refill
+ */
+static void refillPoolCache(bfs_block_pool_cache_t *cache) {
+	char *slab;
+	size_t take;
+	int i;
+
+	// Take a batch from the depot if it has one
+	pthread_mutex_lock(&poolLock);
+	take = (poolDepot->size() < BFS_BLOCK_POOL_BATCH) ? poolDepot->size()
+													  : BFS_BLOCK_POOL_BATCH;
+	cache->free.insert(cache->free.end(), poolDepot->end() - take,
+					   poolDepot->end());
+	poolDepot->resize(poolDepot->size() - take);
+	pthread_mutex_unlock(&poolLock);
+	if (take > 0) {
+		return;
+	}
+
+	// Otherwise carve a new (page aligned) slab into buffers
+	if (posix_memalign((void **)&slab, 4096,
+					   (size_t)BFS_BLOCK_POOL_BUFSZ * BFS_BLOCK_POOL_BATCH)) {
+		throw new bfsUtilError("Failed allocating block pool slab");
+	}
+	for (i = 0; i < BFS_BLOCK_POOL_BATCH; i++) {
+		cache->free.push_back(&slab[(size_t)i * BFS_BLOCK_POOL_BUFSZ]);
+	}
+	poolSlabs++;
+}
+
+//
+// Class functions
+
+/**
+ * @brief Allocate a buffer, block sized buffers come from the calling
+ * thread's free buffers when the pool is enabled.
+ *
+ * @param sz - the size of the buffer
+ * @return char *: the buffer
+ */
+char *BfsBlockPool::allocBuffer(uint32_t sz) {
+	bfs_block_pool_cache_t *cache;
+	char *buf;
+
+	// Other sizes come from the heap (only this thread updates its count)
+	cache = getPoolCache();
+	if ((!poolEnabled) || (sz != BFS_BLOCK_POOL_BUFSZ)) {
+		cache->heapAllocs.store(
+			cache->heapAllocs.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		return (new char[sz]);
+	}
+
+	// Take the most recently released (likely cached) buffer
+	if (cache->free.empty()) {
+		refillPoolCache(cache);
+	}
+	buf = cache->free.back();
+	cache->free.pop_back();
+	return (buf);
+}
+
+/**
+ * @brief Release a buffer, block sized buffers go back to the calling
+ * thread's free buffers (a batch moves to the depot if it holds too many).
+ *
+ * @param buf - the buffer to release
+ * @param sz - the size it was allocated with
+ */
+void BfsBlockPool::releaseBuffer(char *buf, uint32_t sz) {
+	bfs_block_pool_cache_t *cache;
+
+	// Other sizes go back to the heap
+	if ((!poolEnabled) || (sz != BFS_BLOCK_POOL_BUFSZ)) {
+		delete[] buf;
+		return;
+	}
+
+	// Keep it, returning a batch to the depot as needed
+	cache = getPoolCache();
+	cache->free.push_back(buf);
+	if (cache->free.size() > BFS_BLOCK_POOL_CACHE) {
+		pthread_mutex_lock(&poolLock);
+		poolDepot->insert(poolDepot->end(),
+						  cache->free.end() - BFS_BLOCK_POOL_BATCH,
+						  cache->free.end());
+		pthread_mutex_unlock(&poolLock);
+		cache->free.resize(cache->free.size() - BFS_BLOCK_POOL_BATCH);
+	}
+}
+
+/**
+ * @brief Get the number of buffers allocated from the heap (rather than the
+ * pool).
+ *
+ * @return uint64_t: the number of buffers
+ */
+uint64_t BfsBlockPool::getHeapAllocations(void) {
+	uint64_t allocs;
+
+	pthread_once(&poolKeyOnce, makePoolKey);
+	pthread_mutex_lock(&poolLock);
+	allocs = poolExitedHeapAllocs;
+	for (size_t i = 0; i < poolCaches->size(); i++) {
+		allocs += (*poolCaches)[i]->heapAllocs.load(std::memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&poolLock);
+	return (allocs);
+}
+
+/**
+ * @brief Get the number of slabs carved into pooled buffers (each holds
+ * BFS_BLOCK_POOL_BATCH buffers).
+ *
+ * @return uint64_t: the number of slabs
+ */
+uint64_t BfsBlockPool::getSlabs(void) { return (poolSlabs); }
+
+#ifdef __BFS_DEBUG_NO_ENCLAVE
+// The arguments of a benchmark thread
+typedef struct {
+	int ops;		 /* blocks to allocate */
+	pthread_t thread; /* the thread running them */
+} bfs_block_pool_bench_t;
+
+/**
+ * @brief The body of a benchmark thread, allocating physical and virtual
+ * blocks (keeping a window of them live, as the block layer does)
+ *
+ * @param arg - the benchmark arguments
+ * @return void * : NULL
+ */
+static void *blockPoolBenchThread(void *arg) {
+	bfs_block_pool_bench_t *bench = (bfs_block_pool_bench_t *)arg;
+	PBfsBlock *pwin[16] = {NULL};
+	VBfsBlock *vwin[16] = {NULL};
+	int i, w;
+
+	for (i = 0; i < bench->ops; i++) {
+		w = i % 16;
+		delete pwin[w];
+		delete vwin[w];
+		pwin[w] = new PBfsBlock(NULL, BLK_SZ, 0, 0, i, NULL);
+		vwin[w] = new VBfsBlock(NULL, BLK_SZ, 0, 0, i);
+	}
+	for (w = 0; w < 16; w++) {
+		delete pwin[w];
+		delete vwin[w];
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Benchmark allocating (and releasing) blocks from 1, 2 and 4
+ * threads, with the blocks from the heap and from the pool.
+ *
+ * @param ops - the number of physical and virtual blocks per thread
+ * @return int: 0 if successful, -1 if failure
+ */
+int BfsBlockPool::bfsBlockPoolBench(int ops) {
+	bfs_block_pool_bench_t bench[4];
+	bool was_enabled = poolEnabled;
+	uint64_t heap, slabs;
+	int threads, pool, t;
+	double nsecs;
+
+	logMessage(LOG_OUTPUT_LEVEL,
+			   "Block allocation (%d physical and virtual blocks per thread)",
+			   ops);
+	for (threads = 1; threads <= 4; threads *= 2) {
+		for (pool = 0; pool < 2; pool++) {
+			// Run the threads, timing them and counting the allocations
+			setEnabled(pool == 1);
+			heap = getHeapAllocations();
+			slabs = getSlabs();
+			auto start = std::chrono::high_resolution_clock::now();
+			for (t = 0; t < threads; t++) {
+				bench[t].ops = ops;
+				if (pthread_create(&bench[t].thread, NULL,
+								   blockPoolBenchThread, &bench[t])) {
+					logMessage(LOG_ERROR_LEVEL,
+							   "Failed creating benchmark thread, aborting.");
+					setEnabled(was_enabled);
+					return (-1);
+				}
+			}
+			for (t = 0; t < threads; t++) {
+				pthread_join(bench[t].thread, NULL);
+			}
+			nsecs = std::chrono::duration<double, std::nano>(
+						std::chrono::high_resolution_clock::now() - start)
+						.count() /
+					((double)ops * 2 * threads);
+
+			// Report the time and heap allocations per block
+			logMessage(LOG_OUTPUT_LEVEL,
+					   "%d thread(s), %4s : %8.1f ns/block, %5.2f heap "
+					   "allocs/block, %lu slabs",
+					   threads, pool ? "pool" : "heap", nsecs,
+					   (double)(getHeapAllocations() - heap) /
+						   ((double)ops * 2 * threads),
+					   getSlabs() - slabs);
+		}
+	}
+
+	// Restore the pool setting, return successfully
+	setEnabled(was_enabled);
+	return (0);
+}
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @file bfs_block_pool.h
+ * @brief The declarations for the pool of block sized buffers.
+ */
+
+#ifndef BFS_BLOCK_POOL_H
+#define BFS_BLOCK_POOL_H
+
+#include <cstdint>
+
+#include <bfs_common.h>
+
+// Room reserved around block data for the device packet framing (block ID,
+// device header, IV and tag in front, padding and MAC behind, plus the
+// default pads a receive leaves), so sending or receiving a block never
+// reallocates and copies it. The headroom keeps the data cache line aligned
+// in pooled buffers.
+#define BFS_BLOCK_HEADROOM 128
+#define BFS_BLOCK_TAILROOM 64
+
+// The size of the pooled buffers (a block with its headroom), the number of
+// buffers moved between a thread and the shared depot (or carved out of a new
+// slab) at a time, and the number a thread keeps before returning some
+#define BFS_BLOCK_POOL_BUFSZ (BFS_BLOCK_HEADROOM + BLK_SZ + BFS_BLOCK_TAILROOM)
+#define BFS_BLOCK_POOL_BATCH 32
+#define BFS_BLOCK_POOL_CACHE 64
+
+/**
+ * @brief A pool of block sized buffers for the flexible buffers (and so the
+ * physical/virtual blocks and the device packet buffers built on them). Each
+ * thread keeps its own free buffers, so allocating and releasing a block
+ * takes no locks, and trades batches of them with a shared depot when it runs
+ * out or holds too many. Buffers are carved out of page aligned slabs that
+ * are kept for the life of the process. Other sizes (and all buffers when
+ * the pool is disabled) come from the heap.
+ */
+class BfsBlockPool {
+public:
+	static char *allocBuffer(uint32_t sz);
+	// Allocate a buffer (from the pool if block sized)
+
+	static void releaseBuffer(char *buf, uint32_t sz);
+	// Release a buffer allocated by allocBuffer (of the same size)
+
+	static void setEnabled(bool en) { poolEnabled = en; }
+	// Enable/disable the pool (only while no block sized buffers are
+	// allocated, e.g., at initialization)
+
+	static bool enabled(void) { return (poolEnabled); }
+	// Check if the pool is enabled
+
+	static uint64_t getHeapAllocations(void);
+	// Get the number of buffers allocated from the heap
+
+	static uint64_t getSlabs(void);
+	// Get the number of slabs carved into pooled buffers
+
+#ifdef __BFS_DEBUG_NO_ENCLAVE
+	static int bfsBlockPoolBench(int ops);
+	// Benchmark block allocation with and without the pool
+#endif
+
+private:
+	BfsBlockPool(void) {}
+	// Default constructor (prevents creation of any instance)
+
+	static bool poolEnabled;
+	// Flag indicating block sized buffers come from the pool
+};
+
+#endif /* BFS_BLOCK_POOL_H */
@@ -3,6 +3,8 @@
  * @brief Definitions for the bfs cache types.
  */
 
+#include <algorithm>
+#include <list>
 #include <pthread.h>
 
 #include "bfsUtilError.h"
@@ -219,6 +221,7 @@ CacheableObject *BfsCache::insertCache(const baseCacheKey &key, int key_type,
 			ptr->prev = table_end;
 			ptr->next = table;
 			table_end->next = ptr;
+			table->prev = ptr;
 			table_end = ptr;
 		} else {
 			logMessage(LOG_ERROR_LEVEL, "Cache head/tail ptrs inconsistent");
@@ -294,6 +297,7 @@ CacheableObject *BfsCache::insertCache(const baseCacheKey &key, int key_type,
 				ptr->prev = table_end;
 				ptr->next = table;
 				table_end->next = ptr; // (OK if size==1)
+				table->prev = ptr;	   // (keep the queue circular)
 				table_end = ptr;
 			}
 		}
@@ -527,6 +531,11 @@ bool BfsCache::unitTest(void) {
 	int i, r;
 	CacheableObject *check_ptr = new CacheableObject();
 	const int CACHE_UTEST_ITERATIONS = 10000, MAX_KEY_VAL = 100;
+	const int lru_cache_sz = 8;
+	BfsCache lcache(lru_cache_sz);
+	CacheableObject lru_objs[MAX_KEY_VAL + 1];
+	std::list<int> lru;
+	CacheableObject *evicted;
 
 	logMessage(LOG_INFO_LEVEL, "Starting cache test ...");
 	icache.set_debug(true);
@@ -543,7 +552,7 @@ bool BfsCache::unitTest(void) {
 			return false;
 		}
 
-		if (icache.checkCache(ikey, 1) != check_ptr) {
+		if (icache.checkCache(ikey, 1, false, false) != check_ptr) {
 			logMessage(LOG_INFO_LEVEL,
 					   "Failed getting inserted icache entry\n");
 			return false;
@@ -561,13 +570,31 @@ bool BfsCache::unitTest(void) {
 			return false;
 		}
 
-		if (scache.checkCache(skey, 0) != check_ptr) {
+		if (scache.checkCache(skey, 0, false, false) != check_ptr) {
 			logMessage(LOG_INFO_LEVEL,
 					   "Failed getting inserted scache entry\n");
 			return false;
 		}
 	}
 
+	// Check that the least recently inserted (or updated) entry is evicted
+	for (i = 0; i < CACHE_UTEST_ITERATIONS; i++) {
+		r = get_random_value(0, lru_cache_sz * 2);
+		evicted = lcache.insertCache(intCacheKey(r), 1, &lru_objs[r]);
+		if (std::find(lru.begin(), lru.end(), r) != lru.end()) {
+			lru.remove(r);
+		} else if ((int)lru.size() == lru_cache_sz) {
+			if (evicted != &lru_objs[lru.front()]) {
+				logMessage(LOG_INFO_LEVEL,
+						   "Cache evicted the wrong entry (expected [%d])\n",
+						   lru.front());
+				return false;
+			}
+			lru.pop_front();
+		}
+		lru.push_back(r);
+	}
+
 	logMessage(LOG_INFO_LEVEL, "Cache test completed successfully.");
 	logMessage(LOG_INFO_LEVEL, "Integer key cache hit rate : %.2f%%\n",
 			   icache.get_hit_rate() * 100.0);
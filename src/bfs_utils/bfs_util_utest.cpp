@@ -23,14 +23,15 @@
 #include <bfsRegExpressionError.h>
 #include <bfsUtilLayer.h>
 #include <bfs_base64.h>
+#include <bfs_block_pool.h>
 #include <bfs_cache.h>
 #include <bfs_log.h>
 #include <bfs_util.h>
 
 // Defines
-#define BFSUTILTEST_ARGUMENTS "hvucfpxkrl"
+#define BFSUTILTEST_ARGUMENTS "hvucfpxkrla:e:"
 #define USAGE                                                                  \
-	"USAGE: bfs_unit_utest [-h] [-v] [-c|f|r]>n"                               \
+	"USAGE: bfs_unit_utest [-h] [-v] [-c|f|r] [-a <ops>] [-e <ops>]\n"         \
 	"\n"                                                                       \
 	"where:\n"                                                                 \
 	"    -h - help mode (display this message)\n"                              \
@@ -42,6 +43,8 @@
 	"    -k - generate a random key and display in b64 (using crypto utils)\n" \
 	"    -r - do regular expression unit test\n"                               \
 	"    -l - do latency test\n"                                               \
+	"    -a - do block pool benchmark (ops blocks per thread)\n"               \
+	"    -e - do encryption benchmark (ops messages per size)\n"               \
 	"\n"
 
 //
@@ -62,7 +65,7 @@
 int main(int argc, char *argv[]) {
 	// Local variables
 	bfsCryptoKey *key;
-	int ch;
+	int ch, pool_ops = 0, crypto_ops = 0;
 	bool verbose = false, do_cache_test = false, do_flex_test = false,
 		 do_config_test = false, do_crypto_test = false, do_regexp_test = false,
 		 do_bridge_latency_test = false;
@@ -115,6 +118,14 @@ int main(int argc, char *argv[]) {
 			do_regexp_test = true;
 			break;
 
+		case 'a': // block pool benchmark
+			pool_ops = atoi(optarg);
+			break;
+
+		case 'e': // encryption benchmark
+			crypto_ops = atoi(optarg);
+			break;
+
 		default: // Default (unknown)
 			fprintf(stderr, "Unknown command line option (%c), aborting.", ch);
 			fprintf(stderr, USAGE);
@@ -162,6 +173,19 @@ int main(int argc, char *argv[]) {
 					   "bfs config unit tests failed, aborting.");
 			return (-1);
 		}
+
+		if ((pool_ops > 0) && (BfsBlockPool::bfsBlockPoolBench(pool_ops) != 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "bfs block pool benchmark failed, aborting.");
+			return (-1);
+		}
+
+		if ((crypto_ops > 0) &&
+			(bfsCryptoLayer::bfsCryptoLayerBench(crypto_ops) != 0)) {
+			logMessage(LOG_ERROR_LEVEL,
+					   "bfs encryption benchmark failed, aborting.");
+			return (-1);
+		}
 #endif
 
 		if (do_crypto_test) {